@@ -44,9 +44,11 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 #include "mqtt_msg.h"
 #include "ringbuf.h"
+#include "mqtt_store.h"
 
 #include "openssl/ssl.h"
 
@@ -58,6 +60,11 @@
 #define CONFIG_MQTT_MAX_LWT_TOPIC		32
 #define CONFIG_MQTT_MAX_LWT_MSG			32
 #define CONFIG_MQTT_MAX_TASKNAME_LEN	16
+#define MQTT_SEND_TIMEOUT_MS			5000	// max time to wait for send queue space or a free inflight slot
+
+#ifndef CONFIG_MQTT_INFLIGHT_MAX
+#define CONFIG_MQTT_INFLIGHT_MAX		8
+#endif
 
 // Mqtt client status constants
 #define MQTT_STATUS_DISCONNECTED		0
@@ -65,11 +72,11 @@
 #define MQTT_STATUS_STOPPING			2
 #define MQTT_STATUS_STOPPED				4
 
-#define MQTT_SENDING_TYPE_NONE			0
-#define MQTT_SENDING_TYPE_PUBLISH		1
-#define MQTT_SENDING_TYPE_SUBSCRIBE		2
-#define MQTT_SENDING_TYPE_UNSUBSCRIBE	3
-#define MQTT_SENDING_TYPE_PING			4
+// Flag ORed into the message length pushed to xSendingQueue for PUBLISH messages
+#define MQTT_QUEUE_FLAG_PUBLISH			0x80000000
+// Pushed with the inflight slot index instead of a length: the message is in the slot, not in send_rb
+#define MQTT_QUEUE_FLAG_INFLIGHT		0x40000000
+#define MQTT_QUEUE_SLOT_MASK			0x0000ffff
 
 typedef struct mqtt_client mqtt_client;
 typedef struct mqtt_event_data_t mqtt_event_data_t;
@@ -117,6 +124,7 @@ typedef struct mqtt_settings {
     void *mpy_subscribed_cb;
     void *mpy_published_cb;
     void *mpy_data_cb;
+    void *mpy_rx;
 
     char host[CONFIG_MQTT_MAX_HOST_LEN];
     uint16_t port;
@@ -130,6 +138,7 @@ typedef struct mqtt_settings {
     uint32_t lwt_retain;
     uint32_t clean_session;
     uint32_t keepalive;
+    uint32_t replay_rate;	// max stored messages replayed per second
     bool auto_reconnect;
     bool use_ssl;
     TaskHandle_t xMqttTask;
@@ -158,16 +167,30 @@ typedef struct mqtt_state_t
   uint8_t* out_buffer;
   int in_buffer_length;
   int out_buffer_length;
-  uint16_t message_length;
-  uint16_t message_length_read;
+  uint32_t message_length;
+  uint32_t message_length_read;
   mqtt_message_t* outbound_message;
   mqtt_connection_t mqtt_connection;
   uint16_t pending_msg_id;
   int pending_msg_type;
-  int sending_msg_type;
-  int pending_publish_qos;
 } mqtt_state_t;
 
+// QoS1/2 publish waiting for the broker's acknowledge
+// Until PUBACK/PUBREC, 'msg' holds the only copy of the PUBLISH message; the sending task
+// writes it from there, and sends it again with DUP set after a reconnect. Replayed messages have no copy, the persistent queue
+// replays them again. Waiting for PUBCOMP, only the PUBREL is sent again.
+// While the sending task writes 'msg' without send_mutex, 'sending' is set and an acknowledge leaves freeing it to the task.
+typedef struct mqtt_inflight_t
+{
+  uint16_t msg_id;
+  uint8_t wait_type;	// MQTT_MSG_TYPE_PUBACK, MQTT_MSG_TYPE_PUBREC or MQTT_MSG_TYPE_PUBCOMP; 0 if the slot is free
+  uint32_t store_pos;	// persistent queue record offset + 1 for replayed messages, 0 otherwise
+  uint32_t seq;			// publish order, messages are sent again in the same order
+  uint8_t *msg;
+  uint32_t msg_len;
+  bool sending;
+} mqtt_inflight_t;
+
 typedef struct mqtt_client {
   int socket;
   SSL_CTX *ctx;
@@ -176,11 +199,15 @@ typedef struct mqtt_client {
   mqtt_state_t  mqtt_state;
   mqtt_connect_info_t connect_info;
   QueueHandle_t xSendingQueue;
+  SemaphoreHandle_t send_mutex;
   RINGBUF send_rb;
+  mqtt_inflight_t inflight[CONFIG_MQTT_INFLIGHT_MAX];
+  uint8_t inflight_count;
+  uint32_t inflight_seq;
+  mqtt_store_t *store;		// persistent queue for messages published while offline, NULL if not used
+  volatile bool online;		// connected to the broker and the sending task is running
   uint32_t keepalive_tick;
   uint8_t status;
-  uint8_t *msgbuf;
-  uint8_t *topicbuf;
   bool terminate_mqtt;
   char *name;
 } mqtt_client;
@@ -115,6 +115,8 @@ uint16_t mqtt_get_id(uint8_t* buffer, uint16_t length);
 
 mqtt_message_t* mqtt_msg_connect(mqtt_connection_t* connection, mqtt_connect_info_t* info);
 mqtt_message_t* mqtt_msg_publish(mqtt_connection_t* connection, const char* topic, const char* data, int data_length, int qos, int retain, uint16_t* message_id);
+uint16_t mqtt_msg_next_id(mqtt_connection_t* connection);
+int mqtt_msg_publish_header(uint8_t* buffer, int topic_length, int data_length, int dup, int qos, int retain);
 mqtt_message_t* mqtt_msg_puback(mqtt_connection_t* connection, uint16_t message_id);
 mqtt_message_t* mqtt_msg_pubrec(mqtt_connection_t* connection, uint16_t message_id);
 mqtt_message_t* mqtt_msg_pubrel(mqtt_connection_t* connection, uint16_t message_id);
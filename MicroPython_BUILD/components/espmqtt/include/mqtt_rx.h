@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Boris Lovosevic (https://github.com/loboris)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Queue of received Mqtt messages
+ * Single producer (Mqtt task) / single consumer (MicroPython task)
+ *
+ */
+
+#ifndef _MQTT_RX_H_
+#define _MQTT_RX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "mqtt.h"
+
+// Received message queue entry, the topic and the payload follow the header
+typedef struct mqtt_rx_msg_t {
+    uint32_t size;		// entry size including the header, 0 marks the wrap to the buffer start
+    uint32_t data_len;
+    uint16_t topic_len;
+    uint8_t data[] __attribute__((aligned(4)));
+} mqtt_rx_msg_t;
+
+typedef struct mqtt_rx_t mqtt_rx_t;
+
+// Called in the Mqtt task when the consumer has to run: a message was added or,
+// with the queue empty, the wrap to the buffer start has to be taken over
+typedef void (* mqtt_rx_notify_cb)(mqtt_rx_t *rx);
+
+// Each message is stored contiguously, so it can be passed to Python as memoryview without copying
+typedef struct mqtt_rx_t {
+    uint8_t *buf;
+    uint32_t size;
+    volatile uint32_t head;		// written by the Mqtt task only
+    volatile uint32_t tail;		// written by the MicroPython task only
+    volatile bool pending;		// consumer notified and not yet run
+    mqtt_rx_msg_t *msg;			// message being received
+    bool stalled;				// MicroPython task does not empty the queue, drop without waiting
+    uint32_t dropped;
+    mqtt_rx_notify_cb notify;
+    void *obj;
+} mqtt_rx_t;
+
+/**
+ * \return New queue of 'size' bytes, NULL if out of memory
+ */
+mqtt_rx_t *mqtt_rx_new(uint32_t size, mqtt_rx_notify_cb notify, void *obj);
+void mqtt_rx_free(mqtt_rx_t *rx);
+/**
+ * Copy the received block of a message into the queue, runs in Mqtt task ('data_cb')
+ * If there is no space for a new message, waits up to MQTT_RX_WAIT_MS
+ * for the consumer, then drops it.
+ */
+void mqtt_rx_put(mqtt_rx_t *rx, mqtt_event_data_t *event_data);
+/**
+ * \return The oldest message in the queue, NULL if empty
+ */
+mqtt_rx_msg_t *mqtt_rx_peek(mqtt_rx_t *rx);
+/**
+ * Remove the message returned by mqtt_rx_peek
+ */
+void mqtt_rx_release(mqtt_rx_t *rx, mqtt_rx_msg_t *msg);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Boris Lovosevic (https://github.com/loboris)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Mqtt persistent outbound queue
+ * Messages published while the client is offline are appended to segment files
+ * on the native VFS (SPIFFS or FAT) and replayed in order after reconnect.
+ *
+ */
+
+#ifndef _MQTT_STORE_H_
+#define _MQTT_STORE_H_
+
+#include "sdkconfig.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#ifndef CONFIG_MQTT_STORE_MAX_SIZE
+#define CONFIG_MQTT_STORE_MAX_SIZE		65536
+#endif
+#ifndef CONFIG_MQTT_STORE_REPLAY_RATE
+#define CONFIG_MQTT_STORE_REPLAY_RATE	50
+#endif
+
+#define MQTT_STORE_MAX_PATH			64
+#define MQTT_STORE_REC_HDR_SIZE		12							// record header size
+#define MQTT_STORE_BUF_SIZE			(CONFIG_MQTT_BUFFER_SIZE_BYTE * 4 + MQTT_STORE_REC_HDR_SIZE)	// write buffer and read cache size, also the max record size
+#define MQTT_STORE_FLUSH_MS			2000						// max time a record stays in RAM before it is written to the file
+#define MQTT_STORE_SYNC_BYTES		4096						// acknowledged bytes between position file updates
+#define MQTT_STORE_REPLAY_MS		100							// max replay burst is the number of messages allowed in this time
+#define MQTT_STORE_POLL_MS			10							// replay interval while waiting for send queue space or inflight slots
+#define MQTT_STORE_SEGMENTS			4							// the max size is divided into this many segment files
+
+/*
+ * Record format, all values little endian:
+ *   0: 0xA5 record mark
+ *   1: flags, bits 0-1 QoS, bit 2 retain
+ *   2: topic length, 16-bit
+ *   4: data length, 32-bit
+ *   8: CRC32 of bytes 1-7, the topic and the data
+ *  12: topic, data
+ *
+ * Records are appended to the RAM write buffer and written to the files in batches.
+ * The files are segments of max_size / MQTT_STORE_SEGMENTS bytes, '<path>.<n>', a record can
+ * continue in the next segment. A segment is removed as soon as all its records are acknowledged,
+ * so the max size limits the records from the first segment still in use, not all records
+ * appended since the store was last empty: a publisher that never lets the store become empty
+ * is only limited by the records not yet acknowledged.
+ * Offsets used by the store are logical: the content of the segments followed by the write buffer,
+ * so records can be replayed from the write buffer before they ever reach the flash.
+ * Two positions are kept: 'read_pos', the next record to send, and 'ack_pos', below which
+ * all records are acknowledged by the broker (QoS1/2) or queued for sending (QoS0).
+ * After reconnect the replay restarts from 'ack_pos', records replayed before are marked as duplicates.
+ * 'ack_pos' is saved to '<path>.pos' every MQTT_STORE_SYNC_BYTES and with the first segment in use
+ * when a segment is removed, after a reset up to that many bytes of messages can be sent twice.
+ * All files are removed when all records are acknowledged.
+ */
+
+typedef struct mqtt_store_rec_t {
+    uint32_t pos;			// record offset
+    const char *topic;
+    const uint8_t *data;
+    uint16_t topic_len;
+    uint32_t data_len;
+    uint8_t qos;
+    uint8_t retain;
+    uint8_t dup;			// replayed before the last rewind, it may have reached the broker
+} mqtt_store_rec_t;
+
+typedef struct mqtt_store_t {
+    char path[MQTT_STORE_MAX_PATH];
+    char pos_path[MQTT_STORE_MAX_PATH+4];
+    SemaphoreHandle_t mutex;
+    uint32_t max_size;
+    uint32_t file_size;		// logical offset of the end of the last segment file
+    uint32_t read_pos;		// logical offset of the next record to replay
+    uint32_t ack_pos;		// logical offset of the first record not yet acknowledged
+    uint32_t saved_pos;		// ack position saved to the position file
+    uint32_t sent_pos;		// records before this offset were replayed before the last rewind
+    uint32_t seg_size;		// segment file size
+    uint32_t seg_first;		// number of the first segment file in use
+    uint32_t seg_base;		// logical offset of the start of the first segment file
+    uint32_t rec_len;		// length of the record returned by mqtt_store_peek
+    uint8_t *wbuf;			// records not yet written to the file
+    uint32_t wbuf_len;
+    TickType_t wbuf_tick;	// time the first record was added to the empty write buffer
+    uint8_t *rbuf;			// read cache of the file content
+    uint32_t rbuf_pos;		// logical offset of rbuf[0]
+    uint32_t rbuf_len;
+    uint32_t dropped;		// records rejected because the store was full
+    uint32_t corrupted;		// bytes skipped on replay because of bad records
+} mqtt_store_t;
+
+/**
+ * Open or create the store, records left from the previous run are kept
+ * \param[in] path Native VFS path of the data files, '.<n>' and '.pos' are appended
+ * \param[in] max_size Max size in bytes of the segment files in use
+ * \return Pointer to the store, NULL on error
+ */
+mqtt_store_t *mqtt_store_open(const char *path, uint32_t max_size);
+/**
+ * Write the buffered records and free the store
+ */
+void mqtt_store_close(mqtt_store_t *store);
+
+/*
+ * All functions below must be called with the store locked
+ */
+bool mqtt_store_lock(mqtt_store_t *store, uint32_t timeout_ms);
+void mqtt_store_unlock(mqtt_store_t *store);
+/**
+ * \return true if there are records waiting for replay
+ */
+bool mqtt_store_pending(mqtt_store_t *store);
+/**
+ * \return true if there are records not yet acknowledged
+ */
+bool mqtt_store_unacked(mqtt_store_t *store);
+/**
+ * \return 0 on success, -1 if the record does not fit, -2 on write error
+ */
+int mqtt_store_append(mqtt_store_t *store, const char *topic, int topic_len, const uint8_t *data, int len, int qos, int retain);
+/**
+ * Get the next record to replay, the pointers in 'rec' are valid until the next store call
+ * \return 1 if a record is returned, 0 if the store is empty, -1 on read error
+ */
+int mqtt_store_peek(mqtt_store_t *store, mqtt_store_rec_t *rec);
+/**
+ * Advance the read position past the record returned by mqtt_store_peek
+ */
+void mqtt_store_next(mqtt_store_t *store);
+/**
+ * All records before 'pos' are acknowledged, the segments before it are removed
+ * and the store is emptied when all records are done
+ */
+void mqtt_store_ack(mqtt_store_t *store, uint32_t pos);
+/**
+ * Restart the replay from the first record not acknowledged
+ */
+void mqtt_store_rewind(mqtt_store_t *store);
+/**
+ * Write the buffered records to the segment files if 'force' is set or the oldest is older than MQTT_STORE_FLUSH_MS
+ * \return 0 on success, -1 on write error
+ */
+int mqtt_store_flush(mqtt_store_t *store, bool force);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Boris Lovosevic (https://github.com/loboris)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Mqtt topic subscriptions tree with '+' and '#' wildcard matching
+ *
+ */
+
+#ifndef _MQTT_SUBS_H_
+#define _MQTT_SUBS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct mqtt_sub_node {
+    struct mqtt_sub_node *child;	// first node of the next topic level
+    struct mqtt_sub_node *next;		// next node on the same topic level
+    void *data;						// subscription data if a topic filter ends at this level, NULL otherwise
+    uint16_t len;
+    char level[];					// topic level name, "+" or "#"
+} mqtt_sub_node_t;
+
+typedef void (* mqtt_sub_match_cb)(void *data, void *arg);
+
+/**
+ * \return 1 if 'filter' is a valid topic filter, 0 if not
+ */
+int mqtt_sub_filter_valid(const char *filter);
+/**
+ * \param[in] data Subscription data, must not be NULL
+ * \param[out] old_data Data previously stored for the same filter, or NULL
+ * \return 0 on success, -1 for invalid filter, -2 if out of memory
+ */
+int mqtt_sub_add(mqtt_sub_node_t **root, const char *filter, void *data, void **old_data);
+/**
+ * \return Data stored for the filter, NULL if there was no such subscription
+ */
+void *mqtt_sub_remove(mqtt_sub_node_t **root, const char *filter);
+/**
+ * Calls 'cb' with the data of every subscription matching the topic
+ * \return Number of matching subscriptions
+ */
+int mqtt_sub_match(mqtt_sub_node_t *root, const char *topic, int topic_len, mqtt_sub_match_cb cb, void *arg);
+/**
+ * Remove all subscriptions, calls 'free_cb' (if not NULL) for the data of each
+ */
+void mqtt_sub_free(mqtt_sub_node_t **root, mqtt_sub_match_cb free_cb, void *arg);
+
+#endif
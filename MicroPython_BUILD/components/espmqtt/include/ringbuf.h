@@ -19,5 +19,7 @@ int32_t rb_get(RINGBUF *r, uint8_t* c);
 int32_t rb_available(RINGBUF *r);
 uint32_t rb_read(RINGBUF *r, uint8_t *buf, int len);
 uint32_t rb_write(RINGBUF *r, uint8_t *buf, int len);
+int32_t rb_peek(RINGBUF *r, uint8_t **data);
+int32_t rb_skip(RINGBUF *r, int32_t len);
 
 #endif
@@ -55,6 +55,8 @@
 
 const char *MQTT_TAG = "[Mqtt client]";
 
+static int mqtt_publish_msg(mqtt_client* client, const char *topic, int topic_len, const uint8_t *data, int len, int qos, int retain, int dup, uint32_t store_pos, uint32_t timeout_ms);
+
 //----------------------------------------------------------------
 static int resolve_dns(const char *host, struct sockaddr_in *ip) {
     struct hostent *he;
@@ -68,18 +70,242 @@ static int resolve_dns(const char *host, struct sockaddr_in *ip) {
     return 1;
 }
 
-//-----------------------------------------
-static void mqtt_queue(mqtt_client *client)
+// The send queue (send_rb + xSendingQueue) and the inflight table are shared
+// between the MicroPython task(s) publishing, the receive task queuing
+// acknowledges and the sending task. Producers hold send_mutex while a message
+// is reserved, written and committed, so messages are never interleaved.
+// The sending task only takes it to release already sent data.
+
+//---------------------------------------------
+static void mqtt_send_lock(mqtt_client *client)
 {
-    int msg_len;
-    while (rb_available(&client->send_rb) < client->mqtt_state.outbound_message->length) {
-        xQueueReceive(client->xSendingQueue, &msg_len, 1000 / portTICK_RATE_MS);
-        rb_read(&client->send_rb, client->mqtt_state.out_buffer, msg_len);
-    }
-    rb_write(&client->send_rb,
-             client->mqtt_state.outbound_message->data,
-             client->mqtt_state.outbound_message->length);
-    xQueueSend(client->xSendingQueue, &client->mqtt_state.outbound_message->length, 0);
+	xSemaphoreTake(client->send_mutex, portMAX_DELAY);
+}
+
+//-----------------------------------------------
+static void mqtt_send_unlock(mqtt_client *client)
+{
+	xSemaphoreGive(client->send_mutex);
+}
+
+// Wait up to 'timeout_ms' until 'len' bytes can be queued and, if 'need_slot' is set, an inflight slot is free
+// Must be called with send_mutex taken, which is released while waiting
+//----------------------------------------------------------------------------------------------
+static bool mqtt_send_reserve(mqtt_client *client, int len, bool need_slot, uint32_t timeout_ms)
+{
+	if (len > client->send_rb.size) {
+		ESP_LOGE(MQTT_TAG, "Message too long for the send queue (%d > %d)", len, client->send_rb.size);
+		return false;
+	}
+	TickType_t start = xTaskGetTickCount();
+	while ((rb_available(&client->send_rb) < len) || (uxQueueSpacesAvailable(client->xSendingQueue) == 0) ||
+			(need_slot && (client->inflight_count >= CONFIG_MQTT_INFLIGHT_MAX))) {
+		if (((xTaskGetTickCount() - start) >= (timeout_ms / portTICK_RATE_MS)) || (client->terminate_mqtt)) {
+			if (timeout_ms) ESP_LOGW(MQTT_TAG, "Send queue full");
+			return false;
+		}
+		mqtt_send_unlock(client);
+		vTaskDelay(1);
+		mqtt_send_lock(client);
+	}
+	return true;
+}
+
+// Push the message length to the sending task; the message data is already in send_rb,
+// or in the inflight slot given with MQTT_QUEUE_FLAG_INFLIGHT
+//-----------------------------------------------------------------
+static void mqtt_send_commit(mqtt_client *client, uint32_t msg_len)
+{
+    xQueueSend(client->xSendingQueue, &msg_len, 0);
+}
+
+// Queue the message built in 'message'
+//-----------------------------------------------------------------
+static int mqtt_queue(mqtt_client *client, mqtt_message_t *message)
+{
+	int res = -1;
+
+	if (message->length == 0) return -1;
+	mqtt_send_lock(client);
+	if (mqtt_send_reserve(client, message->length, false, MQTT_SEND_TIMEOUT_MS)) {
+		rb_write(&client->send_rb, message->data, message->length);
+		mqtt_send_commit(client, message->length);
+		res = 0;
+	}
+	mqtt_send_unlock(client);
+	return res;
+}
+
+// Queue the acknowledge message of the given type, built in a local buffer
+//---------------------------------------------------------------------------
+static int mqtt_queue_ack(mqtt_client *client, int msg_type, uint16_t msg_id)
+{
+	mqtt_connection_t connection;
+	mqtt_message_t *message;
+	uint8_t buf[8];
+
+	mqtt_msg_init(&connection, buf, sizeof(buf));
+	switch (msg_type) {
+		case MQTT_MSG_TYPE_PUBACK:
+			message = mqtt_msg_puback(&connection, msg_id);
+			break;
+		case MQTT_MSG_TYPE_PUBREC:
+			message = mqtt_msg_pubrec(&connection, msg_id);
+			break;
+		case MQTT_MSG_TYPE_PUBREL:
+			message = mqtt_msg_pubrel(&connection, msg_id);
+			break;
+		case MQTT_MSG_TYPE_PUBCOMP:
+			message = mqtt_msg_pubcomp(&connection, msg_id);
+			break;
+		default:
+			message = mqtt_msg_pingresp(&connection);
+			break;
+	}
+	return mqtt_queue(client, message);
+}
+
+// Find the inflight slot waiting for 'wait_type' with 'msg_id'
+// Must be called with send_mutex taken
+//-------------------------------------------------------------------------------------------------
+static mqtt_inflight_t *mqtt_inflight_find(mqtt_client *client, uint16_t msg_id, uint8_t wait_type)
+{
+	for (int i=0; i<CONFIG_MQTT_INFLIGHT_MAX; i++) {
+		if ((client->inflight[i].wait_type == wait_type) && (client->inflight[i].msg_id == msg_id)) return &client->inflight[i];
+	}
+	return NULL;
+}
+
+// Free the message copy, and the slot if 'wait_type' is 0
+// A copy being written is left to the sending task to free
+// Must be called with send_mutex taken
+//------------------------------------------------------------------------------------------
+static void mqtt_inflight_set(mqtt_client *client, mqtt_inflight_t *slot, uint8_t wait_type)
+{
+	if (slot->sending) slot->sending = false;
+	else free(slot->msg);
+	slot->msg = NULL;
+	slot->msg_len = 0;
+	slot->wait_type = wait_type;
+	if (wait_type == 0) client->inflight_count--;
+}
+
+// Take the message copy of 'slot' to write it without send_mutex taken
+// Must be called with send_mutex taken
+//--------------------------------------------------------
+static uint8_t *mqtt_inflight_take(mqtt_inflight_t *slot)
+{
+	if (slot->msg) slot->sending = true;
+	return slot->msg;
+}
+
+// The message taken from 'slot' is written, free it if the slot was acknowledged meanwhile
+// Must be called with send_mutex taken
+//---------------------------------------------------------------------
+static void mqtt_inflight_written(mqtt_inflight_t *slot, uint8_t *msg)
+{
+	if (slot->sending) slot->sending = false;
+	else free(msg);
+}
+
+// Handle the acknowledge for QoS1/2 publish, returns true if it matched a message in flight
+// After PUBACK or PUBREC the broker has the message, it is never published again
+//------------------------------------------------------------------------------------------------------------
+static bool mqtt_inflight_ack(mqtt_client *client, uint16_t msg_id, uint8_t wait_type, uint8_t next_wait_type)
+{
+	mqtt_send_lock(client);
+	mqtt_inflight_t *slot = mqtt_inflight_find(client, msg_id, wait_type);
+	if (slot) {
+		mqtt_inflight_set(client, slot, next_wait_type);
+		// a replayed QoS2 message can be acknowledged in the store, the PUBREL is resent from here
+		slot->store_pos = 0;
+	}
+	mqtt_send_unlock(client);
+	return (slot != NULL);
+}
+
+// Discard all queued messages, the messages in flight are sent again by mqtt_inflight_resend
+// Replayed messages not yet received by the broker are forgotten, the store replays them again
+//----------------------------------------------
+static void mqtt_send_reset(mqtt_client *client)
+{
+	mqtt_send_lock(client);
+	rb_init(&client->send_rb, client->send_rb.p_o, client->send_rb.size, 1);
+	xQueueReset(client->xSendingQueue);
+	for (int i=0; i<CONFIG_MQTT_INFLIGHT_MAX; i++) {
+		if ((client->inflight[i].wait_type) && (client->inflight[i].store_pos)) mqtt_inflight_set(client, &client->inflight[i], 0);
+	}
+	mqtt_send_unlock(client);
+}
+
+// Send the messages in flight again after reconnect, in publish order:
+// the PUBLISH with DUP set, or the PUBREL if PUBREC was received
+// The messages are written without send_mutex taken, see mqtt_inflight_take
+// Returns false on write error
+//---------------------------------------------------
+static bool mqtt_inflight_resend(mqtt_client *client)
+{
+	mqtt_connection_t connection;
+	mqtt_message_t *message;
+	mqtt_inflight_t *order[CONFIG_MQTT_INFLIGHT_MAX];
+	uint8_t *msg[CONFIG_MQTT_INFLIGHT_MAX];
+	uint32_t msg_len[CONFIG_MQTT_INFLIGHT_MAX];
+	uint16_t msg_id[CONFIG_MQTT_INFLIGHT_MAX];
+	bool pubrel[CONFIG_MQTT_INFLIGHT_MAX];
+	uint8_t buf[8];
+	int n = 0;
+	bool res = true;
+
+	mqtt_send_lock(client);
+	for (int i=0; i<CONFIG_MQTT_INFLIGHT_MAX; i++) {
+		mqtt_inflight_t *slot = &client->inflight[i];
+		if (slot->wait_type == 0) continue;
+		int j = n++;
+		while ((j > 0) && ((int32_t)(order[j-1]->seq - slot->seq) > 0)) {
+			order[j] = order[j-1];
+			j--;
+		}
+		order[j] = slot;
+	}
+	for (int i=0; i<n; i++) {
+		msg[i] = mqtt_inflight_take(order[i]);
+		msg_len[i] = order[i]->msg_len;
+		msg_id[i] = order[i]->msg_id;
+		pubrel[i] = (order[i]->wait_type == MQTT_MSG_TYPE_PUBCOMP);
+		if (msg[i]) msg[i][0] |= 0x08;	// DUP
+	}
+	mqtt_send_unlock(client);
+
+	for (int i=0; (i<n) && (res); i++) {
+		if (msg[i]) {
+			ESP_LOGI(MQTT_TAG, "Resend publish, id: %d", msg_id[i]);
+			res = (client->settings->write_cb(client, msg[i], msg_len[i], 5 * 1000) == msg_len[i]);
+		}
+		else if (pubrel[i]) {
+			mqtt_msg_init(&connection, buf, sizeof(buf));
+			message = mqtt_msg_pubrel(&connection, msg_id[i]);
+			ESP_LOGI(MQTT_TAG, "Resend pubrel, id: %d", msg_id[i]);
+			res = (client->settings->write_cb(client, message->data, message->length, 5 * 1000) == message->length);
+		}
+	}
+
+	mqtt_send_lock(client);
+	for (int i=0; i<n; i++) {
+		if (msg[i]) mqtt_inflight_written(order[i], msg[i]);
+	}
+	mqtt_send_unlock(client);
+	if (!res) ESP_LOGE(MQTT_TAG, "Write error: %d", errno);
+	return res;
+}
+
+// Write stored messages older than MQTT_STORE_FLUSH_MS to the file, skipped if the store is in use
+//----------------------------------------------
+static void mqtt_store_sync(mqtt_client *client)
+{
+	if ((client->store) && (mqtt_store_lock(client->store, 0))) {
+		mqtt_store_flush(client->store, false);
+		mqtt_store_unlock(client->store);
+	}
 }
 
 //---------------------------------------------
@@ -98,6 +324,7 @@ static bool client_connect(mqtt_client *client)
             ESP_LOGI(MQTT_TAG, "Resolve dns for domain: %s", client->settings->host);
 
             if (!resolve_dns(client->settings->host, &remote_ip)) {
+                mqtt_store_sync(client);
                 vTaskDelay(1000 / portTICK_RATE_MS);
                 continue;
             }
@@ -173,6 +400,7 @@ failed1:
         if (client->settings->use_ssl) {
         	client->ctx = NULL;
         }
+         mqtt_store_sync(client);
          vTaskDelay(1000 / portTICK_RATE_MS);
      }
 }
@@ -269,7 +497,11 @@ static bool mqtt_connect(mqtt_client *client)
 {
     int write_len, read_len, connect_rsp_code;
 
+    mqtt_send_lock(client);
+    // message ids continue from the previous connection, the messages in flight keep theirs
+    uint16_t message_id = client->mqtt_state.mqtt_connection.message_id;
     mqtt_msg_init(&client->mqtt_state.mqtt_connection, client->mqtt_state.out_buffer, client->mqtt_state.out_buffer_length);
+    client->mqtt_state.mqtt_connection.message_id = message_id;
     client->mqtt_state.outbound_message = mqtt_msg_connect(&client->mqtt_state.mqtt_connection, client->mqtt_state.connect_info);
     client->mqtt_state.pending_msg_type = mqtt_get_type(client->mqtt_state.outbound_message->data);
     client->mqtt_state.pending_msg_id = mqtt_get_id(client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
@@ -277,6 +509,7 @@ static bool mqtt_connect(mqtt_client *client)
     ESP_LOGI(MQTT_TAG, "Sending MQTT CONNECT message, type: %d, id: %04X", client->mqtt_state.pending_msg_type, client->mqtt_state.pending_msg_id);
 
     write_len = client->settings->write_cb(client, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length, 0);
+    mqtt_send_unlock(client);
     if(write_len < 0) {
         ESP_LOGE(MQTT_TAG, "Writing failed: %d", errno);
         return false;
@@ -318,59 +551,166 @@ static bool mqtt_connect(mqtt_client *client)
     return false;
 }
 
+// Move up to 'max' stored messages to the send queue and acknowledge the replayed ones
+// Returns the number of messages queued
+// Stored messages are acknowledged up to the oldest replayed QoS1/2 message still in flight,
+// QoS0 messages as soon as they are queued.
+// Never waits, if the send queue is full or the store is in use, it is tried again on the next call
+//--------------------------------------------------------
+static int mqtt_store_replay(mqtt_client *client, int max)
+{
+	mqtt_store_rec_t rec;
+	uint32_t pos;
+	int res, n = 0;
+
+	if (!mqtt_store_lock(client->store, 0)) return 0;
+	while ((n < max) && (mqtt_store_peek(client->store, &rec) > 0)) {
+		res = mqtt_publish_msg(client, rec.topic, rec.topic_len, rec.data, rec.data_len, rec.qos, rec.retain, rec.dup, rec.pos + 1, 0);
+		if (res == -1) break;
+		// queued, or too long to be ever sent
+		mqtt_store_next(client->store);
+		n++;
+	}
+
+	pos = client->store->read_pos;
+	mqtt_send_lock(client);
+	for (int i=0; i<CONFIG_MQTT_INFLIGHT_MAX; i++) {
+		if ((client->inflight[i].wait_type) && (client->inflight[i].store_pos) && (client->inflight[i].store_pos <= pos)) {
+			pos = client->inflight[i].store_pos - 1;
+		}
+	}
+	mqtt_send_unlock(client);
+	mqtt_store_ack(client->store, pos);
+
+	mqtt_store_flush(client->store, false);
+	mqtt_store_unlock(client->store);
+	return n;
+}
+
+// Write 'len' bytes from the head of send_rb, returns false on write error
+//--------------------------------------------------------
+static bool mqtt_send_ring(mqtt_client *client, int len)
+{
+    uint8_t *data;
+    int send_len;
+
+    while (len > 0) {
+        send_len = rb_peek(&client->send_rb, &data);
+        if (send_len > len) send_len = len;
+        send_len = client->settings->write_cb(client, data, send_len, 5 * 1000);
+        if (send_len <= 0) {
+            ESP_LOGE(MQTT_TAG, "Write error: %d", errno);
+            return false;
+        }
+        mqtt_send_lock(client);
+        rb_skip(&client->send_rb, send_len);
+        mqtt_send_unlock(client);
+        len -= send_len;
+    }
+    return true;
+}
+
+// Write the PUBLISH kept in inflight slot 'idx', returns false on write error
+// The message is written without send_mutex taken, see mqtt_inflight_take
+//-------------------------------------------------------------
+static bool mqtt_send_inflight(mqtt_client *client, int idx)
+{
+	bool res = true;
+	mqtt_inflight_t *slot = &client->inflight[idx];
+
+	mqtt_send_lock(client);
+	uint8_t *msg = mqtt_inflight_take(slot);
+	uint32_t msg_len = slot->msg_len;
+	mqtt_send_unlock(client);
+	if (msg) {
+		res = (client->settings->write_cb(client, msg, msg_len, 5 * 1000) == msg_len);
+		mqtt_send_lock(client);
+		mqtt_inflight_written(slot, msg);
+		mqtt_send_unlock(client);
+	}
+	if (!res) ESP_LOGE(MQTT_TAG, "Write error: %d", errno);
+	return res;
+}
+
+// Messages queued in send_rb at the time the sending task wakes up are contiguous,
+// so they are written directly from the ring, coalesced into one write (two if
+// the data wraps around the end of the ring). QoS1/2 publishes are written from
+// their inflight slot, the ring data queued before them goes first.
 //========================================
 void mqtt_sending_task(void *pvParameters)
 {
     mqtt_client *client = (mqtt_client *)pvParameters;
     uint32_t msg_len;
-    int send_len, sent_len = 0;
+    int batch_len, send_len;
+    bool published, sent;
     bool connected = true;
-    ESP_LOGI(MQTT_TAG, "Sending task started");
+    mqtt_connection_t ping_connection;
+    mqtt_message_t *ping_message;
+    uint8_t ping_buf[4];
+    TickType_t idle_tick = xTaskGetTickCount();
+    TickType_t replay_tick = idle_tick;
+    uint32_t wait_ms, replay_ms;
+    // stored messages are replayed at replay_rate messages per second,
+    // up to the number allowed in MQTT_STORE_REPLAY_MS at once
+    uint32_t replay_rate = (client->settings->replay_rate) ? client->settings->replay_rate : 1;
+    int replay_max = (replay_rate * MQTT_STORE_REPLAY_MS) / 1000;
+    int replay_credit = 0;
+    if (replay_max < 1) replay_max = 1;
 
-    while (connected) {
-        if (xQueueReceive(client->xSendingQueue, &msg_len, 1000 / portTICK_RATE_MS)) {
-            //queue available
-            while (msg_len > 0) {
-                send_len = msg_len;
-                if (send_len > CONFIG_MQTT_BUFFER_SIZE_BYTE) send_len = CONFIG_MQTT_BUFFER_SIZE_BYTE;
-                ESP_LOGD(MQTT_TAG, "Sending %d bytes", send_len);
-
-                rb_read(&client->send_rb, client->mqtt_state.out_buffer, send_len);
-                client->mqtt_state.pending_msg_type = mqtt_get_type(client->mqtt_state.out_buffer);
-                client->mqtt_state.pending_msg_id = mqtt_get_id(client->mqtt_state.out_buffer, send_len);
-                send_len = client->settings->write_cb(client, client->mqtt_state.out_buffer, send_len, 5 * 1000);
-                if (send_len <= 0) {
-                    ESP_LOGE(MQTT_TAG, "Write error: %d", errno);
+    ESP_LOGI(MQTT_TAG, "Sending task started");
+    if (!mqtt_inflight_resend(client)) connected = false;
+
+    while ((connected) && (client->status == MQTT_STATUS_CONNECTED)) {
+        // store state is only checked here, without the lock
+        wait_ms = 1000;
+        if (client->store) {
+        	if (mqtt_store_pending(client->store)) wait_ms = MQTT_STORE_POLL_MS;
+        	else if (mqtt_store_unacked(client->store)) wait_ms = MQTT_STORE_REPLAY_MS;
+        }
+        if (xQueueReceive(client->xSendingQueue, &msg_len, wait_ms / portTICK_RATE_MS)) {
+            //queue available, collect all queued messages
+            batch_len = 0;
+            published = false;
+            sent = false;
+            do {
+                if (msg_len & MQTT_QUEUE_FLAG_PUBLISH) published = true;
+                if (msg_len & MQTT_QUEUE_FLAG_INFLIGHT) {
+                    connected = mqtt_send_ring(client, batch_len) && mqtt_send_inflight(client, msg_len & MQTT_QUEUE_SLOT_MASK);
+                    batch_len = 0;
+                    sent = true;
+                    if (!connected) break;
+                }
+                else batch_len += msg_len & ~MQTT_QUEUE_FLAG_PUBLISH;
+            } while (xQueueReceive(client->xSendingQueue, &msg_len, 0));
+            if (!connected) break;
+            if (batch_len > 0) {
+                ESP_LOGD(MQTT_TAG, "Sending %d bytes", batch_len);
+                if (!mqtt_send_ring(client, batch_len)) {
                     connected = false;
                     break;
                 }
-
-                //TODO: Check sending type, to callback publish message
-                msg_len -= send_len;
-                sent_len += send_len;
+                sent = true;
             }
+            if (!sent) continue; // wake up only
+
             //invalidate keepalive timer
             client->keepalive_tick = client->settings->keepalive / 2;
-        	if (client->mqtt_state.sending_msg_type == MQTT_SENDING_TYPE_PUBLISH) {
-        		client->mqtt_state.sending_msg_type = MQTT_SENDING_TYPE_NONE;
-                ESP_LOGI(MQTT_TAG, "Published %d bytes", sent_len);
+            idle_tick = xTaskGetTickCount();
+        	if (published) {
                 if (client->settings->publish_cb) {
                     client->settings->publish_cb(client, (void *)"Sent");
                 }
         	}
         }
-        else {
+        else if ((xTaskGetTickCount() - idle_tick) >= (1000 / portTICK_RATE_MS)) {
+            idle_tick = xTaskGetTickCount();
             if (client->keepalive_tick > 0) client->keepalive_tick --;
             else {
                 client->keepalive_tick = client->settings->keepalive / 2;
-                client->mqtt_state.outbound_message = mqtt_msg_pingreq(&client->mqtt_state.mqtt_connection);
-                client->mqtt_state.pending_msg_type = mqtt_get_type(client->mqtt_state.outbound_message->data);
-                client->mqtt_state.pending_msg_id = mqtt_get_id(client->mqtt_state.outbound_message->data,
-                                                    client->mqtt_state.outbound_message->length);
+                mqtt_msg_init(&ping_connection, ping_buf, sizeof(ping_buf));
+                ping_message = mqtt_msg_pingreq(&ping_connection);
                 ESP_LOGD(MQTT_TAG, "Sending ping request");
-                send_len = client->settings->write_cb(client,
-                      client->mqtt_state.outbound_message->data,
-                      client->mqtt_state.outbound_message->length, 0);
+                send_len = client->settings->write_cb(client, ping_message->data, ping_message->length, 0);
                 if(send_len <= 0) {
 					ESP_LOGE(MQTT_TAG, "Write error: %d", errno);
                     connected = false;
@@ -378,7 +718,28 @@ void mqtt_sending_task(void *pvParameters)
 				}
             }
         }
+
+        if (client->store) {
+            if (mqtt_store_unacked(client->store)) {
+                replay_ms = (xTaskGetTickCount() - replay_tick) * portTICK_RATE_MS;
+                if (replay_ms >= (1000 / replay_rate)) {
+                    replay_credit += (replay_ms * replay_rate) / 1000;
+                    replay_tick += (((replay_ms * replay_rate) / 1000) * 1000 / replay_rate) / portTICK_RATE_MS;
+                    if (replay_credit > replay_max) {
+                    	replay_credit = replay_max;
+                    	replay_tick = xTaskGetTickCount();
+                    }
+                }
+                // with no credit, only the acknowledged messages are removed
+                replay_credit -= mqtt_store_replay(client, replay_credit);
+            }
+            else {
+            	replay_tick = xTaskGetTickCount();
+            	mqtt_store_sync(client);
+            }
+        }
     }
+    client->online = false;
     closeclient(client);
     client->settings->xMqttSendingTask = NULL;
     vTaskDelete(NULL);
@@ -421,8 +782,11 @@ void deliver_publish(mqtt_client *client, uint8_t *message, int length)
         if (client->mqtt_state.message_length_read >= client->mqtt_state.message_length)
             break;
 
-        len_read = client->settings->read_cb(client, client->mqtt_state.in_buffer, CONFIG_MQTT_BUFFER_SIZE_BYTE, 0);
-        if(len_read < 0) {
+        // read only the rest of this message, the next one may follow immediately
+        len_read = client->mqtt_state.message_length - client->mqtt_state.message_length_read;
+        if (len_read > CONFIG_MQTT_BUFFER_SIZE_BYTE) len_read = CONFIG_MQTT_BUFFER_SIZE_BYTE;
+        len_read = client->settings->read_cb(client, client->mqtt_state.in_buffer, len_read, 0);
+        if(len_read <= 0) {
             ESP_LOGE(MQTT_TAG, "Read error: %d", errno);
             break;
         }
@@ -431,10 +795,26 @@ void deliver_publish(mqtt_client *client, uint8_t *message, int length)
 
 }
 
+// Returns the length of the fixed header in 'buffer',
+// 0 if more data is needed to decode it, -1 if it is invalid
+//--------------------------------------------------------
+static int mqtt_header_length(uint8_t *buffer, int length)
+{
+	for (int i=1; (i<length) && (i<5); i++) {
+		if ((buffer[i] & 0x80) == 0) return i+1;
+	}
+	if (length >= 5) return -1;
+	return 0;
+}
+
+// One read may return several messages (e.g. acknowledges for a window of publishes)
+// or end with a partial one, which is moved to the buffer start and completed by the next read.
+// Only PUBLISH messages larger than the input buffer are delivered in parts.
 //---------------------------------------------------
 void mqtt_start_receive_schedule(mqtt_client *client)
 {
-    int read_len;
+    int read_len, rx_len = 0, pos, avail, hdr_len, msg_len;
+    uint8_t *msg;
     uint8_t msg_type;
     uint8_t msg_qos;
     uint16_t msg_id;
@@ -446,7 +826,7 @@ void mqtt_start_receive_schedule(mqtt_client *client)
     	}
     	if (client->settings->xMqttSendingTask == NULL) break;
 
-        read_len = client->settings->read_cb(client, client->mqtt_state.in_buffer, CONFIG_MQTT_BUFFER_SIZE_BYTE, 0);
+        read_len = client->settings->read_cb(client, client->mqtt_state.in_buffer + rx_len, CONFIG_MQTT_BUFFER_SIZE_BYTE - rx_len, 0);
 
         ESP_LOGD(MQTT_TAG, "Read length %d", read_len);
         if (read_len <= 0) {
@@ -454,79 +834,100 @@ void mqtt_start_receive_schedule(mqtt_client *client)
             ESP_LOGE(MQTT_TAG, "Read error %d", errno);
             break;
         }
+        rx_len += read_len;
+
+        pos = 0;
+        while (pos < rx_len) {
+        	msg = client->mqtt_state.in_buffer + pos;
+        	avail = rx_len - pos;
+        	hdr_len = mqtt_header_length(msg, avail);
+        	if (hdr_len == 0) break;
+        	if (hdr_len < 0) {
+                ESP_LOGE(MQTT_TAG, "Invalid message header");
+                goto exit;
+        	}
+        	msg_len = mqtt_get_total_length(msg, avail);
+        	msg_type = mqtt_get_type(msg);
+        	if (msg_len > avail) {
+        		// incomplete message, wait for more data unless the buffer is full
+        		if ((pos > 0) || (avail < CONFIG_MQTT_BUFFER_SIZE_BYTE)) break;
+        		if (msg_type != MQTT_MSG_TYPE_PUBLISH) {
+                    ESP_LOGE(MQTT_TAG, "Message too long: %d", msg_len);
+                    goto exit;
+        		}
+        	}
 
-        msg_type = mqtt_get_type(client->mqtt_state.in_buffer);
-        msg_qos = mqtt_get_qos(client->mqtt_state.in_buffer);
-        msg_id = mqtt_get_id(client->mqtt_state.in_buffer, client->mqtt_state.in_buffer_length);
-        // ESP_LOGI(MQTT_TAG, "msg_type %d, msg_id: %d, pending_id: %d", msg_type, msg_id, client->mqtt_state.pending_msg_type);
-        switch (msg_type)
-        {
-            case MQTT_MSG_TYPE_SUBACK:
-                if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_SUBSCRIBE && client->mqtt_state.pending_msg_id == msg_id) {
-                    ESP_LOGI(MQTT_TAG, "Subscribe successful");
-                    if (client->settings->subscribe_cb) {
-                        client->settings->subscribe_cb(client, NULL);
+            msg_qos = mqtt_get_qos(msg);
+            msg_id = mqtt_get_id(msg, (msg_len > avail) ? avail : msg_len);
+            switch (msg_type)
+            {
+                case MQTT_MSG_TYPE_SUBACK:
+                    if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_SUBSCRIBE && client->mqtt_state.pending_msg_id == msg_id) {
+                        ESP_LOGI(MQTT_TAG, "Subscribe successful");
+                        if (client->settings->subscribe_cb) {
+                            client->settings->subscribe_cb(client, NULL);
+                        }
                     }
-                }
-                break;
-            case MQTT_MSG_TYPE_UNSUBACK:
-                if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE && client->mqtt_state.pending_msg_id == msg_id)
-                    ESP_LOGI(MQTT_TAG, "UnSubscribe successful");
-                break;
-            case MQTT_MSG_TYPE_PUBLISH:
-                if (msg_qos == 1)
-                    client->mqtt_state.outbound_message = mqtt_msg_puback(&client->mqtt_state.mqtt_connection, msg_id);
-                else if (msg_qos == 2)
-                    client->mqtt_state.outbound_message = mqtt_msg_pubrec(&client->mqtt_state.mqtt_connection, msg_id);
-
-                if (msg_qos == 1 || msg_qos == 2) {
-                    ESP_LOGI(MQTT_TAG, "Queue response QoS: %d", msg_qos);
-                    mqtt_queue(client);
-                    // if (QUEUE_Puts(&client->msgQueue, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length) == -1) {
-                    //     ESP_LOGI(MQTT_TAG, "MQTT: Queue full");
-                    // }
-                }
-                client->mqtt_state.message_length_read = read_len;
-                client->mqtt_state.message_length = mqtt_get_total_length(client->mqtt_state.in_buffer, client->mqtt_state.message_length_read);
-                ESP_LOGI(MQTT_TAG, "deliver_publish");
-
-                deliver_publish(client, client->mqtt_state.in_buffer, client->mqtt_state.message_length_read);
-                break;
-            case MQTT_MSG_TYPE_PUBACK:
-                if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_PUBLISH && client->mqtt_state.pending_msg_id == msg_id) {
-                    ESP_LOGI(MQTT_TAG, "received MQTT_MSG_TYPE_PUBACK, finish QoS1 publish");
-                    if (client->settings->publish_cb) {
-                        client->settings->publish_cb(client, (void *)"QoS1 acknowledged");
+                    break;
+                case MQTT_MSG_TYPE_UNSUBACK:
+                    if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_UNSUBSCRIBE && client->mqtt_state.pending_msg_id == msg_id)
+                        ESP_LOGI(MQTT_TAG, "UnSubscribe successful");
+                    break;
+                case MQTT_MSG_TYPE_PUBLISH:
+                    if (msg_qos == 1 || msg_qos == 2) {
+                        ESP_LOGI(MQTT_TAG, "Queue response QoS: %d", msg_qos);
+                        mqtt_queue_ack(client, (msg_qos == 1) ? MQTT_MSG_TYPE_PUBACK : MQTT_MSG_TYPE_PUBREC, msg_id);
                     }
-                }
-                break;
-            case MQTT_MSG_TYPE_PUBREC:
-                client->mqtt_state.outbound_message = mqtt_msg_pubrel(&client->mqtt_state.mqtt_connection, msg_id);
-                mqtt_queue(client);
-                break;
-            case MQTT_MSG_TYPE_PUBREL:
-                client->mqtt_state.outbound_message = mqtt_msg_pubcomp(&client->mqtt_state.mqtt_connection, msg_id);
-                mqtt_queue(client);
-                break;
-            case MQTT_MSG_TYPE_PUBCOMP:
-                if (client->mqtt_state.pending_msg_type == MQTT_MSG_TYPE_PUBREL && client->mqtt_state.pending_msg_id == msg_id) {
-                    ESP_LOGI(MQTT_TAG, "Receive MQTT_MSG_TYPE_PUBCOMP, finish QoS2 publish");
-                    if (client->settings->publish_cb) {
-                        client->settings->publish_cb(client, (void *)"QoS2 acknowledged");
+                    client->mqtt_state.message_length_read = (msg_len > avail) ? avail : msg_len;
+                    client->mqtt_state.message_length = msg_len;
+                    ESP_LOGI(MQTT_TAG, "deliver_publish");
+
+                    deliver_publish(client, msg, client->mqtt_state.message_length_read);
+                    break;
+                case MQTT_MSG_TYPE_PUBACK:
+                    if (mqtt_inflight_ack(client, msg_id, MQTT_MSG_TYPE_PUBACK, 0)) {
+                        ESP_LOGD(MQTT_TAG, "received MQTT_MSG_TYPE_PUBACK, finish QoS1 publish");
+                        if (client->settings->publish_cb) {
+                            client->settings->publish_cb(client, (void *)"QoS1 acknowledged");
+                        }
                     }
-                }
-                break;
-            case MQTT_MSG_TYPE_PINGREQ:
-            	client->mqtt_state.sending_msg_type = MQTT_SENDING_TYPE_PING;
-                client->mqtt_state.outbound_message = mqtt_msg_pingresp(&client->mqtt_state.mqtt_connection);
-                mqtt_queue(client);
-                break;
-            case MQTT_MSG_TYPE_PINGRESP:
-                ESP_LOGD(MQTT_TAG, "MQTT_MSG_TYPE_PINGRESP");
-                // Ignore
-                break;
+                    break;
+                case MQTT_MSG_TYPE_PUBREC:
+                    mqtt_inflight_ack(client, msg_id, MQTT_MSG_TYPE_PUBREC, MQTT_MSG_TYPE_PUBCOMP);
+                    mqtt_queue_ack(client, MQTT_MSG_TYPE_PUBREL, msg_id);
+                    break;
+                case MQTT_MSG_TYPE_PUBREL:
+                    mqtt_queue_ack(client, MQTT_MSG_TYPE_PUBCOMP, msg_id);
+                    break;
+                case MQTT_MSG_TYPE_PUBCOMP:
+                    if (mqtt_inflight_ack(client, msg_id, MQTT_MSG_TYPE_PUBCOMP, 0)) {
+                        ESP_LOGD(MQTT_TAG, "Receive MQTT_MSG_TYPE_PUBCOMP, finish QoS2 publish");
+                        if (client->settings->publish_cb) {
+                            client->settings->publish_cb(client, (void *)"QoS2 acknowledged");
+                        }
+                    }
+                    break;
+                case MQTT_MSG_TYPE_PINGREQ:
+                    mqtt_queue_ack(client, MQTT_MSG_TYPE_PINGRESP, 0);
+                    break;
+                case MQTT_MSG_TYPE_PINGRESP:
+                    ESP_LOGD(MQTT_TAG, "MQTT_MSG_TYPE_PINGRESP");
+                    // Ignore
+                    break;
+            }
+            if (msg_len > avail) {
+            	// the rest of the message was read by deliver_publish
+            	pos = rx_len;
+            	break;
+            }
+            pos += msg_len;
         }
+        // keep the incomplete message for the next read
+        rx_len -= pos;
+        if ((rx_len > 0) && (pos > 0)) memmove(client->mqtt_state.in_buffer, client->mqtt_state.in_buffer + pos, rx_len);
     }
+exit:
+    return;
 }
 
 //---------------------------------
@@ -535,6 +936,11 @@ void mqtt_free(mqtt_client *client)
 	if (client == NULL) return;
 
 	vQueueDelete(client->xSendingQueue);
+	vSemaphoreDelete(client->send_mutex);
+	for (int i=0; i<CONFIG_MQTT_INFLIGHT_MAX; i++) {
+		free(client->inflight[i].msg);
+		client->inflight[i].msg = NULL;
+	}
 
     free(client->mqtt_state.in_buffer);
     free(client->mqtt_state.out_buffer);
@@ -573,15 +979,30 @@ void mqtt_task(void *pvParameters)
             else continue;
         }
 
+        // Anything left in the send queue from the previous connection is discarded,
+        // messages in flight are sent again first by the sending task,
+        // stored messages not acknowledged are replayed again
+        mqtt_send_reset(client);
+        if (client->store) {
+        	mqtt_store_lock(client->store, portMAX_DELAY);
+        	mqtt_store_rewind(client->store);
+        	mqtt_store_unlock(client->store);
+        }
+        client->online = true;
+
         ESP_LOGI(MQTT_TAG, "Connected to MQTT broker, creating sending thread before calling connected callback");
         xTaskCreate(&mqtt_sending_task, "mqtt_sending_task", client->settings->xMqttSendingTask_stacksize, client, CONFIG_MQTT_PRIORITY + 1, &(client->settings->xMqttSendingTask));
-        if (client->settings->xMqttSendingTask == NULL) break;
+        if (client->settings->xMqttSendingTask == NULL) {
+        	client->online = false;
+        	break;
+        }
         if (client->settings->connected_cb) {
             client->settings->connected_cb(client, NULL);
         }
 
         ESP_LOGI(MQTT_TAG, "mqtt_start_receive_schedule");
         mqtt_start_receive_schedule(client);
+        client->online = false;
 
         client->settings->disconnect_cb(client);
         if (client->settings->disconnected_cb) {
@@ -589,7 +1010,18 @@ void mqtt_task(void *pvParameters)
 		}
 
         if (client->settings->xMqttSendingTask != NULL) {
-        	vTaskDelete(client->settings->xMqttSendingTask);
+        	// wake the sending task and let it exit by itself, it may hold send_mutex
+        	uint32_t wake = 0;
+        	xQueueSendToFront(client->xSendingQueue, &wake, 0);
+        	int tmo = 2000;
+        	while ((client->settings->xMqttSendingTask != NULL) && (tmo > 0)) {
+        		vTaskDelay(10 / portTICK_RATE_MS);
+        		tmo -= 10;
+        	}
+        	if (client->settings->xMqttSendingTask != NULL) {
+        		vTaskDelete(client->settings->xMqttSendingTask);
+        		client->settings->xMqttSendingTask = NULL;
+        	}
         }
         if (!client->settings->auto_reconnect) {
     	    client->status = MQTT_STATUS_STOPPING;
@@ -628,6 +1060,7 @@ int mqtt_start(mqtt_client *client)
     if (client->settings->xMqttTask != NULL) return -1;
 
     client->status = MQTT_STATUS_DISCONNECTED;
+    client->online = false;
     client->settings->xMqttSendingTask = NULL;
     client->settings->xMqttSendingTask_stacksize = 2048;
     client->settings->xMqttTask_stacksize = 2048;
@@ -671,6 +1104,15 @@ int mqtt_start(mqtt_client *client)
     client->xSendingQueue = xQueueCreate(64, sizeof( uint32_t ));
     if (client->xSendingQueue == 0) return -3;
 
+    client->send_mutex = xSemaphoreCreateMutex();
+    if (client->send_mutex == NULL) {
+    	vQueueDelete(client->xSendingQueue);
+    	return -3;
+    }
+    memset(client->inflight, 0, sizeof(client->inflight));
+    client->inflight_count = 0;
+    client->inflight_seq = 0;
+
     rb_buf = (uint8_t*) malloc(CONFIG_MQTT_BUFFER_SIZE_BYTE * 4);
 
     if (rb_buf == NULL) {
@@ -693,41 +1135,156 @@ int mqtt_start(mqtt_client *client)
 //----------------------------------------------------------------------
 void mqtt_subscribe(mqtt_client *client, const char *topic, uint8_t qos)
 {
-	client->mqtt_state.sending_msg_type = MQTT_SENDING_TYPE_SUBSCRIBE;
-    client->mqtt_state.outbound_message = mqtt_msg_subscribe(&client->mqtt_state.mqtt_connection,
-                                          topic, qos,
-                                          &client->mqtt_state.pending_msg_id);
-    ESP_LOGI(MQTT_TAG, "Queue subscribe, topic\"%s\", id: %d", topic, client->mqtt_state.pending_msg_id);
-    mqtt_queue(client);
+	mqtt_send_lock(client);
+	if (mqtt_send_reserve(client, strlen(topic) + 8, false, MQTT_SEND_TIMEOUT_MS)) {
+		client->mqtt_state.outbound_message = mqtt_msg_subscribe(&client->mqtt_state.mqtt_connection,
+											  topic, qos,
+											  &client->mqtt_state.pending_msg_id);
+		if (client->mqtt_state.outbound_message->length > 0) {
+			client->mqtt_state.pending_msg_type = MQTT_MSG_TYPE_SUBSCRIBE;
+			rb_write(&client->send_rb, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+			mqtt_send_commit(client, client->mqtt_state.outbound_message->length);
+			ESP_LOGI(MQTT_TAG, "Queue subscribe, topic\"%s\", id: %d", topic, client->mqtt_state.pending_msg_id);
+		}
+	}
+	mqtt_send_unlock(client);
 }
 
 //-----------------------------------------------------------
 void mqtt_unsubscribe(mqtt_client *client, const char *topic)
 {
-	client->mqtt_state.sending_msg_type = MQTT_SENDING_TYPE_UNSUBSCRIBE;
-	client->mqtt_state.outbound_message = mqtt_msg_unsubscribe(&client->mqtt_state.mqtt_connection,
-	                                          topic,
-	                                          &client->mqtt_state.pending_msg_id);
-	ESP_LOGI(MQTT_TAG, "Queue unsubscribe, topic\"%s\", id: %d", topic, client->mqtt_state.pending_msg_id);
-	mqtt_queue(client);
+	mqtt_send_lock(client);
+	if (mqtt_send_reserve(client, strlen(topic) + 8, false, MQTT_SEND_TIMEOUT_MS)) {
+		client->mqtt_state.outbound_message = mqtt_msg_unsubscribe(&client->mqtt_state.mqtt_connection,
+												  topic,
+												  &client->mqtt_state.pending_msg_id);
+		if (client->mqtt_state.outbound_message->length > 0) {
+			client->mqtt_state.pending_msg_type = MQTT_MSG_TYPE_UNSUBSCRIBE;
+			rb_write(&client->send_rb, client->mqtt_state.outbound_message->data, client->mqtt_state.outbound_message->length);
+			mqtt_send_commit(client, client->mqtt_state.outbound_message->length);
+			ESP_LOGI(MQTT_TAG, "Queue unsubscribe, topic\"%s\", id: %d", topic, client->mqtt_state.pending_msg_id);
+		}
+	}
+	mqtt_send_unlock(client);
 }
 
+// The payload is copied only once, directly from the caller's buffer.
+// QoS0 messages are written into the send queue piece by piece.
+// QoS1/2 messages take an inflight slot, up to CONFIG_MQTT_INFLIGHT_MAX
+// messages can wait for the acknowledge; if none is free, wait for one.
+// The message is built in a copy kept in the slot, the sending task writes it from
+// there and it is sent again after reconnect until acknowledged. Messages replayed
+// from the store ('store_pos' > 0) have no copy, they go through the send queue.
+// Returns the message id (0 for QoS0), -1 if the message could not be queued
+// in 'timeout_ms' or -2 if it is too long for the send queue
+//-------------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+static int mqtt_publish_msg(mqtt_client* client, const char *topic, int topic_len, const uint8_t *data, int len, int qos, int retain, int dup, uint32_t store_pos, uint32_t timeout_ms)
+{
+	uint8_t header[8];
+	uint8_t *copy = NULL;
+	uint16_t msg_id = 0;
+	int hdr_len, msg_len;
+
+	hdr_len = mqtt_msg_publish_header(header, topic_len, len, (qos > 0) ? dup : 0, qos, retain);
+	msg_len = hdr_len + topic_len + ((qos > 0) ? 2 : 0) + len;
+	if (msg_len > client->send_rb.size) {
+		ESP_LOGE(MQTT_TAG, "Message too long for the send queue (%d > %d)", msg_len, client->send_rb.size);
+		return -2;
+	}
+	if ((qos > 0) && (store_pos == 0)) {
+		// the copy is what is queued, the message id is set when it is known
+		copy = malloc(msg_len);
+		if (copy == NULL) {
+			ESP_LOGE(MQTT_TAG, "No memory for the message copy");
+			return -1;
+		}
+		memcpy(copy, header, hdr_len);
+		memcpy(copy + hdr_len, topic, topic_len);
+		if (len > 0) memcpy(copy + hdr_len + topic_len + 2, data, len);
+	}
+
+	uint32_t queued = msg_len | MQTT_QUEUE_FLAG_PUBLISH;
+	mqtt_send_lock(client);
+	if (!mqtt_send_reserve(client, (copy) ? 0 : msg_len, (qos > 0), timeout_ms)) {
+		mqtt_send_unlock(client);
+		free(copy);
+		return -1;
+	}
+	if (qos > 0) {
+		// skip the ids still in flight after the id counter wrapped around
+		do {
+			msg_id = mqtt_msg_next_id(&client->mqtt_state.mqtt_connection);
+		} while ((mqtt_inflight_find(client, msg_id, MQTT_MSG_TYPE_PUBACK)) || (mqtt_inflight_find(client, msg_id, MQTT_MSG_TYPE_PUBREC)) ||
+				(mqtt_inflight_find(client, msg_id, MQTT_MSG_TYPE_PUBCOMP)));
+		// take a free inflight slot, mqtt_send_reserve ensured there is one
+		for (int i=0; i<CONFIG_MQTT_INFLIGHT_MAX; i++) {
+			mqtt_inflight_t *slot = &client->inflight[i];
+			if (slot->wait_type == 0) {
+				slot->msg_id = msg_id;
+				slot->wait_type = (qos == 1) ? MQTT_MSG_TYPE_PUBACK : MQTT_MSG_TYPE_PUBREC;
+				slot->store_pos = store_pos;
+				slot->seq = client->inflight_seq++;
+				slot->msg = copy;
+				slot->msg_len = (copy) ? msg_len : 0;
+				client->inflight_count++;
+				if (copy) queued = MQTT_QUEUE_FLAG_PUBLISH | MQTT_QUEUE_FLAG_INFLIGHT | i;
+				break;
+			}
+		}
+	}
+	if (copy) {
+		copy[hdr_len + topic_len] = msg_id >> 8;
+		copy[hdr_len + topic_len + 1] = msg_id & 0xff;
+	}
+	else {
+		rb_write(&client->send_rb, header, hdr_len);
+		rb_write(&client->send_rb, (uint8_t *)topic, topic_len);
+		if (qos > 0) {
+			header[0] = msg_id >> 8;
+			header[1] = msg_id & 0xff;
+			rb_write(&client->send_rb, header, 2);
+		}
+		if (len > 0) rb_write(&client->send_rb, (uint8_t *)data, len);
+	}
+	mqtt_send_commit(client, queued);
+	mqtt_send_unlock(client);
+
+    ESP_LOGD(MQTT_TAG, "Queuing publish, length: %d, queue size(%d/%d), in flight: %d",
+              msg_len, client->send_rb.fill_cnt, client->send_rb.size, client->inflight_count);
+    return msg_id;
+}
+
+// If the persistent queue is used, the message is stored while the client is offline,
+// when the send queue is full, or if older stored messages still wait for replay (to keep the order).
+// Returns the message id (0 for QoS0 or stored message) or -1 on error
 //------------------------------------------------------------------------------------------------------
 int mqtt_publish(mqtt_client* client, const char *topic, const char *data, int len, int qos, int retain)
 {
-    client->mqtt_state.outbound_message = mqtt_msg_publish(&client->mqtt_state.mqtt_connection,
-                                          topic, data, len,
-                                          qos, retain,
-                                          &client->mqtt_state.pending_msg_id);
-    if (client->mqtt_state.outbound_message->length == 0) return -1;
-
-	client->mqtt_state.sending_msg_type = MQTT_SENDING_TYPE_PUBLISH;
-    mqtt_queue(client);
-    ESP_LOGI(MQTT_TAG, "Queuing publish, length: %d, queue size(%d/%d)",
-              client->mqtt_state.outbound_message->length,
-              client->send_rb.fill_cnt,
-              client->send_rb.size);
-    return 0;
+	int res;
+
+	if ((topic == NULL) || (topic[0] == '\0') || (len < 0)) return -1;
+	if (qos > 2) qos = 2;
+	int topic_len = strlen(topic);
+
+	if (client->store == NULL) {
+		if (!client->online) return -1;
+		return mqtt_publish_msg(client, topic, topic_len, (const uint8_t *)data, len, qos, retain, 0, 0, MQTT_SEND_TIMEOUT_MS);
+	}
+
+	mqtt_store_lock(client->store, portMAX_DELAY);
+	res = -1;
+	if ((client->online) && (!mqtt_store_pending(client->store))) {
+		res = mqtt_publish_msg(client, topic, topic_len, (const uint8_t *)data, len, qos, retain, 0, 0, MQTT_SEND_TIMEOUT_MS);
+	}
+	if (res == -1) {
+		res = mqtt_store_append(client->store, topic, topic_len, (const uint8_t *)data, len, qos, retain);
+		if (res < 0) {
+			ESP_LOGW(MQTT_TAG, "Persistent queue full, message dropped");
+			res = -1;
+		}
+	}
+	mqtt_store_unlock(client->store);
+	return res;
 }
 
 //---------------------------------
@@ -382,6 +382,38 @@ mqtt_message_t* mqtt_msg_publish(mqtt_connection_t* connection, const char* topi
     return fini_message(connection, MQTT_MSG_TYPE_PUBLISH, 0, qos, retain);
 }
 
+uint16_t mqtt_msg_next_id(mqtt_connection_t* connection)
+{
+    uint16_t message_id = 0;
+
+    while (message_id == 0)
+        message_id = ++connection->message_id;
+    return message_id;
+}
+
+int mqtt_msg_publish_header(uint8_t* buffer, int topic_length, int data_length, int dup, int qos, int retain)
+{
+    // Builds everything preceding the topic and the payload of a PUBLISH message:
+    // fixed header, remaining length (up to 4 bytes) and the topic length.
+    // The caller sends the topic, message id (if qos > 0) and payload itself.
+    int remaining_length = 2 + topic_length + data_length + ((qos > 0) ? 2 : 0);
+    int i = 0;
+
+    buffer[i++] = (MQTT_MSG_TYPE_PUBLISH << 4) | ((dup & 1) << 3) | ((qos & 3) << 1) | (retain & 1);
+    do
+    {
+        buffer[i] = remaining_length % 128;
+        remaining_length /= 128;
+        if (remaining_length > 0)
+            buffer[i] |= 0x80;
+        i++;
+    } while (remaining_length > 0 && i < 5);
+
+    buffer[i++] = topic_length >> 8;
+    buffer[i++] = topic_length & 0xff;
+    return i;
+}
+
 mqtt_message_t* mqtt_msg_puback(mqtt_connection_t* connection, uint16_t message_id)
 {
     init_message(connection);
@@ -0,0 +1,186 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Boris Lovosevic (https://github.com/loboris)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Queue of received Mqtt messages
+ * The Mqtt task copies each message into one contiguous entry, the MicroPython task
+ * dispatches the entries in place. 'head' and 'tail' are each written by one side only.
+ *
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MICROPY_USE_MQTT
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt_rx.h"
+
+// Max time to wait for space in the receive queue before the message is dropped
+#define MQTT_RX_WAIT_MS		1000
+
+//------------------------------------------------------------------------
+mqtt_rx_t *mqtt_rx_new(uint32_t size, mqtt_rx_notify_cb notify, void *obj)
+{
+	mqtt_rx_t *rx = malloc(sizeof(mqtt_rx_t));
+	if (rx == NULL) return NULL;
+	memset(rx, 0, sizeof(mqtt_rx_t));
+	rx->buf = malloc(size);
+	if (rx->buf == NULL) {
+		free(rx);
+		return NULL;
+	}
+	rx->size = size;
+	rx->notify = notify;
+	rx->obj = obj;
+	return rx;
+}
+
+//------------------------------
+void mqtt_rx_free(mqtt_rx_t *rx)
+{
+	if (rx == NULL) return;
+	free(rx->buf);
+	free(rx);
+}
+
+// Reserve a contiguous queue entry for the message
+// Runs in Mqtt task
+//-----------------------------------------------------------------------------------------
+static mqtt_rx_msg_t *mqtt_rx_reserve(mqtt_rx_t *rx, uint32_t topic_len, uint32_t data_len)
+{
+	uint32_t n = (sizeof(mqtt_rx_msg_t) + topic_len + data_len + 3) & ~3;
+	uint32_t head = rx->head;
+	uint32_t tail = rx->tail;
+	uint32_t pos;
+
+	if (head >= tail) {
+		if (((head + n) < rx->size) || (((head + n) == rx->size) && (tail > 0))) pos = head;
+		else if (n < tail) {
+			// no space at the end, mark the wrap and continue from the start
+			((mqtt_rx_msg_t *)(rx->buf + head))->size = 0;
+			pos = 0;
+		}
+		else {
+			if ((head == tail) && (head > 0) && (n < rx->size)) {
+				// the queue is empty, restart at offset 0: the consumer moves 'tail'
+				// to the start when it reaches the wrap mark, then the whole buffer is free
+				((mqtt_rx_msg_t *)(rx->buf + head))->size = 0;
+				__sync_synchronize();
+				rx->head = 0;
+				if ((!rx->pending) && (rx->notify)) rx->notify(rx);
+			}
+			return NULL;
+		}
+	}
+	else if ((head + n) < tail) pos = head;
+	else return NULL;
+
+	mqtt_rx_msg_t *msg = (mqtt_rx_msg_t *)(rx->buf + pos);
+	msg->size = n;
+	msg->topic_len = topic_len;
+	msg->data_len = data_len;
+	return msg;
+}
+
+// Make the reserved message visible to the MicroPython task
+//-----------------------------------------------------------
+static void mqtt_rx_commit(mqtt_rx_t *rx, mqtt_rx_msg_t *msg)
+{
+	uint32_t head = ((uint8_t *)msg - rx->buf) + msg->size;
+	__sync_synchronize();
+	rx->head = (head >= rx->size) ? 0 : head;
+}
+
+// Runs in Mqtt task, no MicroPython objects are created here
+//------------------------------------------------------------
+void mqtt_rx_put(mqtt_rx_t *rx, mqtt_event_data_t *event_data)
+{
+	if (event_data->data_offset == 0) {
+		// First block of data, reserve the space for the whole message
+		rx->msg = NULL;
+		if (event_data->topic == NULL) return;
+		rx->msg = mqtt_rx_reserve(rx, event_data->topic_length, event_data->data_total_length);
+		if ((rx->msg == NULL) && (!rx->stalled)) {
+			// wait for the MicroPython task to dispatch queued messages,
+			// the broker is throttled by TCP flow control meanwhile
+			int tmo = MQTT_RX_WAIT_MS / portTICK_RATE_MS;
+			while ((rx->msg == NULL) && (tmo > 0)) {
+				vTaskDelay(1);
+				tmo--;
+				rx->msg = mqtt_rx_reserve(rx, event_data->topic_length, event_data->data_total_length);
+			}
+		}
+		if (rx->msg == NULL) {
+			rx->stalled = true;
+			rx->dropped++;
+			return;
+		}
+		rx->stalled = false;
+		memcpy(rx->msg->data, event_data->topic, event_data->topic_length);
+	}
+	if (rx->msg == NULL) return;
+
+	uint32_t len = event_data->data_length;
+	if ((event_data->data_offset + len) > rx->msg->data_len) len = rx->msg->data_len - event_data->data_offset;
+	memcpy(rx->msg->data + rx->msg->topic_len + event_data->data_offset, event_data->data, len);
+
+	if ((event_data->data_offset + len) >= rx->msg->data_len) {
+		// all data received
+		mqtt_rx_commit(rx, rx->msg);
+		rx->msg = NULL;
+		if ((!rx->pending) && (rx->notify)) rx->notify(rx);
+	}
+}
+
+// Runs in MicroPython task
+//----------------------------------------
+mqtt_rx_msg_t *mqtt_rx_peek(mqtt_rx_t *rx)
+{
+	uint32_t tail = rx->tail;
+
+	if (tail == rx->head) return NULL;
+	__sync_synchronize();
+	if (((mqtt_rx_msg_t *)(rx->buf + tail))->size == 0) {
+		tail = 0;
+		rx->tail = 0;
+		if (tail == rx->head) return NULL;
+		__sync_synchronize();
+	}
+	return (mqtt_rx_msg_t *)(rx->buf + tail);
+}
+
+//-----------------------------------------------------
+void mqtt_rx_release(mqtt_rx_t *rx, mqtt_rx_msg_t *msg)
+{
+	uint32_t tail = ((uint8_t *)msg - rx->buf) + msg->size;
+	__sync_synchronize();
+	rx->tail = (tail >= rx->size) ? 0 : tail;
+}
+
+#endif
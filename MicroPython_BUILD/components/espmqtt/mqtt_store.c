@@ -0,0 +1,498 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Boris Lovosevic (https://github.com/loboris)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Mqtt persistent outbound queue
+ * Append-only segment files with CRC protected records, see mqtt_store.h
+ * Writes and reads are done in blocks of up to MQTT_STORE_BUF_SIZE bytes
+ * to keep the number of flash operations low.
+ *
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MICROPY_USE_MQTT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "rom/crc.h"
+
+#include "mqtt_store.h"
+
+#define STORE_REC_MARK		0xA5
+#define STORE_POS_MAGIC		0x3253514D	// "MQS2"
+#define MQTT_STORE_SEG_MIN_SIZE	1024
+#define MQTT_STORE_REBASE_POS	0x40000000	// offsets are made relative to the first segment again above this
+
+static const char *TAG = "[Mqtt store]";
+
+//---------------------------------------------
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = (val >> 8) & 0xff;
+	buf[2] = (val >> 16) & 0xff;
+	buf[3] = val >> 24;
+}
+
+//-----------------------------------------
+static uint32_t get_u32(const uint8_t *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+// Segment file 'seq' is '<path>.<seq>'
+//--------------------------------------------------------------------
+static void store_seg_path(mqtt_store_t *store, uint32_t seq, char *buf)
+{
+	sprintf(buf, "%s.%u", store->path, seq);
+}
+
+// Segment file holding the logical offset 'pos'
+//-----------------------------------------------------------
+static uint32_t store_seg_seq(mqtt_store_t *store, uint32_t pos)
+{
+	return store->seg_first + ((pos - store->seg_base) / store->seg_size);
+}
+
+//---------------------------------------------
+static void store_save_pos(mqtt_store_t *store)
+{
+	uint8_t buf[24];
+
+	put_u32(buf, STORE_POS_MAGIC);
+	put_u32(buf+4, store->ack_pos);
+	put_u32(buf+8, store->seg_first);
+	put_u32(buf+12, store->seg_base);
+	put_u32(buf+16, store->seg_size);
+	put_u32(buf+20, crc32_le(0, buf, 20));
+	int fd = open(store->pos_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) return;
+	if (write(fd, buf, sizeof(buf)) == sizeof(buf)) store->saved_pos = store->ack_pos;
+	close(fd);
+}
+
+// Returns true if the position file is valid, the positions are set from it
+//---------------------------------------------
+static bool store_load_pos(mqtt_store_t *store)
+{
+	uint8_t buf[24];
+	bool res = false;
+
+	int fd = open(store->pos_path, O_RDONLY);
+	if (fd < 0) return false;
+	if ((read(fd, buf, sizeof(buf)) == sizeof(buf)) && (get_u32(buf) == STORE_POS_MAGIC) && (get_u32(buf+20) == crc32_le(0, buf, 20)) &&
+			(get_u32(buf+16) > 0) && (get_u32(buf+12) <= get_u32(buf+4))) {
+		store->saved_pos = get_u32(buf+4);
+		store->seg_first = get_u32(buf+8);
+		store->seg_base = get_u32(buf+12);
+		store->seg_size = get_u32(buf+16);
+		res = true;
+	}
+	close(fd);
+	return res;
+}
+
+// All records are acknowledged, remove the files and start from the beginning
+//------------------------------------------
+static void store_reset(mqtt_store_t *store)
+{
+	char name[MQTT_STORE_MAX_PATH+12];
+
+	if (store->file_size > store->seg_base) {
+		uint32_t last = store_seg_seq(store, store->file_size - 1);
+		for (uint32_t seq = store->seg_first; seq <= last; seq++) {
+			store_seg_path(store, seq, name);
+			unlink(name);
+		}
+	}
+	if ((store->file_size > 0) || (store->saved_pos > 0) || (store->seg_first > 0)) unlink(store->pos_path);
+	store->file_size = 0;
+	store->read_pos = 0;
+	store->ack_pos = 0;
+	store->saved_pos = 0;
+	store->sent_pos = 0;
+	store->seg_first = 0;
+	store->seg_base = 0;
+	store->seg_size = store->max_size / MQTT_STORE_SEGMENTS;
+	if (store->seg_size < MQTT_STORE_SEG_MIN_SIZE) store->seg_size = MQTT_STORE_SEG_MIN_SIZE;
+	store->rec_len = 0;
+	store->wbuf_len = 0;
+	store->rbuf_pos = 0;
+	store->rbuf_len = 0;
+}
+
+// No replayed record waits for the acknowledge, so no record offset is held outside
+// the store: make the offsets relative to the first segment again
+//-------------------------------------------
+static void store_rebase(mqtt_store_t *store)
+{
+	uint32_t base = store->seg_base;
+
+	store->file_size -= base;
+	store->read_pos -= base;
+	store->ack_pos -= base;
+	store->saved_pos = (store->saved_pos > base) ? (store->saved_pos - base) : 0;
+	store->sent_pos = (store->sent_pos > base) ? (store->sent_pos - base) : 0;
+	store->seg_base = 0;
+	store->rbuf_len = 0;
+	store_save_pos(store);
+}
+
+// Remove the segments with all records acknowledged and written to the file
+// Returns true if any was removed
+//---------------------------------------------------
+static bool store_remove_acked(mqtt_store_t *store)
+{
+	char name[MQTT_STORE_MAX_PATH+12];
+	uint32_t first = store->seg_first;
+
+	while (((store->seg_base + store->seg_size) <= store->ack_pos) && ((store->seg_base + store->seg_size) <= store->file_size)) {
+		store->seg_first++;
+		store->seg_base += store->seg_size;
+	}
+	if (store->seg_first == first) return false;
+
+	// the position file must not point to a removed segment
+	if ((store->seg_base >= MQTT_STORE_REBASE_POS) && (store->ack_pos == store->read_pos)) store_rebase(store);
+	else store_save_pos(store);
+	for (uint32_t seq = first; seq != store->seg_first; seq++) {
+		store_seg_path(store, seq, name);
+		unlink(name);
+	}
+	return true;
+}
+
+// Make at least 'need' bytes from 'read_pos' available in the read cache, if the file has them
+// The cache is filled across the segment files
+// Returns the number of bytes available, -1 on read error
+//-------------------------------------------------------
+static int store_read(mqtt_store_t *store, uint32_t need)
+{
+	char name[MQTT_STORE_MAX_PATH+12];
+
+	if ((store->read_pos < store->rbuf_pos) || ((store->read_pos + need) > (store->rbuf_pos + store->rbuf_len))) {
+		uint32_t len = store->file_size - store->read_pos;
+		if (len > MQTT_STORE_BUF_SIZE) len = MQTT_STORE_BUF_SIZE;
+		store->rbuf_pos = store->read_pos;
+		store->rbuf_len = 0;
+
+		while (store->rbuf_len < len) {
+			uint32_t pos = store->read_pos + store->rbuf_len;
+			uint32_t seg_off = (pos - store->seg_base) % store->seg_size;
+			uint32_t n = len - store->rbuf_len;
+			if (n > (store->seg_size - seg_off)) n = store->seg_size - seg_off;
+
+			store_seg_path(store, store_seg_seq(store, pos), name);
+			int fd = open(name, O_RDONLY);
+			int res = -1;
+			if (fd >= 0) {
+				if (lseek(fd, seg_off, SEEK_SET) == seg_off) res = read(fd, store->rbuf + store->rbuf_len, n);
+				close(fd);
+			}
+			if (res <= 0) break;
+			store->rbuf_len += res;
+			if (res < n) break;
+		}
+		if (store->rbuf_len == 0) {
+			ESP_LOGE(TAG, "Read error at %u", store->read_pos);
+			return -1;
+		}
+	}
+	return store->rbuf_pos + store->rbuf_len - store->read_pos;
+}
+
+//================================================================
+mqtt_store_t *mqtt_store_open(const char *path, uint32_t max_size)
+{
+	struct stat st;
+
+	if (strlen(path) >= MQTT_STORE_MAX_PATH) return NULL;
+	mqtt_store_t *store = calloc(1, sizeof(mqtt_store_t));
+	if (store == NULL) return NULL;
+
+	strcpy(store->path, path);
+	sprintf(store->pos_path, "%s.pos", path);
+	store->max_size = max_size;
+	store->mutex = xSemaphoreCreateMutex();
+	store->wbuf = malloc(MQTT_STORE_BUF_SIZE);
+	store->rbuf = malloc(MQTT_STORE_BUF_SIZE);
+	if ((store->mutex == NULL) || (store->wbuf == NULL) || (store->rbuf == NULL)) {
+		mqtt_store_close(store);
+		return NULL;
+	}
+
+	// continue with the records left from the previous run,
+	// in the segment files following the first one in use
+	store_reset(store);
+	bool loaded = store_load_pos(store);
+	store->file_size = store->seg_base;
+	for (uint32_t seq = store->seg_first; ; seq++) {
+		char name[MQTT_STORE_MAX_PATH+12];
+		store_seg_path(store, seq, name);
+		if (stat(name, &st) != 0) break;
+		// without the position file all records are in the first segment, maybe written with another max size
+		if ((!loaded) && (st.st_size > store->seg_size)) store->seg_size = st.st_size;
+		store->file_size += (st.st_size < store->seg_size) ? st.st_size : store->seg_size;
+		if ((!loaded) || (st.st_size < store->seg_size)) break;
+	}
+	store->ack_pos = ((store->saved_pos >= store->seg_base) && (store->saved_pos <= store->file_size)) ? store->saved_pos : store->seg_base;
+	store->read_pos = store->ack_pos;
+	if (store->ack_pos >= store->file_size) store_reset(store);
+	else ESP_LOGI(TAG, "%u bytes queued in '%s.*'", store->file_size - store->ack_pos, path);
+
+	return store;
+}
+
+//========================================
+void mqtt_store_close(mqtt_store_t *store)
+{
+	if (store == NULL) return;
+	if (store->wbuf) mqtt_store_flush(store, true);
+	if (store->mutex) vSemaphoreDelete(store->mutex);
+	free(store->wbuf);
+	free(store->rbuf);
+	free(store);
+}
+
+//============================================================
+bool mqtt_store_lock(mqtt_store_t *store, uint32_t timeout_ms)
+{
+	return (xSemaphoreTake(store->mutex, (timeout_ms == portMAX_DELAY) ? portMAX_DELAY : (timeout_ms / portTICK_RATE_MS)) == pdTRUE);
+}
+
+//=========================================
+void mqtt_store_unlock(mqtt_store_t *store)
+{
+	xSemaphoreGive(store->mutex);
+}
+
+//==========================================
+bool mqtt_store_pending(mqtt_store_t *store)
+{
+	return (store->read_pos < (store->file_size + store->wbuf_len));
+}
+
+//==========================================
+bool mqtt_store_unacked(mqtt_store_t *store)
+{
+	return (store->ack_pos < (store->file_size + store->wbuf_len));
+}
+
+// Length of the record starting at 'rec' in the write buffer
+//------------------------------------------------
+static uint32_t store_rec_len(const uint8_t *rec)
+{
+	return MQTT_STORE_REC_HDR_SIZE + (rec[2] | (rec[3] << 8)) + get_u32(rec+4);
+}
+
+// The write buffer is appended to the last segment file and continues in new ones,
+// a new segment file replaces any file left with its name
+//===================================================
+int mqtt_store_flush(mqtt_store_t *store, bool force)
+{
+	char name[MQTT_STORE_MAX_PATH+12];
+	uint32_t start = store->file_size;
+	uint32_t done = 0;
+	int res = 0;
+
+	if (store->wbuf_len == 0) return 0;
+	if ((!force) && ((xTaskGetTickCount() - store->wbuf_tick) < (MQTT_STORE_FLUSH_MS / portTICK_RATE_MS))) return 0;
+
+	while ((res == 0) && (done < store->wbuf_len)) {
+		uint32_t seg_off = (store->file_size - store->seg_base) % store->seg_size;
+		uint32_t n = store->wbuf_len - done;
+		if (n > (store->seg_size - seg_off)) n = store->seg_size - seg_off;
+
+		res = -1;
+		uint32_t seq = store_seg_seq(store, store->file_size);
+		// the segment size must be known to find the records after a restart,
+		// the position file is written when the second segment is started
+		if ((seg_off == 0) && (seq == 1)) store_save_pos(store);
+		store_seg_path(store, seq, name);
+		int fd = open(name, O_WRONLY | O_CREAT | ((seg_off == 0) ? O_TRUNC : O_APPEND), 0666);
+		if (fd >= 0) {
+			if (write(fd, store->wbuf + done, n) == n) {
+				store->file_size += n;
+				done += n;
+				res = 0;
+			}
+			else {
+				off_t size = lseek(fd, 0, SEEK_END);
+				if (size > seg_off) store->file_size += size - seg_off;
+			}
+			close(fd);
+		}
+	}
+	if (res == 0) {
+		store->wbuf_len = 0;
+		return 0;
+	}
+
+	// Keep the records not completely written in RAM, they now logically follow the partially written data,
+	// which will be skipped on replay
+	uint32_t keep = 0;
+	while ((keep + store_rec_len(store->wbuf + keep)) <= done) keep += store_rec_len(store->wbuf + keep);
+	uint32_t from = start + keep;
+	uint32_t shift = store->file_size - from;
+	if (shift > 0) {
+		if (store->read_pos >= from) store->read_pos += shift;
+		if (store->ack_pos >= from) store->ack_pos += shift;
+		if (store->sent_pos >= from) store->sent_pos += shift;
+	}
+	if (keep > 0) {
+		memmove(store->wbuf, store->wbuf + keep, store->wbuf_len - keep);
+		store->wbuf_len -= keep;
+	}
+	ESP_LOGE(TAG, "Write error");
+	return -1;
+}
+
+//=============================================================================================================================
+int mqtt_store_append(mqtt_store_t *store, const char *topic, int topic_len, const uint8_t *data, int len, int qos, int retain)
+{
+	uint32_t rec_len = MQTT_STORE_REC_HDR_SIZE + topic_len + len;
+
+	// the segments before 'seg_base' are acknowledged and removed
+	if (((store->file_size + store->wbuf_len + rec_len - store->seg_base) > store->max_size) && (store->ack_pos >= (store->seg_base + store->seg_size))) {
+		// acknowledged records still in RAM, write them so that their segments can be removed
+		if (mqtt_store_flush(store, true) == 0) store_remove_acked(store);
+	}
+	if ((rec_len > MQTT_STORE_BUF_SIZE) || ((store->file_size + store->wbuf_len + rec_len - store->seg_base) > store->max_size)) {
+		store->dropped++;
+		return -1;
+	}
+	if ((store->wbuf_len + rec_len) > MQTT_STORE_BUF_SIZE) {
+		if (mqtt_store_flush(store, true) < 0) return -2;
+	}
+	if (store->wbuf_len == 0) store->wbuf_tick = xTaskGetTickCount();
+
+	uint8_t *rec = store->wbuf + store->wbuf_len;
+	rec[0] = STORE_REC_MARK;
+	rec[1] = (qos & 3) | ((retain) ? 4 : 0);
+	rec[2] = topic_len & 0xff;
+	rec[3] = topic_len >> 8;
+	put_u32(rec+4, len);
+	memcpy(rec + MQTT_STORE_REC_HDR_SIZE, topic, topic_len);
+	if (len > 0) memcpy(rec + MQTT_STORE_REC_HDR_SIZE + topic_len, data, len);
+	put_u32(rec+8, crc32_le(crc32_le(0, rec+1, 7), rec + MQTT_STORE_REC_HDR_SIZE, topic_len + len));
+	store->wbuf_len += rec_len;
+
+	return mqtt_store_flush(store, false);
+}
+
+// Bad records (torn write on power loss, flash errors) are skipped
+// up to the next record mark with a valid CRC
+//=============================================================
+int mqtt_store_peek(mqtt_store_t *store, mqtt_store_rec_t *rec)
+{
+	uint8_t *p;
+	int avail;
+
+	while (mqtt_store_pending(store)) {
+		bool in_file = (store->read_pos < store->file_size);
+		if (in_file) {
+			avail = store_read(store, MQTT_STORE_REC_HDR_SIZE);
+			if (avail < 0) return -1;
+			p = store->rbuf + (store->read_pos - store->rbuf_pos);
+		}
+		else {
+			p = store->wbuf + (store->read_pos - store->file_size);
+			avail = store->file_size + store->wbuf_len - store->read_pos;
+		}
+
+		if ((avail >= MQTT_STORE_REC_HDR_SIZE) && (p[0] == STORE_REC_MARK)) {
+			uint16_t topic_len = p[2] | (p[3] << 8);
+			uint32_t data_len = get_u32(p+4);
+			uint32_t rec_len = MQTT_STORE_REC_HDR_SIZE + topic_len + data_len;
+			if ((rec_len <= MQTT_STORE_BUF_SIZE) && (topic_len > 0)) {
+				if ((in_file) && (avail < rec_len) && ((store->read_pos + rec_len) <= store->file_size)) {
+					avail = store_read(store, rec_len);
+					if (avail < 0) return -1;
+					p = store->rbuf;
+				}
+				if ((avail >= rec_len) &&
+						(get_u32(p+8) == crc32_le(crc32_le(0, p+1, 7), p + MQTT_STORE_REC_HDR_SIZE, topic_len + data_len))) {
+					rec->pos = store->read_pos;
+					rec->qos = p[1] & 3;
+					rec->retain = (p[1] & 4) ? 1 : 0;
+					rec->topic = (const char *)(p + MQTT_STORE_REC_HDR_SIZE);
+					rec->topic_len = topic_len;
+					rec->data = p + MQTT_STORE_REC_HDR_SIZE + topic_len;
+					rec->data_len = data_len;
+					rec->dup = (store->read_pos < store->sent_pos);
+					store->rec_len = rec_len;
+					return 1;
+				}
+			}
+		}
+		// bad record, skip to the next record mark
+		uint8_t *mark = (avail > 1) ? memchr(p+1, STORE_REC_MARK, avail-1) : NULL;
+		uint32_t skip = (mark) ? (mark - p) : avail;
+		store->read_pos += skip;
+		store->corrupted += skip;
+		ESP_LOGW(TAG, "Bad record, %u bytes skipped", skip);
+	}
+	return 0;
+}
+
+//=======================================
+void mqtt_store_next(mqtt_store_t *store)
+{
+	store->read_pos += store->rec_len;
+	store->rec_len = 0;
+}
+
+// Acknowledged segments are removed, so the records are not limited by
+// the size of the store since it was last emptied
+//====================================================
+void mqtt_store_ack(mqtt_store_t *store, uint32_t pos)
+{
+	if (pos > store->read_pos) pos = store->read_pos;
+	if (pos <= store->ack_pos) return;
+	store->ack_pos = pos;
+	if (!mqtt_store_unacked(store)) store_reset(store);
+	else if (store_remove_acked(store)) return;
+	else if ((store->seg_base >= MQTT_STORE_REBASE_POS) && (store->ack_pos == store->read_pos)) store_rebase(store);
+	else if ((store->ack_pos <= store->file_size) && ((store->ack_pos - store->saved_pos) >= MQTT_STORE_SYNC_BYTES)) {
+		store_save_pos(store);
+	}
+}
+
+//=========================================
+void mqtt_store_rewind(mqtt_store_t *store)
+{
+	if (store->read_pos > store->sent_pos) store->sent_pos = store->read_pos;
+	store->read_pos = store->ack_pos;
+	store->rec_len = 0;
+}
+
+#endif
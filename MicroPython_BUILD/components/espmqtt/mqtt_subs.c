@@ -0,0 +1,213 @@
+/*
+ * This file is part of the Micro Python project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2017 Boris Lovosevic (https://github.com/loboris)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Mqtt topic subscriptions
+ * Topic filters are stored in a tree, one node per topic level,
+ * so matching a topic visits only the levels of that topic,
+ * not every subscription.
+ *
+ */
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MICROPY_USE_MQTT
+
+#include <stdlib.h>
+#include <string.h>
+#include "mqtt_subs.h"
+
+#define SUB_IS_WILD(n, c)	(((n)->len == 1) && ((n)->level[0] == (c)))
+
+// Returns the length of the topic level starting at 'str'
+//-------------------------------------------------------
+static int level_length(const char *str, const char *end)
+{
+	const char *p = memchr(str, '/', end - str);
+	return (p) ? (p - str) : (end - str);
+}
+
+// Find the node for the level 'str' in the list of siblings
+//----------------------------------------------------------------------------------
+static mqtt_sub_node_t **find_node(mqtt_sub_node_t **list, const char *str, int len)
+{
+	while (*list) {
+		if (((*list)->len == len) && (memcmp((*list)->level, str, len) == 0)) break;
+		list = &(*list)->next;
+	}
+	return list;
+}
+
+//===========================================
+int mqtt_sub_filter_valid(const char *filter)
+{
+	const char *p = filter;
+	const char *end = filter + strlen(filter);
+	int len;
+
+	if (p == end) return 0;
+	while (1) {
+		len = level_length(p, end);
+		if ((len > 1) && ((memchr(p, '+', len)) || (memchr(p, '#', len)))) return 0;	// wildcard must be the whole level
+		if ((len == 1) && (p[0] == '#') && ((p + len) != end)) return 0;				// '#' must be the last level
+		if ((p + len) == end) break;
+		p += len + 1;
+	}
+	return 1;
+}
+
+//=======================================================================================
+int mqtt_sub_add(mqtt_sub_node_t **root, const char *filter, void *data, void **old_data)
+{
+	const char *p = filter;
+	const char *end = filter + strlen(filter);
+	mqtt_sub_node_t **list = root;
+	mqtt_sub_node_t **pnode = NULL;
+	int len;
+
+	if (old_data) *old_data = NULL;
+	if ((data == NULL) || (!mqtt_sub_filter_valid(filter))) return -1;
+
+	while (1) {
+		len = level_length(p, end);
+		pnode = find_node(list, p, len);
+		if (*pnode == NULL) {
+			// new level, wildcards are added in front of the list
+			mqtt_sub_node_t *node = malloc(sizeof(mqtt_sub_node_t) + len);
+			if (node == NULL) return -2;
+			memset(node, 0, sizeof(mqtt_sub_node_t));
+			node->len = len;
+			memcpy(node->level, p, len);
+			if ((len == 1) && ((p[0] == '+') || (p[0] == '#'))) {
+				node->next = *list;
+				*list = node;
+				pnode = list;
+			}
+			else *pnode = node;
+		}
+		if ((p + len) == end) break;
+		p += len + 1;
+		list = &(*pnode)->child;
+	}
+	if (old_data) *old_data = (*pnode)->data;
+	(*pnode)->data = data;
+	return 0;
+}
+
+//-------------------------------------------------------------------------------
+static void *sub_remove(mqtt_sub_node_t **list, const char *str, const char *end)
+{
+	int len = level_length(str, end);
+	mqtt_sub_node_t **pnode = find_node(list, str, len);
+	mqtt_sub_node_t *node = *pnode;
+	void *data;
+
+	if (node == NULL) return NULL;
+	if ((str + len) == end) {
+		data = node->data;
+		node->data = NULL;
+	}
+	else data = sub_remove(&node->child, str + len + 1, end);
+
+	// prune the levels not used any more
+	if ((node->data == NULL) && (node->child == NULL)) {
+		*pnode = node->next;
+		free(node);
+	}
+	return data;
+}
+
+//===============================================================
+void *mqtt_sub_remove(mqtt_sub_node_t **root, const char *filter)
+{
+	if ((filter == NULL) || (filter[0] == '\0')) return NULL;
+	return sub_remove(root, filter, filter + strlen(filter));
+}
+
+//------------------------------------------------------------------------------------------------------------------------
+static int sub_match(mqtt_sub_node_t *node, const char *str, const char *end, bool first, mqtt_sub_match_cb cb, void *arg)
+{
+	int len = level_length(str, end);
+	bool last = ((str + len) == end);
+	// topics starting with '$' are not matched by wildcards at the first level
+	bool wild = !(first && (len > 0) && (str[0] == '$'));
+	int count = 0;
+
+	for (; node; node = node->next) {
+		if (SUB_IS_WILD(node, '#')) {
+			if (wild && node->data) {
+				cb(node->data, arg);
+				count++;
+			}
+			continue;
+		}
+		if (SUB_IS_WILD(node, '+')) {
+			if (!wild) continue;
+		}
+		else if ((node->len != len) || (memcmp(node->level, str, len) != 0)) continue;
+
+		if (last) {
+			if (node->data) {
+				cb(node->data, arg);
+				count++;
+			}
+			// "a/#" also matches the parent level "a"
+			for (mqtt_sub_node_t *child = node->child; child; child = child->next) {
+				if (SUB_IS_WILD(child, '#') && child->data) {
+					cb(child->data, arg);
+					count++;
+				}
+			}
+		}
+		else if (node->child) count += sub_match(node->child, str + len + 1, end, false, cb, arg);
+	}
+	return count;
+}
+
+//==========================================================================================================
+int mqtt_sub_match(mqtt_sub_node_t *root, const char *topic, int topic_len, mqtt_sub_match_cb cb, void *arg)
+{
+	if ((root == NULL) || (topic_len <= 0)) return 0;
+	return sub_match(root, topic, topic + topic_len, true, cb, arg);
+}
+
+//==============================================================================
+void mqtt_sub_free(mqtt_sub_node_t **root, mqtt_sub_match_cb free_cb, void *arg)
+{
+	mqtt_sub_node_t *node = *root;
+	mqtt_sub_node_t *next;
+
+	while (node) {
+		next = node->next;
+		mqtt_sub_free(&node->child, free_cb, arg);
+		if ((free_cb) && (node->data)) free_cb(node->data, arg);
+		free(node);
+		node = next;
+	}
+	*root = NULL;
+}
+
+#endif
@@ -82,25 +82,84 @@ int32_t rb_available(RINGBUF *r)
     return (r->size - r->fill_cnt);
 }
 
+/**
+* \brief copy data out of the ring buffer, at most two memcpy's
+* \param r pointer to a ringbuf object
+* \param buf destination buffer
+* \param len number of bytes to read
+* \return number of bytes actually read
+*/
 uint32_t rb_read(RINGBUF *r, uint8_t *buf, int len)
 {
-    int n = 0;
-    uint8_t data;
-    while (len > 0) {
-        while (rb_get(r, &data) != 0);
-        *buf++ = data;
-        n ++;
-        len --;
+    int n, chunk;
+
+    if (len > r->fill_cnt) len = r->fill_cnt;
+    n = len;
+    while (n > 0) {
+        chunk = (r->p_o + r->size) - r->p_r;
+        if (chunk > n) chunk = n;
+        memcpy(buf, r->p_r, chunk);
+        buf += chunk;
+        n -= chunk;
+        r->p_r += chunk;
+        if (r->p_r >= r->p_o + r->size) r->p_r = r->p_o;
     }
-
-    return n;
+    r->fill_cnt -= len;
+    return len;
 }
 
+/**
+* \brief copy data into the ring buffer, at most two memcpy's
+* \param r pointer to a ringbuf object
+* \param buf source buffer
+* \param len number of bytes to write
+* \return number of bytes actually written
+*/
 uint32_t rb_write(RINGBUF *r, uint8_t *buf, int len)
 {
-    uint32_t wi;
-    for (wi = 0; wi < len; wi++) {
-        while (rb_put(r, &buf[wi]) != 0);
+    int n, chunk;
+
+    if (len > (r->size - r->fill_cnt)) len = r->size - r->fill_cnt;
+    n = len;
+    while (n > 0) {
+        chunk = (r->p_o + r->size) - r->p_w;
+        if (chunk > n) chunk = n;
+        memcpy(r->p_w, buf, chunk);
+        buf += chunk;
+        n -= chunk;
+        r->p_w += chunk;
+        if (r->p_w >= r->p_o + r->size) r->p_w = r->p_o;
     }
-    return 0;
+    r->fill_cnt += len;
+    return len;
+}
+
+/**
+* \brief get the contiguous block of data at the read pointer without copying it
+* \param r pointer to a ringbuf object
+* \param data set to the read pointer
+* \return number of contiguous bytes available at *data
+*/
+int32_t rb_peek(RINGBUF *r, uint8_t **data)
+{
+    int32_t chunk = (r->p_o + r->size) - r->p_r;
+
+    *data = r->p_r;
+    if (chunk > r->fill_cnt) chunk = r->fill_cnt;
+    return chunk;
+}
+
+/**
+* \brief discard data from the ring buffer, used after rb_peek
+* \param r pointer to a ringbuf object
+* \param len number of bytes to discard
+* \return number of bytes discarded
+*/
+int32_t rb_skip(RINGBUF *r, int32_t len)
+{
+    if (len > r->fill_cnt) len = r->fill_cnt;
+    r->p_r += len;
+    if (r->p_r >= r->p_o + r->size) r->p_r -= r->size;
+    r->fill_cnt -= len;
+    return len;
 }
@@ -5,7 +5,9 @@
 #if defined(CONFIG_MICROPY_USE_CURL) || defined(CONFIG_MICROPY_USE_SSH)
 
 #include <string.h>
+#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "libs/espcurl.h"
 #include "libs/libGSM.h"
 
@@ -28,13 +30,16 @@ uint8_t curl_progress = 1;       // show progress during transfers
 uint16_t curl_timeout = 60;      // curl operations timeout in seconds
 uint32_t curl_maxbytes = 300000; // limit download length
 uint8_t curl_initialized = 0;
+uint8_t curl_keepalive = 1;      // reuse connections between requests
 
 #if CONFIG_SPIRAM_SUPPORT
 int hdr_maxlen = 1024;
 int body_maxlen = 4096;
+uint32_t curl_chunksize = 8192;
 #else
 int hdr_maxlen = 512;
 int body_maxlen = 1024;
+uint32_t curl_chunksize = 2048;
 #endif
 
 //--------------------
@@ -62,16 +67,117 @@ struct curl_Transfer {
 	uint32_t len;
 	uint32_t size;
 	int status;
-	uint8_t tofile;
+	uint8_t tofile;		// 0: to buffer, 1: to file, 2: to stream callback
 	uint32_t maxlen;
 	double lastruntime;
 	FILE *file;
 	CURL *curl;
+	curl_stream_cb_t stream_cb;
+	void *stream_arg;
+	uint8_t *chunk;
+	uint32_t chunk_len;
+	uint32_t chunk_size;
 };
 
 struct curl_httppost *formpost = NULL;
 struct curl_httppost *lastptr = NULL;
 
+// Idle easy handles are kept with their open connections and reused by the next requests.
+// DNS cache and SSL sessions are shared between all handles.
+static CURL *curl_handles[CURL_HANDLE_POOL_SIZE] = { NULL };
+static CURLM *curl_multi = NULL;
+static CURLSH *curl_share = NULL;
+static SemaphoreHandle_t curl_mutex = NULL;
+static SemaphoreHandle_t curl_share_mutex = NULL;
+
+//------------------------------------------------------------------------------------------------
+static void _share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	xSemaphoreTake(curl_share_mutex, portMAX_DELAY);
+}
+
+//-------------------------------------------------------------------------
+static void _share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	xSemaphoreGive(curl_share_mutex);
+}
+
+// Initialize curl library and the shared data
+//---------------------
+static int _curl_init()
+{
+	if (!curl_initialized) {
+		if (curl_global_init(CURL_GLOBAL_DEFAULT)) return -4;
+		curl_initialized = 1;
+	}
+	if (curl_mutex == NULL) {
+		curl_mutex = xSemaphoreCreateMutex();
+		if (curl_mutex == NULL) return -4;
+	}
+	if (curl_share == NULL) {
+		if (curl_share_mutex == NULL) {
+			curl_share_mutex = xSemaphoreCreateMutex();
+			if (curl_share_mutex == NULL) return -4;
+		}
+		curl_share = curl_share_init();
+		if (curl_share) {
+			curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, _share_lock);
+			curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, _share_unlock);
+			curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+			curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		}
+	}
+	return 0;
+}
+
+// Get the idle easy handle from the pool or create the new one
+//-----------------------------
+static CURL *_curl_get_handle()
+{
+	CURL *curl = NULL;
+
+	if (curl_keepalive) {
+		xSemaphoreTake(curl_mutex, portMAX_DELAY);
+		for (int i=0; i<CURL_HANDLE_POOL_SIZE; i++) {
+			if (curl_handles[i]) {
+				curl = curl_handles[i];
+				curl_handles[i] = NULL;
+				break;
+			}
+		}
+		xSemaphoreGive(curl_mutex);
+	}
+
+	if (curl) {
+		// Options are cleared, open connections, DNS cache and the share are kept
+		curl_easy_reset(curl);
+	}
+	else {
+		curl = curl_easy_init();
+		if ((curl) && (curl_share)) curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+	}
+	return curl;
+}
+
+// Return the easy handle to the pool or close it
+//------------------------------------------
+static void _curl_release_handle(CURL *curl)
+{
+	if (curl == NULL) return;
+	if (curl_keepalive) {
+		xSemaphoreTake(curl_mutex, portMAX_DELAY);
+		for (int i=0; i<CURL_HANDLE_POOL_SIZE; i++) {
+			if (curl_handles[i] == NULL) {
+				curl_handles[i] = curl;
+				curl = NULL;
+				break;
+			}
+		}
+		xSemaphoreGive(curl_mutex);
+	}
+	if (curl) curl_easy_cleanup(curl);
+}
+
 
 // Initialize the structure used in curlWrite callback
 //-----------------------------------------------------------------------------------------------------------
@@ -85,6 +191,11 @@ static void init_curl_Transfer(CURL *curl, struct curl_Transfer *s, char *buf, u
     s->file = file;
     s->ptr = buf;
     s->curl = curl;
+    s->stream_cb = NULL;
+    s->stream_arg = NULL;
+    s->chunk = NULL;
+    s->chunk_len = 0;
+    s->chunk_size = 0;
     if (s->ptr) s->ptr[0] = '\0';
 }
 
@@ -121,6 +232,32 @@ static size_t curlWrite(void *buffer, size_t size, size_t nmemb, void *userdata)
 		}
 		return size*nmemb;
 	}
+	else if (s->tofile == 2) {
+		// === Streaming to callback through the chunk buffer ===
+		uint8_t *buf = (uint8_t *)buffer;
+		size_t nwrite = size*nmemb;
+		size_t pos = 0;
+
+		while (pos < nwrite) {
+			size_t count = s->chunk_size - s->chunk_len;
+			if (count > (nwrite - pos)) count = nwrite - pos;
+			memcpy(s->chunk + s->chunk_len, buf + pos, count);
+			s->chunk_len += count;
+			pos += count;
+			if (s->chunk_len >= s->chunk_size) {
+				if (s->stream_cb(s->stream_arg, s->chunk, s->chunk_len) != 0) return 0;
+				s->chunk_len = 0;
+			}
+		}
+
+		s->len += nwrite;
+		if ((curl_progress) && ((curtime - s->lastruntime) > curl_progress)) {
+			s->lastruntime = curtime;
+			mp_printf(&mp_plat_print, "* Download: received %d\r\n", s->len);
+		}
+
+		return nwrite;
+	}
 	else {
 		// === Downloading to file ===
 		size_t nwrite;
@@ -226,7 +363,9 @@ static void _set_default_options(CURL *handle) {
     curl_easy_setopt(handle, CURLOPT_TIMEOUT, (long)curl_timeout);
 
     curl_easy_setopt(handle, CURLOPT_MAXFILESIZE, (long)curl_maxbytes);
-    curl_easy_setopt(handle, CURLOPT_FORBID_REUSE, 1L);
+    curl_easy_setopt(handle, CURLOPT_FORBID_REUSE, (curl_keepalive) ? 0L : 1L);
+    curl_easy_setopt(handle, CURLOPT_MAXCONNECTS, 1L);
+    if (curl_keepalive) curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
     curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L);
 
     //curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, 1024L);	//bytes/sec
@@ -241,8 +380,8 @@ static void _set_default_options(CURL *handle) {
 
 }
 
-//==================================================================================
-int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int bodylen)
+//--------------------------------------------------------------------------------------------------------------------------------------------------------
+static int _curl_get(char *url, char *fname, curl_stream_cb_t cb, void *arg, uint8_t *chunk, int chunklen, char *hdr, char *body, int hdrlen, int bodylen)
 {
 	CURL *curl = NULL;
 	CURLcode res = 0;
@@ -266,17 +405,11 @@ int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int body
         goto exit;
     }
 
-	if (!curl_initialized) {
-		res = curl_global_init(CURL_GLOBAL_DEFAULT);
-		if (res) {
-            err = -4;
-            goto exit;
-        }
-		curl_initialized = 1;
-	}
+	err = _curl_init();
+	if (err) goto exit;
 
-	// Create a curl curl
-	curl = curl_easy_init();
+	// Get the curl handle
+	curl = _curl_get_handle();
 	if (curl == NULL) {
         err = -5;
         goto exit;
@@ -296,11 +429,24 @@ int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int body
 				err = -6;
 				goto exit;
 			}
+			// Write to file in chunks, using the provided buffer
+			if ((chunk) && (chunklen > 0)) setvbuf(file, (char *)chunk, _IOFBF, chunklen);
 			get_data.file = file;
 			get_data.tofile = 1;
 			curl_sim_fs = 0;
 		}
 	}
+	else if (cb) {
+		if ((chunk == NULL) || (chunklen <= 0)) {
+			err = -2;
+			goto exit;
+		}
+		get_data.tofile = 2;
+		get_data.stream_cb = cb;
+		get_data.stream_arg = arg;
+		get_data.chunk = chunk;
+		get_data.chunk_size = chunklen;
+	}
 
     curl_easy_setopt(curl, CURLOPT_URL, url);
 
@@ -317,6 +463,12 @@ int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int body
 	// Perform the request, res will get the return code
     res = curl_easy_perform(curl);
 
+    if ((res == CURLE_OK) && (get_data.tofile == 2) && (get_data.chunk_len > 0)) {
+    	// Pass the remaining data to the callback
+    	if (cb(arg, get_data.chunk, get_data.chunk_len) != 0) res = CURLE_WRITE_ERROR;
+    	get_data.chunk_len = 0;
+    }
+
     if (res != CURLE_OK) {
     	if (curl_verbose) mp_printf(&mp_plat_print, "curl_easy_perform failed: %s\r\n", curl_easy_strerror(res));
 		if (body) snprintf(body, bodylen, "%s", curl_easy_strerror(res));
@@ -331,7 +483,8 @@ int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int body
 			mp_printf(&mp_plat_print, "* Download: received %d B; time=%0.1f s; speed=%0.1f KB/sec\r\n", get_data.len, curtime, (float)(((get_data.len*10)/curtime) / 10240.0));
     	}
 		if (body) {
-			if (strcmp(fname, "simulate") == 0) snprintf(body, bodylen, "SIMULATED save to file; size=%d", get_data.len);
+			if (get_data.tofile == 2) snprintf(body, bodylen, "Streamed to callback, size=%d", get_data.len);
+			else if (strcmp(fname, "simulate") == 0) snprintf(body, bodylen, "SIMULATED save to file; size=%d", get_data.len);
 			else snprintf(body, bodylen, "Saved to file %s, size=%d", fname, get_data.len);
 		}
     }
@@ -339,7 +492,149 @@ int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int body
 exit:
 	// Cleanup
     if (file) fclose(file);
-    if (curl) curl_easy_cleanup(curl);
+    _curl_release_handle(curl);
+
+    return err;
+}
+
+//==================================================================================
+int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int bodylen)
+{
+	return _curl_get(url, fname, NULL, NULL, NULL, 0, hdr, body, hdrlen, bodylen);
+}
+
+//=======================================================================================================================================================
+int Curl_GET_stream(char *url, char *fname, curl_stream_cb_t cb, void *arg, uint8_t *chunk, int chunklen, char *hdr, char *body, int hdrlen, int bodylen)
+{
+	if ((fname == NULL) && (cb == NULL)) return -3;
+	return _curl_get(url, fname, cb, arg, chunk, chunklen, hdr, body, hdrlen, bodylen);
+}
+
+//======================================================================================================================
+int Curl_MULTI_GET(int n, char **urls, char **fnames, char **hdrs, char **bodies, int hdrlen, int bodylen, int *results)
+{
+	CURLM *multi = NULL;
+	CURL *handles[CURL_MULTI_MAX] = { NULL };
+	struct curl_Transfer *xfer = NULL;
+	CURLMsg *msg;
+	int running, left;
+    int err = 0;
+
+    if ((n <= 0) || (n > CURL_MULTI_MAX) || (!urls) || (!hdrs) || (!bodies) || (!results)) return -3;
+    if (hdrlen < MIN_HDR_BODY_BUF_LEN) return -1;
+    if (bodylen < MIN_HDR_BODY_BUF_LEN) return -2;
+
+	for (int i=0; i<n; i++) {
+		results[i] = -7;
+		hdrs[i][0] = '\0';
+		bodies[i][0] = '\0';
+	}
+
+	err = _curl_init();
+	if (err) goto exit;
+
+	// 2 transfer structures (body, header) for each request
+	xfer = calloc(n*2, sizeof(struct curl_Transfer));
+	if (xfer == NULL) {
+        err = -5;
+        goto exit;
+	}
+
+	// Take the multi handle, its connection cache is kept for the next call
+	xSemaphoreTake(curl_mutex, portMAX_DELAY);
+	multi = curl_multi;
+	curl_multi = NULL;
+	xSemaphoreGive(curl_mutex);
+	if (multi == NULL) {
+		multi = curl_multi_init();
+		if (multi == NULL) {
+	        err = -5;
+	        goto exit;
+		}
+		curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)CURL_MULTI_MAXCONN);
+		curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)CURL_MULTI_MAXCONN);
+	}
+
+	curl_sim_fs = 0;
+	for (int i=0; i<n; i++) {
+		handles[i] = _curl_get_handle();
+		if (handles[i] == NULL) {
+	        err = -5;
+	        goto exit;
+		}
+		struct curl_Transfer *get_data = &xfer[i*2];
+		struct curl_Transfer *get_header = &xfer[i*2+1];
+	    init_curl_Transfer(handles[i], get_data, bodies[i], bodylen, NULL);
+	    init_curl_Transfer(handles[i], get_header, hdrs[i], hdrlen, NULL);
+
+		if ((fnames) && (fnames[i])) {
+			get_data->file = fopen(fnames[i], "wb");
+			if (get_data->file == NULL) {
+				results[i] = -6;
+				_curl_release_handle(handles[i]);
+				handles[i] = NULL;
+				continue;
+			}
+			get_data->tofile = 1;
+		}
+
+	    curl_easy_setopt(handles[i], CURLOPT_URL, urls[i]);
+	    _set_default_options(handles[i]);
+	    curl_easy_setopt(handles[i], CURLOPT_ACCEPT_ENCODING, "deflate, gzip");
+	    curl_easy_setopt(handles[i], CURLOPT_HEADERFUNCTION, curlWrite);
+	    curl_easy_setopt(handles[i], CURLOPT_HEADERDATA, get_header);
+	    curl_easy_setopt(handles[i], CURLOPT_WRITEFUNCTION, curlWrite);
+		curl_easy_setopt(handles[i], CURLOPT_WRITEDATA, get_data);
+
+		curl_multi_add_handle(multi, handles[i]);
+	}
+
+	// Run all transfers
+	running = 1;
+	while (running) {
+		if (curl_multi_perform(multi, &running) != CURLM_OK) break;
+		if (running) curl_multi_wait(multi, NULL, 0, 1000, NULL);
+	}
+
+	// Collect the results
+	while ((msg = curl_multi_info_read(multi, &left))) {
+		if (msg->msg != CURLMSG_DONE) continue;
+		for (int i=0; i<n; i++) {
+			if (handles[i] != msg->easy_handle) continue;
+			struct curl_Transfer *get_data = &xfer[i*2];
+			if (msg->data.result != CURLE_OK) {
+		    	if (curl_verbose) mp_printf(&mp_plat_print, "curl transfer %d failed: %s\r\n", i, curl_easy_strerror(msg->data.result));
+				snprintf(bodies[i], bodylen, "%s", curl_easy_strerror(msg->data.result));
+			}
+			else {
+				results[i] = 0;
+				if (get_data->tofile) snprintf(bodies[i], bodylen, "Saved to file %s, size=%d", fnames[i], get_data->len);
+			}
+			break;
+		}
+	}
+
+exit:
+	// Cleanup
+	for (int i=0; i<n; i++) {
+		if (handles[i]) {
+			if (multi) curl_multi_remove_handle(multi, handles[i]);
+			_curl_release_handle(handles[i]);
+		}
+		if ((xfer) && (xfer[i*2].file)) fclose(xfer[i*2].file);
+	}
+	if (xfer) free(xfer);
+	if (multi) {
+		if ((curl_keepalive) && (curl_mutex)) {
+			xSemaphoreTake(curl_mutex, portMAX_DELAY);
+			if (curl_multi == NULL) {
+				curl_multi = multi;
+				multi = NULL;
+			}
+			xSemaphoreGive(curl_mutex);
+		}
+		if (multi) curl_multi_cleanup(multi);
+	}
 
     return err;
 }
@@ -371,17 +666,11 @@ int Curl_POST(char *url , char *hdr, char *body, int hdrlen, int bodylen)
         goto exit;
     }
 
-	if (!curl_initialized) {
-		res = curl_global_init(CURL_GLOBAL_DEFAULT);
-		if (res) {
-            err = -4;
-            goto exit;
-        }
-		curl_initialized = 1;
-	}
+	err = _curl_init();
+	if (err) goto exit;
 
-	// Create a curl curl
-	curl = curl_easy_init();
+	// Get the curl handle
+	curl = _curl_get_handle();
 	if (curl == NULL) {
         err = -5;
         goto exit;
@@ -418,7 +707,7 @@ int Curl_POST(char *url , char *hdr, char *body, int hdrlen, int bodylen)
 
 exit:
 	// Cleanup
-    if (curl) curl_easy_cleanup(curl);
+    _curl_release_handle(curl);
 	if (formpost) {
 		curl_formfree(formpost);
 		formpost = NULL;
@@ -458,17 +747,11 @@ int Curl_FTP(uint8_t upload, char *url, char *user_pass, char *fname, char *hdr,
         goto exit;
     }
 
-	if (!curl_initialized) {
-		res = curl_global_init(CURL_GLOBAL_DEFAULT);
-		if (res) {
-            err = -4;
-            goto exit;
-        }
-		curl_initialized = 1;
-	}
+	err = _curl_init();
+	if (err) goto exit;
 
-	// Create a curl curl
-	curl = curl_easy_init();
+	// Get the curl handle
+	curl = _curl_get_handle();
 	if (curl == NULL) {
         err = -5;
         goto exit;
@@ -572,15 +855,43 @@ int Curl_FTP(uint8_t upload, char *url, char *user_pass, char *fname, char *hdr,
 exit:
 	// Cleanup
     if (file) fclose(file);
-    if (curl) curl_easy_cleanup(curl);
+    _curl_release_handle(curl);
 
     return err;
 }
 
 #endif
 
+//====================
+void Curl_close_idle()
+{
+	CURL *idle[CURL_HANDLE_POOL_SIZE];
+	CURLM *multi;
+
+	if (curl_mutex == NULL) return;
+
+	xSemaphoreTake(curl_mutex, portMAX_DELAY);
+	for (int i=0; i<CURL_HANDLE_POOL_SIZE; i++) {
+		idle[i] = curl_handles[i];
+		curl_handles[i] = NULL;
+	}
+	multi = curl_multi;
+	curl_multi = NULL;
+	xSemaphoreGive(curl_mutex);
+
+	for (int i=0; i<CURL_HANDLE_POOL_SIZE; i++) {
+		if (idle[i]) curl_easy_cleanup(idle[i]);
+	}
+	if (multi) curl_multi_cleanup(multi);
+}
+
 //-------------------
 void Curl_cleanup() {
+	Curl_close_idle();
+	if (curl_share) {
+		curl_share_cleanup(curl_share);
+		curl_share = NULL;
+	}
 	if (curl_initialized) {
 		curl_global_cleanup();
 		curl_initialized = 0;
@@ -14,6 +14,17 @@
 #define GMAIL_SMTP  "smtp.gmail.com"
 #define GMAIL_PORT  465
 
+#define CURL_HANDLE_POOL_SIZE 2 // number of idle easy handles (and their open connections) kept for reuse
+#define CURL_MULTI_MAX        8 // maximal number of concurrent transfers in Curl_MULTI_GET
+#define CURL_MULTI_MAXCONN    4 // maximal number of connections opened by Curl_MULTI_GET
+
+/*
+ * Response body streaming callback
+ *   called with the chunk buffer each time it is filled and once more with the remaining data
+ *   return 0 to continue the transfer, any other value aborts it
+ */
+typedef int (*curl_stream_cb_t)(void *arg, uint8_t *data, int len);
+
 
 // Some configuration variables
 extern uint8_t curl_verbose;   // show detailed info of what curl functions are doing
@@ -21,6 +32,8 @@ extern uint8_t curl_progress;  // show progress during transfers
 extern uint16_t curl_timeout;  // curl operations timeout in seconds
 extern uint32_t curl_maxbytes; // limit download length
 extern uint8_t curl_initialized;
+extern uint8_t curl_keepalive;  // keep connections open and reuse them for the following requests
+extern uint32_t curl_chunksize; // size of the buffer used to stream the response body to file or callback
 
 extern int hdr_maxlen;
 extern int body_maxlen;
@@ -86,6 +99,56 @@ int Curl_GET(char *url, char *fname, char *hdr, char *body, int hdrlen, int body
 //=======================================================================
 int Curl_POST(char *url, char *hdr, char *body, int hdrlen, int bodylen);
 
+/*
+ * -------------------------------------------------------------------------------------------
+ * int res = Curl_GET_stream(url, fname, cb, arg, chunk, chunklen, hdr, body, hdrlen, bodylen)
+ * -------------------------------------------------------------------------------------------
+ *
+ * GET data from http or https server, streaming the response body
+ *
+ * Params:
+ * 		   url:	pointer to server url, if starting with 'https://' SSL will be used
+ * 		 fname:	pointer to file name; if not NULL response body will be written to the file of that name
+ * 		    cb:	if fname is NULL, function called with each received chunk of the response body
+ * 		   arg:	argument passed to the callback function
+ * 		 chunk:	pointer to the buffer used for streaming; used as file buffer if writing to file
+ *    chunklen: length of the chunk buffer
+ * 		   hdr:	pointer to char buffer to which the received response header or error message will be written
+ * 		  body:	pointer to char buffer to which the transfer result or error message will be written
+ *      hdrlen: length of the hdr buffer, must be greather than MIN_HDR_BODY_BUF_LEN
+ *     bodylen: length of the body buffer, must be greather than MIN_HDR_BODY_BUF_LEN
+ *
+ * Returns:
+ * 		 res:	0 success, error code on error
+ *
+ */
+//========================================================================================================================================================
+int Curl_GET_stream(char *url, char *fname, curl_stream_cb_t cb, void *arg, uint8_t *chunk, int chunklen, char *hdr, char *body, int hdrlen, int bodylen);
+
+/*
+ * ---------------------------------------------------------------------------------
+ * int res = Curl_MULTI_GET(n, urls, fnames, hdrs, bodies, hdrlen, bodylen, results)
+ * ---------------------------------------------------------------------------------
+ *
+ * GET data from up to CURL_MULTI_MAX http or https servers concurrently
+ *
+ * Params:
+ * 		     n:	number of transfers
+ * 		  urls:	array of pointers to server urls
+ * 		fnames:	array of pointers to file names, NULL or NULL entry to receive the body into the body buffer
+ * 		  hdrs:	array of pointers to the response header buffers
+ * 		bodies:	array of pointers to the response body buffers
+ *      hdrlen: length of each header buffer, must be greather than MIN_HDR_BODY_BUF_LEN
+ *     bodylen: length of each body buffer, must be greather than MIN_HDR_BODY_BUF_LEN
+ *     results: array of transfer results, 0 success, error code on error
+ *
+ * Returns:
+ * 		 res:	0 if all transfers were started, error code on error
+ *
+ */
+//=======================================================================================================================
+int Curl_MULTI_GET(int n, char **urls, char **fnames, char **hdrs, char **bodies, int hdrlen, int bodylen, int *results);
+
 #ifdef CONFIG_MICROPY_USE_CURLFTP
 
 /*
@@ -118,6 +181,12 @@ int Curl_FTP(uint8_t upload, char *url, char *user_pass, char *fname, char *hdr,
 
 #endif
 
+/*
+ * Close the idle handles kept for reuse and their open connections
+ */
+//=====================
+void Curl_close_idle();
+
 //==================
 void Curl_cleanup();
 
@@ -54,6 +54,7 @@
 #include "dirent.h"
 
 #include "esp_system.h"
+#include "esp_heap_caps.h"
 #include "esp_spi_flash.h"
 #include "nvs_flash.h"
 #include "esp_event.h"
@@ -79,15 +80,30 @@ const char *FTP_TAG = "[Ftp]";
 /******************************************************************************
  DEFINE PRIVATE CONSTANTS
  ******************************************************************************/
+#ifndef CONFIG_MICROPY_FTPSERVER_CLIENTS
+#define CONFIG_MICROPY_FTPSERVER_CLIENTS    2
+#endif
+#ifndef CONFIG_MICROPY_FTPSERVER_BUFFER_PSRAM
+#define CONFIG_MICROPY_FTPSERVER_BUFFER_PSRAM   0
+#endif
+
+#ifndef FTP_CMD_PORT
 #define FTP_CMD_PORT                        21
+#endif
 #define FTP_ACTIVE_DATA_PORT                20
-#define FTP_PASIVE_DATA_PORT                2024
+#ifndef FTP_PASIVE_DATA_PORT
+#define FTP_PASIVE_DATA_PORT                2024	// session n uses FTP_PASIVE_DATA_PORT + n
+#endif
 #define FTP_CMD_SIZE_MAX                    6
-#define FTP_CMD_CLIENTS_MAX                 1
-#define FTP_DATA_CLIENTS_MAX                1
+#define FTP_CMD_CLIENTS_MAX                 CONFIG_MICROPY_FTPSERVER_CLIENTS
+#define FTP_DATA_CLIENTS_MAX                1		// per session
 #define FTP_MAX_PARAM_SIZE                  (MICROPY_ALLOC_PATH_MAX + 1)
 #define FTP_UNIX_SECONDS_180_DAYS           15552000
-#define FTP_DATA_TIMEOUT_MS                 5000	// 10 seconds
+#define FTP_DATA_TIMEOUT_MS                 5000	// 5 seconds
+#define FTP_REPLY_TIMEOUT_MS                200		// longest time a queued reply may wait for the client
+#define FTP_REPLY_BUF_SIZE                  (2 * (FTP_MAX_PARAM_SIZE + FTP_CMD_SIZE_MAX))
+#define FTP_PUMP_ROUNDS_MAX                 4		// buffers moved per session in one run, so sessions take turns
+#define FTP_IDLE_WAIT_MS                    100		// longest wait for socket activity in ftp_wait()
 #define FTP_SOCKETFIFO_ELEMENTS_MAX         4
 
 /******************************************************************************
@@ -116,30 +132,55 @@ typedef enum {
     E_FTP_CLOSE_CMD_AND_DATA,
 } ftp_e_closesocket_t;
 
+// One client connection.
+// Downloads and listings move through two buffers: while one is being sent,
+// the other is filled from the file, so flash reads overlap with lwIP sending
+// the previous block. Uploads only use dBuffer[0], which is written to the
+// file when full (the write blocks, there is nothing to overlap it with).
+// A reply the control socket does not take at once waits in reply[] and is
+// sent by ftp_session_run(); no new command is read until it is out.
 typedef struct {
-    uint8_t         *dBuffer;
+    uint8_t         *dBuffer[2];
+    uint32_t        dLen[2];        // bytes in each buffer
+    uint32_t        dOffset;        // bytes of dBuffer[dIdx] already sent
+    uint32_t        dSize;          // size of each buffer, ftp_buff_size at connect time
     uint32_t        ctimeout;
     union {
         DIR         *dp;
         FILE        *fp;
     };
-    int32_t         lc_sd;
+    char            *path;
+    char            *scratch;
+    char            *cmd_buffer;
+    char            *rnfr_path;     // source of RNTO, set by the RNFR just before it
+    char            *reply;
+    uint32_t        reply_len;      // bytes of reply[] not sent yet
+    uint32_t        rtimeout;       // ms since the client last took reply data
     int32_t         ld_sd;
     int32_t         c_sd;
     int32_t         d_sd;
     int32_t         dtimeout;
     uint32_t        ip_addr;
+    uint32_t        rest;           // restart offset set by REST for the next transfer
+    uint8_t         dIdx;           // buffer currently sent / received into
     uint8_t         state;
     uint8_t         substate;
-    uint8_t         txRetries;
     uint8_t         logginRetries;
     ftp_loggin_t	loggin;
     uint8_t         e_open;
     bool            closechild;
-    bool            enabled;
     bool            listroot;
+    bool            mlsd;
+    bool            eof;
+    bool            closing;        // close after the queued reply (221)
     uint32_t		total;
     uint32_t		time;
+} ftp_session_t;
+
+typedef struct {
+    int32_t         lc_sd;
+    uint8_t         state;
+    bool            enabled;
 } ftp_data_t;
 
 typedef struct {
@@ -171,6 +212,8 @@ typedef enum {
     E_FTP_CMD_NOOP,
     E_FTP_CMD_QUIT,
     E_FTP_CMD_APPE,
+    E_FTP_CMD_MLSD,
+    E_FTP_CMD_REST,
     E_FTP_NUM_FTP_CMDS
 } ftp_cmd_index_t;
 
@@ -182,15 +225,16 @@ char ftp_pass[FTP_USER_PASS_LEN_MAX + 1];
  DECLARE PRIVATE DATA
  ******************************************************************************/
 static ftp_data_t ftp_data = {0};
-static char *ftp_path = NULL;
-static char *ftp_scratch_buffer = NULL;;
-static char *ftp_cmd_buffer = NULL;
+static ftp_session_t ftp_sessions[FTP_CMD_CLIENTS_MAX] = {0};
 static const ftp_cmd_t ftp_cmd_table[] = { { "FEAT" }, { "SYST" }, { "CDUP" }, { "CWD"  },
                                            { "PWD"  }, { "XPWD" }, { "SIZE" }, { "MDTM" },
                                            { "TYPE" }, { "USER" }, { "PASS" }, { "PASV" },
                                            { "LIST" }, { "RETR" }, { "STOR" }, { "DELE" },
                                            { "RMD"  }, { "MKD"  }, { "RNFR" }, { "RNTO" },
-                                           { "NOOP" }, { "QUIT" }, { "APPE" } };
+                                           { "NOOP" }, { "QUIT" }, { "APPE" }, { "MLSD" },
+                                           { "REST" } };
+
+static const char ftp_features[] = "211-Features:\r\n MDTM\r\n MLSD type*;size*;modify*;\r\n REST STREAM\r\n SIZE\r\n211 End\r\n";
 
 // ==== PRIVATE FUNCTIONS ===================================================
 
@@ -202,63 +246,72 @@ static void stoupper (char *str) {
     }
 }
 
+// Transfer buffers are taken from psRAM if available
+//------------------------------------------------
+static uint8_t *ftp_buffer_alloc(uint32_t size) {
+    uint8_t *buf = NULL;
+	#if CONFIG_MICROPY_FTPSERVER_BUFFER_PSRAM
+    buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+	#endif
+    if (buf == NULL) buf = malloc(size);
+    return buf;
+}
+
 // ==== File functions =========================================
 
-//--------------------------------------------------------------
-static bool ftp_open_file (const char *path, const char *mode) {
-	ftp_data.fp = fopen(path, mode);
-    if (ftp_data.fp == NULL) {
+//-----------------------------------------------------------------------------
+static bool ftp_open_file (ftp_session_t *s, const char *path, const char *mode) {
+	s->fp = fopen(path, mode);
+    if (s->fp == NULL) {
         return false;
     }
-    ftp_data.e_open = E_FTP_FILE_OPEN;
+    s->e_open = E_FTP_FILE_OPEN;
     return true;
 }
 
-//----------------------------------
-static void ftp_close_files (void) {
-    if (ftp_data.e_open == E_FTP_FILE_OPEN) {
-        fclose(ftp_data.fp);
-    } else if (ftp_data.e_open == E_FTP_DIR_OPEN) {
-        closedir(ftp_data.dp);
+//----------------------------------------------
+static void ftp_close_files (ftp_session_t *s) {
+    if (s->e_open == E_FTP_FILE_OPEN) {
+        fclose(s->fp);
+    } else if (s->e_open == E_FTP_DIR_OPEN) {
+        closedir(s->dp);
     }
-    ftp_data.e_open = E_FTP_NOTHING_OPEN;
+    s->e_open = E_FTP_NOTHING_OPEN;
 }
 
-//------------------------------------------------
-static void ftp_close_filesystem_on_error (void) {
-    ftp_close_files();
+//------------------------------------------------------------
+static void ftp_close_filesystem_on_error (ftp_session_t *s) {
+    ftp_close_files(s);
 }
 
-//---------------------------------------------------------------------------------------------
-static ftp_result_t ftp_read_file (char *filebuf, uint32_t desiredsize, uint32_t *actualsize) {
+//------------------------------------------------------------------------------------------------
+static ftp_result_t ftp_read_file (ftp_session_t *s, char *filebuf, uint32_t desiredsize, uint32_t *actualsize) {
     ftp_result_t result = E_FTP_RESULT_CONTINUE;
-    *actualsize = fread(filebuf, 1, desiredsize, ftp_data.fp);
-    if (*actualsize == 0) {
-        ftp_close_files();
-        result = E_FTP_RESULT_FAILED;
-    } else if (*actualsize < desiredsize) {
-        ftp_close_files();
-        result = E_FTP_RESULT_OK;
+    *actualsize = fread(filebuf, 1, desiredsize, s->fp);
+    if (*actualsize < desiredsize) {
+        result = ferror(s->fp) ? E_FTP_RESULT_FAILED : E_FTP_RESULT_OK;
+        ftp_close_files(s);
     }
     return result;
 }
 
-//-----------------------------------------------------------------
-static ftp_result_t ftp_write_file (char *filebuf, uint32_t size) {
+//------------------------------------------------------------------------------
+static ftp_result_t ftp_write_file (ftp_session_t *s, char *filebuf, uint32_t size) {
     ftp_result_t result = E_FTP_RESULT_FAILED;
-    uint32_t actualsize = fwrite(filebuf, 1, size, ftp_data.fp);
+    uint32_t actualsize = fwrite(filebuf, 1, size, s->fp);
     if (actualsize == size) {
         result = E_FTP_RESULT_OK;
     } else {
-        ftp_close_files();
+        ftp_close_files(s);
     }
     return result;
 }
 
-//---------------------------------------------------------------
-static ftp_result_t ftp_open_dir_for_listing (const char *path) {
+//------------------------------------------------------------------------------------------
+static ftp_result_t ftp_open_dir_for_listing (ftp_session_t *s, const char *path, bool mlsd) {
+    s->mlsd = mlsd;
     if (path[0] == '/' && path[1] == '\0') {
-        ftp_data.listroot = true;
+        s->listroot = true;
     	ESP_LOGD(FTP_TAG, "ftp_open_dir_for_listing: root");
     }
     else {
@@ -268,24 +321,24 @@ static ftp_result_t ftp_open_dir_for_listing (const char *path) {
     		strcat(fullname, "/");
     	}
     	ESP_LOGD(FTP_TAG, "ftp_open_dir_for_listing: %s", fullname);
-		ftp_data.dp = opendir(fullname);  // Open the directory
-		if (ftp_data.dp == NULL) {
+		s->dp = opendir(fullname);  // Open the directory
+		if (s->dp == NULL) {
 			return E_FTP_RESULT_FAILED;
 		}
-		ftp_data.e_open = E_FTP_DIR_OPEN;
-        ftp_data.listroot = false;
+		s->e_open = E_FTP_DIR_OPEN;
+        s->listroot = false;
     }
     return E_FTP_RESULT_CONTINUE;
 }
 
-//---------------------------------------------------------------------------------
-static int ftp_print_eplf_item (char *dest, uint32_t destsize, struct dirent *de) {
+//-------------------------------------------------------------------------------------------------------
+static int ftp_print_eplf_item (ftp_session_t *s, char *dest, uint32_t destsize, struct dirent *de) {
 
     char *type = (de->d_type & DT_DIR) ? "d" : "-";
 
     // Get full file path needed for stat function
     char fullname[128];
-    strcpy(fullname, ftp_path);
+    strcpy(fullname, s->path);
     if (fullname[strlen(fullname)-1] != '/') strcat(fullname, "/");
     strcat(fullname, de->d_name);
 
@@ -293,56 +346,67 @@ static int ftp_print_eplf_item (char *dest, uint32_t destsize, struct dirent *de
 	int res = stat(fullname, &buf);
 	if (res < 0) {
 		buf.st_size = 0;
-		buf.st_atime = 946684800; // Jan 1, 2000
+		buf.st_mtime = 946684800; // Jan 1, 2000
 	}
 
 	char str_time[64];
     struct tm *tm_info;
+    if (s->mlsd) {
+        // RFC 3659 machine listing
+        tm_info = gmtime(&buf.st_mtime);
+        strftime(str_time, 63, "%Y%m%d%H%M%S", tm_info);
+        return snprintf(dest, destsize, "type=%s;size=%u;modify=%s; %s\r\n",
+                        (de->d_type & DT_DIR) ? "dir" : "file", (uint32_t)buf.st_size, str_time, de->d_name);
+    }
+
     time_t now;
     if (time(&now) < 0) now = 946684800;	// get the current time from the RTC
     tm_info = localtime(&buf.st_mtime);		// get broken-down file time
 
     // if file is older than 180 days show dat,month,year else show month, day and time
-    if ((buf.st_mtime + FTP_UNIX_SECONDS_180_DAYS) < now) strftime(str_time, 127, "%b %d %Y", tm_info);
+    if ((buf.st_mtime + FTP_UNIX_SECONDS_180_DAYS) < now) strftime(str_time, 63, "%b %d %Y", tm_info);
     else strftime(str_time, 63, "%b %d %H:%M", tm_info);
 
     return snprintf(dest, destsize, "%srw-rw-r--   1 root  root %9u %s %s\r\n", type, (uint32_t)buf.st_size, str_time, de->d_name);
 }
 
-//---------------------------------------------------------------------------
-static int ftp_print_eplf_drive (char *dest, uint32_t destsize, char *name) {
+//-----------------------------------------------------------------------------------------------
+static int ftp_print_eplf_drive (ftp_session_t *s, char *dest, uint32_t destsize, char *name) {
     char *type = "d";
     struct tm *tm_info;
     time_t seconds;
     time(&seconds); // get the time from the RTC
     tm_info = gmtime(&seconds);
     char str_time[64];
+    if (s->mlsd) {
+        strftime(str_time, 63, "%Y%m%d%H%M%S", tm_info);
+        return snprintf(dest, destsize, "type=dir;size=0;modify=%s; %s\r\n", str_time, name);
+    }
     strftime(str_time, 63, "%b %d %Y", tm_info);
 
     return snprintf(dest, destsize, "%srw-rw-r--   1 root  root %9u %s %s\r\n", type, 0, str_time, name);
 }
 
-//---------------------------------------------------------------------------------------
-static ftp_result_t ftp_list_dir (char *list, uint32_t maxlistsize, uint32_t *listsize) {
+//-----------------------------------------------------------------------------------------------------------
+static ftp_result_t ftp_list_dir (ftp_session_t *s, char *list, uint32_t maxlistsize, uint32_t *listsize) {
     uint next = 0;
-    uint listcount = 0;
     ftp_result_t result = E_FTP_RESULT_CONTINUE;
 	struct dirent *de;
 
-    if (ftp_data.listroot) {
+    if (s->listroot) {
     	if (native_vfs_mounted[0]) {
-            next += ftp_print_eplf_drive((list + next), (maxlistsize - next), "flash");
+            next += ftp_print_eplf_drive(s, (list + next), (maxlistsize - next), "flash");
     	}
     	if (native_vfs_mounted[1]) {
-            next += ftp_print_eplf_drive((list + next), (maxlistsize - next), "sd");
+            next += ftp_print_eplf_drive(s, (list + next), (maxlistsize - next), "sd");
     	}
         *listsize = next;
         return E_FTP_RESULT_OK;
     }
 
-    // read up to 8 directory items
-    while (listcount < 8) {
-		de = readdir(ftp_data.dp);                  										// Read a directory item
+    // read directory items while there is room for one more in the buffer
+    while ((maxlistsize - next) > (FTP_MAX_PARAM_SIZE + 80)) {
+		de = readdir(s->dp);                  												// Read a directory item
 		if (de == NULL) {
 			result = E_FTP_RESULT_OK;
 			break;                                                                          // Break on error or end of dp
@@ -352,11 +416,10 @@ static ftp_result_t ftp_list_dir (char *list, uint32_t maxlistsize, uint32_t *li
 
 		// add the entry to the list
     	ESP_LOGD(FTP_TAG, "Add to dir list: %s", de->d_name);
-		next += ftp_print_eplf_item((list + next), (maxlistsize - next), de);
-        listcount++;
+		next += ftp_print_eplf_item(s, (list + next), (maxlistsize - next), de);
     }
     if (result == E_FTP_RESULT_OK) {
-        ftp_close_files();
+        ftp_close_files(s);
     }
     *listsize = next;
     return result;
@@ -364,28 +427,45 @@ static ftp_result_t ftp_list_dir (char *list, uint32_t maxlistsize, uint32_t *li
 
 // ==== Socket functions ==============================================================
 
-//------------------------------------
-static void ftp_close_cmd_data(void) {
-    closesocket(ftp_data.c_sd);
-    closesocket(ftp_data.d_sd);
-    ftp_data.c_sd  = -1;
-    ftp_data.d_sd  = -1;
-    ftp_close_filesystem_on_error ();
+//----------------------------------------------------
+static void ftp_close_data (ftp_session_t *s) {
+    if (s->d_sd >= 0) closesocket(s->d_sd);
+    s->d_sd = -1;
+    s->dLen[0] = 0;
+    s->dLen[1] = 0;
+    s->dOffset = 0;
+    ftp_close_filesystem_on_error(s);
+}
+
+// Close the client connection and free its transfer buffers
+//------------------------------------------------------
+static void ftp_close_session (ftp_session_t *s) {
+    if (s->c_sd >= 0) closesocket(s->c_sd);
+    if (s->ld_sd >= 0) closesocket(s->ld_sd);
+    s->c_sd = -1;
+    s->ld_sd = -1;
+    ftp_close_data(s);
+    s->reply_len = 0;
+    s->closing = false;
+    if (s->rnfr_path) s->rnfr_path[0] = '\0';
+    for (int i = 0; i < 2; i++) {
+        if (s->dBuffer[i]) free(s->dBuffer[i]);
+        s->dBuffer[i] = NULL;
+    }
+    s->state = E_FTP_STE_READY;
+    s->substate = E_FTP_STE_SUB_DISCONNECTED;
 }
 
 //----------------------------
 static void _ftp_reset(void) {
     // close all connections and start all over again
 	ESP_LOGW(FTP_TAG, "FTP RESET");
-    closesocket(ftp_data.lc_sd);
-    closesocket(ftp_data.ld_sd);
+    if (ftp_data.lc_sd >= 0) closesocket(ftp_data.lc_sd);
     ftp_data.lc_sd = -1;
-    ftp_data.ld_sd = -1;
-    ftp_close_cmd_data();
-
-    ftp_data.e_open = E_FTP_NOTHING_OPEN;
+    for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+        ftp_close_session(&ftp_sessions[i]);
+    }
     ftp_data.state = E_FTP_STE_START;
-    ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
 }
 
 //-------------------------------------------------------------------------------------
@@ -409,6 +489,7 @@ static bool ftp_create_listening_socket (int32_t *sd, uint32_t port, uint8_t bac
         result = setsockopt(_sd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
 
         // bind the socket to a port number
+        memset(&sServerAddress, 0, sizeof(sServerAddress));
         sServerAddress.sin_family = AF_INET;
         sServerAddress.sin_addr.s_addr = INADDR_ANY;
         sServerAddress.sin_len = sizeof(sServerAddress);
@@ -424,13 +505,14 @@ static bool ftp_create_listening_socket (int32_t *sd, uint32_t port, uint8_t bac
         }
         closesocket(*sd);
     }
+    *sd = -1;
     return false;
 }
 
 //--------------------------------------------------------------------------------------------
 static ftp_result_t ftp_wait_for_connection (int32_t l_sd, int32_t *n_sd, uint32_t *ip_addr) {
     struct sockaddr_in  sClientAddress;
-    socklen_t  in_addrSize;
+    socklen_t  in_addrSize = sizeof(sClientAddress);
 
     // accepts a connection from a TCP client, if there is any, otherwise returns EAGAIN
     *n_sd = accept(l_sd, (struct sockaddr *)&sClientAddress, (socklen_t *)&in_addrSize);
@@ -440,7 +522,6 @@ static ftp_result_t ftp_wait_for_connection (int32_t l_sd, int32_t *n_sd, uint32
             return E_FTP_RESULT_CONTINUE;
         }
         // error
-        _ftp_reset();
         return E_FTP_RESULT_FAILED;
     }
 
@@ -467,122 +548,81 @@ static ftp_result_t ftp_wait_for_connection (int32_t l_sd, int32_t *n_sd, uint32
         *ip_addr = ip_info.ip.addr;
     }
 
-    // enable non-blocking mode if not data channel connection
+    // all sockets are non-blocking, the server task serves all sessions
     uint32_t option = fcntl(_sd, F_GETFL, 0);
-    if (l_sd != ftp_data.ld_sd) option |= O_NONBLOCK;
+    option |= O_NONBLOCK;
     fcntl(_sd, F_SETFL, option);
 
     // client connected, so go on
     return E_FTP_RESULT_OK;
 }
 
-//-----------------------------------------------------------
-static void ftp_send_reply (uint32_t status, char *message) {
-    if (!message) {
-        message = "";
+// Send what the control socket takes now, queue the rest for ftp_reply_pump()
+//----------------------------------------------------------------
+static void ftp_send_raw (ftp_session_t *s, const char *str) {
+    int32_t size = strlen(str);
+    int32_t sent = 0;
+
+    if (s->reply_len == 0) {
+        // keep the order of replies, only send directly if nothing is queued
+        sent = send(s->c_sd, str, size, 0);
+        if (sent < 0) {
+            if (errno != EAGAIN) {
+                ftp_close_session(s);
+                ESP_LOGW(FTP_TAG, "Error sending command reply.");
+                return;
+            }
+            sent = 0;
+        }
+        s->rtimeout = 0;
     }
-    snprintf((char *)ftp_cmd_buffer, 4, "%u", status);
-    strcat ((char *)ftp_cmd_buffer, " ");
-    strcat ((char *)ftp_cmd_buffer, message);
-    strcat ((char *)ftp_cmd_buffer, "\r\n");
-
-    int32_t timeout = 200;
-    ftp_result_t result;
-    uint32_t size = strlen((char *)ftp_cmd_buffer);
-
-    ESP_LOGD(FTP_TAG, "Send reply: [%s]", ftp_cmd_buffer);
-    vTaskDelay(1);
-
-    while (1) {
-        result = send(ftp_data.c_sd, ftp_cmd_buffer, size, 0);
-		if (result == size) {
-			if (status == 221) {
-				closesocket(ftp_data.d_sd);
-				ftp_data.d_sd = -1;
-				closesocket(ftp_data.ld_sd);
-				ftp_data.ld_sd = -1;
-				closesocket(ftp_data.c_sd);
-				ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
-				ftp_close_filesystem_on_error();
-			}
-			else if (status == 426 || status == 451 || status == 550) {
-				closesocket(ftp_data.d_sd);
-				ftp_data.d_sd = -1;
-				ftp_close_filesystem_on_error();
-			}
-			vTaskDelay(1);
-			ESP_LOGD(FTP_TAG, "Send reply: OK (%u)", size);
-			break;
-		}
-		else {
-		    vTaskDelay(1);
-			if ((timeout <= 0) || (errno != EAGAIN)) {
-				// error
-				_ftp_reset();
-	            ESP_LOGW(FTP_TAG, "Error sending command reply.");
-				break;
-			}
-		}
-		timeout -= portTICK_PERIOD_MS;
+    if (sent < size) {
+        if ((s->reply_len + size - sent) > FTP_REPLY_BUF_SIZE) {
+            ftp_close_session(s);
+            ESP_LOGW(FTP_TAG, "Command reply queue full.");
+            return;
+        }
+        memcpy(s->reply + s->reply_len, str + sent, size - sent);
+        s->reply_len += size - sent;
     }
 }
 
-//------------------------------------------
-static void ftp_send_list(uint32_t datasize)
-{
-    int32_t timeout = 200;
-    ftp_result_t result;
-
-    ESP_LOGD(FTP_TAG, "Send list data: (%u)", datasize);
-    vTaskDelay(1);
-
-    while (1) {
-        result = send(ftp_data.d_sd, ftp_data.dBuffer, datasize, 0);
-		if (result == datasize) {
-			vTaskDelay(1);
-			ESP_LOGD(FTP_TAG, "Send OK");
-			break;
-		}
-		else {
-		    vTaskDelay(1);
-			if ((timeout <= 0) || (errno != EAGAIN)) {
-				// error
-				_ftp_reset();
-				ESP_LOGW(FTP_TAG, "Error sending list data.");
-				break;
-			}
-		}
-		timeout -= portTICK_PERIOD_MS;
+// Send the queued reply, the session is closed if the client does not take it in time
+//--------------------------------------------------
+static void ftp_reply_pump (ftp_session_t *s) {
+    int32_t result = send(s->c_sd, s->reply, s->reply_len, 0);
+    if (result > 0) {
+        s->reply_len -= result;
+        memmove(s->reply, s->reply + result, s->reply_len);
+        s->rtimeout = 0;
+    }
+    else if (((result < 0) && (errno != EAGAIN)) || (s->rtimeout > FTP_REPLY_TIMEOUT_MS)) {
+        ftp_close_session(s);
+        ESP_LOGW(FTP_TAG, "Error sending command reply.");
+        return;
     }
+    if ((s->reply_len == 0) && s->closing) ftp_close_session(s);
 }
 
-//-----------------------------------------------
-static void ftp_send_file_data(uint32_t datasize)
-{
-    ftp_result_t result;
-    uint32_t timeout = 200;
+//-----------------------------------------------------------------------------
+static void ftp_send_reply (ftp_session_t *s, uint32_t status, char *message) {
+    if (!message) {
+        message = "";
+    }
+    snprintf(s->cmd_buffer, FTP_MAX_PARAM_SIZE + FTP_CMD_SIZE_MAX, "%u %s\r\n", status, message);
 
-    ESP_LOGD(FTP_TAG, "Send file data: (%u)", datasize);
-    vTaskDelay(1);
+    ESP_LOGD(FTP_TAG, "Send reply: [%s]", s->cmd_buffer);
+    ftp_send_raw(s, s->cmd_buffer);
+    if (s->c_sd < 0) return;
 
-    while (1) {
-        result = send(ftp_data.d_sd, ftp_data.dBuffer, datasize, 0);
-		if (result == datasize) {
-			vTaskDelay(1);
-			ESP_LOGD(FTP_TAG, "Send OK");
-			break;
-		}
-		else {
-		    vTaskDelay(1);
-			if ((timeout <= 0) || (errno != EAGAIN)) {
-				// error
-				_ftp_reset();
-				ESP_LOGW(FTP_TAG, "Error sending file data.");
-				break;
-			}
-		}
-		timeout -= portTICK_PERIOD_MS;
-    }
+	if (status == 221) {
+		// close when the client has the reply
+		if (s->reply_len > 0) s->closing = true;
+		else ftp_close_session(s);
+	}
+	else if (status == 426 || status == 451 || status == 550) {
+		ftp_close_data(s);
+	}
 }
 
 //------------------------------------------------------------------------------------------------
@@ -592,9 +632,153 @@ static ftp_result_t ftp_recv_non_blocking (int32_t sd, void *buff, int32_t Maxle
 
 	*rxLen = recv(sd, buff, Maxlen, 0);
     if (*rxLen > 0) return E_FTP_RESULT_OK;
-    else if (errno != EAGAIN) return E_FTP_RESULT_FAILED;
+    else if ((*rxLen < 0) && (errno == EAGAIN)) return E_FTP_RESULT_CONTINUE;
 
-    return E_FTP_RESULT_CONTINUE;
+    return E_FTP_RESULT_FAILED;
+}
+
+// ==== Data transfer functions ===================================================
+
+// Fill an empty buffer from the open file or directory
+//------------------------------------------------------------------
+static ftp_result_t ftp_fill_buffer (ftp_session_t *s, uint8_t idx) {
+    ftp_result_t result;
+    uint32_t len = 0;
+    if (s->state == E_FTP_STE_CONTINUE_LISTING) {
+        result = ftp_list_dir(s, (char *)s->dBuffer[idx], s->dSize, &len);
+    }
+    else {
+        result = ftp_read_file(s, (char *)s->dBuffer[idx], s->dSize, &len);
+    }
+    s->dLen[idx] = len;
+    if (result == E_FTP_RESULT_OK) s->eof = true;
+    return result;
+}
+
+//---------------------------------------------
+static void ftp_end_tx (ftp_session_t *s) {
+	if (s->state == E_FTP_STE_CONTINUE_FILE_TX) {
+		ESP_LOGI(FTP_TAG, "File sent (%u bytes in %u msek).", s->total, s->time);
+	}
+	ftp_send_reply(s, 226, NULL);
+	s->state = E_FTP_STE_END_TRANSFER;
+}
+
+// Send file or listing data, reading the next block while the previous one is sent
+//----------------------------------------------
+static bool ftp_tx_pump (ftp_session_t *s) {
+    for (int round = 0; round < FTP_PUMP_ROUNDS_MAX; round++) {
+        uint8_t idx = s->dIdx;
+        if (s->dLen[idx] == 0) {
+            if (s->dLen[idx ^ 1] > 0) {
+                s->dIdx = idx ^= 1;
+            }
+            else if (s->eof) {
+                ftp_end_tx(s);
+                return false;
+            }
+            else if (ftp_fill_buffer(s, idx) == E_FTP_RESULT_FAILED) {
+                ftp_send_reply(s, 451, NULL);
+                s->state = E_FTP_STE_END_TRANSFER;
+                return false;
+            }
+            if (s->dLen[idx] == 0) continue;
+        }
+
+        int32_t n = send(s->d_sd, s->dBuffer[idx] + s->dOffset, s->dLen[idx] - s->dOffset, 0);
+        if (n < 0) {
+            if (errno != EAGAIN) {
+                ESP_LOGW(FTP_TAG, "Error sending data.");
+                ftp_send_reply(s, 426, NULL);
+                s->state = E_FTP_STE_END_TRANSFER;
+                return false;
+            }
+            if (s->dtimeout > FTP_DATA_TIMEOUT_MS) {
+                ESP_LOGW(FTP_TAG, "Sending data timeout");
+                ftp_send_reply(s, 426, NULL);
+                s->state = E_FTP_STE_END_TRANSFER;
+                return false;
+            }
+            n = 0;
+        }
+        else {
+            s->dtimeout = 0;
+            s->total += n;
+            s->dOffset += n;
+            if (s->dOffset == s->dLen[idx]) {
+                s->dLen[idx] = 0;
+                s->dOffset = 0;
+            }
+        }
+
+        // lwIP sends the queued data now, read the next block meanwhile
+        if ((s->dLen[idx ^ 1] == 0) && !s->eof) {
+            if (ftp_fill_buffer(s, idx ^ 1) == E_FTP_RESULT_FAILED) {
+                ftp_send_reply(s, 451, NULL);
+                s->state = E_FTP_STE_END_TRANSFER;
+                return false;
+            }
+        }
+        if (n == 0) break;	// socket full, wait until it drains
+    }
+    // more work to do without waiting for the socket
+    return (s->dLen[s->dIdx] == 0) && ((s->dLen[s->dIdx ^ 1] > 0) || s->eof);
+}
+
+// Receive file data, the buffer is written to the file when full
+//----------------------------------------------
+static void ftp_rx_pump (ftp_session_t *s) {
+    uint8_t *buf = s->dBuffer[s->dIdx];
+    for (int round = 0; round < FTP_PUMP_ROUNDS_MAX; round++) {
+        int32_t len;
+        ftp_result_t result = ftp_recv_non_blocking(s->d_sd, buf + s->dLen[s->dIdx], s->dSize - s->dLen[s->dIdx], &len);
+        if (result == E_FTP_RESULT_OK) {
+            // block of data received
+            s->dtimeout = 0;
+            s->ctimeout = 0;
+            s->total += len;
+            s->dLen[s->dIdx] += len;
+            if (s->dLen[s->dIdx] < s->dSize) continue;
+        }
+        else if (result == E_FTP_RESULT_CONTINUE) {
+            // nothing received
+            if (s->dtimeout > FTP_DATA_TIMEOUT_MS) {
+                ftp_close_files(s);
+                ftp_send_reply(s, 426, NULL);
+                s->state = E_FTP_STE_END_TRANSFER;
+                ESP_LOGW(FTP_TAG, "Receiving to file timeout");
+            }
+            return;
+        }
+
+        // save received data to file
+        if ((s->dLen[s->dIdx] > 0) && (E_FTP_RESULT_OK != ftp_write_file(s, (char *)buf, s->dLen[s->dIdx]))) {
+            ftp_send_reply(s, 451, NULL);
+            s->state = E_FTP_STE_END_TRANSFER;
+            ESP_LOGW(FTP_TAG, "Error writing to file");
+            return;
+        }
+        s->dLen[s->dIdx] = 0;
+        if (result == E_FTP_RESULT_FAILED) {
+            // File received
+            ftp_close_files(s);
+            ftp_send_reply(s, 226, NULL);
+            s->state = E_FTP_STE_END_TRANSFER;
+            ESP_LOGI(FTP_TAG, "File received (%u bytes in %u msek).", s->total, s->time);
+            return;
+        }
+    }
+}
+
+// Prepare the session for a file or listing transfer
+//-------------------------------------------------------------------
+static void ftp_start_transfer (ftp_session_t *s, uint8_t state) {
+    s->dLen[0] = 0;
+    s->dLen[1] = 0;
+    s->dIdx = 0;
+    s->dOffset = 0;
+    s->eof = false;
+    s->state = state;
 }
 
 // ==== Directory functions =======================
@@ -723,494 +907,591 @@ static ftp_cmd_index_t ftp_pop_command(char **str) {
     return E_FTP_CMD_NOT_SUPPORTED;
 }
 
-// Get file name from parameter and append to ftp_path
-//-------------------------------------------------------
-static void ftp_get_param_and_open_child(char **bufptr) {
-    ftp_pop_param(bufptr, ftp_scratch_buffer, false);
-    ftp_open_child(ftp_path, ftp_scratch_buffer);
-    ftp_data.closechild = true;
+// Get file name from parameter and append to the session path
+//---------------------------------------------------------------------------
+static void ftp_get_param_and_open_child(ftp_session_t *s, char **bufptr) {
+    ftp_pop_param(bufptr, s->scratch, false);
+    ftp_open_child(s->path, s->scratch);
+    s->closechild = true;
+}
+
+// Consume the REST offset for a RETR/STOR/APPE
+//-----------------------------------------------------
+static bool ftp_seek_rest (ftp_session_t *s) {
+    uint32_t rest = s->rest;
+    s->rest = 0;
+    if (rest == 0) return true;
+    if (fseek(s->fp, rest, SEEK_SET) == 0) return true;
+    ftp_close_files(s);
+    return false;
 }
 
 // ==== Ftp command processing =====
 
-//----------------------------------
-static void ftp_process_cmd (void) {
-    int32_t len;
-    char *bufptr = (char *)ftp_cmd_buffer;
-    ftp_result_t result;
+//----------------------------------------------------------
+static void ftp_process_cmd (ftp_session_t *s, int32_t len) {
+    char *bufptr = (char *)s->cmd_buffer;
 	struct stat buf;
+	char str[24];
 	int res;
 
-    ftp_data.closechild = false;
-    // use the reply buffer to receive new commands
-    result = ftp_recv_non_blocking(ftp_data.c_sd, ftp_cmd_buffer, FTP_MAX_PARAM_SIZE + FTP_CMD_SIZE_MAX, &len);
-    if (result == E_FTP_RESULT_OK) {
-        // bufptr is moved as commands are being popped
-        ftp_cmd_index_t cmd = ftp_pop_command(&bufptr);
-        if (!ftp_data.loggin.passvalid && (cmd != E_FTP_CMD_USER && cmd != E_FTP_CMD_PASS && cmd != E_FTP_CMD_QUIT)) {
-            ftp_send_reply(332, NULL);
-            return;
-        }
-        if ((cmd >= 0) && (cmd < E_FTP_NUM_FTP_CMDS)) {
-        	ESP_LOGD(FTP_TAG, "CMD: %s", ftp_cmd_table[cmd].cmd);
-        }
-        else {
-        	ESP_LOGD(FTP_TAG, "CMD: %d", cmd);
-        }
-        switch (cmd) {
-        case E_FTP_CMD_FEAT:
-            ftp_send_reply(211, "no-features");
-            break;
-        case E_FTP_CMD_SYST:
-            ftp_send_reply(215, "UNIX Type: L8");
-            break;
-        case E_FTP_CMD_CDUP:
-            ftp_close_child(ftp_path);
-            ftp_send_reply(250, NULL);
-            break;
-        case E_FTP_CMD_CWD:
-            {
-                ftp_pop_param (&bufptr, ftp_scratch_buffer, false);
-                ftp_open_child (ftp_path, ftp_scratch_buffer);
-                if ((ftp_path[0] == '/') && (ftp_path[1] == '\0')) {
-                    ftp_data.dp = NULL;
-                    ftp_send_reply(250, NULL);
+    s->closechild = false;
+    s->cmd_buffer[len] = '\0';
+    s->ctimeout = 0;
+
+    // bufptr is moved as commands are being popped
+    ftp_cmd_index_t cmd = ftp_pop_command(&bufptr);
+    if (!s->loggin.passvalid && (cmd != E_FTP_CMD_USER && cmd != E_FTP_CMD_PASS && cmd != E_FTP_CMD_QUIT)) {
+        ftp_send_reply(s, 332, NULL);
+        return;
+    }
+    if ((cmd >= 0) && (cmd < E_FTP_NUM_FTP_CMDS)) {
+    	ESP_LOGD(FTP_TAG, "CMD: %s", ftp_cmd_table[cmd].cmd);
+    }
+    else {
+    	ESP_LOGD(FTP_TAG, "CMD: %d", cmd);
+    }
+    // RNTO must follow its RNFR directly
+    if (cmd != E_FTP_CMD_RNTO) s->rnfr_path[0] = '\0';
+    switch (cmd) {
+    case E_FTP_CMD_FEAT:
+        ftp_send_raw(s, ftp_features);
+        break;
+    case E_FTP_CMD_SYST:
+        ftp_send_reply(s, 215, "UNIX Type: L8");
+        break;
+    case E_FTP_CMD_CDUP:
+        ftp_close_child(s->path);
+        ftp_send_reply(s, 250, NULL);
+        break;
+    case E_FTP_CMD_CWD:
+        {
+            ftp_pop_param (&bufptr, s->scratch, false);
+            ftp_open_child (s->path, s->scratch);
+            if ((s->path[0] == '/') && (s->path[1] == '\0')) {
+                ftp_send_reply(s, 250, NULL);
+            }
+            else {
+            	DIR *dp = opendir(s->path);
+                if (dp != NULL) {
+                    closedir(dp);
+                    ftp_send_reply(s, 250, NULL);
                 }
                 else {
-                	ftp_data.dp = opendir(ftp_path);
-                    if (ftp_data.dp != NULL) {
-                        closedir(ftp_data.dp);
-                        ftp_data.dp = NULL;
-                        ftp_send_reply(250, NULL);
-                    }
-                    else {
-                        ftp_close_child (ftp_path);
-                        ftp_send_reply(550, NULL);
-                    }
+                    ftp_close_child (s->path);
+                    ftp_send_reply(s, 550, NULL);
                 }
             }
-            break;
-        case E_FTP_CMD_PWD:
-        case E_FTP_CMD_XPWD:
-        	{
-        		char lpath[128];
-        		if (strstr(ftp_path, VFS_NATIVE_MOUNT_POINT) == ftp_path) {
-        			sprintf(lpath, "%s%s", VFS_NATIVE_INTERNAL_MP, ftp_path+strlen(VFS_NATIVE_MOUNT_POINT));
-        		}
-        		else if (strstr(ftp_path, VFS_NATIVE_SDCARD_MOUNT_POINT) == ftp_path) {
-        			sprintf(lpath, "%s%s", VFS_NATIVE_EXTERNAL_MP, ftp_path+strlen(VFS_NATIVE_SDCARD_MOUNT_POINT));
-        		}
-        		else strcpy(lpath,ftp_path);
-
-        		ftp_send_reply(257, lpath);
-        	}
-            break;
-        case E_FTP_CMD_SIZE:
-            {
-                ftp_get_param_and_open_child (&bufptr);
-            	int res = stat(ftp_path, &buf);
-            	if (res == 0) {
-                    // send the file size
-                    snprintf((char *)ftp_data.dBuffer, ftp_buff_size, "%u", (uint32_t)buf.st_size);
-                    ftp_send_reply(213, (char *)ftp_data.dBuffer);
-                } else {
-                    ftp_send_reply(550, NULL);
-                }
-            }
-            break;
-        case E_FTP_CMD_MDTM:
-            ftp_get_param_and_open_child (&bufptr);
-        	res = stat(ftp_path, &buf);
-        	if (res < 0) {
-                // send the file modification time
-                snprintf((char *)ftp_data.dBuffer, ftp_buff_size, "%u", (uint32_t)buf.st_mtime);
-                ftp_send_reply(213, (char *)ftp_data.dBuffer);
-            } else {
-                ftp_send_reply(550, NULL);
-            }
-            break;
-        case E_FTP_CMD_TYPE:
-            ftp_send_reply(200, NULL);
-            break;
-        case E_FTP_CMD_USER:
-            ftp_pop_param (&bufptr, ftp_scratch_buffer, true);
-            if (!memcmp(ftp_scratch_buffer, ftp_user, MAX(strlen(ftp_scratch_buffer), strlen(ftp_user)))) {
-                ftp_data.loggin.uservalid = true && (strlen(ftp_user) == strlen(ftp_scratch_buffer));
-            }
-            ftp_send_reply(331, NULL);
-            break;
-        case E_FTP_CMD_PASS:
-            ftp_pop_param (&bufptr, ftp_scratch_buffer, true);
-            if (!memcmp(ftp_scratch_buffer, ftp_pass, MAX(strlen(ftp_scratch_buffer), strlen(ftp_pass))) &&
-                    ftp_data.loggin.uservalid) {
-                ftp_data.loggin.passvalid = true && (strlen(ftp_pass) == strlen(ftp_scratch_buffer));
-                if (ftp_data.loggin.passvalid) {
-                    ftp_send_reply(230, NULL);
-                    break;
-                }
+        }
+        break;
+    case E_FTP_CMD_PWD:
+    case E_FTP_CMD_XPWD:
+    	{
+    		char lpath[128];
+    		if (strstr(s->path, VFS_NATIVE_MOUNT_POINT) == s->path) {
+    			sprintf(lpath, "%s%s", VFS_NATIVE_INTERNAL_MP, s->path+strlen(VFS_NATIVE_MOUNT_POINT));
+    		}
+    		else if (strstr(s->path, VFS_NATIVE_SDCARD_MOUNT_POINT) == s->path) {
+    			sprintf(lpath, "%s%s", VFS_NATIVE_EXTERNAL_MP, s->path+strlen(VFS_NATIVE_SDCARD_MOUNT_POINT));
+    		}
+    		else strcpy(lpath,s->path);
+
+    		ftp_send_reply(s, 257, lpath);
+    	}
+        break;
+    case E_FTP_CMD_SIZE:
+        ftp_get_param_and_open_child(s, &bufptr);
+    	res = stat(s->path, &buf);
+    	if ((res == 0) && !S_ISDIR(buf.st_mode)) {
+            // send the file size
+            snprintf(str, sizeof(str), "%u", (uint32_t)buf.st_size);
+            ftp_send_reply(s, 213, str);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_MDTM:
+        ftp_get_param_and_open_child(s, &bufptr);
+    	res = stat(s->path, &buf);
+    	if (res == 0) {
+            // send the file modification time (RFC 3659, UTC)
+            strftime(str, sizeof(str), "%Y%m%d%H%M%S", gmtime(&buf.st_mtime));
+            ftp_send_reply(s, 213, str);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_TYPE:
+        ftp_send_reply(s, 200, NULL);
+        break;
+    case E_FTP_CMD_USER:
+        ftp_pop_param (&bufptr, s->scratch, true);
+        if (!memcmp(s->scratch, ftp_user, MAX(strlen(s->scratch), strlen(ftp_user)))) {
+            s->loggin.uservalid = true && (strlen(ftp_user) == strlen(s->scratch));
+        }
+        ftp_send_reply(s, 331, NULL);
+        break;
+    case E_FTP_CMD_PASS:
+        ftp_pop_param (&bufptr, s->scratch, true);
+        if (!memcmp(s->scratch, ftp_pass, MAX(strlen(s->scratch), strlen(ftp_pass))) &&
+                s->loggin.uservalid) {
+            s->loggin.passvalid = true && (strlen(ftp_pass) == strlen(s->scratch));
+            if (s->loggin.passvalid) {
+                ftp_send_reply(s, 230, NULL);
+                break;
             }
-            ftp_send_reply(530, NULL);
-            break;
-        case E_FTP_CMD_PASV:
-            {
-                // some servers (e.g. google chrome) send PASV several times very quickly
-                closesocket(ftp_data.d_sd);
-                ftp_data.d_sd = -1;
-                ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
-                bool socketcreated = true;
-                if (ftp_data.ld_sd < 0) {
-                    socketcreated = ftp_create_listening_socket(&ftp_data.ld_sd, FTP_PASIVE_DATA_PORT, FTP_DATA_CLIENTS_MAX - 1);
-                }
-                if (socketcreated) {
-                    uint8_t *pip = (uint8_t *)&ftp_data.ip_addr;
-                    ftp_data.dtimeout = 0;
-                    snprintf((char *)ftp_data.dBuffer, ftp_buff_size, "(%u,%u,%u,%u,%u,%u)",
-                             pip[0], pip[1], pip[2], pip[3], (FTP_PASIVE_DATA_PORT >> 8), (FTP_PASIVE_DATA_PORT & 0xFF));
-                    ftp_data.substate = E_FTP_STE_SUB_LISTEN_FOR_DATA;
-                	ESP_LOGD(FTP_TAG, "Data socket created");
-                    ftp_send_reply(227, (char *)ftp_data.dBuffer);
-                } else {
-                	ESP_LOGW(FTP_TAG, "Error creating data socket");
-                    ftp_send_reply(425, NULL);
-                }
+        }
+        ftp_send_reply(s, 530, NULL);
+        break;
+    case E_FTP_CMD_PASV:
+        {
+            // some servers (e.g. google chrome) send PASV several times very quickly
+            if (s->d_sd >= 0) closesocket(s->d_sd);
+            s->d_sd = -1;
+            s->substate = E_FTP_STE_SUB_DISCONNECTED;
+            // each session listens on its own data port
+            uint32_t port = FTP_PASIVE_DATA_PORT + (s - ftp_sessions);
+            bool socketcreated = true;
+            if (s->ld_sd < 0) {
+                socketcreated = ftp_create_listening_socket(&s->ld_sd, port, FTP_DATA_CLIENTS_MAX - 1);
             }
-            break;
-        case E_FTP_CMD_LIST:
-            if (ftp_open_dir_for_listing(ftp_path) == E_FTP_RESULT_CONTINUE) {
-                ftp_data.state = E_FTP_STE_CONTINUE_LISTING;
-                ftp_send_reply(150, NULL);
+            if (socketcreated) {
+                uint8_t *pip = (uint8_t *)&s->ip_addr;
+                s->dtimeout = 0;
+                snprintf(s->scratch, FTP_MAX_PARAM_SIZE, "(%u,%u,%u,%u,%u,%u)",
+                         pip[0], pip[1], pip[2], pip[3], (port >> 8), (port & 0xFF));
+                s->substate = E_FTP_STE_SUB_LISTEN_FOR_DATA;
+            	ESP_LOGD(FTP_TAG, "Data socket created");
+                ftp_send_reply(s, 227, s->scratch);
             } else {
-                ftp_send_reply(550, NULL);
+            	ESP_LOGW(FTP_TAG, "Error creating data socket");
+                ftp_send_reply(s, 425, NULL);
             }
-            break;
-        case E_FTP_CMD_RETR:
-        	ftp_data.total = 0;
-        	ftp_data.time = 0;
-            ftp_get_param_and_open_child(&bufptr);
-            if (ftp_open_file(ftp_path, "rb")) {
-                ftp_data.state = E_FTP_STE_CONTINUE_FILE_TX;
-	            vTaskDelay(50 / portTICK_PERIOD_MS);
-                ftp_send_reply(150, NULL);
-            } else {
-                ftp_data.state = E_FTP_STE_END_TRANSFER;
-                ftp_send_reply(550, NULL);
+        }
+        break;
+    case E_FTP_CMD_LIST:
+    case E_FTP_CMD_MLSD:
+    	s->total = 0;
+    	s->time = 0;
+        if (ftp_open_dir_for_listing(s, s->path, (cmd == E_FTP_CMD_MLSD)) == E_FTP_RESULT_CONTINUE) {
+            ftp_start_transfer(s, E_FTP_STE_CONTINUE_LISTING);
+            ftp_send_reply(s, 150, NULL);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_RETR:
+    	s->total = 0;
+    	s->time = 0;
+        ftp_get_param_and_open_child(s, &bufptr);
+        if (ftp_open_file(s, s->path, "rb") && ftp_seek_rest(s)) {
+            ftp_start_transfer(s, E_FTP_STE_CONTINUE_FILE_TX);
+            ftp_send_reply(s, 150, NULL);
+        } else {
+            s->state = E_FTP_STE_END_TRANSFER;
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_APPE:
+    case E_FTP_CMD_STOR:
+    	s->total = 0;
+    	s->time = 0;
+        ftp_get_param_and_open_child(s, &bufptr);
+        {
+            // STOR after REST overwrites the existing file from the given offset
+            bool opened;
+            if (cmd == E_FTP_CMD_APPE) {
+                s->rest = 0;
+                opened = ftp_open_file(s, s->path, "ab");
             }
-            break;
-        case E_FTP_CMD_APPE:
-        	ftp_data.total = 0;
-        	ftp_data.time = 0;
-            ftp_get_param_and_open_child(&bufptr);
-			if (ftp_open_file(ftp_path, "ab")) {
-				ftp_data.state = E_FTP_STE_CONTINUE_FILE_RX;
-	            vTaskDelay(50 / portTICK_PERIOD_MS);
-				ftp_send_reply(150, NULL);
-			} else {
-				ftp_data.state = E_FTP_STE_END_TRANSFER;
-				ftp_send_reply(550, NULL);
-			}
-            break;
-        case E_FTP_CMD_STOR:
-        	ftp_data.total = 0;
-        	ftp_data.time = 0;
-            ftp_get_param_and_open_child(&bufptr);
-			if (ftp_open_file(ftp_path, "wb")) {
-				ftp_data.state = E_FTP_STE_CONTINUE_FILE_RX;
-	            vTaskDelay(50 / portTICK_PERIOD_MS);
-				ftp_send_reply(150, NULL);
+            else if (s->rest > 0) opened = ftp_open_file(s, s->path, "r+b") && ftp_seek_rest(s);
+            else opened = ftp_open_file(s, s->path, "wb");
+
+			if (opened) {
+				ftp_start_transfer(s, E_FTP_STE_CONTINUE_FILE_RX);
+				ftp_send_reply(s, 150, NULL);
 			} else {
-				ftp_data.state = E_FTP_STE_END_TRANSFER;
-				ftp_send_reply(550, NULL);
+				s->state = E_FTP_STE_END_TRANSFER;
+				ftp_send_reply(s, 550, NULL);
 			}
-            break;
-        case E_FTP_CMD_DELE:
-        case E_FTP_CMD_RMD:
-            ftp_get_param_and_open_child(&bufptr);
-            if (unlink(ftp_path) >= 0) {
-                vTaskDelay(50 / portTICK_PERIOD_MS);
-                ftp_send_reply(250, NULL);
-            } else {
-                ftp_send_reply(550, NULL);
+        }
+        break;
+    case E_FTP_CMD_REST:
+        ftp_pop_param(&bufptr, s->scratch, true);
+        {
+            char *endptr;
+            s->rest = strtoul(s->scratch, &endptr, 10);
+            if ((endptr != s->scratch) && (*endptr == '\0')) {
+                ftp_send_reply(s, 350, NULL);
             }
-            break;
-        case E_FTP_CMD_MKD:
-            ftp_get_param_and_open_child(&bufptr);
-            if (mkdir(ftp_path, 0755) == 0) {
-                vTaskDelay(50 / portTICK_PERIOD_MS);
-                ftp_send_reply(250, NULL);
-            } else {
-                ftp_send_reply(550, NULL);
+            else {
+                s->rest = 0;
+                ftp_send_reply(s, 501, NULL);
             }
+        }
+        break;
+    case E_FTP_CMD_DELE:
+    case E_FTP_CMD_RMD:
+        ftp_get_param_and_open_child(s, &bufptr);
+        if (unlink(s->path) >= 0) {
+            ftp_send_reply(s, 250, NULL);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_MKD:
+        ftp_get_param_and_open_child(s, &bufptr);
+        if (mkdir(s->path, 0755) == 0) {
+            ftp_send_reply(s, 250, NULL);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_RNFR:
+        ftp_get_param_and_open_child(s, &bufptr);
+    	res = stat(s->path, &buf);
+    	if (res == 0) {
+            ftp_send_reply(s, 350, NULL);
+            // save the path of the file to rename
+            strcpy(s->rnfr_path, s->path);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        break;
+    case E_FTP_CMD_RNTO:
+        ftp_get_param_and_open_child(s, &bufptr);
+        if (s->rnfr_path[0] == '\0') {
+            ftp_send_reply(s, 503, NULL);
+        } else if (rename(s->rnfr_path, s->path) == 0) {
+            ftp_send_reply(s, 250, NULL);
+        } else {
+            ftp_send_reply(s, 550, NULL);
+        }
+        s->rnfr_path[0] = '\0';
+        break;
+    case E_FTP_CMD_NOOP:
+        ftp_send_reply(s, 200, NULL);
+        break;
+    case E_FTP_CMD_QUIT:
+        ftp_send_reply(s, 221, NULL);
+        break;
+    default:
+        // command not implemented
+        ftp_send_reply(s, 502, NULL);
+        break;
+    }
+
+    if (s->closechild) {
+        remove_fname_from_path(s->path, s->scratch);
+    }
+}
+
+//---------------------------------------
+static void ftp_wait_for_enabled (void) {
+    // Check if the ftp service has been enabled
+    if (ftp_data.enabled) {
+        ftp_data.state = E_FTP_STE_START;
+    }
+}
+
+// Accept a new client into a free session slot
+//--------------------------------------
+static void ftp_accept_client (void) {
+    int32_t sd;
+    uint32_t ip_addr;
+    if (E_FTP_RESULT_OK != ftp_wait_for_connection(ftp_data.lc_sd, &sd, &ip_addr)) return;
+
+    ftp_session_t *s = NULL;
+    for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+        if (ftp_sessions[i].c_sd < 0) {
+            s = &ftp_sessions[i];
             break;
-        case E_FTP_CMD_RNFR:
-            ftp_get_param_and_open_child(&bufptr);
-        	res = stat(ftp_path, &buf);
-        	if (res == 0) {
-                ftp_send_reply(350, NULL);
-                // save the path of the file to rename
-                strcpy((char *)ftp_data.dBuffer, ftp_path);
-            } else {
-                ftp_send_reply(550, NULL);
-            }
+        }
+    }
+    if (s) {
+        s->dSize = ftp_buff_size;
+        s->dBuffer[0] = ftp_buffer_alloc(s->dSize);
+        s->dBuffer[1] = ftp_buffer_alloc(s->dSize);
+    }
+    if ((s == NULL) || (s->dBuffer[0] == NULL) || (s->dBuffer[1] == NULL)) {
+        static const char busy[] = "421 Too many connections\r\n";
+        send(sd, busy, sizeof(busy) - 1, 0);
+        closesocket(sd);
+        if (s) ftp_close_session(s);
+        ESP_LOGW(FTP_TAG, "Connection refused, no free session.");
+        return;
+    }
+
+    s->c_sd = sd;
+    s->ip_addr = ip_addr;
+    s->state = E_FTP_STE_READY;
+    s->substate = E_FTP_STE_SUB_DISCONNECTED;
+    s->logginRetries = 0;
+    s->ctimeout = 0;
+    s->rest = 0;
+    s->loggin.uservalid = false;
+    s->loggin.passvalid = false;
+    strcpy (s->path, "/");
+    ESP_LOGI(FTP_TAG, "Connected (session %d).", (int)(s - ftp_sessions));
+    ftp_send_reply (s, 220, "Micropython FTP Server");
+}
+
+// Run one session, returns true if it has more work which does not need to wait for a socket
+//---------------------------------------------------------------
+static bool ftp_session_run (ftp_session_t *s, uint32_t elapsed) {
+    bool busy = false;
+
+    s->dtimeout += elapsed;
+	s->ctimeout += elapsed;
+	s->time += elapsed;
+	s->rtimeout += elapsed;
+
+    if (s->reply_len > 0) {
+        ftp_reply_pump(s);
+        if (s->c_sd < 0) return false;
+    }
+
+    switch (s->state) {
+        case E_FTP_STE_READY:
+			if ((s->substate != E_FTP_STE_SUB_LISTEN_FOR_DATA) && (s->reply_len == 0)) {
+                int32_t len;
+                ftp_result_t result = ftp_recv_non_blocking(s->c_sd, s->cmd_buffer, FTP_MAX_PARAM_SIZE + FTP_CMD_SIZE_MAX - 1, &len);
+                if (result == E_FTP_RESULT_OK) {
+                    ftp_process_cmd(s, len);
+                    if (s->c_sd < 0) return false;
+                }
+                else if (result == E_FTP_RESULT_CONTINUE) {
+                    if (s->ctimeout > ftp_timeout) {
+                        ESP_LOGI(FTP_TAG, "Connection timeout");
+                        ftp_send_reply(s, 221, NULL);
+                        return false;
+                    }
+                }
+                else {
+                    ftp_close_session(s);
+                    ESP_LOGI(FTP_TAG, "Disconnected.");
+                    return false;
+                }
+			}
             break;
-        case E_FTP_CMD_RNTO:
-            ftp_get_param_and_open_child(&bufptr);
-            // the path of the file to rename was saved in the data buffer
-            if (rename((char *)ftp_data.dBuffer, ftp_path) == 0) {
-                ftp_send_reply(250, NULL);
-            } else {
-                ftp_send_reply(550, NULL);
-            }
+        case E_FTP_STE_END_TRANSFER:
+        	if (s->d_sd >= 0) {
+				closesocket(s->d_sd);
+				s->d_sd = -1;
+        	}
             break;
-        case E_FTP_CMD_NOOP:
-            ftp_send_reply(200, NULL);
+        case E_FTP_STE_CONTINUE_LISTING:
+        case E_FTP_STE_CONTINUE_FILE_TX:
+            s->ctimeout = 0;
+            if (s->d_sd >= 0) busy = ftp_tx_pump(s);
             break;
-        case E_FTP_CMD_QUIT:
-            ftp_send_reply(221, NULL);
+        case E_FTP_STE_CONTINUE_FILE_RX:
+            if (s->d_sd >= 0) ftp_rx_pump(s);
             break;
         default:
-            // command not implemented
-            ftp_send_reply(502, NULL);
             break;
-        }
+    }
+    if (s->c_sd < 0) return false;
 
-        if (ftp_data.closechild) {
-            remove_fname_from_path(ftp_path, ftp_scratch_buffer);
+    switch (s->substate) {
+    case E_FTP_STE_SUB_DISCONNECTED:
+        break;
+    case E_FTP_STE_SUB_LISTEN_FOR_DATA:
+        if (E_FTP_RESULT_OK == ftp_wait_for_connection(s->ld_sd, &s->d_sd, NULL)) {
+            s->dtimeout = 0;
+            s->substate = E_FTP_STE_SUB_DATA_CONNECTED;
+            busy = true;
+			ESP_LOGD(FTP_TAG, "Data socket connected");
         }
-    }
-    else if (result == E_FTP_RESULT_CONTINUE) {
-        if (ftp_data.ctimeout > ftp_timeout) {
-            ftp_send_reply(221, NULL);
-        	ESP_LOGI(FTP_TAG, "Connection timeout");
+        else if (s->dtimeout > FTP_DATA_TIMEOUT_MS) {
+            s->dtimeout = 0;
+            // close the listening socket
+            closesocket(s->ld_sd);
+            s->ld_sd = -1;
+            s->substate = E_FTP_STE_SUB_DISCONNECTED;
+            ESP_LOGW(FTP_TAG, "Waiting for data connection timeout");
         }
+        break;
+    case E_FTP_STE_SUB_DATA_CONNECTED:
+        if (s->state == E_FTP_STE_READY && (s->dtimeout > FTP_DATA_TIMEOUT_MS)) {
+            // close the listening and the data socket
+            closesocket(s->ld_sd);
+            s->ld_sd = -1;
+            ftp_close_data(s);
+            s->substate = E_FTP_STE_SUB_DISCONNECTED;
+            ESP_LOGW(FTP_TAG, "Data connection timeout");
+        }
+        break;
+    default:
+        break;
     }
-    else {
-        ftp_close_cmd_data();
+
+    // the data socket is closed on the next run
+    if (s->state == E_FTP_STE_END_TRANSFER) busy = true;
+
+    // check the state of the data sockets
+    if (s->d_sd < 0 && (s->state > E_FTP_STE_READY)) {
+        ftp_close_files(s);
+        s->substate = E_FTP_STE_SUB_DISCONNECTED;
+        s->state = E_FTP_STE_READY;
+		ESP_LOGD(FTP_TAG, "Data socket disconnected");
     }
+    return busy;
 }
 
-//---------------------------------------
-static void ftp_wait_for_enabled (void) {
-    // Check if the telnet service has been enabled
-    if (ftp_data.enabled) {
-        ftp_data.state = E_FTP_STE_START;
+// Return true if a transfer is in progress on any session
+//------------------------------------
+static bool ftp_transfer_active (void) {
+    for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+        if ((ftp_sessions[i].c_sd >= 0) && (ftp_sessions[i].state > E_FTP_STE_READY)) return true;
     }
+    return false;
 }
 
 // ==== PUBLIC FUNCTIONS ===================================================================
 
 //---------------------
 void ftp_deinit(void) {
-	if (ftp_path) free(ftp_path);
-	if (ftp_cmd_buffer) free(ftp_cmd_buffer);
-	if (ftp_data.dBuffer) free(ftp_data.dBuffer);
-	if (ftp_scratch_buffer) free(ftp_scratch_buffer);
-	ftp_path = NULL;
-	ftp_cmd_buffer = NULL;
-	ftp_data.dBuffer = NULL;
-	ftp_scratch_buffer = NULL;
+    for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+        ftp_session_t *s = &ftp_sessions[i];
+        if (s->dBuffer[0]) free(s->dBuffer[0]);
+        if (s->dBuffer[1]) free(s->dBuffer[1]);
+        if (s->path) free(s->path);
+        if (s->cmd_buffer) free(s->cmd_buffer);
+        if (s->scratch) free(s->scratch);
+        if (s->rnfr_path) free(s->rnfr_path);
+        if (s->reply) free(s->reply);
+        s->dBuffer[0] = NULL;
+        s->dBuffer[1] = NULL;
+        s->path = NULL;
+        s->cmd_buffer = NULL;
+        s->scratch = NULL;
+        s->rnfr_path = NULL;
+        s->reply = NULL;
+    }
 }
 
 //-------------------
 void ftp_init(void) {
 	ftp_stop = 0;
-    // Allocate memory for the data buffer, and the file system structures (from the RTOS heap)
+    // Allocate memory for the file system structures (from the RTOS heap)
+    // transfer buffers are allocated when a client connects
 	ftp_deinit();
 
 	memset(&ftp_data, 0, sizeof(ftp_data_t));
-	ftp_data.dBuffer = malloc(ftp_buff_size);
-	ftp_path = malloc(FTP_MAX_PARAM_SIZE);
-	ftp_scratch_buffer = malloc(FTP_MAX_PARAM_SIZE);
-	ftp_cmd_buffer = malloc(FTP_MAX_PARAM_SIZE + FTP_CMD_SIZE_MAX);
-
-    //SOCKETFIFO_Init((void *)ftp_fifoelements, FTP_SOCKETFIFO_ELEMENTS_MAX);
+	memset(ftp_sessions, 0, sizeof(ftp_sessions));
+    for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+        ftp_session_t *s = &ftp_sessions[i];
+        s->path = malloc(FTP_MAX_PARAM_SIZE);
+        s->scratch = malloc(FTP_MAX_PARAM_SIZE);
+        s->cmd_buffer = malloc(FTP_MAX_PARAM_SIZE + FTP_CMD_SIZE_MAX);
+        s->rnfr_path = malloc(FTP_MAX_PARAM_SIZE);
+        s->reply = malloc(FTP_REPLY_BUF_SIZE);
+        s->rnfr_path[0] = '\0';
+        s->c_sd  = -1;
+        s->d_sd  = -1;
+        s->ld_sd = -1;
+        s->e_open = E_FTP_NOTHING_OPEN;
+        s->state = E_FTP_STE_READY;
+        s->substate = E_FTP_STE_SUB_DISCONNECTED;
+    }
 
-    ftp_data.c_sd  = -1;
-    ftp_data.d_sd  = -1;
     ftp_data.lc_sd = -1;
-    ftp_data.ld_sd = -1;
-    ftp_data.e_open = E_FTP_NOTHING_OPEN;
     ftp_data.state = E_FTP_STE_DISABLED;
-    ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
 
     if (ftp_mutex == NULL) ftp_mutex = xSemaphoreCreateMutex();
 }
 
+// Returns 1 if some session can make progress without waiting for a socket
 //============================
 int ftp_run (uint32_t elapsed)
 {
     if (xSemaphoreTake(ftp_mutex, FTP_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return -1;
-    if (ftp_stop) return -2;
-
-    ftp_data.dtimeout += elapsed;
-	ftp_data.ctimeout += elapsed;
-	ftp_data.time += elapsed;
+    if (ftp_stop) {
+    	xSemaphoreGive(ftp_mutex);
+    	return -2;
+    }
 
+    int res = 0;
     switch (ftp_data.state) {
         case E_FTP_STE_DISABLED:
             ftp_wait_for_enabled();
             break;
         case E_FTP_STE_START:
-            if (ftp_create_listening_socket(&ftp_data.lc_sd, FTP_CMD_PORT, FTP_CMD_CLIENTS_MAX - 1)) {
+            if (ftp_create_listening_socket(&ftp_data.lc_sd, FTP_CMD_PORT, FTP_CMD_CLIENTS_MAX)) {
                 ftp_data.state = E_FTP_STE_READY;
             }
             break;
         case E_FTP_STE_READY:
-            if (ftp_data.c_sd < 0 && ftp_data.substate == E_FTP_STE_SUB_DISCONNECTED) {
-                if (E_FTP_RESULT_OK == ftp_wait_for_connection(ftp_data.lc_sd, &ftp_data.c_sd, &ftp_data.ip_addr)) {
-                    ftp_data.txRetries = 0;
-                    ftp_data.logginRetries = 0;
-                    ftp_data.ctimeout = 0;
-                    ftp_data.loggin.uservalid = false;
-                    ftp_data.loggin.passvalid = false;
-                    strcpy (ftp_path, "/");
-                    ESP_LOGI(FTP_TAG, "Connected.");
-                    ftp_send_reply (220, "Micropython FTP Server");
-                    break;
-                }
+            ftp_accept_client();
+            for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+                if (ftp_sessions[i].c_sd < 0) continue;
+                if (ftp_session_run(&ftp_sessions[i], elapsed)) res = 1;
             }
-			if (ftp_data.c_sd > 0 && ftp_data.substate != E_FTP_STE_SUB_LISTEN_FOR_DATA) {
-				ftp_process_cmd();
-				if (ftp_data.state != E_FTP_STE_READY) {
-					break;
-				}
-			}
-            break;
-        case E_FTP_STE_END_TRANSFER:
-        	if (ftp_data.d_sd >= 0) {
-				closesocket(ftp_data.d_sd);
-				ftp_data.d_sd = -1;
-        	}
-            break;
-        case E_FTP_STE_CONTINUE_LISTING:
-            // go on with listing
-        	{
-                uint32_t listsize;
-                ftp_list_dir((char *)ftp_data.dBuffer, ftp_buff_size, &listsize);
-                if (listsize > 0) {
-                    ftp_send_list(listsize);
-                    if (ftp_data.listroot) {
-                        ftp_send_reply(226, NULL);
-                        ftp_data.state = E_FTP_STE_END_TRANSFER;
-                    }
-                } else {
-                    ftp_send_reply(226, NULL);
-                    ftp_data.state = E_FTP_STE_END_TRANSFER;
-                }
-                ftp_data.ctimeout = 0;
-            }
-            break;
-        case E_FTP_STE_CONTINUE_FILE_TX:
-            // read and send the next block from the file
-        	{
-                uint32_t readsize;
-                ftp_result_t result;
-                ftp_data.ctimeout = 0;
-                result = ftp_read_file ((char *)ftp_data.dBuffer, ftp_buff_size, &readsize);
-                if (result == E_FTP_RESULT_FAILED) {
-                    ftp_send_reply(451, NULL);
-                    ftp_data.state = E_FTP_STE_END_TRANSFER;
-                }
-                else {
-                    if (readsize > 0) {
-                        ftp_send_file_data(readsize);
-                        ftp_data.total += readsize;
-						ESP_LOGD(FTP_TAG, "Sent %u, total: %u", readsize, ftp_data.total);
-                    }
-                    if (result == E_FTP_RESULT_OK) {
-                        ftp_send_reply(226, NULL);
-                        ftp_data.state = E_FTP_STE_END_TRANSFER;
-    					ESP_LOGI(FTP_TAG, "File sent (%u bytes in %u msek).", ftp_data.total, ftp_data.time);
-                    }
-                }
-            }
-            break;
-        case E_FTP_STE_CONTINUE_FILE_RX:
-        	{
-                int32_t len;
-                ftp_result_t result = E_FTP_RESULT_OK;
-
-                result = ftp_recv_non_blocking(ftp_data.d_sd, ftp_data.dBuffer, ftp_buff_size, &len);
-				if (result == E_FTP_RESULT_OK) {
-					// block of data received
-					ftp_data.dtimeout = 0;
-					ftp_data.ctimeout = 0;
-					// save received data to file
-					if (E_FTP_RESULT_OK != ftp_write_file ((char *)ftp_data.dBuffer, len)) {
-						ftp_send_reply(451, NULL);
-						ftp_data.state = E_FTP_STE_END_TRANSFER;
-						ESP_LOGW(FTP_TAG, "Error writing to file");
-					}
-					else {
-						ftp_data.total += len;
-						ESP_LOGD(FTP_TAG, "Received %u, total: %u", len, ftp_data.total);
-					}
-				}
-				else if (result == E_FTP_RESULT_CONTINUE) {
-					// nothing received
-					if (ftp_data.dtimeout > FTP_DATA_TIMEOUT_MS) {
-						ftp_close_files();
-						ftp_send_reply(426, NULL);
-						ftp_data.state = E_FTP_STE_END_TRANSFER;
-						ESP_LOGW(FTP_TAG, "Receiving to file timeout");
-					}
-				}
-				else {
-					// File received (E_FTP_RESULT_FAILED)
-					ftp_close_files();
-					ftp_send_reply(226, NULL);
-					ftp_data.state = E_FTP_STE_END_TRANSFER;
-					ESP_LOGI(FTP_TAG, "File received (%u bytes in %u msek).", ftp_data.total, ftp_data.time);
-					break;
-				}
-        	}
             break;
         default:
             break;
     }
 
-    switch (ftp_data.substate) {
-    case E_FTP_STE_SUB_DISCONNECTED:
-        break;
-    case E_FTP_STE_SUB_LISTEN_FOR_DATA:
-        if (E_FTP_RESULT_OK == ftp_wait_for_connection(ftp_data.ld_sd, &ftp_data.d_sd, NULL)) {
-            ftp_data.dtimeout = 0;
-            ftp_data.substate = E_FTP_STE_SUB_DATA_CONNECTED;
-			ESP_LOGD(FTP_TAG, "Data socket connected");
-        }
-        else if (ftp_data.dtimeout > FTP_DATA_TIMEOUT_MS) {
-            ftp_data.dtimeout = 0;
-            // close the listening socket
-            closesocket(ftp_data.ld_sd);
-            ftp_data.ld_sd = -1;
-            ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
-            ESP_LOGW(FTP_TAG, "Waiting for data connection timeout");
-        }
-        break;
-    case E_FTP_STE_SUB_DATA_CONNECTED:
-        if (ftp_data.state == E_FTP_STE_READY && (ftp_data.dtimeout > FTP_DATA_TIMEOUT_MS)) {
-            // close the listening and the data socket
-            closesocket(ftp_data.ld_sd);
-            closesocket(ftp_data.d_sd);
-            ftp_data.ld_sd = -1;
-            ftp_data.d_sd = -1;
-            ftp_close_filesystem_on_error ();
-            ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
-            ESP_LOGW(FTP_TAG, "Data connection timeout");
+    xSemaphoreGive(ftp_mutex);
+    return res;
+}
+
+// Wait up to timeout_ms for activity on any of the server sockets
+// Returns the number of ready sockets, 0 on timeout
+//====================================
+int ftp_wait (uint32_t timeout_ms)
+{
+    fd_set rfds, wfds;
+    int maxfd = -1;
+    // session timeouts are counted in ftp_run, wake up at least that often
+    if (timeout_ms > FTP_IDLE_WAIT_MS) timeout_ms = FTP_IDLE_WAIT_MS;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    if (xSemaphoreTake(ftp_mutex, FTP_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return -1;
+    if ((ftp_data.state == E_FTP_STE_READY) && (ftp_data.lc_sd >= 0)) {
+        FD_SET(ftp_data.lc_sd, &rfds);
+        maxfd = ftp_data.lc_sd;
+        for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+            ftp_session_t *s = &ftp_sessions[i];
+            int sd = -1;
+            if (s->c_sd < 0) continue;
+            if (s->substate == E_FTP_STE_SUB_LISTEN_FOR_DATA) {
+                sd = s->ld_sd;
+                FD_SET(sd, &rfds);
+            }
+            else if ((s->state == E_FTP_STE_CONTINUE_LISTING) || (s->state == E_FTP_STE_CONTINUE_FILE_TX)) {
+                sd = s->d_sd;
+                if (sd >= 0) FD_SET(sd, &wfds);
+            }
+            else if (s->state == E_FTP_STE_CONTINUE_FILE_RX) {
+                sd = s->d_sd;
+                if (sd >= 0) FD_SET(sd, &rfds);
+            }
+            else if (s->reply_len == 0) {
+                sd = s->c_sd;
+                FD_SET(sd, &rfds);
+            }
+            if (s->reply_len > 0) {
+                // a queued reply, wait until the client can take more
+                FD_SET(s->c_sd, &wfds);
+                if (s->c_sd > maxfd) maxfd = s->c_sd;
+            }
+            if (sd > maxfd) maxfd = sd;
         }
-        break;
-    default:
-        break;
     }
+    xSemaphoreGive(ftp_mutex);
 
-    // check the state of the data sockets
-    if (ftp_data.d_sd < 0 && (ftp_data.state > E_FTP_STE_READY)) {
-        ftp_data.substate = E_FTP_STE_SUB_DISCONNECTED;
-        ftp_data.state = E_FTP_STE_READY;
-		ESP_LOGD(FTP_TAG, "Data socket disconnected");
+    if (maxfd < 0) {
+        // the server is not listening, there are no sessions to hold up
+        vTaskDelay(timeout_ms / portTICK_PERIOD_MS);
+        return 0;
     }
-
-    xSemaphoreGive(ftp_mutex);
-    return 0;
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = timeout_ms * 1000;
+    return select(maxfd + 1, &rfds, &wfds, NULL, &tv);
 }
 
 //----------------------
@@ -1243,7 +1524,7 @@ bool ftp_disable (void) {
 	if (xSemaphoreTake(ftp_mutex, FTP_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return false;
 
 	bool res = false;
-    if (ftp_data.state == E_FTP_STE_READY) {
+    if ((ftp_data.state == E_FTP_STE_READY) && !ftp_transfer_active()) {
 		_ftp_reset();
 		ftp_data.enabled = false;
 		ftp_data.state = E_FTP_STE_DISABLED;
@@ -1264,13 +1545,26 @@ bool ftp_reset (void) {
 }
 
 // Return current ftp server state
+// With several clients the state of the first session with a transfer in progress is reported
 //------------------
 int ftp_getstate() {
 	if ((FtpTaskHandle == NULL) || (ftp_mutex == NULL)) return -1;
 	if (xSemaphoreTake(ftp_mutex, FTP_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return -2;
 
-	int fstate = ftp_data.state | (ftp_data.substate << 8);
-	if ((ftp_data.state == E_FTP_STE_READY) && (ftp_data.c_sd > 0)) fstate = E_FTP_STE_CONNECTED;
+	int fstate = ftp_data.state;
+	if (ftp_data.state == E_FTP_STE_READY) {
+		ftp_session_t *connected = NULL;
+	    for (int i = 0; i < FTP_CMD_CLIENTS_MAX; i++) {
+	        ftp_session_t *s = &ftp_sessions[i];
+	        if (s->c_sd < 0) continue;
+	        if ((connected == NULL) || (s->state > E_FTP_STE_READY)) connected = s;
+	        if (s->state > E_FTP_STE_READY) break;
+	    }
+	    if (connected) {
+	    	if (connected->state == E_FTP_STE_READY) fstate = E_FTP_STE_CONNECTED;
+	    	else fstate = connected->state | (connected->substate << 8);
+	    }
+	}
 	xSemaphoreGive(ftp_mutex);
 	return fstate;
 }
@@ -1281,7 +1575,7 @@ bool ftp_terminate (void) {
 	if (xSemaphoreTake(ftp_mutex, FTP_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return false;
 
 	bool res = false;
-    if (ftp_data.state == E_FTP_STE_READY) {
+    if ((ftp_data.state == E_FTP_STE_READY) && !ftp_transfer_active()) {
 		ftp_stop = 1;
 		_ftp_reset();
 		res = true;
@@ -72,6 +72,7 @@ int ftp_timeout;
 void ftp_init (void);
 void ftp_deinit (void);
 int ftp_run (uint32_t elapsed);
+int ftp_wait (uint32_t timeout_ms);
 bool ftp_enable (void);
 bool ftp_isenabled (void);
 bool ftp_disable (void);
@@ -62,13 +62,26 @@
 /******************************************************************************
  DEFINE PRIVATE CONSTANTS
  ******************************************************************************/
+#ifndef CONFIG_MICROPY_TELNET_RX_BUFFER_SIZE
+#define CONFIG_MICROPY_TELNET_RX_BUFFER_SIZE    1024
+#endif
+#ifndef CONFIG_MICROPY_TELNET_TX_BUFFER_SIZE
+#define CONFIG_MICROPY_TELNET_TX_BUFFER_SIZE    4096
+#endif
+
+#ifndef TELNET_PORT
 #define TELNET_PORT                         23
-// rxRindex and rxWindex must be uint8_t and TELNET_RX_BUFFER_SIZE == 256
-#define TELNET_RX_BUFFER_SIZE               256
+#endif
+#define TELNET_RX_BUFFER_SIZE               CONFIG_MICROPY_TELNET_RX_BUFFER_SIZE
+#define TELNET_TX_BUFFER_SIZE               CONFIG_MICROPY_TELNET_TX_BUFFER_SIZE
+#define TELNET_RX_CHUNK_SIZE                256		// received data is parsed in chunks of this size
+#define TELNET_RX_INCOMPLETE_MAX            8		// longest IAC sequence kept for the next chunk
 #define TELNET_MAX_CLIENTS                  1
 #define TELNET_TX_RETRIES_MAX               50
 #define TELNET_WAIT_TIME_MS                 10
+#define TELNET_TX_STALL_MS                  1000	// output is dropped if the client does not read it for this long
 #define TELNET_LOGIN_RETRIES_MAX            3
+#define TELNET_ERASE_LINE_LEN               128
 
 #define SE 240
 #define AYT 246
@@ -115,21 +128,46 @@ typedef union {
     telnet_connected_substate_t connected;
 } telnet_substate_t;
 
+// Single producer, single consumer ring buffer
+// Only the producer writes 'head' and only the consumer writes 'tail',
+// so the two sides don't need a lock; one byte is always left free.
+//   RX: the telnet task produces, the MicroPython task consumes
+//   TX: the MicroPython task produces, the telnet task consumes
+typedef struct {
+    uint8_t             *buf;
+    uint32_t            size;
+    volatile uint32_t   head;
+    volatile uint32_t   tail;
+} telnet_ring_t;
+
 typedef struct {
-    uint8_t             *rxBuffer;
+    telnet_ring_t       rx;
+    telnet_ring_t       tx;
+    uint8_t             *rxChunk;
     uint32_t            timeout;
-    telnet_state_t      state;
+    volatile telnet_state_t state;
     telnet_substate_t   substate;
     int32_t             sd;
     int32_t             n_sd;
 
-    // rxRindex and rxWindex must be uint8_t and TELNET_RX_BUFFER_SIZE == 256
-    uint8_t             rxWindex;
-    uint8_t             rxRindex;
+    // set by the telnet task, the consumer discards RX data up to this index
+    volatile int32_t    rxFlushTo;
 
     // used to store incoming chars in cases the reception needs to be completed later
+    uint8_t             rxIncomplete[TELNET_RX_INCOMPLETE_MAX];
     uint8_t             rxIncompleteLen;
 
+    // a subnegotiation (IAC SB ... IAC SE) is being skipped, it can span chunks
+    bool                rxInSB;
+    bool                rxSBIAC;        // the last byte skipped was an IAC
+
+    // user name or password being received
+    uint8_t             credBuffer[TELNET_USER_PASS_LEN_MAX + 1];
+    uint8_t             credLen;
+
+    // set when the client stopped reading, output is dropped until it reads again
+    volatile bool       txStalled;
+
     uint8_t             txRetries;
     uint8_t             loginRetries;
     bool                enabled;
@@ -157,6 +195,74 @@ static const uint8_t telnet_options_pass[]  = { IAC, WILL, ECHO, IAC, WONT, SUPP
 static const uint8_t telnet_options_repl[]  = { IAC, WILL, ECHO, IAC, WILL, SUPPRESS_GO_AHEAD, IAC, WONT, LINEMODE };
 
 
+// ==== Ring buffer functions ====
+
+//---------------------------------------------------------
+static uint32_t telnet_ring_used (const telnet_ring_t *r) {
+    uint32_t head = r->head;
+    uint32_t tail = r->tail;
+    return (head >= tail) ? (head - tail) : (r->size - tail + head);
+}
+
+//---------------------------------------------------------
+static uint32_t telnet_ring_free (const telnet_ring_t *r) {
+    return r->size - 1 - telnet_ring_used(r);
+}
+
+// Producer side: copy as much of the data as fits, return the number of bytes copied
+//-------------------------------------------------------------------------------------
+static uint32_t telnet_ring_put (telnet_ring_t *r, const uint8_t *data, uint32_t len) {
+    uint32_t head = r->head;
+    uint32_t n = telnet_ring_free(r);
+    if (len < n) n = len;
+    if (n == 0) return 0;
+
+    uint32_t first = r->size - head;
+    if (first > n) first = n;
+    memcpy(r->buf + head, data, first);
+    if (n > first) memcpy(r->buf, data + first, n - first);
+
+    head += n;
+    if (head >= r->size) head -= r->size;
+    // the data must be in the buffer before the consumer can see the new head
+    __sync_synchronize();
+    r->head = head;
+    return n;
+}
+
+// Consumer side: return the length of the contiguous data block at the tail
+//-------------------------------------------------------------------------
+static uint32_t telnet_ring_peek (const telnet_ring_t *r, uint8_t **data) {
+    uint32_t head = r->head;
+    uint32_t tail = r->tail;
+    *data = r->buf + tail;
+    return (head >= tail) ? (head - tail) : (r->size - tail);
+}
+
+//-------------------------------------------------------------
+static void telnet_ring_skip (telnet_ring_t *r, uint32_t len) {
+    uint32_t tail = r->tail + len;
+    if (tail >= r->size) tail -= r->size;
+    __sync_synchronize();
+    r->tail = tail;
+}
+
+//---------------------------------------------------------------
+static bool telnet_ring_alloc (telnet_ring_t *r, uint32_t size) {
+    r->buf = malloc(size);
+    r->size = size;
+    r->head = 0;
+    r->tail = 0;
+    return (r->buf != NULL);
+}
+
+// Discard the received data not yet read by the MicroPython task
+// Only the consumer may move the tail, so it is done on its next read
+//----------------------------------
+static void telnet_rx_flush (void) {
+    telnet_data.rxFlushTo = telnet_data.rx.head;
+}
+
 //--------------------------------
 static void _telnet_reset (void) {
     // close the connection and start all over again
@@ -165,6 +271,8 @@ static void _telnet_reset (void) {
     closesocket(telnet_data.sd);
     telnet_data.sd = -1;
     telnet_data.state = E_TELNET_STE_START;
+    // drop the pending output, the telnet task is the TX consumer
+    telnet_data.tx.tail = telnet_data.tx.head;
 }
 
 //------------------------------------------
@@ -222,7 +330,7 @@ static bool telnet_create_socket (void) {
 
 //---------------------------------------------
 static void telnet_wait_for_connection (void) {
-    socklen_t  in_addrSize;
+    socklen_t  in_addrSize = sizeof(struct sockaddr_in);
     struct sockaddr_in  sClientAddress;
 
     // accepts a connection from a TCP client, if there is any, otherwise returns EAGAIN
@@ -250,10 +358,14 @@ static void telnet_wait_for_connection (void) {
         fcntl(telnet_data.n_sd, F_SETFL, option);
 
         // client connected, so go on
-        telnet_data.rxWindex = 0;
-        telnet_data.rxRindex = 0;
+        telnet_rx_flush();
+        telnet_data.tx.tail = telnet_data.tx.head;
         telnet_data.txRetries = 0;
+        telnet_data.txStalled = false;
         telnet_data.rxIncompleteLen = 0;
+        telnet_data.rxInSB = false;
+        telnet_data.rxSBIAC = false;
+        telnet_data.credLen = 0;
 
         telnet_data.state = E_TELNET_STE_CONNECTED;
         telnet_data.substate.connected = E_TELNET_STE_SUB_WELCOME;
@@ -311,82 +423,115 @@ static uint8_t telnet_get_reply_verb(uint8_t verb) {
     }
 }
 
-//------------------------------------------------------------------------------------------------
-static int telnet_process_IAC (uint8_t **strR, uint8_t **strW, int32_t *len, uint32_t remaining) {
-    if (remaining >= 2)  {
-        switch (*((*strR) + 1)) {
-            case IAC:
-                // double IAC char (0xFF) means escaped 0xFF
-                **strW = 0xFF;
-                (*strW)++;
-                (*strR) += 2;
-                (*len)--;
-                return 0;
-
-            case AYT:
-                // reply to the AYT with an echo of the IAC AYT
-                telnet_send_with_retries (telnet_data.n_sd, (char *) *strR, 2);
-                (*strR) += 2;
-                (*len) -= 2;
-                return 0;
-        }
+// Process the IAC sequence at 'str', escaped 0xFF is written to 'dest'
+// Returns the number of bytes used, 0 if the sequence is not complete
+//-------------------------------------------------------------------------------------
+static uint32_t telnet_process_IAC (uint8_t *str, uint32_t remaining, uint8_t **dest) {
+    if (remaining < 2) return 0;
+
+    uint8_t cmd = str[1];
+    if (cmd == IAC) {
+        // double IAC char (0xFF) means escaped 0xFF
+        *(*dest)++ = 0xFF;
+        return 2;
+    }
+    if (cmd == AYT) {
+        // reply to the AYT with an echo of the IAC AYT
+        telnet_send_with_retries (telnet_data.n_sd, (char *)str, 2);
+        return 2;
+    }
+    if (cmd == SB) {
+        // the rest is skipped by telnet_skip_SB()
+        telnet_data.rxInSB = true;
+        telnet_data.rxSBIAC = false;
+        return 2;
+    }
+    if (cmd < WILL) {
+        // other two byte commands are ignored
+        return 2;
     }
 
-    if (remaining >= 3) {
-        if (*((*strR) + 2) == TRANSMIT_BINARY) {
-            uint8_t option = *((*strR) + 1);
-            if (option == WILL) telnet_data.binary_mode = true;
-            if (option == WONT) telnet_data.binary_mode = false;
-            *((*strR) + 1) = telnet_get_reply_verb(option);
-            telnet_send_with_retries (telnet_data.n_sd, (char *) *strR, 3);
-        }
-        (*strR) += 3;
-        (*len) -= 3;
-        return 0;
-    } else {
-        // no enough characters to continue
-        *len -= remaining;
-        return remaining;
+    // WILL, WONT, DO, DONT <option>
+    if (remaining < 3) return 0;
+    if (str[2] == TRANSMIT_BINARY) {
+        if (cmd == WILL) telnet_data.binary_mode = true;
+        if (cmd == WONT) telnet_data.binary_mode = false;
+        str[1] = telnet_get_reply_verb(cmd);
+        telnet_send_with_retries (telnet_data.n_sd, (char *)str, 3);
     }
-    return 0;
+    return 3;
 }
 
-//-----------------------------------------------------------
-static void telnet_parse_input (uint8_t *str, int32_t *len) {
-    int32_t b_len = *len;
-    uint8_t *b_str = str - telnet_data.rxIncompleteLen;
-
-    *len += telnet_data.rxIncompleteLen;
-    b_len = *len;
-
-    for (uint8_t *_str = b_str; _str < b_str + b_len; ) {
-        uint8_t ch = *_str;
-        if (ch == IAC) {
-            uint32_t remaining = b_len - (_str - b_str);
-            telnet_data.rxIncompleteLen = telnet_process_IAC(&_str, &str, len, remaining);
-            if (telnet_data.rxIncompleteLen > 0) {
-                break;
+// Skip subnegotiation data up to and including IAC SE
+// Returns the number of bytes used, all of them if IAC SE is in a later chunk
+//------------------------------------------------------------------
+static uint32_t telnet_skip_SB (const uint8_t *str, uint32_t remaining) {
+    for (uint32_t i = 0; i < remaining; i++) {
+        if (telnet_data.rxSBIAC) {
+            // IAC IAC is an escaped 0xFF in the subnegotiation data
+            telnet_data.rxSBIAC = false;
+            if (str[i] == SE) {
+                telnet_data.rxInSB = false;
+                return i + 1;
             }
-            continue;
         }
+        else if (str[i] == IAC) {
+            telnet_data.rxSBIAC = true;
+        }
+    }
+    return remaining;
+}
 
-        if (telnet_data.binary_mode == true) {
-            *str++ = *_str++;
+// Remove telnet commands and unwanted characters from the received data (in place)
+// Runs of plain characters are moved as a block, only IAC and control chars are
+// looked at individually. Returns the new data length.
+//-------------------------------------------------------------
+static int32_t telnet_parse_input (uint8_t *str, int32_t len) {
+    uint8_t *src = str;
+    uint8_t *dest = str;
+    uint8_t *end = str + len;
+    bool filter_intr = (telnet_data.state == E_TELNET_STE_LOGGED_IN);
+
+    telnet_data.rxIncompleteLen = 0;
+    while (src < end) {
+        if (telnet_data.rxInSB) {
+            src += telnet_skip_SB(src, end - src);
             continue;
         }
-
-        // in this case the server is not operating on binary mode
-        if (ch > 127 || ch == 0 || (telnet_data.state == E_TELNET_STE_LOGGED_IN && ch == mp_interrupt_char)) {
-            if (ch == mp_interrupt_char) {
-                mp_keyboard_interrupt();
+        // find the end of the run of plain characters
+        uint8_t *run = src;
+        if (telnet_data.binary_mode) {
+            src = memchr(src, IAC, end - src);
+            if (src == NULL) src = end;
+        }
+        else {
+            while ((src < end) && (*src != 0) && (*src < 128) && (!filter_intr || (*src != mp_interrupt_char))) src++;
+        }
+        if (src > run) {
+            if (dest != run) memmove(dest, run, src - run);
+            dest += src - run;
+        }
+        if (src >= end) break;
+
+        if (*src == IAC) {
+            uint32_t used = telnet_process_IAC(src, end - src, &dest);
+            if (used == 0) {
+                // no enough characters to continue, keep them for the next chunk
+                telnet_data.rxIncompleteLen = end - src;
+                memcpy(telnet_data.rxIncomplete, src, telnet_data.rxIncompleteLen);
+                break;
             }
-            // skip this char
-            (*len)--;
-            _str++;
-        } else {
-            *str++ = *_str++;
+            src += used;
+            continue;
+        }
+
+        // in this case the server is not operating on binary mode, skip this char
+        if (filter_intr && (*src == mp_interrupt_char)) {
+            mp_keyboard_interrupt();
         }
+        src++;
     }
+    return dest - str;
 }
 
 //-----------------------------------------------------------------------------------------------------
@@ -396,18 +541,27 @@ static void telnet_send_and_proceed (void *data, int32_t Len, telnet_connected_s
     }
 }
 
-//-------------------------------------------------------------------------------------------------
-static telnet_result_t telnet_recv_text_non_blocking (void *buff, int32_t Maxlen, int32_t *rxLen) {
-    *rxLen = recv(telnet_data.n_sd, buff, Maxlen, 0);
+// Receive up to Maxlen bytes into the chunk buffer and parse them
+// An incomplete IAC sequence from the previous chunk is put in front of the new data
+//-------------------------------------------------------------------------------------
+static telnet_result_t telnet_recv_text_non_blocking (int32_t Maxlen, int32_t *rxLen) {
+    uint8_t *buff = telnet_data.rxChunk;
+    int32_t pending = telnet_data.rxIncompleteLen;
+
+    if (Maxlen > TELNET_RX_CHUNK_SIZE) Maxlen = TELNET_RX_CHUNK_SIZE;
+    if (Maxlen <= pending) return E_TELNET_RESULT_AGAIN;
+    memcpy(buff, telnet_data.rxIncomplete, pending);
+
+    *rxLen = recv(telnet_data.n_sd, buff + pending, Maxlen - pending, 0);
     // if there's data received, parse it
     if (*rxLen > 0) {
         telnet_data.timeout = mp_hal_ticks_ms();
-        telnet_parse_input (buff, rxLen);
+        *rxLen = telnet_parse_input (buff, *rxLen + pending);
         if (*rxLen > 0) {
             return E_TELNET_RESULT_OK;
         }
     }
-    else if (errno != EAGAIN) {
+    else if ((*rxLen == 0) || (errno != EAGAIN)) {
         // error
     	printf("[Telnet] Connection terminated\n");
         _telnet_reset();
@@ -416,36 +570,58 @@ static telnet_result_t telnet_recv_text_non_blocking (void *buff, int32_t Maxlen
     return E_TELNET_RESULT_AGAIN;
 }
 
+// Send the buffered output, as much as the socket accepts
+//------------------------------------
+static void telnet_process_tx (void) {
+    uint8_t *data;
+    uint32_t len;
+
+    while ((len = telnet_ring_peek(&telnet_data.tx, &data)) > 0) {
+        int32_t sent = send(telnet_data.n_sd, data, len, 0);
+        if (sent > 0) {
+            telnet_ring_skip(&telnet_data.tx, sent);
+            telnet_data.timeout = mp_hal_ticks_ms();
+            telnet_data.txStalled = false;
+            if (sent < len) break;
+        }
+        else {
+            if (errno != EAGAIN) {
+            	printf("[Telnet] Send Error\n");
+                _telnet_reset();
+            }
+            break;
+        }
+    }
+}
+
 //---------------------------------
 static void telnet_process (void) {
     int32_t rxLen;
-    int32_t maxLen = (telnet_data.rxWindex >= telnet_data.rxRindex) ? (TELNET_RX_BUFFER_SIZE - telnet_data.rxWindex) :
-                                                                   ((telnet_data.rxRindex - telnet_data.rxWindex) - 1);
-    // to avoid an overrrun
-    maxLen = (telnet_data.rxRindex == 0) ? (maxLen - 1) : maxLen;
+    // no more than fits in the RX buffer is read, the rest waits in the socket
+    uint32_t maxLen = telnet_ring_free(&telnet_data.rx);
 
     if (maxLen > 0) {
-        if (E_TELNET_RESULT_OK == telnet_recv_text_non_blocking(&telnet_data.rxBuffer[telnet_data.rxWindex], maxLen, &rxLen)) {
-            // rxWindex must be uint8_t and TELNET_RX_BUFFER_SIZE == 256 so that it wraps around automatically
-            telnet_data.rxWindex = telnet_data.rxWindex + rxLen;
+        if (E_TELNET_RESULT_OK == telnet_recv_text_non_blocking(maxLen, &rxLen)) {
+            telnet_ring_put(&telnet_data.rx, telnet_data.rxChunk, rxLen);
         }
     }
+    if (telnet_data.state == E_TELNET_STE_LOGGED_IN) telnet_process_tx();
 }
 
-//----------------------------------------------------------------------
-static int telnet_process_credential (char *credential, int32_t rxLen) {
-    telnet_data.rxWindex += rxLen;
-    if (telnet_data.rxWindex >= TELNET_USER_PASS_LEN_MAX) {
-        telnet_data.rxWindex = TELNET_USER_PASS_LEN_MAX;
-    }
+//-------------------------------------------------------------------------------------------
+static int telnet_process_credential (const char *credential, uint8_t *data, int32_t rxLen) {
+    int32_t len = TELNET_USER_PASS_LEN_MAX - telnet_data.credLen;
+    if (rxLen < len) len = rxLen;
+    memcpy(telnet_data.credBuffer + telnet_data.credLen, data, len);
+    telnet_data.credLen += len;
 
-    uint8_t *p = telnet_data.rxBuffer + TELNET_USER_PASS_LEN_MAX;
+    uint8_t *p = memchr(telnet_data.credBuffer, '\r', telnet_data.credLen);
     // if a '\r' is found, or the length exceeds the max username length
-    if ((p = memchr(telnet_data.rxBuffer, '\r', telnet_data.rxWindex)) || (telnet_data.rxWindex >= TELNET_USER_PASS_LEN_MAX)) {
-        uint8_t len = p - telnet_data.rxBuffer;
+    if ((p) || (telnet_data.credLen >= TELNET_USER_PASS_LEN_MAX)) {
+        len = (p) ? (p - telnet_data.credBuffer) : telnet_data.credLen;
 
-        telnet_data.rxWindex = 0;
-        if ((len > 0) && (memcmp(credential, telnet_data.rxBuffer, MAX(len, strlen(credential))) == 0)) {
+        telnet_data.credLen = 0;
+        if ((len > 0) && (len == strlen(credential)) && (memcmp(credential, telnet_data.credBuffer, len) == 0)) {
             return 1;
         }
         return -1;
@@ -455,17 +631,53 @@ static int telnet_process_credential (char *credential, int32_t rxLen) {
 
 //--------------------------------------
 static void telnet_reset_buffer (void) {
+    uint8_t erase[TELNET_ERASE_LINE_LEN + 1];
     // erase any characters present in the current line
-    memset (telnet_data.rxBuffer, '\b', TELNET_RX_BUFFER_SIZE / 2);
-    telnet_data.rxWindex = TELNET_RX_BUFFER_SIZE / 2;
+    memset (erase, '\b', TELNET_ERASE_LINE_LEN);
     // fake an "enter" key pressed to display the prompt
-    telnet_data.rxBuffer[telnet_data.rxWindex++] = '\r';
+    erase[TELNET_ERASE_LINE_LEN] = '\r';
+    telnet_ring_put(&telnet_data.rx, erase, sizeof(erase));
+}
+
+// Copy data to the TX buffer and wake up the telnet task to send it
+// Waits only while the buffer is full and gives up if the client stops reading
+//-------------------------------------------------------------
+static void telnet_tx_put (const uint8_t *data, uint32_t len) {
+    uint32_t stalled = 0;
+    bool yielded = false;
+    while (len > 0) {
+        if (telnet_data.state != E_TELNET_STE_LOGGED_IN) return;
+        uint32_t n = telnet_ring_put(&telnet_data.tx, data, len);
+        xTaskNotifyGive(TelnetTaskHandle);
+        if (n > 0) {
+            data += n;
+            len -= n;
+            stalled = 0;
+            yielded = false;
+        }
+        else if (!yielded) {
+            // let the telnet task empty the buffer
+            taskYIELD();
+            yielded = true;
+        }
+        else {
+            // the socket is full, wait for the client
+            if ((telnet_data.txStalled) || (stalled >= TELNET_TX_STALL_MS)) {
+                telnet_data.txStalled = true;
+                return;
+            }
+            vTaskDelay(1);
+            stalled += portTICK_PERIOD_MS;
+        }
+    }
 }
 
 
 // =======================================================
 // = The following functions are called from other tasks =
 // = Mutex is used to synchronize with telnet_run        =
+// = except for the RX/TX buffer functions, which use    =
+// = the lock-free ring buffers                          =
 // =======================================================
 
 //======================
@@ -473,7 +685,10 @@ int telnet_run (void) {
     int32_t rxLen;
     if (xSemaphoreTake(telnet_mutex, TELNET_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return -1;
 
-    if (telnet_stop) return -2;
+    if (telnet_stop) {
+    	xSemaphoreGive(telnet_mutex);
+    	return -2;
+    }
 
     switch (telnet_data.state) {
         case E_TELNET_STE_DISABLED:
@@ -497,15 +712,13 @@ int telnet_run (void) {
                 break;
             case E_TELNET_STE_SUB_REQ_USER:
                 // to catch any left over characters from the previous actions
-                telnet_recv_text_non_blocking(telnet_data.rxBuffer, TELNET_RX_BUFFER_SIZE, &rxLen);
+                telnet_recv_text_non_blocking(TELNET_RX_CHUNK_SIZE, &rxLen);
                 telnet_send_and_proceed((void *)telnet_request_user, strlen(telnet_request_user), E_TELNET_STE_SUB_GET_USER);
                 break;
             case E_TELNET_STE_SUB_GET_USER:
-                if (E_TELNET_RESULT_OK == telnet_recv_text_non_blocking(telnet_data.rxBuffer + telnet_data.rxWindex,
-                                                                        TELNET_RX_BUFFER_SIZE - telnet_data.rxWindex,
-                                                                        &rxLen)) {
+                if (E_TELNET_RESULT_OK == telnet_recv_text_non_blocking(TELNET_RX_CHUNK_SIZE, &rxLen)) {
                     int result;
-                    if ((result = telnet_process_credential (telnet_user, rxLen))) {
+                    if ((result = telnet_process_credential (telnet_user, telnet_data.rxChunk, rxLen))) {
                         telnet_data.credentialsValid = result > 0 ? true : false;
                         telnet_data.substate.connected = E_TELNET_STE_SUB_REQ_PASSWORD;
                     }
@@ -516,15 +729,13 @@ int telnet_run (void) {
                 break;
             case E_TELNET_STE_SUB_SND_PASSWORD_OPTIONS:
                 // to catch any left over characters from the previous actions
-                telnet_recv_text_non_blocking(telnet_data.rxBuffer, TELNET_RX_BUFFER_SIZE, &rxLen);
+                telnet_recv_text_non_blocking(TELNET_RX_CHUNK_SIZE, &rxLen);
                 telnet_send_and_proceed((void *)telnet_options_pass, sizeof(telnet_options_pass), E_TELNET_STE_SUB_GET_PASSWORD);
                 break;
             case E_TELNET_STE_SUB_GET_PASSWORD:
-                if (E_TELNET_RESULT_OK == telnet_recv_text_non_blocking(telnet_data.rxBuffer + telnet_data.rxWindex,
-                                                                        TELNET_RX_BUFFER_SIZE - telnet_data.rxWindex,
-                                                                        &rxLen)) {
+                if (E_TELNET_RESULT_OK == telnet_recv_text_non_blocking(TELNET_RX_CHUNK_SIZE, &rxLen)) {
                     int result;
-                    if ((result = telnet_process_credential (telnet_pass, rxLen))) {
+                    if ((result = telnet_process_credential (telnet_pass, telnet_data.rxChunk, rxLen))) {
                         if ((telnet_data.credentialsValid = telnet_data.credentialsValid && (result > 0 ? true : false))) {
                             telnet_data.substate.connected = E_TELNET_STE_SUB_SND_REPL_OPTIONS;
                         }
@@ -580,67 +791,87 @@ int telnet_run (void) {
 //-----------------------
 void telnet_init (void) {
 	telnet_stop = 0;
-    // Allocate memory for the receive buffer (from the RTOS heap)
-	if (telnet_data.rxBuffer) free(telnet_data.rxBuffer);
-	memset(&telnet_data, 0, sizeof(telnet_data_t));
-    telnet_data.rxBuffer = malloc(TELNET_RX_BUFFER_SIZE);
+    // Allocate memory for the receive and transmit buffers (from the RTOS heap)
+	telnet_deinit();
+	telnet_ring_alloc(&telnet_data.rx, TELNET_RX_BUFFER_SIZE);
+	telnet_ring_alloc(&telnet_data.tx, TELNET_TX_BUFFER_SIZE);
+    telnet_data.rxChunk = malloc(TELNET_RX_CHUNK_SIZE);
+    telnet_data.rxFlushTo = -1;
     telnet_data.state = E_TELNET_STE_DISABLED;
 	if (telnet_mutex == NULL) telnet_mutex = xSemaphoreCreateMutex();
 }
 
 //-------------------------
 void telnet_deinit (void) {
-	if (telnet_data.rxBuffer) free(telnet_data.rxBuffer);
+	// stop the other tasks from using the buffers before they are freed
+	telnet_data.state = E_TELNET_STE_DISABLED;
+	if (telnet_data.rx.buf) free(telnet_data.rx.buf);
+	if (telnet_data.tx.buf) free(telnet_data.tx.buf);
+	if (telnet_data.rxChunk) free(telnet_data.rxChunk);
 	memset(&telnet_data, 0, sizeof(telnet_data_t));
 }
 
 
 // Send string to telnet client
+// The data is only buffered, it is sent by the telnet task
 //----------------------------------------------
 void telnet_tx_strn (const char *str, int len) {
-	if ((TelnetTaskHandle == NULL) || (telnet_mutex == NULL) || (telnet_data.n_sd <= 0)) return;
-    if (xSemaphoreTake(telnet_mutex, TELNET_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return;
-
-    if ((telnet_data.state == E_TELNET_STE_LOGGED_IN) && (len > 0)) {
-        int32_t retries = 0;
-        uint32_t delay = TELNET_WAIT_TIME_MS;
-
-    	do {
-    		if (send(telnet_data.n_sd, str, len, 0) > 0) {
-    			telnet_data.timeout = mp_hal_ticks_ms();
-    			break;
-    		}
-    		else if (EAGAIN != errno) break;
-    		// start with the default delay and increment it on each retry
-    		vTaskDelay(delay++ / portTICK_PERIOD_MS);
-    	} while (++retries <= TELNET_TX_RETRIES_MAX);
-    }
-	xSemaphoreGive(telnet_mutex);
+	if ((TelnetTaskHandle == NULL) || (telnet_data.tx.buf == NULL) || (len <= 0)) return;
+
+	telnet_tx_put((const uint8_t *)str, len);
+}
+
+// Send string to telnet client, converting '\n' to '\r\n'
+//-----------------------------------------------------
+void telnet_tx_strn_cooked (const char *str, int len) {
+	if ((TelnetTaskHandle == NULL) || (telnet_data.tx.buf == NULL) || (len <= 0)) return;
+
+	const char *end = str + len;
+	char prev = '\0';
+	while (str < end) {
+		const char *nl = memchr(str, '\n', end - str);
+		if (nl == NULL) {
+			telnet_tx_put((const uint8_t *)str, end - str);
+			break;
+		}
+		if (nl > str) prev = nl[-1];
+		telnet_tx_put((const uint8_t *)str, nl - str);
+		if (prev != '\r') telnet_tx_put((const uint8_t *)"\r\n", 2);
+		else telnet_tx_put((const uint8_t *)"\n", 1);
+		prev = '\n';
+		str = nl + 1;
+	}
+}
+
+// Discard the RX data if the telnet task requested it
+//----------------------------------------
+static void telnet_rx_check_flush (void) {
+	int32_t flush_to = telnet_data.rxFlushTo;
+	if (flush_to >= 0) {
+		telnet_data.rxFlushTo = -1;
+		telnet_data.rx.tail = flush_to;
+	}
 }
 
 // Return true if any character is available in RX buffer
 //-------------------------
 bool telnet_rx_any (void) {
-	if ((TelnetTaskHandle == NULL) || (telnet_mutex == NULL) || (telnet_data.n_sd <= 0)) return false;
-	if (xSemaphoreTake(telnet_mutex, TELNET_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return false;
+	if ((TelnetTaskHandle == NULL) || (telnet_data.rx.buf == NULL)) return false;
 
-	bool res = (telnet_data.n_sd > 0) ? ((telnet_data.rxRindex != telnet_data.rxWindex) && (telnet_data.state == E_TELNET_STE_LOGGED_IN)) : false;
-	xSemaphoreGive(telnet_mutex);
-	return res;
+	telnet_rx_check_flush();
+	return (telnet_data.state == E_TELNET_STE_LOGGED_IN) && (telnet_data.rx.head != telnet_data.rx.tail);
 }
 
 // Return one character from RX buffer if available
 //-------------------------
 int telnet_rx_char (void) {
-	if ((TelnetTaskHandle == NULL) || (telnet_mutex == NULL) || (telnet_data.n_sd <= 0)) return -1;
-	if (xSemaphoreTake(telnet_mutex, TELNET_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return -1;
+	if ((TelnetTaskHandle == NULL) || (telnet_data.rx.buf == NULL)) return -1;
 
-    int rx_char = -1;
-	if (telnet_data.rxRindex != telnet_data.rxWindex) {
-        // rxRindex must be uint8_t and TELNET_RX_BUFFER_SIZE == 256 so that it wraps around automatically
-        rx_char = (int)telnet_data.rxBuffer[telnet_data.rxRindex++];
-    }
-	xSemaphoreGive(telnet_mutex);
+	uint8_t *data;
+	telnet_rx_check_flush();
+	if (telnet_ring_peek(&telnet_data.rx, &data) == 0) return -1;
+	int rx_char = *data;
+	telnet_ring_skip(&telnet_data.rx, 1);
     return rx_char;
 }
 
@@ -648,11 +879,9 @@ int telnet_rx_char (void) {
 //---------------------------
 bool telnet_loggedin (void) {
 	if ((TelnetTaskHandle == NULL) || (telnet_mutex == NULL) || (telnet_data.n_sd <= 0)) return false;
-	if (xSemaphoreTake(telnet_mutex, TELNET_MUTEX_TIMEOUT_MS / portTICK_PERIOD_MS) !=pdTRUE) return false;
 
-	bool res = (telnet_data.state == E_TELNET_STE_LOGGED_IN);
-	xSemaphoreGive(telnet_mutex);
-    return res;
+	// called for every stdout write, a single read needs no mutex
+	return (telnet_data.state == E_TELNET_STE_LOGGED_IN);
 }
 
 // Enable telnet server
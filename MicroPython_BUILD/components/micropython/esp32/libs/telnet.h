@@ -71,6 +71,7 @@ void telnet_init (void);
 void telnet_deinit (void);
 int telnet_run (void);
 void telnet_tx_strn (const char *str, int len);
+void telnet_tx_strn_cooked (const char *str, int len);
 bool telnet_rx_any (void);
 bool telnet_loggedin (void);
 int  telnet_rx_char (void);
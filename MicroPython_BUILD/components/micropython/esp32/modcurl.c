@@ -43,6 +43,7 @@
 #include "esp_system.h"
 
 #include "py/obj.h"
+#include "py/objarray.h"
 #include "py/runtime.h"
 
 #include "libs/espcurl.h"
@@ -110,7 +111,7 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_0(curl_info_obj, curl_info);
 //--------------------------------------------------------------------------------------
 STATIC mp_obj_t curl_Options(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
 {
-    enum { ARG_print, ARG_verbose, ARG_progress, ARG_timeout, ARG_maxfsize, ARG_hdrlen, ARG_bodylen };
+    enum { ARG_print, ARG_verbose, ARG_progress, ARG_timeout, ARG_maxfsize, ARG_hdrlen, ARG_bodylen, ARG_keepalive, ARG_chunksize };
 	const mp_arg_t allowed_args[] = {
 		{ MP_QSTR_print,                      MP_ARG_BOOL, { .u_bool = true } },
 		{ MP_QSTR_verbose,  MP_ARG_KW_ONLY  | MP_ARG_INT, { .u_int = -1 } },
@@ -119,6 +120,8 @@ STATIC mp_obj_t curl_Options(size_t n_args, const mp_obj_t *pos_args, mp_map_t *
 		{ MP_QSTR_maxfsize, MP_ARG_KW_ONLY  | MP_ARG_INT, { .u_int = -1 } },
 		{ MP_QSTR_hdrlen,   MP_ARG_KW_ONLY  | MP_ARG_INT, { .u_int = -1 } },
 		{ MP_QSTR_bodylen,  MP_ARG_KW_ONLY  | MP_ARG_INT, { .u_int = -1 } },
+		{ MP_QSTR_keepalive, MP_ARG_KW_ONLY | MP_ARG_INT, { .u_int = -1 } },
+		{ MP_QSTR_chunksize, MP_ARG_KW_ONLY | MP_ARG_INT, { .u_int = -1 } },
 	};
 
 	mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
@@ -130,16 +133,57 @@ STATIC mp_obj_t curl_Options(size_t n_args, const mp_obj_t *pos_args, mp_map_t *
     if (args[ARG_maxfsize].u_int > 1000) curl_maxbytes = args[ARG_maxfsize].u_int;
     if (args[ARG_hdrlen].u_int > 128) hdr_maxlen = args[ARG_hdrlen].u_int;
     if (args[ARG_bodylen].u_int > MIN_HDR_BODY_BUF_LEN) body_maxlen = args[ARG_bodylen].u_int;
+    if (args[ARG_chunksize].u_int >= 512) curl_chunksize = args[ARG_chunksize].u_int;
+    if (args[ARG_keepalive].u_int >= 0) {
+    	curl_keepalive = args[ARG_keepalive].u_int & 1;
+    	// close the connections kept open
+    	if (curl_keepalive == 0) Curl_close_idle();
+    }
 
     if (args[ARG_print].u_bool) {
-        mp_printf(&mp_plat_print, "Curl options(\n  Verbose: %s, Progress: %d, Timeout: %d, Max fsize: %d, Header len: %d, Body len: %d\n)\n",
-        		((curl_verbose) ? "True" : "False"), curl_progress, curl_timeout, curl_maxbytes, hdr_maxlen, body_maxlen);
+        mp_printf(&mp_plat_print, "Curl options(\n  Verbose: %s, Progress: %d, Timeout: %d, Max fsize: %d, Header len: %d, Body len: %d\n  Keep alive: %s, Chunk size: %d\n)\n",
+        		((curl_verbose) ? "True" : "False"), curl_progress, curl_timeout, curl_maxbytes, hdr_maxlen, body_maxlen,
+        		((curl_keepalive) ? "True" : "False"), curl_chunksize);
 
     }
 	return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_KW(curl_Options_obj, 0, curl_Options);
 
+typedef struct _curl_stream_t {
+	mp_obj_t callback;
+	mp_obj_array_t *view;	// memoryview of the chunk buffer passed to the callback
+	mp_obj_t exc;
+} curl_stream_t;
+
+// Called from the curl write callback with the GIL released
+//----------------------------------------------------------------
+static int curl_stream_callback(void *arg, uint8_t *data, int len)
+{
+	curl_stream_t *stream = (curl_stream_t *)arg;
+	int ret = 0;
+
+	MP_THREAD_GIL_ENTER();
+	stream->view->items = data;
+	stream->view->len = len;
+	nlr_buf_t nlr;
+	if (nlr_push(&nlr) == 0) {
+		// returning False from the callback aborts the transfer
+		if (mp_call_function_1(stream->callback, MP_OBJ_FROM_PTR(stream->view)) == mp_const_false) ret = 1;
+		nlr_pop();
+	}
+	else {
+		stream->exc = MP_OBJ_FROM_PTR(nlr.ret_val);
+		ret = 1;
+	}
+	// a view kept by the callback is empty until the next chunk,
+	// 'items' is left pointing to the buffer to keep it alive
+	stream->view->len = 0;
+	MP_THREAD_GIL_EXIT();
+
+	return ret;
+}
+
 //----------------------------------------------------------------------------------
 STATIC mp_obj_t curl_GET(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
 {
@@ -161,6 +205,9 @@ STATIC mp_obj_t curl_GET(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_a
     char *url = NULL;
     char *fname = NULL;
 	char fullname[128] = {'\0'};
+	uint8_t *chunk = NULL;
+	size_t chunk_size = curl_chunksize;	// curl.options() may change it from another thread
+	curl_stream_t stream = { mp_const_none, NULL, MP_OBJ_NULL };
 
 	url = (char *)mp_obj_str_get_str(args[ARG_url].u_obj);
 
@@ -173,9 +220,17 @@ STATIC mp_obj_t curl_GET(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_a
 				nlr_raise(mp_obj_new_exception_msg(&mp_type_OSError, "Error resolving file name"));
 			}
 		    fname = fullname;
+			chunk = m_new(uint8_t, chunk_size);
 		}
 		body_len = MIN_HDR_BODY_BUF_LEN;
     }
+    else if (mp_obj_is_callable(args[ARG_file].u_obj)) {
+    	// GET to callback, the same buffer is passed for each chunk
+		chunk = m_new(uint8_t, chunk_size);
+		stream.callback = args[ARG_file].u_obj;
+		stream.view = MP_OBJ_TO_PTR(mp_obj_new_memoryview('B', 0, chunk));
+		body_len = MIN_HDR_BODY_BUF_LEN;
+    }
 
     vstr_init_len(&header, hdr_len);
     vstr_init_len(&body, body_len);
@@ -183,9 +238,17 @@ STATIC mp_obj_t curl_GET(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_a
     body.buf[0] = '\0';
 
    	MP_THREAD_GIL_EXIT();
-   	res = Curl_GET(url, fname, header.buf, body.buf, header.len, body.len);
+   	if (chunk) res = Curl_GET_stream(url, fname, curl_stream_callback, &stream, chunk, chunk_size, header.buf, body.buf, header.len, body.len);
+   	else res = Curl_GET(url, fname, header.buf, body.buf, header.len, body.len);
    	MP_THREAD_GIL_ENTER();
 
+   	// the callback may have kept the memoryview, its buffer is left to the GC
+   	if ((chunk) && (stream.view == NULL)) m_del(uint8_t, chunk, chunk_size);
+   	if (stream.exc != MP_OBJ_NULL) {
+   		// exception raised in the callback
+   		nlr_raise(stream.exc);
+   	}
+
    	mp_obj_t tuple[3];
 	tuple[0] = mp_obj_new_int(res);
 	header.len = strlen(header.buf);
@@ -197,6 +260,79 @@ STATIC mp_obj_t curl_GET(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_a
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_KW(curl_GET_obj, 1, curl_GET);
 
+//--------------------------------------------------------------------------------------
+STATIC mp_obj_t curl_GETMANY(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
+{
+	checkConnection();
+    enum { ARG_urls, ARG_files };
+	const mp_arg_t allowed_args[] = {
+        { MP_QSTR_urls,     MP_ARG_REQUIRED | MP_ARG_OBJ, { .u_obj = mp_const_none } },
+        { MP_QSTR_files,                      MP_ARG_OBJ, { .u_obj = mp_const_none } },
+    };
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args, pos_args, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    size_t n, nfiles = 0;
+    mp_obj_t *urls_items;
+    mp_obj_t *files_items = NULL;
+    char *urls[CURL_MULTI_MAX];
+    char *fnames[CURL_MULTI_MAX];
+    char *hdrs[CURL_MULTI_MAX];
+    char *bodies[CURL_MULTI_MAX];
+    int results[CURL_MULTI_MAX];
+    vstr_t header[CURL_MULTI_MAX];
+    vstr_t body[CURL_MULTI_MAX];
+	char fullname[128];
+
+    mp_obj_get_array(args[ARG_urls].u_obj, &n, &urls_items);
+    if ((n == 0) || (n > CURL_MULTI_MAX)) {
+		nlr_raise(mp_obj_new_exception_msg_varg(&mp_type_ValueError, "Expected 1 to %d urls", CURL_MULTI_MAX));
+    }
+    if (args[ARG_files].u_obj != mp_const_none) {
+    	mp_obj_get_array(args[ARG_files].u_obj, &nfiles, &files_items);
+		if (nfiles != n) {
+			nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "Expected one file name or None for each url"));
+		}
+    }
+
+    for (int i=0; i<n; i++) {
+    	urls[i] = (char *)mp_obj_str_get_str(urls_items[i]);
+    	fnames[i] = NULL;
+    	if ((files_items) && (MP_OBJ_IS_STR(files_items[i]))) {
+			int res = physicalPath(mp_obj_str_get_str(files_items[i]), fullname);
+			if ((res != 0) || (strlen(fullname) == 0)) {
+				nlr_raise(mp_obj_new_exception_msg(&mp_type_OSError, "Error resolving file name"));
+			}
+			fnames[i] = m_new(char, strlen(fullname)+1);
+			strcpy(fnames[i], fullname);
+    	}
+        vstr_init_len(&header[i], hdr_maxlen);
+        vstr_init_len(&body[i], body_maxlen);
+        hdrs[i] = header[i].buf;
+        bodies[i] = body[i].buf;
+    }
+
+   	MP_THREAD_GIL_EXIT();
+   	int res = Curl_MULTI_GET(n, urls, fnames, hdrs, bodies, hdr_maxlen, body_maxlen, results);
+   	MP_THREAD_GIL_ENTER();
+
+   	mp_obj_t list = mp_obj_new_list(0, NULL);
+    for (int i=0; i<n; i++) {
+    	if (fnames[i]) m_del(char, fnames[i], strlen(fnames[i])+1);
+	   	mp_obj_t tuple[3];
+		tuple[0] = mp_obj_new_int((res) ? res : results[i]);
+		header[i].len = strlen(header[i].buf);
+		body[i].len = strlen(body[i].buf);
+		tuple[1] = mp_obj_new_str_from_vstr(&mp_type_str, &header[i]);
+		tuple[2] = mp_obj_new_str_from_vstr(&mp_type_str, &body[i]);
+		mp_obj_list_append(list, mp_obj_new_tuple(3, tuple));
+    }
+
+   	return list;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(curl_GETMANY_obj, 1, curl_GETMANY);
+
 //-----------------------------------------------------------------------------------
 STATIC mp_obj_t curl_POST(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args)
 {
@@ -533,6 +669,7 @@ STATIC const mp_rom_map_elem_t curl_module_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_info), MP_ROM_PTR(&curl_info_obj) },
     { MP_ROM_QSTR(MP_QSTR_options), MP_ROM_PTR(&curl_Options_obj) },
     { MP_ROM_QSTR(MP_QSTR_get), MP_ROM_PTR(&curl_GET_obj) },
+    { MP_ROM_QSTR(MP_QSTR_getmany), MP_ROM_PTR(&curl_GETMANY_obj) },
     { MP_ROM_QSTR(MP_QSTR_post), MP_ROM_PTR(&curl_POST_obj) },
     { MP_ROM_QSTR(MP_QSTR_sendmail), MP_ROM_PTR(&curl_sendmail_obj) },
 	#ifdef CONFIG_MICROPY_USE_CURLFTP
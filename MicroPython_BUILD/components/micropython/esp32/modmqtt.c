@@ -40,20 +40,45 @@
 #include <string.h>
 
 #include "mqtt.h"
+#include "mqtt_subs.h"
+#include "mqtt_rx.h"
 
 #include "py/nlr.h"
 #include "py/runtime.h"
+#include "py/objarray.h"
 #include "modmachine.h"
 #include "mphalport.h"
+#include "extmod/vfs_native.h"
 
+// Size of the queue holding received messages until they are dispatched in the MicroPython task
+#define MQTT_RX_QUEUE_SIZE	(((CONFIG_MQTT_MAX_PAYLOAD_SIZE + CONFIG_MQTT_BUFFER_SIZE_BYTE) * 2 + 3) & ~3)
+// Number of subscription callbacks for one message collected without allocation,
+// more are collected in an array on the GC heap
+#define MQTT_MAX_MATCHES	16
 
 typedef struct _mqtt_obj_t {
     mp_obj_base_t base;
     mqtt_client *client;
     char name[CONFIG_MQTT_MAX_TASKNAME_LEN];
+    mqtt_rx_t *rx;
+    mqtt_sub_node_t *subs;		// subscriptions with callback function
+    mp_obj_t sub_dict;			// topic filter -> callback, keeps the callbacks referenced
+    mp_obj_array_t topic_mv;	// read-only memoryviews passed to subscription callbacks
+    mp_obj_array_t data_mv;
+    byte *view_buf;				// topic and payload the memoryviews point to, on the GC heap
+    size_t view_alloc;
 } mqtt_obj_t;
 
+typedef struct _mqtt_match_t {
+    int n;
+    int alloc;
+    int dropped;				// callbacks not collected, no memory for a larger array
+    mp_obj_t *cb;				// 'local' or an array on the GC heap
+    mp_obj_t local[MQTT_MAX_MATCHES];
+} mqtt_match_t;
+
 const mp_obj_type_t mqtt_type;
+MP_DECLARE_CONST_FUN_OBJ_1(mqtt_dispatch_obj);
 
 
 
@@ -117,79 +142,158 @@ STATIC void published_cb(void *self, void *params)
     }
 }
 
+// Schedule the dispatch function, called from the receive queue (Mqtt task)
+//----------------------------------------
+STATIC void mqtt_rx_schedule(mqtt_rx_t *rx)
+{
+	rx->pending = true;
+	if (!mp_sched_schedule(MP_OBJ_FROM_PTR(&mqtt_dispatch_obj), rx->obj)) rx->pending = false;
+}
+
+// Received data is copied into the receive queue and the dispatch function is scheduled
+// when the message is complete. No MicroPython objects are created here (Mqtt task).
 //-------------------------------------------
 STATIC void data_cb(void *self, void *params)
 {
     mqtt_client *client = (mqtt_client *)self;
-    if (!client->settings->mpy_data_cb) return;
-
-    mqtt_event_data_t *event_data = (mqtt_event_data_t *)params;
-
-	if (event_data->data_offset == 0) {
-		// First block of data
-		if (client->msgbuf != NULL) free(client->msgbuf);
-		if (client->topicbuf != NULL) free(client->topicbuf);
-		client->msgbuf = NULL;
-		client->topicbuf = NULL;
-		if (event_data->data_length < event_data->data_total_length) {
-			// more data will follow, allocate the data buffer and copy the first part
-			client->topicbuf = malloc(event_data->topic_length + 1);
-			if (client->topicbuf) {
-				memcpy(client->topicbuf, event_data->topic, event_data->topic_length);
-				client->topicbuf[event_data->topic_length] = 0;
-
-				int buf_len = event_data->data_total_length + 1;
-				client->msgbuf = malloc(buf_len + 1);
-				if (client->msgbuf) {
-					memcpy(client->msgbuf, event_data->data, event_data->data_length);
-					client->msgbuf[event_data->data_length] = 0;
-				}
-				else {
-					free(client->topicbuf);
-					client->msgbuf = NULL;
-					client->topicbuf = NULL;
-				}
-			}
-		}
-		else {
-			// all data received, we can schedule the callback function now
-			mp_obj_t tuple[3];
-			tuple[0] = mp_obj_new_str(client->name, strlen(client->name), 0);
-			tuple[1] = mp_obj_new_str(event_data->topic, event_data->topic_length, 0);
-			tuple[2] = mp_obj_new_str(event_data->data, event_data->data_length, 0);
-			mp_sched_schedule(client->settings->mpy_data_cb, mp_obj_new_tuple(3, tuple));
+    mqtt_rx_t *rx = (mqtt_rx_t *)client->settings->mpy_rx;
+    if (rx == NULL) return;
+
+    mqtt_rx_put(rx, (mqtt_event_data_t *)params);
+}
+
+// Call the Python function, an exception is printed and does not stop the dispatching
+//------------------------------------------------------------------------
+STATIC void mqtt_call_cb(mp_obj_t cb, size_t n_args, const mp_obj_t *args)
+{
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+    	mp_call_function_n_kw(cb, n_args, 0, args);
+        nlr_pop();
+    }
+    else {
+        mp_obj_print_exception(&mp_plat_print, (mp_obj_t)nlr.ret_val);
+    }
+}
+
+//----------------------------------------------
+STATIC void mqtt_match_cb(void *data, void *arg)
+{
+	mqtt_match_t *match = (mqtt_match_t *)arg;
+	if (match->n == match->alloc) {
+		// the old array is left to the GC, the new one is referenced from the stack only
+		mp_obj_t *cb = m_new_maybe(mp_obj_t, match->alloc * 2);
+		if (cb == NULL) {
+			match->dropped++;
+			return;
 		}
+		memcpy(cb, match->cb, match->n * sizeof(mp_obj_t));
+		match->cb = cb;
+		match->alloc *= 2;
 	}
-	else {
-		if ((client->topicbuf) && (client->msgbuf)) {
-			// more payload data arrived, add to buffer
-			int new_len = event_data->data_offset + event_data->data_length;
-			memcpy(client->msgbuf + event_data->data_offset, event_data->data, event_data->data_length);
-			client->msgbuf[new_len] = 0;
-			if (new_len >= event_data->data_total_length) {
-				// all data received, we can schedule the callback function now
-				mp_obj_t tuple[3];
-				tuple[0] = mp_obj_new_str(client->name, strlen(client->name), 0);
-				tuple[1] = mp_obj_new_str((const char*)client->topicbuf, strlen((const char *)client->topicbuf), 0);
-				tuple[2] = mp_obj_new_str((const char*)client->msgbuf, event_data->data_total_length, 0);
-				mp_sched_schedule(client->settings->mpy_data_cb, mp_obj_new_tuple(3, tuple));
-				// Free the buffers
-				free(client->msgbuf);
-				free(client->topicbuf);
-				client->msgbuf = NULL;
-				client->topicbuf = NULL;
+	match->cb[match->n++] = (mp_obj_t)data;
+}
+
+// Deliver all queued messages, runs in MicroPython task (scheduled from data_cb)
+// Subscription callbacks get topic and payload as read-only memoryviews, emptied
+// after each call. They don't point into the receive queue, which is reused and
+// freed outside of the GC, but into 'view_buf': a view or slice kept by a callback
+// holds no dangling pointer, only data overwritten by a later message.
+// A callback keeping the data must copy it, e.g. bytes(msg).
+// Messages not matching any subscription callback are passed to 'data_cb' as before.
+//---------------------------------------------
+STATIC mp_obj_t mqtt_dispatch(mp_obj_t self_in)
+{
+    mqtt_obj_t *self = self_in;
+    mqtt_rx_t *rx = self->rx;
+    mqtt_rx_msg_t *msg;
+    mqtt_match_t match;
+    mp_obj_t args[3];
+
+    if (rx == NULL) return mp_const_none;
+    rx->pending = false;
+	__sync_synchronize();
+
+    while ((msg = mqtt_rx_peek(rx)) != NULL) {
+    	const char *topic = (const char *)msg->data;
+    	const char *data = topic + msg->topic_len;
+
+    	// callbacks may change the subscriptions, collect them first
+    	match.n = 0;
+    	match.alloc = MQTT_MAX_MATCHES;
+    	match.dropped = 0;
+    	match.cb = match.local;
+    	mqtt_sub_match(self->subs, topic, msg->topic_len, mqtt_match_cb, &match);
+    	if (match.dropped > 0) {
+			mp_printf(&mp_plat_print, "Mqtt[%s]: no memory, %d of %d subscription callbacks not called\n",
+					self->name, match.dropped, match.n + match.dropped);
+    	}
+    	if (match.n > 0) {
+    		size_t len = msg->topic_len + msg->data_len;
+    		if (len > self->view_alloc) {
+    			// a new buffer, the old one is left to the GC as views may still use it
+    			byte *buf = m_new_maybe(byte, len);
+    			if (buf == NULL) {
+    				mp_printf(&mp_plat_print, "Mqtt[%s]: no memory for a %u byte message\n", self->name, (unsigned)len);
+    				mqtt_rx_release(rx, msg);
+    				continue;
+    			}
+    			self->view_buf = buf;
+    			self->view_alloc = len;
+    		}
+    		memcpy(self->view_buf, topic, len);
+			args[0] = MP_OBJ_FROM_PTR(&self->topic_mv);
+			args[1] = MP_OBJ_FROM_PTR(&self->data_mv);
+			for (int i=0; i<match.n; i++) {
+				// both views start at the head of the buffer, which keeps it alive
+				self->topic_mv.items = self->view_buf;
+				self->topic_mv.free = 0;
+				self->topic_mv.len = msg->topic_len;
+				self->data_mv.items = self->view_buf;
+				self->data_mv.free = msg->topic_len;
+				self->data_mv.len = msg->data_len;
+				mqtt_call_cb(match.cb[i], 2, args);
+				self->topic_mv.items = NULL;
+				self->topic_mv.len = 0;
+				self->data_mv.items = NULL;
+				self->data_mv.len = 0;
 			}
-		}
-		else {
-			// more payload data arrived, but there is no data buffers ??
-			if (client->msgbuf != NULL) free(client->msgbuf);
-			if (client->topicbuf != NULL) free(client->topicbuf);
-			client->msgbuf = NULL;
-			client->topicbuf = NULL;
-		}
-	}
+    	}
+    	else if ((self->client) && (self->client->settings->mpy_data_cb)) {
+			args[0] = mp_obj_new_str(self->name, strlen(self->name), 0);
+			args[1] = mp_obj_new_str(topic, msg->topic_len, 0);
+			args[2] = mp_obj_new_str(data, msg->data_len, 0);
+			mp_obj_t tuple = mp_obj_new_tuple(3, args);
+			mqtt_call_cb(self->client->settings->mpy_data_cb, 1, &tuple);
+    	}
+    	mqtt_rx_release(rx, msg);
+    }
+    return mp_const_none;
+}
+MP_DEFINE_CONST_FUN_OBJ_1(mqtt_dispatch_obj, mqtt_dispatch);
+
+//----------------------------------------
+STATIC void mqtt_free_rx(mqtt_obj_t *self)
+{
+	mqtt_sub_free(&self->subs, NULL, NULL);
+	self->sub_dict = mp_obj_new_dict(0);
+	if (self->client) self->client->settings->mpy_rx = NULL;
+	mqtt_rx_free(self->rx);
+	self->rx = NULL;
+	self->view_buf = NULL;
+	self->view_alloc = 0;
 }
 
+// Free all client resources, the Mqtt task must not be running
+//-------------------------------------------
+STATIC void mqtt_free_client(mqtt_obj_t *self)
+{
+	mqtt_free_rx(self);
+	mqtt_store_close(self->client->store);
+	free(self->client->settings);
+	free(self->client);
+	self->client = NULL;
+}
 
 //-------------------------------------------------------------------------------------
 STATIC void mqtt_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind)
@@ -218,6 +322,11 @@ STATIC void mqtt_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_
 				self->client->settings->xMqttTask_stacksize - uxTaskGetStackHighWaterMark(self->client->settings->xMqttTask), self->client->settings->xMqttTask_stacksize,
 				self->client->settings->xMqttSendingTask_stacksize - uxTaskGetStackHighWaterMark(self->client->settings->xMqttSendingTask), self->client->settings->xMqttSendingTask_stacksize);
 	}
+	if (self->client->store) {
+		mqtt_store_t *store = self->client->store;
+		mp_printf(print, "     Persistent queue: %s, queued: %u bytes, dropped: %u, replay rate: %u msg/s\n",
+				store->path, store->file_size + store->wbuf_len - store->read_pos, store->dropped, self->client->settings->replay_rate);
+	}
 	mp_printf(print, "    )\n");
 }
 
@@ -226,7 +335,7 @@ STATIC void mqtt_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_
 STATIC mp_obj_t mqtt_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args)
 {
 	enum { ARG_name, ARG_host, ARG_user, ARG_pass, ARG_port, ARG_reconnect, ARG_clientid, ARG_cleansess, ARG_keepalive, ARG_qos, ARG_retain, ARG_secure,
-		   ARG_datacb, ARG_connected, ARG_disconnected, ARG_subscribed, ARG_published };
+		   ARG_datacb, ARG_connected, ARG_disconnected, ARG_subscribed, ARG_published, ARG_persistent, ARG_persistsize, ARG_replayrate };
 
     const mp_arg_t mqtt_init_allowed_args[] = {
 			{ MP_QSTR_name,   	    	MP_ARG_REQUIRED | MP_ARG_OBJ,  {.u_obj = mp_const_none} },
@@ -246,6 +355,9 @@ STATIC mp_obj_t mqtt_make_new(const mp_obj_type_t *type, size_t n_args, size_t n
 			{ MP_QSTR_disconnected_cb,	MP_ARG_KW_ONLY  | MP_ARG_OBJ,  {.u_obj = mp_const_none} },
 			{ MP_QSTR_subscribed_cb,  	MP_ARG_KW_ONLY  | MP_ARG_OBJ,  {.u_obj = mp_const_none} },
 			{ MP_QSTR_published_cb,		MP_ARG_KW_ONLY  | MP_ARG_OBJ,  {.u_obj = mp_const_none} },
+			{ MP_QSTR_persistent,		MP_ARG_KW_ONLY  | MP_ARG_OBJ,  {.u_obj = mp_const_none} },
+			{ MP_QSTR_persistent_size,	MP_ARG_KW_ONLY  | MP_ARG_INT,  {.u_int = CONFIG_MQTT_STORE_MAX_SIZE} },
+			{ MP_QSTR_replay_rate,		MP_ARG_KW_ONLY  | MP_ARG_INT,  {.u_int = CONFIG_MQTT_STORE_REPLAY_RATE} },
 	};
 	mp_arg_val_t args[MP_ARRAY_SIZE(mqtt_init_allowed_args)];
 	mp_arg_parse_all_kw_array(n_args, n_kw, all_args, MP_ARRAY_SIZE(mqtt_init_allowed_args), mqtt_init_allowed_args, args);
@@ -296,10 +408,44 @@ STATIC mp_obj_t mqtt_make_new(const mp_obj_type_t *type, size_t n_args, size_t n
     sprintf(self->client->settings->lwt_msg, "offline");
     self->client->settings->lwt_qos = args[ARG_qos].u_int;
     self->client->settings->lwt_retain = args[ARG_retain].u_int;
+    self->client->settings->replay_rate = (args[ARG_replayrate].u_int > 0) ? args[ARG_replayrate].u_int : CONFIG_MQTT_STORE_REPLAY_RATE;
+
+    // messages published while offline are stored in the file and sent after reconnect
+    if (MP_OBJ_IS_STR(args[ARG_persistent].u_obj)) {
+    	char fullname[128] = {'\0'};
+    	int res = physicalPath(mp_obj_str_get_str(args[ARG_persistent].u_obj), fullname);
+    	if ((res == 0) && (strlen(fullname) > 0)) {
+    		self->client->store = mqtt_store_open(fullname, (args[ARG_persistsize].u_int > 0) ? args[ARG_persistsize].u_int : CONFIG_MQTT_STORE_MAX_SIZE);
+    	}
+    	if (self->client->store == NULL) {
+        	free(self->client->settings);
+        	free(self->client);
+            nlr_raise(mp_obj_new_exception_msg(&mp_type_OSError, "Error opening persistent queue file"));
+    	}
+    }
+
+    // received messages are always queued, for subscription callbacks or data_cb
+    self->rx = mqtt_rx_new(MQTT_RX_QUEUE_SIZE, mqtt_rx_schedule, self);
+    if (self->rx == NULL) {
+    	mqtt_free_client(self);
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_TypeError, "Error allocating client memory"));
+    }
+    self->subs = NULL;
+    self->sub_dict = mp_obj_new_dict(0);
+    // typecode without the 0x80 flag: read-only
+    self->topic_mv.base.type = &mp_type_memoryview;
+    self->topic_mv.typecode = 'B';
+    self->topic_mv.free = 0;
+    self->topic_mv.len = 0;
+    self->topic_mv.items = NULL;
+    self->data_mv = self->topic_mv;
+    self->view_buf = NULL;
+    self->view_alloc = 0;
+    self->client->settings->mpy_rx = self->rx;
+    self->client->settings->data_cb = (void*)data_cb;
 
     // set callbacks
     if (MP_OBJ_IS_FUN(args[ARG_datacb].u_obj)) {
-	    self->client->settings->data_cb = (void*)data_cb;
 	    self->client->settings->mpy_data_cb = args[ARG_datacb].u_obj;
 	}
 
@@ -326,8 +472,7 @@ STATIC mp_obj_t mqtt_make_new(const mp_obj_type_t *type, size_t n_args, size_t n
     // Start the mqtt task
     int res = mqtt_start(self->client);
     if (res != 0) {
-    	free(self->client->settings);
-    	free(self->client);
+    	mqtt_free_client(self);
         nlr_raise(mp_obj_new_exception_msg(&mp_type_TypeError, "Error starting client"));
     }
 
@@ -372,9 +517,7 @@ STATIC mp_obj_t mqtt_op_config(mp_uint_t n_args, const mp_obj_t *pos_args, mp_ma
     if (args[ARG_cleansess].u_int >= 0) self->client->settings->clean_session = args[ARG_cleansess].u_int;
 
     if (MP_OBJ_IS_FUN(args[ARG_datacb].u_obj)) {
-	    self->client->settings->data_cb = NULL;
 	    self->client->settings->mpy_data_cb = args[ARG_datacb].u_obj;
-	    self->client->settings->data_cb = (void*)data_cb;
 	}
     if (MP_OBJ_IS_FUN(args[ARG_connected].u_obj)) {
 	    self->client->settings->connected_cb = NULL;
@@ -401,17 +544,33 @@ STATIC mp_obj_t mqtt_op_config(mp_uint_t n_args, const mp_obj_t *pos_args, mp_ma
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_KW(mqtt_config_obj, 1, mqtt_op_config);
 
+// subscribe(topic [, cb])
+// If the callback function is given, it is called as cb(topic, msg) for messages
+// matching the topic filter, with both arguments as read-only memoryviews valid only
+// during the call; use bytes(topic), bytes(msg) to keep them.
 //--------------------------------------------------------------------
-STATIC mp_obj_t mqtt_op_subscribe(mp_obj_t self_in, mp_obj_t topic_in)
+STATIC mp_obj_t mqtt_op_subscribe(size_t n_args, const mp_obj_t *args)
 {
-    mqtt_obj_t *self = self_in;
+    mqtt_obj_t *self = args[0];
     if (checkClient(self)) return mp_const_none;
 
-    const char *topic = mp_obj_str_get_str(topic_in);
+    const char *topic = mp_obj_str_get_str(args[1]);
+    if (!mqtt_sub_filter_valid(topic)) {
+        nlr_raise(mp_obj_new_exception_msg(&mp_type_ValueError, "Invalid topic"));
+    }
+    if ((n_args > 2) && (args[2] != mp_const_none)) {
+    	if (!mp_obj_is_callable(args[2])) {
+            nlr_raise(mp_obj_new_exception_msg(&mp_type_TypeError, "Callback must be a function"));
+    	}
+    	if (mqtt_sub_add(&self->subs, topic, args[2], NULL) != 0) {
+            nlr_raise(mp_obj_new_exception_msg(&mp_type_MemoryError, "Error adding subscription"));
+    	}
+    	mp_obj_dict_store(self->sub_dict, args[1], args[2]);
+    }
     mqtt_subscribe(self->client, topic, self->client->settings->lwt_qos);
     return mp_const_none;
 }
-MP_DEFINE_CONST_FUN_OBJ_2(mqtt_subscribe_obj, mqtt_op_subscribe);
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mqtt_subscribe_obj, 2, 3, mqtt_op_subscribe);
 
 //----------------------------------------------------------------------
 STATIC mp_obj_t mqtt_op_unsubscribe(mp_obj_t self_in, mp_obj_t topic_in)
@@ -420,6 +579,9 @@ STATIC mp_obj_t mqtt_op_unsubscribe(mp_obj_t self_in, mp_obj_t topic_in)
     if (checkClient(self)) return mp_const_none;
 
     const char *topic = mp_obj_str_get_str(topic_in);
+    if (mqtt_sub_remove(&self->subs, topic)) {
+    	mp_map_lookup(mp_obj_dict_get_map(self->sub_dict), topic_in, MP_MAP_LOOKUP_REMOVE_IF_FOUND);
+    }
     mqtt_unsubscribe(self->client, topic);
     return mp_const_none;
 }
@@ -429,12 +591,19 @@ MP_DEFINE_CONST_FUN_OBJ_2(mqtt_unsubscribe_obj, mqtt_op_unsubscribe);
 STATIC mp_obj_t mqtt_op_publish(mp_obj_t self_in, mp_obj_t topic_in, mp_obj_t msg_in)
 {
     mqtt_obj_t *self = self_in;
-    if (checkClient(self)) return mp_const_none;
+    // with the persistent queue, messages can be published while not connected
+    if ((checkClient(self)) && (self->client->store == NULL)) return mp_const_none;
 
-    size_t len;
+    // Any object supporting the buffer protocol (str, bytes, bytearray, memoryview)
+    // can be published, the data is copied directly into the send queue
+    mp_buffer_info_t bufinfo;
     const char *topic = mp_obj_str_get_str(topic_in);
-    const char *msg = mp_obj_str_get_data(msg_in, &len);
-    int res = mqtt_publish(self->client, topic, msg, len, self->client->settings->lwt_qos, self->client->settings->lwt_retain);
+    mp_get_buffer_raise(msg_in, &bufinfo, MP_BUFFER_READ);
+
+    // may wait for send queue space or a free inflight slot
+    MP_THREAD_GIL_EXIT();
+    int res = mqtt_publish(self->client, topic, (const char *)bufinfo.buf, bufinfo.len, self->client->settings->lwt_qos, self->client->settings->lwt_retain);
+    MP_THREAD_GIL_ENTER();
 
     if (res < 0) return mp_const_false;
     return mp_const_true;
@@ -489,8 +658,7 @@ STATIC mp_obj_t mqtt_op_start(mp_obj_t self_in)
 	if ((self->client) && (self->client->status == MQTT_STATUS_STOPPED) && (self->client->settings->xMqttTask == NULL)) {
 	    int res = mqtt_start(self->client);
 	    if (res != 0) {
-	    	free(self->client->settings);
-	    	free(self->client);
+	    	mqtt_free_client(self);
 	        nlr_raise(mp_obj_new_exception_msg(&mp_type_TypeError, "Error starting client"));
 	    }
     }
@@ -504,9 +672,7 @@ STATIC mp_obj_t mqtt_op_free(mp_obj_t self_in)
 {
     mqtt_obj_t *self = self_in;
 	if ((self->client) && (self->client->status == MQTT_STATUS_STOPPED) && (self->client->settings->xMqttTask == NULL)) {
-    	free(self->client->settings);
-    	free(self->client);
-    	self->client = NULL;
+		mqtt_free_client(self);
         return mp_const_true;
     }
     return mp_const_false;
@@ -250,6 +250,19 @@ STATIC mp_obj_t socket_connect(const mp_obj_t arg0, const mp_obj_t arg1) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_connect_obj, socket_connect);
 
+STATIC mp_obj_t socket_getpeername(const mp_obj_t arg0) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(arg0);
+    struct sockaddr addr;
+    socklen_t addr_len = sizeof(addr);
+    if (lwip_getpeername(self->fd, &addr, &addr_len) != 0) {
+        exception_from_errno(errno);
+    }
+    uint8_t *ip = (uint8_t*)&((struct sockaddr_in*)&addr)->sin_addr;
+    mp_uint_t port = lwip_ntohs(((struct sockaddr_in*)&addr)->sin_port);
+    return netutils_format_inet_addr(ip, port, NETUTILS_BIG);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(socket_getpeername_obj, socket_getpeername);
+
 STATIC mp_obj_t socket_setsockopt(size_t n_args, const mp_obj_t *args) {
     (void)n_args; // always 4
     socket_obj_t *self = MP_OBJ_TO_PTR(args[0]);
@@ -455,6 +468,14 @@ STATIC mp_uint_t socket_stream_write(mp_obj_t self_in, const void *buf, mp_uint_
 
 STATIC mp_uint_t socket_stream_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
     socket_obj_t * socket = self_in;
+    if (socket->fd < 0) {
+        // closed
+        if (request == MP_STREAM_POLL) {
+            return MP_STREAM_POLL_NVAL;
+        }
+        *errcode = MP_EBADF;
+        return MP_STREAM_ERROR;
+    }
     if (request == MP_STREAM_POLL) {
 
         fd_set rfds; FD_ZERO(&rfds);
@@ -467,6 +488,10 @@ STATIC mp_uint_t socket_stream_ioctl(mp_obj_t self_in, mp_uint_t request, uintpt
 
         int r = select((socket->fd)+1, &rfds, &wfds, &efds, &timeout);
         if (r < 0) {
+            if (errno == EBADF) {
+                // dropped by lwip
+                return MP_STREAM_POLL_NVAL;
+            }
             *errcode = MP_EIO;
             return MP_STREAM_ERROR;
         }
@@ -477,6 +502,10 @@ STATIC mp_uint_t socket_stream_ioctl(mp_obj_t self_in, mp_uint_t request, uintpt
         if (FD_ISSET(socket->fd, &efds)) ret |= MP_STREAM_POLL_HUP;
         return ret;
     }
+    else if (request == MP_STREAM_GET_FILENO) {
+        // uselect waits on all sockets with one select()
+        return socket->fd;
+    }
 
     *errcode = MP_EINVAL;
     return MP_STREAM_ERROR;
@@ -490,6 +519,7 @@ STATIC const mp_map_elem_t socket_locals_dict_table[] = {
     { MP_OBJ_NEW_QSTR(MP_QSTR_accept), (mp_obj_t)&socket_accept_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_accepted), (mp_obj_t)&socket_accepted_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_connect), (mp_obj_t)&socket_connect_obj },
+    { MP_OBJ_NEW_QSTR(MP_QSTR_getpeername), (mp_obj_t)&socket_getpeername_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_send), (mp_obj_t)&socket_send_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_sendall), (mp_obj_t)&socket_sendall_obj },
     { MP_OBJ_NEW_QSTR(MP_QSTR_sendto), (mp_obj_t)&socket_sendto_obj },
@@ -24,6 +24,8 @@
  * THE SOFTWARE.
  */
 #include "py/runtime.h"
+#include "py/stream.h"
+#include "extmod/moduhashlib.h"
 
 #include "mbedtls/sha256.h"
 #include "mbedtls/sha1.h"
@@ -46,6 +48,7 @@ STATIC mp_obj_t sha256_make_new(const mp_obj_type_t *type,
     mp_obj_hash_t *o = m_new_obj_var(mp_obj_hash_t, char, sizeof(union sha_ctxs));
     o->base.type = type;
     mbedtls_sha256_init(&o->state.sha256);
+    mbedtls_sha256_starts(&o->state.sha256, 0);
     if (n_args == 1) {
         sha256_update(MP_OBJ_FROM_PTR(o), args[0]);
     }
@@ -58,6 +61,7 @@ STATIC mp_obj_t sha1_make_new(const mp_obj_type_t *type,
     mp_obj_hash_t *o = m_new_obj_var(mp_obj_hash_t, char, sizeof(union sha_ctxs));
     o->base.type = type;
     mbedtls_sha1_init(&o->state.sha1);
+    mbedtls_sha1_starts(&o->state.sha1);
     if (n_args == 1) {
         sha1_update(MP_OBJ_FROM_PTR(o), args[0]);
     }
@@ -100,9 +104,20 @@ STATIC mp_obj_t sha1_digest(mp_obj_t self_in) {
 }
 MP_DEFINE_CONST_FUN_OBJ_1(sha1_digest_obj, sha1_digest);
 
+STATIC mp_obj_t sha256_hexdigest(mp_obj_t self_in) {
+    return mod_uhashlib_hexlify(sha256_digest(self_in));
+}
+MP_DEFINE_CONST_FUN_OBJ_1(sha256_hexdigest_obj, sha256_hexdigest);
+
+STATIC mp_obj_t sha1_hexdigest(mp_obj_t self_in) {
+    return mod_uhashlib_hexlify(sha1_digest(self_in));
+}
+MP_DEFINE_CONST_FUN_OBJ_1(sha1_hexdigest_obj, sha1_hexdigest);
+
 STATIC const mp_rom_map_elem_t sha256_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_update), MP_ROM_PTR(&sha256_update_obj) },
     { MP_ROM_QSTR(MP_QSTR_digest), MP_ROM_PTR(&sha256_digest_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hexdigest), MP_ROM_PTR(&sha256_hexdigest_obj) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(sha256_locals_dict, sha256_locals_dict_table);
@@ -117,6 +132,7 @@ STATIC const mp_obj_type_t sha256_type = {
 STATIC const mp_rom_map_elem_t sha1_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_update), MP_ROM_PTR(&sha1_update_obj) },
     { MP_ROM_QSTR(MP_QSTR_digest), MP_ROM_PTR(&sha1_digest_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hexdigest), MP_ROM_PTR(&sha1_hexdigest_obj) },
 };
 STATIC MP_DEFINE_CONST_DICT(sha1_locals_dict, sha1_locals_dict_table);
 
@@ -127,10 +143,19 @@ STATIC const mp_obj_type_t sha1_type = {
     .locals_dict = (void*)&sha1_locals_dict,
 };
 
+STATIC const mp_obj_dict_t mp_module_hashlib_globals;
+
+// file_digest(stream, digest='sha256'), see extmod/moduhashlib.c
+STATIC mp_obj_t mod_hashlib_file_digest(size_t n_args, const mp_obj_t *args) {
+    return mod_uhashlib_file_digest(n_args, args, MP_OBJ_FROM_PTR(&sha256_type), &mp_module_hashlib_globals);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_hashlib_file_digest_obj, 1, 2, mod_hashlib_file_digest);
+
 STATIC const mp_rom_map_elem_t mp_module_hashlib_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_uhashlib) },
     { MP_ROM_QSTR(MP_QSTR_sha256), MP_ROM_PTR(&sha256_type) },
     { MP_ROM_QSTR(MP_QSTR_sha1), MP_ROM_PTR(&sha1_type) },
+    { MP_ROM_QSTR(MP_QSTR_file_digest), MP_ROM_PTR(&mod_hashlib_file_digest_obj) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_hashlib_globals,
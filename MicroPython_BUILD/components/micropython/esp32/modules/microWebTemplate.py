@@ -1,6 +1,7 @@
 
 from    sys		import exc_info
 import	re
+import	uio
 
 class MicroWebTemplate :
 
@@ -59,7 +60,7 @@ class MicroWebTemplate :
 	def Execute(self) :
 		try :
 			self._parseCode(execute=True)
-			return self._rendered
+			return self._rendered.getvalue()
 		except :
 			raise Exception(exc_info()[1])
 
@@ -70,7 +71,7 @@ class MicroWebTemplate :
 	def _parseCode(self, execute) :
 		self._pyGlobalVars = { }
 		self._pyLocalVars  = { }
-		self._rendered	   = ''
+		self._rendered	   = uio.StringIO()
 		newTokenToProcess  = self._parseBloc(execute)
 		if newTokenToProcess is not None :
 			raise Exception( '"%s" instruction is not valid here (line %s)'
@@ -80,37 +81,38 @@ class MicroWebTemplate :
 
 	def _parseBloc(self, execute) :
 		while self._pos <= self._endPos :
-			c = self._code[self._pos]
-			if c == MicroWebTemplate.TOKEN_OPEN[0] and \
-			   self._code[ self._pos : self._pos + MicroWebTemplate.TOKEN_OPEN_LEN ] == MicroWebTemplate.TOKEN_OPEN :
-				self._pos    += MicroWebTemplate.TOKEN_OPEN_LEN
-				tokenContent  = ''
-				x 			  = self._pos
-				while True :
-					if x > self._endPos :
-						raise Exception("%s is missing (line %s)" % (MicroWebTemplate.TOKEN_CLOSE, self._line))
-					c = self._code[x]
-					if c == MicroWebTemplate.TOKEN_CLOSE[0] and \
-					   self._code[ x : x + MicroWebTemplate.TOKEN_CLOSE_LEN ] == MicroWebTemplate.TOKEN_CLOSE :
-					   self._pos = x + MicroWebTemplate.TOKEN_CLOSE_LEN
-					   break
-					elif c == '\n' :
-					 	self._line += 1
-					tokenContent += c
-					x 			 += 1
-				newTokenToProcess = self._processToken(tokenContent, execute)
-				if newTokenToProcess is not None :
-					return newTokenToProcess
+			# Copy the whole run of text up to the next token in one go
+			x = self._code.find(MicroWebTemplate.TOKEN_OPEN, self._pos)
+			if x < 0 :
+				x = self._endPos + 1
+			if x > self._pos :
+				text 		= self._code[self._pos:x]
+				self._line += text.count('\n')
+				if execute :
+					self._rendered.write(text)
+				self._pos 	= x
 				continue
-			elif c == '\n' :
-				self._line += 1
-			if execute :
-				self._rendered += c
-			self._pos += 1
+			self._pos   += MicroWebTemplate.TOKEN_OPEN_LEN
+			tokenContent = self._readTokenContent()
+			newTokenToProcess = self._processToken(tokenContent, execute)
+			if newTokenToProcess is not None :
+				return newTokenToProcess
 		return None
 
 	# ----------------------------------------------------------------------------
 
+	def _readTokenContent(self) :
+		x = self._code.find(MicroWebTemplate.TOKEN_CLOSE, self._pos)
+		if x < 0 :
+			self._line += self._code.count('\n', self._pos)
+			raise Exception("%s is missing (line %s)" % (MicroWebTemplate.TOKEN_CLOSE, self._line))
+		tokenContent = self._code[self._pos:x]
+		self._line  += tokenContent.count('\n')
+		self._pos 	 = x + MicroWebTemplate.TOKEN_CLOSE_LEN
+		return tokenContent
+
+	# ----------------------------------------------------------------------------
+
 	def _processToken(self, tokenContent, execute) :
 		tokenContent = tokenContent.strip()
 		parts 		 = tokenContent.split(' ', 1)
@@ -128,9 +130,9 @@ class MicroWebTemplate :
 							   self._pyGlobalVars,
 							   self._pyLocalVars ) )
 				if (self._escapeStrFunc is not None) :
-					self._rendered += self._escapeStrFunc(s)
+					self._rendered.write(self._escapeStrFunc(s))
 				else :
-					self._rendered += s
+					self._rendered.write(s)
 			except :
 				raise Exception('%s (line %s)' % (exc_info()[1], self._line))
 		return newTokenToProcess
@@ -141,39 +143,18 @@ class MicroWebTemplate :
 		if instructionBody is not None :
 			raise Exception( 'Instruction "%s" is invalid (line %s)'
 							 % (MicroWebTemplate.INSTRUCTION_PYTHON, self._line) )
-		pyCode = ''
-		while True :
-			if self._pos > self._endPos :
-				raise Exception( '"%s" instruction is missing (line %s)'
-								 % (MicroWebTemplate.INSTRUCTION_END, self._line) )
-			c = self._code[self._pos]
-			if c == MicroWebTemplate.TOKEN_OPEN[0] and \
-			   self._code[ self._pos : self._pos + MicroWebTemplate.TOKEN_OPEN_LEN ] == MicroWebTemplate.TOKEN_OPEN :
-				self._pos    += MicroWebTemplate.TOKEN_OPEN_LEN
-				tokenContent  = ''
-				x 			  = self._pos
-				while True :
-					if x > self._endPos :
-						raise Exception("%s is missing (line %s)" % (MicroWebTemplate.TOKEN_CLOSE, self._line))
-					c = self._code[x]
-					if c == MicroWebTemplate.TOKEN_CLOSE[0] and \
-					   self._code[ x : x + MicroWebTemplate.TOKEN_CLOSE_LEN ] == MicroWebTemplate.TOKEN_CLOSE :
-					   self._pos = x + MicroWebTemplate.TOKEN_CLOSE_LEN
-					   break
-					elif c == '\n' :
-					 	self._line += 1
-					tokenContent += c
-					x 			 += 1
-				tokenContent = tokenContent.strip()
-				if tokenContent == MicroWebTemplate.INSTRUCTION_END :
-					break
-				raise Exception( '"%s" is a bad instruction in a python bloc (line %s)'
-								 % (tokenContent, self._line) )				
-			elif c == '\n' :
-				self._line += 1
-			if execute :
-				pyCode += c
-			self._pos += 1
+		x = self._code.find(MicroWebTemplate.TOKEN_OPEN, self._pos)
+		if x < 0 :
+			self._line += self._code.count('\n', self._pos)
+			raise Exception( '"%s" instruction is missing (line %s)'
+							 % (MicroWebTemplate.INSTRUCTION_END, self._line) )
+		pyCode 		= self._code[self._pos:x]
+		self._line += pyCode.count('\n')
+		self._pos   = x + MicroWebTemplate.TOKEN_OPEN_LEN
+		tokenContent = self._readTokenContent().strip()
+		if tokenContent != MicroWebTemplate.INSTRUCTION_END :
+			raise Exception( '"%s" is a bad instruction in a python bloc (line %s)'
+							 % (tokenContent, self._line) )
 		if execute :
 			lines  = pyCode.split('\n')
 			indent = '' 
@@ -185,11 +166,8 @@ class MicroWebTemplate :
 						else :
 							break
 					break
-			pyCode = ''
-			for line in lines :
-				if line.find(indent) == 0 :
-					line = line[len(indent):]
-				pyCode += line + '\n'
+			pyCode = '\n'.join( line[len(indent):] if line.find(indent) == 0 else line
+								for line in lines ) + '\n'
 			try :
 				exec(pyCode, self._pyGlobalVars, self._pyLocalVars)
 			except :
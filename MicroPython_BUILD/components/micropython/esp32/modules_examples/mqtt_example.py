@@ -20,3 +20,14 @@ mqtts = network.mqtt("eclipse", "iot.eclipse.org", secure=True, cleansession=Tru
 
 
 
+
+# Per-topic callbacks: matched in C against the subscription tree,
+# topic and data are memoryviews valid only during the call
+def tempcb(topic, data):
+    print("Temperature [{}]: {}".format(bytes(topic), bytes(data)))
+
+# mqtt.subscribe("sensors/+/temperature", tempcb)
+
+# Persistent outbound queue: messages published while offline are stored
+# in the file and sent in order, at most 'replay_rate' per second, after reconnect
+# mqttp = network.mqtt("persist", "loboris.eu", autoreconnect=1, qos=1, persistent="/flash/mqtt_q.dat", persistent_size=65536, replay_rate=20)
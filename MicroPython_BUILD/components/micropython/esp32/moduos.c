@@ -40,6 +40,9 @@
 #include "extmod/vfs.h"
 #include "mpversion.h"
 #include "extmod/vfs_native.h"
+#if MICROPY_USE_SPIFFS
+#include "spiffs_vfs.h"
+#endif
 
 //extern const mp_obj_type_t mp_fat_vfs_type;
 
@@ -130,6 +133,54 @@ STATIC mp_obj_t os_umount_sdcard(void)
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_0(os_umount_sdcard_obj, os_umount_sdcard);
 
+#if MICROPY_USE_SPIFFS
+//-------------------------------------------------------------
+STATIC mp_obj_t os_fscache(size_t n_args, const mp_obj_t *args)
+{
+	// Return (cache_pages, hits, misses, prefetched) of the spiffs read cache
+	uint32_t pages, hits, misses, prefetched;
+	int reset = 0;
+	if (n_args > 0) reset = mp_obj_is_true(args[0]);
+	spiffs_cache_stat(&pages, &hits, &misses, &prefetched, reset);
+
+	mp_obj_t tuple[4];
+	tuple[0] = mp_obj_new_int(pages);
+	tuple[1] = mp_obj_new_int_from_uint(hits);
+	tuple[2] = mp_obj_new_int_from_uint(misses);
+	tuple[3] = mp_obj_new_int_from_uint(prefetched);
+	return mp_obj_new_tuple(4, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(os_fscache_obj, 0, 1, os_fscache);
+
+//----------------------------------------------------------
+STATIC mp_obj_t os_fsgc(size_t n_args, const mp_obj_t *args)
+{
+	// Incremental garbage collection for up to budget_ms (default 100 ms)
+	// Returns (erased_blocks, free_blocks)
+	uint32_t budget = 100;
+	uint32_t free_blocks;
+	if (n_args > 0) {
+		mp_int_t ms = mp_obj_get_int(args[0]);
+		if (ms < 0) mp_raise_ValueError("budget must be >= 0");
+		budget = ms;
+	}
+
+	int erased;
+	MP_THREAD_GIL_EXIT();
+	erased = spiffs_fs_gc(budget, &free_blocks);
+	MP_THREAD_GIL_ENTER();
+	if (erased < 0) {
+		mp_raise_OSError(MP_EIO);
+	}
+
+	mp_obj_t tuple[2];
+	tuple[0] = mp_obj_new_int(erased);
+	tuple[1] = mp_obj_new_int(free_blocks);
+	return mp_obj_new_tuple(2, tuple);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(os_fsgc_obj, 0, 1, os_fsgc);
+#endif
+
 
 //==========================================================
 STATIC const mp_rom_map_elem_t os_module_globals_table[] = {
@@ -156,6 +207,10 @@ STATIC const mp_rom_map_elem_t os_module_globals_table[] = {
     //{ MP_ROM_QSTR(MP_QSTR_VfsNative), MP_ROM_PTR(&mp_native_vfs_type) },
     { MP_ROM_QSTR(MP_QSTR_mountsd), MP_ROM_PTR(&os_mount_sdcard_obj) },
     { MP_ROM_QSTR(MP_QSTR_umountsd), MP_ROM_PTR(&os_umount_sdcard_obj) },
+    #if MICROPY_USE_SPIFFS
+    { MP_ROM_QSTR(MP_QSTR_fscache), MP_ROM_PTR(&os_fscache_obj) },
+    { MP_ROM_QSTR(MP_QSTR_fsgc), MP_ROM_PTR(&os_fsgc_obj) },
+    #endif
     #endif
 };
 
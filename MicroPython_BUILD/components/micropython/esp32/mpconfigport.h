@@ -111,6 +111,8 @@
 #define MICROPY_PY_SYS_STDIO_BUFFER         (1)
 #define MICROPY_PY_UERRNO                   (1)
 #define MICROPY_PY_USELECT                  (1)
+#define MICROPY_PY_USELECT_SELECT_FD        (1)
+#define MICROPY_PY_USELECT_SELECT_HEADER    "lwip/sockets.h"
 #define MICROPY_PY_UTIME_MP_HAL             (1)
 #ifdef CONFIG_MICROPY_USE_THREADS
 #define MICROPY_PY_THREAD                   (1)
@@ -124,12 +126,15 @@
 // extended modules
 #define MICROPY_PY_UCTYPES                  (1)
 #define MICROPY_PY_UZLIB                    (1)
+#define MICROPY_PY_UZLIB_CRC32_SLICE8       (1)
 #define MICROPY_PY_UJSON                    (1)
 #define MICROPY_PY_URE                      (1)
 #define MICROPY_PY_UHEAPQ                   (1)
 #define MICROPY_PY_UTIMEQ                   (1)
+#define MICROPY_PY_UASYNCIO                 (1)
 #define MICROPY_PY_UHASHLIB                 (0) // We use the ESP32 version
 #define MICROPY_PY_UHASHLIB_SHA1            (MICROPY_PY_USSL && MICROPY_SSL_AXTLS)
+#define MICROPY_PY_UHASHLIB_FILE_DIGEST_BUF (4096) // file_digest() reads flash sector sized chunks
 #define MICROPY_PY_UBINASCII                (1)
 #define MICROPY_PY_UBINASCII_CRC32          (1)
 #define MICROPY_PY_URANDOM                  (1)
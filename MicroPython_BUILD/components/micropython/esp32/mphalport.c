@@ -105,25 +105,6 @@ int mp_hal_stdin_rx_chr(uint32_t timeout)
     return -1;
 }
 
-#ifdef CONFIG_MICROPY_USE_TELNET
-// Convert '\n' to '\r\n'
-//-------------------------------------------------------------
-static void telnet_stdout_tx_str(const char *str, uint32_t len)
-{
-	char *tstr = malloc(len*2+1);
-	char prev = '\0';
-	uint32_t idx = 0;
-	while (len--) {
-		if ((*str == '\n') && (prev != '\r')) tstr[idx++] = '\r';
-		tstr[idx++] = *str;
-		prev = *str++;
-	}
-	tstr[idx++] = '\0';
-	telnet_tx_strn(tstr, strlen(tstr));
-	free(tstr);
-}
-#endif
-
 //------------------------------------------
 void mp_hal_stdout_tx_str(const char *str) {
 	#ifdef CONFIG_MICROPY_USE_TELNET
@@ -167,7 +148,7 @@ void mp_hal_stdout_tx_strn(const char *str, uint32_t len) {
 //----------------------------------------------------------------
 void mp_hal_stdout_tx_strn_cooked(const char *str, uint32_t len) {
 	#ifdef CONFIG_MICROPY_USE_TELNET
-   	if (telnet_loggedin()) telnet_stdout_tx_str(str, len);
+   	if (telnet_loggedin()) telnet_tx_strn_cooked(str, len);
    	else {
    	   	//MP_THREAD_GIL_EXIT();
    	    while (len--) {
@@ -660,7 +660,8 @@ void telnet_task (void *pvParameters)
         	break;
         }
 
-        vTaskDelay(1);
+        // wait one tick, or less if there is output to send
+        ulTaskNotifyTake(pdTRUE, 1);
 
         // ---- Check if WiFi is still available ----
         tcpip_adapter_get_ip_info(WIFI_IF_STA, &info);
@@ -702,7 +703,7 @@ uintptr_t mp_thread_createTelnetTask(size_t stack_size)
 //================================
 void ftp_task (void *pvParameters)
 {
-	int res;
+	int res, busy_loops = 0;
 	uint32_t elapsed, time_ms = mp_hal_ticks_ms();
 	// Initialize ftp, create rx buffer and mutex
 	ftp_init();
@@ -731,7 +732,14 @@ void ftp_task (void *pvParameters)
         	break;
         }
 
-        vTaskDelay(1);
+        // Sleep until some socket is ready, don't wait if a transfer can go on
+        if (res == 0) res = ftp_wait(100);
+        if (res == 0) busy_loops = 0;
+        else if (++busy_loops >= 16) {
+        	// let the lower priority tasks run during long transfers
+        	busy_loops = 0;
+        	vTaskDelay(1);
+        }
 
         // ---- Check if WiFi is still available ----
         tcpip_adapter_get_ip_info(WIFI_IF_STA, &info);
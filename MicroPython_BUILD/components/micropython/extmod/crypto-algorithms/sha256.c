@@ -40,15 +40,36 @@ static const WORD k[64] = {
 	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
 };
 
+// One round of the compression function.  Instead of shifting the eight
+// working variables each round, the callers rotate the argument names.
+#define ROUND(a,b,c,d,e,f,g,h,i,w) { \
+	WORD t1 = (h) + EP1(e) + CH(e,f,g) + k[i] + (w); \
+	(d) += t1; \
+	(h) = t1 + EP0(a) + MAJ(a,b,c); \
+}
+
+// Message schedule kept in a 16 word circular buffer.
+#define SCHED(i) (m[(i) & 15] += SIG1(m[((i) - 2) & 15]) + m[((i) - 7) & 15] + SIG0(m[((i) - 15) & 15]))
+
+#define ROUNDS8(i,W) \
+	ROUND(a,b,c,d,e,f,g,h,(i) + 0,W((i) + 0)); \
+	ROUND(h,a,b,c,d,e,f,g,(i) + 1,W((i) + 1)); \
+	ROUND(g,h,a,b,c,d,e,f,(i) + 2,W((i) + 2)); \
+	ROUND(f,g,h,a,b,c,d,e,(i) + 3,W((i) + 3)); \
+	ROUND(e,f,g,h,a,b,c,d,(i) + 4,W((i) + 4)); \
+	ROUND(d,e,f,g,h,a,b,c,(i) + 5,W((i) + 5)); \
+	ROUND(c,d,e,f,g,h,a,b,(i) + 6,W((i) + 6)); \
+	ROUND(b,c,d,e,f,g,h,a,(i) + 7,W((i) + 7));
+
+#define MSG(i) (m[i])
+
 /*********************** FUNCTION DEFINITIONS ***********************/
 static void sha256_transform(CRYAL_SHA256_CTX *ctx, const BYTE data[])
 {
-	WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
+	WORD a, b, c, d, e, f, g, h, i, m[16];
 
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-	for ( ; i < 64; ++i)
-		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+	for (i = 0; i < 16; ++i, data += 4)
+		m[i] = ((WORD)data[0] << 24) | ((WORD)data[1] << 16) | ((WORD)data[2] << 8) | (data[3]);
 
 	a = ctx->state[0];
 	b = ctx->state[1];
@@ -59,17 +80,11 @@ static void sha256_transform(CRYAL_SHA256_CTX *ctx, const BYTE data[])
 	g = ctx->state[6];
 	h = ctx->state[7];
 
-	for (i = 0; i < 64; ++i) {
-		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-		t2 = EP0(a) + MAJ(a,b,c);
-		h = g;
-		g = f;
-		f = e;
-		e = d + t1;
-		d = c;
-		c = b;
-		b = a;
-		a = t1 + t2;
+	ROUNDS8(0, MSG);
+	ROUNDS8(8, MSG);
+	for (i = 16; i < 64; i += 16) {
+		ROUNDS8(i, SCHED);
+		ROUNDS8(i + 8, SCHED);
 	}
 
 	ctx->state[0] += a;
@@ -98,17 +113,30 @@ void sha256_init(CRYAL_SHA256_CTX *ctx)
 
 void sha256_update(CRYAL_SHA256_CTX *ctx, const BYTE data[], size_t len)
 {
-	WORD i;
+	// Top up a partially filled block first
+	if (ctx->datalen != 0) {
+		size_t n = 64 - ctx->datalen;
+		if (n > len)
+			n = len;
+		memcpy(ctx->data + ctx->datalen, data, n);
+		ctx->datalen += n;
+		data += n;
+		len -= n;
+		if (ctx->datalen < 64)
+			return;
+		sha256_transform(ctx, ctx->data);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
+	}
 
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Whole blocks are hashed straight from the caller's buffer
+	for (; len >= 64; data += 64, len -= 64) {
+		sha256_transform(ctx, data);
+		ctx->bitlen += 512;
 	}
+
+	memcpy(ctx->data, data, len);
+	ctx->datalen = len;
 }
 
 void sha256_final(CRYAL_SHA256_CTX *ctx, BYTE hash[])
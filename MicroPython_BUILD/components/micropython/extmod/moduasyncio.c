@@ -0,0 +1,647 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 The MicroPython_ESP32_psRAM_LoBo contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Native core of a uasyncio style event loop.
+ *
+ * Tasks are generators (or coroutines, which are the same in MicroPython),
+ * resumed directly from C.  What a task yields tells the loop what to do:
+ *
+ *   yield                      reschedule, let other tasks run
+ *   yield 100                  sleep 100 ms (no allocation)
+ *   yield sleep_ms(100)        the same, also usable with 'await'
+ *   yield wait_io_read(sock)   wait until the stream is readable
+ *   yield wait_io_write(sock)  wait until the stream is writable
+ *   res = yield task           wait for another task, returns its result
+ *   t = yield coro             start coro as a new task, continue
+ *   yield False                park until loop.call_soon(task, value)
+ *
+ * Sleeping tasks are kept in a utimeq heap, I/O waits are done with
+ * a uselect.poll object, so all sockets are checked with one select().
+ */
+
+#include <string.h>
+
+#include "py/runtime.h"
+#include "py/objgenerator.h"
+#include "py/smallint.h"
+#include "py/stream.h"
+#include "py/mphal.h"
+#include "extmod/modutimeq.h"
+
+#if MICROPY_PY_UASYNCIO
+
+#if !MICROPY_PY_USELECT
+#error MICROPY_PY_UASYNCIO requires MICROPY_PY_USELECT
+#endif
+
+#define TICKS_PERIOD MICROPY_PY_UTIME_TICKS_PERIOD
+#define TICKS_MAX (TICKS_PERIOD - 1)
+
+enum {
+    TASK_QUEUED,
+    TASK_RUNNING,
+    TASK_SLEEPING,
+    TASK_IO,
+    TASK_WAITING,
+    TASK_PARKED,
+    TASK_DONE,
+};
+
+enum {
+    SYSCALL_SLEEP_MS,
+    SYSCALL_IO_READ,
+    SYSCALL_IO_WRITE,
+};
+
+typedef struct _mp_obj_task_t {
+    mp_obj_base_t base;
+    mp_obj_t coro;
+    mp_obj_t data;      // value sent on next resume; the stream or task waited on; the result when done
+    mp_obj_t exc;       // exception thrown in on next resume, or MP_OBJ_NULL
+    struct _mp_obj_task_t *waiter; // task waiting for this one to finish
+    mp_uint_t state;
+} mp_obj_task_t;
+
+typedef struct _mp_obj_syscall_t {
+    mp_obj_base_t base;
+    uint16_t kind;
+    uint16_t yielded;
+    mp_obj_t arg;
+} mp_obj_syscall_t;
+
+typedef struct _mp_obj_loop_t {
+    mp_obj_base_t base;
+    mp_obj_utimeq_t *waitq;
+    mp_obj_t poller;
+    mp_map_t io_rd;     // id(stream) -> task waiting to read
+    mp_map_t io_wr;     // id(stream) -> task waiting to write
+    mp_obj_task_t *cur;
+    bool stopped;
+    mp_uint_t runq_alloc;
+    mp_uint_t runq_head;
+    mp_uint_t runq_len;
+    mp_obj_task_t **runq;
+} mp_obj_loop_t;
+
+STATIC const mp_obj_type_t task_type;
+STATIC const mp_obj_type_t syscall_type;
+STATIC const mp_obj_type_t mp_type_CancelledError;
+
+MP_DECLARE_CONST_FUN_OBJ_0(mp_select_poll_obj);
+
+STATIC mp_int_t ticks_diff(mp_uint_t end, mp_uint_t start) {
+    return ((mp_int_t)((end - start + TICKS_PERIOD / 2) & TICKS_MAX)) - TICKS_PERIOD / 2;
+}
+
+// the run queue grows when full, so a task woken from I/O or by another
+// task finishing is never dropped
+STATIC void runq_push(mp_obj_loop_t *self, mp_obj_task_t *task) {
+    if (self->runq_len == self->runq_alloc) {
+        mp_uint_t alloc = self->runq_alloc * 2;
+        mp_obj_task_t **runq = m_new(mp_obj_task_t*, alloc);
+        for (mp_uint_t i = 0; i < self->runq_len; i++) {
+            mp_uint_t j = self->runq_head + i;
+            runq[i] = self->runq[(j >= self->runq_alloc) ? j - self->runq_alloc : j];
+        }
+        memset(runq + self->runq_len, 0, (alloc - self->runq_len) * sizeof(*runq));
+        m_del(mp_obj_task_t*, self->runq, self->runq_alloc);
+        self->runq = runq;
+        self->runq_alloc = alloc;
+        self->runq_head = 0;
+    }
+    mp_uint_t i = self->runq_head + self->runq_len++;
+    if (i >= self->runq_alloc) {
+        i -= self->runq_alloc;
+    }
+    self->runq[i] = task;
+    task->state = TASK_QUEUED;
+}
+
+// the wait queue grows the same way, a sleeping task is always kept
+STATIC void waitq_push(mp_obj_loop_t *self, mp_obj_task_t *task, mp_uint_t time) {
+    mp_obj_utimeq_t *waitq = self->waitq;
+    if (waitq->len == waitq->alloc) {
+        // the items stay a valid heap when copied as they are
+        mp_obj_utimeq_t *q = mp_utimeq_new(waitq->alloc * 2);
+        memcpy(q->items, waitq->items, waitq->len * sizeof(*q->items));
+        q->len = waitq->len;
+        m_del_var(mp_obj_utimeq_t, struct qentry, waitq->alloc, waitq);
+        self->waitq = waitq = q;
+    }
+    mp_utimeq_push(waitq, time, MP_OBJ_FROM_PTR(task), mp_const_none);
+    task->state = TASK_SLEEPING;
+}
+
+STATIC mp_obj_task_t *runq_pop(mp_obj_loop_t *self) {
+    mp_obj_task_t *task = self->runq[self->runq_head];
+    self->runq[self->runq_head] = NULL;
+    if (++self->runq_head == self->runq_alloc) {
+        self->runq_head = 0;
+    }
+    self->runq_len--;
+    return task;
+}
+
+STATIC void task_wake(mp_obj_loop_t *self, mp_obj_task_t *task, mp_obj_t value) {
+    task->data = value;
+    runq_push(self, task);
+}
+
+STATIC mp_obj_task_t *task_new(mp_obj_loop_t *self, mp_obj_t coro) {
+    mp_obj_task_t *task = m_new_obj(mp_obj_task_t);
+    task->base.type = &task_type;
+    task->coro = coro;
+    task->data = mp_const_none;
+    task->exc = MP_OBJ_NULL;
+    task->waiter = NULL;
+    runq_push(self, task);
+    return task;
+}
+
+// (re)register the stream with the poller for the directions still waited on,
+// or unregister it when none is, so idle streams cost nothing in poll()
+STATIC void io_update(mp_obj_loop_t *self, mp_obj_t stream) {
+    mp_uint_t flags = 0;
+    if (mp_map_lookup(&self->io_rd, mp_obj_id(stream), MP_MAP_LOOKUP) != NULL) {
+        flags |= MP_STREAM_POLL_RD;
+    }
+    if (mp_map_lookup(&self->io_wr, mp_obj_id(stream), MP_MAP_LOOKUP) != NULL) {
+        flags |= MP_STREAM_POLL_WR;
+    }
+    mp_obj_t dest[4];
+    if (flags == 0) {
+        mp_load_method(self->poller, MP_QSTR_unregister, dest);
+        dest[2] = stream;
+        mp_call_method_n_kw(1, 0, dest);
+        return;
+    }
+    mp_load_method(self->poller, MP_QSTR_register, dest);
+    dest[2] = stream;
+    dest[3] = MP_OBJ_NEW_SMALL_INT(flags);
+    mp_call_method_n_kw(2, 0, dest);
+}
+
+STATIC void io_wait(mp_obj_loop_t *self, mp_obj_task_t *task, mp_map_t *map, mp_obj_t stream) {
+    mp_map_elem_t *elem = mp_map_lookup(map, mp_obj_id(stream), MP_MAP_LOOKUP_ADD_IF_NOT_FOUND);
+    if (elem->value != MP_OBJ_NULL) {
+        mp_raise_ValueError("stream already waited on");
+    }
+    elem->value = MP_OBJ_FROM_PTR(task);
+    task->data = stream;
+    task->state = TASK_IO;
+    io_update(self, stream);
+}
+
+// wait for I/O at most timeout ms (-1 is forever), wake the tasks whose streams are ready
+STATIC void io_poll(mp_obj_loop_t *self, mp_int_t timeout) {
+    mp_obj_t dest[4];
+    mp_load_method(self->poller, MP_QSTR_ipoll, dest);
+    dest[2] = MP_OBJ_NEW_SMALL_INT(timeout);
+    dest[3] = MP_OBJ_NEW_SMALL_INT(1); // one-shot, io_update() sets the flags again or unregisters
+    mp_obj_t iter = mp_call_method_n_kw(2, 0, dest);
+    mp_obj_t item;
+    while ((item = mp_iternext(iter)) != MP_OBJ_STOP_ITERATION) {
+        mp_obj_t *ev;
+        mp_obj_get_array_fixed_n(item, 2, &ev);
+        mp_obj_t stream = ev[0];
+        mp_uint_t flags = MP_OBJ_SMALL_INT_VALUE(ev[1]);
+        // the task is queued before it is forgotten, so it can't get lost
+        mp_map_elem_t *elem = mp_map_lookup(&self->io_rd, mp_obj_id(stream), MP_MAP_LOOKUP);
+        if (elem != NULL && (flags & ~MP_STREAM_POLL_WR)) {
+            task_wake(self, MP_OBJ_TO_PTR(elem->value), mp_const_none);
+            mp_map_lookup(&self->io_rd, mp_obj_id(stream), MP_MAP_LOOKUP_REMOVE_IF_FOUND);
+        }
+        elem = mp_map_lookup(&self->io_wr, mp_obj_id(stream), MP_MAP_LOOKUP);
+        if (elem != NULL && (flags & ~MP_STREAM_POLL_RD)) {
+            task_wake(self, MP_OBJ_TO_PTR(elem->value), mp_const_none);
+            mp_map_lookup(&self->io_wr, mp_obj_id(stream), MP_MAP_LOOKUP_REMOVE_IF_FOUND);
+        }
+        io_update(self, stream);
+    }
+}
+
+// act on the value yielded by a task
+STATIC void task_yielded(mp_obj_loop_t *self, mp_obj_task_t *task, mp_obj_t ret) {
+    if (task->exc != MP_OBJ_NULL) {
+        // cancelled while running, deliver it right away
+        runq_push(self, task);
+        return;
+    }
+    if (ret == mp_const_none) {
+        runq_push(self, task);
+        return;
+    }
+    if (ret == mp_const_false) {
+        task->state = TASK_PARKED;
+        return;
+    }
+
+    mp_int_t delay = 0;
+    if (MP_OBJ_IS_SMALL_INT(ret)) {
+        delay = MP_OBJ_SMALL_INT_VALUE(ret);
+    } else if (MP_OBJ_IS_TYPE(ret, &syscall_type)) {
+        mp_obj_syscall_t *sc = MP_OBJ_TO_PTR(ret);
+        if (sc->kind == SYSCALL_IO_READ) {
+            io_wait(self, task, &self->io_rd, sc->arg);
+            return;
+        } else if (sc->kind == SYSCALL_IO_WRITE) {
+            io_wait(self, task, &self->io_wr, sc->arg);
+            return;
+        }
+        delay = MP_OBJ_SMALL_INT_VALUE(sc->arg);
+    } else if (MP_OBJ_IS_TYPE(ret, &task_type)) {
+        mp_obj_task_t *other = MP_OBJ_TO_PTR(ret);
+        if (other->state == TASK_DONE) {
+            task_wake(self, task, other->data);
+        } else if (other->waiter != NULL || other == task) {
+            task->exc = mp_obj_new_exception_msg(&mp_type_ValueError, "task already awaited");
+            runq_push(self, task);
+        } else {
+            other->waiter = task;
+            task->data = ret;
+            task->state = TASK_WAITING;
+        }
+        return;
+    } else if (MP_OBJ_IS_TYPE(ret, &mp_type_gen_instance)) {
+        task_wake(self, task, MP_OBJ_FROM_PTR(task_new(self, ret)));
+        return;
+    } else {
+        task->exc = mp_obj_new_exception_msg(&mp_type_TypeError, "unsupported yield value");
+        runq_push(self, task);
+        return;
+    }
+
+    if (delay <= 0) {
+        runq_push(self, task);
+        return;
+    }
+    // the task has left the run queue, if it can't sleep it gets the error
+    nlr_buf_t nlr;
+    if (nlr_push(&nlr) == 0) {
+        waitq_push(self, task, (mp_hal_ticks_ms() + delay) & TICKS_MAX);
+        nlr_pop();
+    } else {
+        task->exc = MP_OBJ_FROM_PTR(nlr.ret_val);
+        runq_push(self, task);
+    }
+}
+
+STATIC void task_finished(mp_obj_loop_t *self, mp_obj_task_t *task, mp_obj_t result, mp_obj_t exc) {
+    task->state = TASK_DONE;
+    task->data = result;
+    mp_obj_task_t *waiter = task->waiter;
+    task->waiter = NULL;
+    if (waiter != NULL) {
+        if (exc != MP_OBJ_NULL) {
+            waiter->exc = exc;
+        }
+        task_wake(self, waiter, result);
+    } else if (exc != MP_OBJ_NULL
+        && !mp_obj_is_subclass_fast(MP_OBJ_FROM_PTR(mp_obj_get_type(exc)), MP_OBJ_FROM_PTR(&mp_type_CancelledError))) {
+        // nobody to deliver it to, stop the loop with it
+        nlr_raise(exc);
+    }
+}
+
+STATIC void task_run(mp_obj_loop_t *self, mp_obj_task_t *task) {
+    mp_obj_t send = task->data;
+    mp_obj_t exc = task->exc;
+    task->data = mp_const_none;
+    task->exc = MP_OBJ_NULL;
+    task->state = TASK_RUNNING;
+
+    self->cur = task;
+    mp_obj_t ret;
+    mp_vm_return_kind_t kind = mp_resume(task->coro, (exc == MP_OBJ_NULL) ? send : MP_OBJ_NULL, exc, &ret);
+    self->cur = NULL;
+
+    if (kind == MP_VM_RETURN_YIELD) {
+        task_yielded(self, task, ret);
+    } else if (kind == MP_VM_RETURN_NORMAL) {
+        task_finished(self, task, (ret == MP_OBJ_NULL) ? mp_const_none : ret, MP_OBJ_NULL);
+    } else {
+        task_finished(self, task, mp_const_none, ret);
+    }
+}
+
+// move tasks whose sleep expired to the run queue, returns ms until the next one, or -1
+STATIC mp_int_t timers_expire(mp_obj_loop_t *self) {
+    mp_obj_utimeq_t *waitq = self->waitq;
+    mp_uint_t now = mp_hal_ticks_ms() & TICKS_MAX;
+    while (waitq->len > 0) {
+        mp_int_t delay = ticks_diff(waitq->items[0].time, now);
+        if (delay > 0) {
+            return delay;
+        }
+        struct qentry item;
+        mp_utimeq_pop(waitq, &item);
+        task_wake(self, MP_OBJ_TO_PTR(item.callback), mp_const_none);
+    }
+    return -1;
+}
+
+// run until the main task finishes (or forever if NULL), stop() is called or nothing is left to do
+STATIC mp_obj_t loop_run(mp_obj_loop_t *self, mp_obj_task_t *main) {
+    self->stopped = false;
+    for (;;) {
+        // run the tasks ready now, the ones they make ready run in the next round
+        for (mp_uint_t n = self->runq_len; n > 0; n--) {
+            task_run(self, runq_pop(self));
+            if (main != NULL && main->state == TASK_DONE) {
+                return main->data;
+            }
+        }
+        if (self->stopped) {
+            return mp_const_none;
+        }
+
+        // after the tasks ran, so the sleeps they just started are counted
+        mp_int_t timeout = timers_expire(self);
+        bool io = (self->io_rd.used + self->io_wr.used) > 0;
+        if (self->runq_len > 0) {
+            timeout = 0;
+        } else if (timeout < 0 && !io) {
+            if (main != NULL) {
+                mp_raise_msg(&mp_type_RuntimeError, "all tasks blocked");
+            }
+            return mp_const_none;
+        }
+        if (io) {
+            io_poll(self, timeout);
+        } else if (timeout > 0) {
+            mp_hal_delay_ms(timeout);
+        }
+        mp_handle_pending();
+    }
+}
+
+// Loop(runq_len=16, waitq_len=16): the run queue and the wait queue of
+// sleeping tasks start with that many slots and grow when full
+STATIC mp_obj_t loop_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    mp_arg_check_num(n_args, n_kw, 0, 2, false);
+    mp_uint_t runq_len = (n_args > 0) ? mp_obj_get_int(args[0]) : 16;
+    mp_uint_t waitq_len = (n_args > 1) ? mp_obj_get_int(args[1]) : 16;
+    if (runq_len == 0 || waitq_len == 0) {
+        mp_raise_ValueError(NULL);
+    }
+    mp_obj_loop_t *self = m_new_obj(mp_obj_loop_t);
+    self->base.type = type;
+    self->waitq = mp_utimeq_new(waitq_len);
+    self->poller = mp_call_function_0(MP_OBJ_FROM_PTR(&mp_select_poll_obj));
+    mp_map_init(&self->io_rd, 0);
+    mp_map_init(&self->io_wr, 0);
+    self->cur = NULL;
+    self->stopped = false;
+    self->runq = m_new0(mp_obj_task_t*, runq_len);
+    self->runq_alloc = runq_len;
+    self->runq_head = 0;
+    self->runq_len = 0;
+    return MP_OBJ_FROM_PTR(self);
+}
+
+STATIC mp_obj_t loop_create_task(mp_obj_t self_in, mp_obj_t coro) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    return MP_OBJ_FROM_PTR(task_new(self, coro));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(loop_create_task_obj, loop_create_task);
+
+STATIC mp_obj_t loop_run_forever(mp_obj_t self_in) {
+    return loop_run(MP_OBJ_TO_PTR(self_in), NULL);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(loop_run_forever_obj, loop_run_forever);
+
+STATIC mp_obj_t loop_run_until_complete(mp_obj_t self_in, mp_obj_t coro) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_obj_task_t *main;
+    if (MP_OBJ_IS_TYPE(coro, &task_type)) {
+        main = MP_OBJ_TO_PTR(coro);
+    } else {
+        main = task_new(self, coro);
+    }
+    if (main->state == TASK_DONE) {
+        return main->data;
+    }
+    return loop_run(self, main);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(loop_run_until_complete_obj, loop_run_until_complete);
+
+STATIC mp_obj_t loop_stop(mp_obj_t self_in) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    self->stopped = true;
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(loop_stop_obj, loop_stop);
+
+STATIC mp_obj_t loop_current(mp_obj_t self_in) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    return (self->cur == NULL) ? mp_const_none : MP_OBJ_FROM_PTR(self->cur);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(loop_current_obj, loop_current);
+
+// wake a task parked with 'yield False', value is what its yield returns
+STATIC mp_obj_t loop_call_soon(size_t n_args, const mp_obj_t *args) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(args[0]);
+    if (!MP_OBJ_IS_TYPE(args[1], &task_type)) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_task_t *task = MP_OBJ_TO_PTR(args[1]);
+    if (task->state != TASK_PARKED) {
+        return mp_const_false;
+    }
+    task_wake(self, task, (n_args > 2) ? args[2] : mp_const_none);
+    return mp_const_true;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(loop_call_soon_obj, 2, 3, loop_call_soon);
+
+// throw CancelledError into the task at its next resume, returns False if already finished
+STATIC mp_obj_t loop_cancel(mp_obj_t self_in, mp_obj_t task_in) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    if (!MP_OBJ_IS_TYPE(task_in, &task_type)) {
+        mp_raise_TypeError(NULL);
+    }
+    mp_obj_task_t *task = MP_OBJ_TO_PTR(task_in);
+    if (task->state == TASK_DONE) {
+        return mp_const_false;
+    }
+    task->exc = mp_obj_new_exception(&mp_type_CancelledError);
+    switch (task->state) {
+        case TASK_SLEEPING:
+            mp_utimeq_remove(self->waitq, task_in);
+            task_wake(self, task, mp_const_none);
+            break;
+        case TASK_IO: {
+            mp_obj_t stream = task->data;
+            mp_map_elem_t *elem = mp_map_lookup(&self->io_rd, mp_obj_id(stream), MP_MAP_LOOKUP);
+            if (elem != NULL && elem->value == task_in) {
+                mp_map_lookup(&self->io_rd, mp_obj_id(stream), MP_MAP_LOOKUP_REMOVE_IF_FOUND);
+            } else {
+                mp_map_lookup(&self->io_wr, mp_obj_id(stream), MP_MAP_LOOKUP_REMOVE_IF_FOUND);
+            }
+            io_update(self, stream);
+            task_wake(self, task, mp_const_none);
+            break;
+        }
+        case TASK_WAITING: {
+            mp_obj_task_t *other = MP_OBJ_TO_PTR(task->data);
+            other->waiter = NULL;
+            task_wake(self, task, mp_const_none);
+            break;
+        }
+        case TASK_PARKED:
+            task_wake(self, task, mp_const_none);
+            break;
+        default:
+            // queued or running, gets it when resumed next
+            break;
+    }
+    return mp_const_true;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(loop_cancel_obj, loop_cancel);
+
+// forget a stream, e.g. before closing it; tasks still waiting on it are cancelled
+STATIC mp_obj_t loop_remove_io(mp_obj_t self_in, mp_obj_t stream) {
+    mp_obj_loop_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_map_elem_t *elem = mp_map_lookup(&self->io_rd, mp_obj_id(stream), MP_MAP_LOOKUP);
+    if (elem != NULL) {
+        loop_cancel(self_in, elem->value);
+    }
+    elem = mp_map_lookup(&self->io_wr, mp_obj_id(stream), MP_MAP_LOOKUP);
+    if (elem != NULL) {
+        loop_cancel(self_in, elem->value);
+    }
+    mp_obj_t dest[3];
+    mp_load_method(self->poller, MP_QSTR_unregister, dest);
+    dest[2] = stream;
+    mp_call_method_n_kw(1, 0, dest);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(loop_remove_io_obj, loop_remove_io);
+
+STATIC const mp_rom_map_elem_t loop_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_create_task), MP_ROM_PTR(&loop_create_task_obj) },
+    { MP_ROM_QSTR(MP_QSTR_run_forever), MP_ROM_PTR(&loop_run_forever_obj) },
+    { MP_ROM_QSTR(MP_QSTR_run_until_complete), MP_ROM_PTR(&loop_run_until_complete_obj) },
+    { MP_ROM_QSTR(MP_QSTR_stop), MP_ROM_PTR(&loop_stop_obj) },
+    { MP_ROM_QSTR(MP_QSTR_current), MP_ROM_PTR(&loop_current_obj) },
+    { MP_ROM_QSTR(MP_QSTR_call_soon), MP_ROM_PTR(&loop_call_soon_obj) },
+    { MP_ROM_QSTR(MP_QSTR_cancel), MP_ROM_PTR(&loop_cancel_obj) },
+    { MP_ROM_QSTR(MP_QSTR_remove_io), MP_ROM_PTR(&loop_remove_io_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(loop_locals_dict, loop_locals_dict_table);
+
+STATIC const mp_obj_type_t loop_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Loop,
+    .make_new = loop_make_new,
+    .locals_dict = (void*)&loop_locals_dict,
+};
+
+STATIC mp_obj_t task_done(mp_obj_t self_in) {
+    mp_obj_task_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_bool(self->state == TASK_DONE);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(task_done_obj, task_done);
+
+STATIC const mp_rom_map_elem_t task_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_done), MP_ROM_PTR(&task_done_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(task_locals_dict, task_locals_dict_table);
+
+STATIC const mp_obj_type_t task_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Task,
+    .locals_dict = (void*)&task_locals_dict,
+};
+
+// a syscall is yielded once, so 'await sleep_ms(10)' works as well as 'yield sleep_ms(10)'
+STATIC mp_obj_t syscall_iternext(mp_obj_t self_in) {
+    mp_obj_syscall_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->yielded) {
+        return MP_OBJ_STOP_ITERATION;
+    }
+    self->yielded = 1;
+    return self_in;
+}
+
+STATIC const mp_obj_type_t syscall_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_SysCall,
+    .getiter = mp_identity_getiter,
+    .iternext = syscall_iternext,
+};
+
+STATIC mp_obj_t syscall_new(uint16_t kind, mp_obj_t arg) {
+    mp_obj_syscall_t *sc = m_new_obj(mp_obj_syscall_t);
+    sc->base.type = &syscall_type;
+    sc->kind = kind;
+    sc->yielded = 0;
+    sc->arg = arg;
+    return MP_OBJ_FROM_PTR(sc);
+}
+
+STATIC mp_obj_t mod_uasyncio_sleep_ms(mp_obj_t ms_in) {
+    return syscall_new(SYSCALL_SLEEP_MS, MP_OBJ_NEW_SMALL_INT(mp_obj_get_int(ms_in)));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_uasyncio_sleep_ms_obj, mod_uasyncio_sleep_ms);
+
+STATIC mp_obj_t mod_uasyncio_wait_io_read(mp_obj_t stream) {
+    mp_get_stream_raise(stream, MP_STREAM_OP_IOCTL);
+    return syscall_new(SYSCALL_IO_READ, stream);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_uasyncio_wait_io_read_obj, mod_uasyncio_wait_io_read);
+
+STATIC mp_obj_t mod_uasyncio_wait_io_write(mp_obj_t stream) {
+    mp_get_stream_raise(stream, MP_STREAM_OP_IOCTL);
+    return syscall_new(SYSCALL_IO_WRITE, stream);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(mod_uasyncio_wait_io_write_obj, mod_uasyncio_wait_io_write);
+
+STATIC const mp_obj_type_t mp_type_CancelledError = {
+    { &mp_type_type },
+    .name = MP_QSTR_CancelledError,
+    .print = mp_obj_exception_print,
+    .make_new = mp_obj_exception_make_new,
+    .parent = &mp_type_Exception,
+};
+
+STATIC const mp_rom_map_elem_t mp_module_uasyncio_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR__uasyncio) },
+    { MP_ROM_QSTR(MP_QSTR_Loop), MP_ROM_PTR(&loop_type) },
+    { MP_ROM_QSTR(MP_QSTR_CancelledError), MP_ROM_PTR(&mp_type_CancelledError) },
+    { MP_ROM_QSTR(MP_QSTR_sleep_ms), MP_ROM_PTR(&mod_uasyncio_sleep_ms_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wait_io_read), MP_ROM_PTR(&mod_uasyncio_wait_io_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_wait_io_write), MP_ROM_PTR(&mod_uasyncio_wait_io_write_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(mp_module_uasyncio_globals, mp_module_uasyncio_globals_table);
+
+const mp_obj_module_t mp_module_uasyncio = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t*)&mp_module_uasyncio_globals,
+};
+
+#endif // MICROPY_PY_UASYNCIO
@@ -31,8 +31,66 @@
 #include "py/nlr.h"
 #include "py/runtime.h"
 #include "py/binary.h"
+#include "py/stream.h"
 #include "extmod/modubinascii.h"
 
+STATIC const char hexchars[] = "0123456789abcdef";
+
+STATIC const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Maps a character to its sextet value, or 0xff if it's not in the base64
+// alphabet (this includes the '=' pad character).
+STATIC const byte base64_decode_table[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// Number of bytes base64_encode() writes for len input bytes
+#define BASE64_ENCODED_LEN(len) (((len) + 2) / 3 * 4)
+
+STATIC void check_out_buf(size_t needed, size_t avail) {
+    if (needed > avail) {
+        mp_raise_ValueError("buffer too small");
+    }
+}
+
+// Writes 2 hex digits per input byte, and if sep is not NULL then sep[0]
+// between each pair.  Returns the number of bytes written.
+STATIC size_t hexlify_buf(byte *out, const byte *in, size_t len, const char *sep) {
+    byte *out_start = out;
+    for (size_t i = len; i--;) {
+        byte b = *in++;
+        *out++ = hexchars[b >> 4];
+        *out++ = hexchars[b & 0xf];
+        if (sep != NULL && i != 0) {
+            *out++ = *sep;
+        }
+    }
+    return out - out_start;
+}
+
+STATIC size_t hexlify_len(size_t len, const char *sep) {
+    // code below assumes non-zero len when computing size with separator
+    if (len == 0) {
+        return 0;
+    }
+    return len * 2 + (sep != NULL ? len - 1 : 0);
+}
+
 mp_obj_t mod_binascii_hexlify(size_t n_args, const mp_obj_t *args) {
     // Second argument is for an extension to allow a separator to be used
     // between values.
@@ -40,40 +98,36 @@ mp_obj_t mod_binascii_hexlify(size_t n_args, const mp_obj_t *args) {
     mp_buffer_info_t bufinfo;
     mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_READ);
 
-    // Code below assumes non-zero buffer length when computing size with
-    // separator, so handle the zero-length case here.
     if (bufinfo.len == 0) {
         return mp_const_empty_bytes;
     }
 
-    vstr_t vstr;
-    size_t out_len = bufinfo.len * 2;
     if (n_args > 1) {
         // 1-char separator between hex numbers
-        out_len += bufinfo.len - 1;
         sep = mp_obj_str_get_str(args[1]);
     }
-    vstr_init_len(&vstr, out_len);
-    byte *in = bufinfo.buf, *out = (byte*)vstr.buf;
-    for (mp_uint_t i = bufinfo.len; i--;) {
-        byte d = (*in >> 4);
-        if (d > 9) {
-            d += 'a' - '9' - 1;
-        }
-        *out++ = d + '0';
-        d = (*in++ & 0xf);
-        if (d > 9) {
-            d += 'a' - '9' - 1;
-        }
-        *out++ = d + '0';
-        if (sep != NULL && i != 0) {
-            *out++ = *sep;
-        }
-    }
+    vstr_t vstr;
+    vstr_init_len(&vstr, hexlify_len(bufinfo.len, sep));
+    hexlify_buf((byte*)vstr.buf, bufinfo.buf, bufinfo.len, sep);
     return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
 }
 MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_binascii_hexlify_obj, 1, 2, mod_binascii_hexlify);
 
+// hexlify_into(data, buf[, sep])
+// Like hexlify but writes into buf and returns the number of bytes written.
+mp_obj_t mod_binascii_hexlify_into(size_t n_args, const mp_obj_t *args) {
+    const char *sep = NULL;
+    mp_buffer_info_t bufinfo, outinfo;
+    mp_get_buffer_raise(args[0], &bufinfo, MP_BUFFER_READ);
+    mp_get_buffer_raise(args[1], &outinfo, MP_BUFFER_WRITE);
+    if (n_args > 2) {
+        sep = mp_obj_str_get_str(args[2]);
+    }
+    check_out_buf(hexlify_len(bufinfo.len, sep), outinfo.len);
+    return MP_OBJ_NEW_SMALL_INT(hexlify_buf(outinfo.buf, bufinfo.buf, bufinfo.len, sep));
+}
+MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_binascii_hexlify_into_obj, 2, 3, mod_binascii_hexlify_into);
+
 mp_obj_t mod_binascii_unhexlify(mp_obj_t data) {
     mp_buffer_info_t bufinfo;
     mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
@@ -103,39 +157,39 @@ mp_obj_t mod_binascii_unhexlify(mp_obj_t data) {
 }
 MP_DEFINE_CONST_FUN_OBJ_1(mod_binascii_unhexlify_obj, mod_binascii_unhexlify);
 
-// If ch is a character in the base64 alphabet, and is not a pad character, then
-// the corresponding integer between 0 and 63, inclusively, is returned.
-// Otherwise, -1 is returned.
-static int mod_binascii_sextet(byte ch) {
-    if (ch >= 'A' && ch <= 'Z') {
-        return ch - 'A';
-    } else if (ch >= 'a' && ch <= 'z') {
-        return ch - 'a' + 26;
-    } else if (ch >= '0' && ch <= '9') {
-        return ch - '0' + 52;
-    } else if (ch == '+') {
-        return 62;
-    } else if (ch == '/') {
-        return 63;
-    } else {
-        return -1;
-    }
-}
-
-mp_obj_t mod_binascii_a2b_base64(mp_obj_t data) {
-    mp_buffer_info_t bufinfo;
-    mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
-    byte *in = bufinfo.buf;
-
-    vstr_t vstr;
-    vstr_init(&vstr, (bufinfo.len / 4) * 3 + 1); // Potentially over-allocate
-    byte *out = (byte *)vstr.buf;
+// Decodes base64 from in to out, which has room for out_max bytes.
+// Characters outside the base64 alphabet are skipped.  Returns the number
+// of bytes written.
+STATIC size_t base64_decode(byte *out, size_t out_max, const byte *in, size_t len) {
+    byte *out_start = out;
+    byte *out_end = out + out_max;
+    const byte *top = in + len;
 
     uint shift = 0;
     int nbits = 0; // Number of meaningful bits in shift
     bool hadpad = false; // Had a pad character since last valid character
-    for (size_t i = 0; i < bufinfo.len; i++) {
-        if (in[i] == '=') {
+    while (in < top) {
+        // Fast path: a complete group of 4 alphabet characters at a group
+        // boundary decodes straight to 3 bytes.
+        if (nbits == 0 && top - in >= 4 && out_end - out >= 3) {
+            uint32_t a = base64_decode_table[in[0]];
+            uint32_t b = base64_decode_table[in[1]];
+            uint32_t c = base64_decode_table[in[2]];
+            uint32_t d = base64_decode_table[in[3]];
+            if ((a | b | c | d) < 64) {
+                uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+                out[0] = v >> 16;
+                out[1] = v >> 8;
+                out[2] = v;
+                out += 3;
+                in += 4;
+                hadpad = false;
+                continue;
+            }
+        }
+
+        byte ch = *in++;
+        if (ch == '=') {
             if ((nbits == 2) || ((nbits == 4) && hadpad)) {
                 nbits = 0;
                 break;
@@ -143,8 +197,8 @@ mp_obj_t mod_binascii_a2b_base64(mp_obj_t data) {
             hadpad = true;
         }
 
-        int sextet = mod_binascii_sextet(in[i]);
-        if (sextet == -1) {
+        byte sextet = base64_decode_table[ch];
+        if (sextet >= 64) {
             continue;
         }
         hadpad = false;
@@ -153,7 +207,8 @@ mp_obj_t mod_binascii_a2b_base64(mp_obj_t data) {
 
         if (nbits >= 8) {
             nbits -= 8;
-            out[vstr.len++] = (shift >> nbits) & 0xFF;
+            check_out_buf(out - out_start + 1, out_max);
+            *out++ = (shift >> nbits) & 0xFF;
         }
     }
 
@@ -161,62 +216,187 @@ mp_obj_t mod_binascii_a2b_base64(mp_obj_t data) {
         mp_raise_ValueError("incorrect padding");
     }
 
+    return out - out_start;
+}
+
+mp_obj_t mod_binascii_a2b_base64(mp_obj_t data) {
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
+
+    // each 4 input characters give at most 3 bytes, plus 2 for a trailing partial group
+    vstr_t vstr;
+    vstr_init(&vstr, (bufinfo.len / 4) * 3 + 2);
+    vstr.len = base64_decode((byte*)vstr.buf, vstr.alloc, bufinfo.buf, bufinfo.len);
     return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
 }
 MP_DEFINE_CONST_FUN_OBJ_1(mod_binascii_a2b_base64_obj, mod_binascii_a2b_base64);
 
+// a2b_base64_into(data, buf)
+// Decodes into buf and returns the number of bytes written.
+mp_obj_t mod_binascii_a2b_base64_into(mp_obj_t data, mp_obj_t buf) {
+    mp_buffer_info_t bufinfo, outinfo;
+    mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
+    mp_get_buffer_raise(buf, &outinfo, MP_BUFFER_WRITE);
+    return MP_OBJ_NEW_SMALL_INT(base64_decode(outinfo.buf, outinfo.len, bufinfo.buf, bufinfo.len));
+}
+MP_DEFINE_CONST_FUN_OBJ_2(mod_binascii_a2b_base64_into_obj, mod_binascii_a2b_base64_into);
+
+// Encodes len bytes from in to out, padding the final group with '='.
+// Returns the number of bytes written, which is BASE64_ENCODED_LEN(len).
+STATIC size_t base64_encode(byte *out, const byte *in, size_t len) {
+    byte *out_start = out;
+    for (; len >= 3; len -= 3, in += 3) {
+        uint32_t v = (in[0] << 16) | (in[1] << 8) | in[2];
+        out[0] = base64_alphabet[v >> 18];
+        out[1] = base64_alphabet[(v >> 12) & 0x3f];
+        out[2] = base64_alphabet[(v >> 6) & 0x3f];
+        out[3] = base64_alphabet[v & 0x3f];
+        out += 4;
+    }
+    if (len != 0) {
+        uint32_t v = (in[0] << 16) | (len == 2 ? in[1] << 8 : 0);
+        out[0] = base64_alphabet[v >> 18];
+        out[1] = base64_alphabet[(v >> 12) & 0x3f];
+        out[2] = len == 2 ? base64_alphabet[(v >> 6) & 0x3f] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+    return out - out_start;
+}
+
 mp_obj_t mod_binascii_b2a_base64(mp_obj_t data) {
     mp_buffer_info_t bufinfo;
     mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
 
     vstr_t vstr;
-    vstr_init_len(&vstr, ((bufinfo.len != 0) ? (((bufinfo.len - 1) / 3) + 1) * 4 : 0) + 1);
+    vstr_init_len(&vstr, BASE64_ENCODED_LEN(bufinfo.len) + 1);
+    byte *out = (byte*)vstr.buf;
+    out += base64_encode(out, bufinfo.buf, bufinfo.len);
+    *out = '\n';
+    return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
+}
+MP_DEFINE_CONST_FUN_OBJ_1(mod_binascii_b2a_base64_obj, mod_binascii_b2a_base64);
 
-    // First pass, we convert input buffer to numeric base 64 values
-    byte *in = bufinfo.buf, *out = (byte*)vstr.buf;
-    mp_uint_t i;
-    for (i = bufinfo.len; i >= 3; i -= 3) {
-        *out++ = (in[0] & 0xFC) >> 2;
-        *out++ = (in[0] & 0x03) << 4 | (in[1] & 0xF0) >> 4;
-        *out++ = (in[1] & 0x0F) << 2 | (in[2] & 0xC0) >> 6;
-        *out++ = in[2] & 0x3F;
-        in += 3;
-    }
-    if (i != 0) {
-        *out++ = (in[0] & 0xFC) >> 2;
-        if (i == 2) {
-            *out++ = (in[0] & 0x03) << 4 | (in[1] & 0xF0) >> 4;
-            *out++ = (in[1] & 0x0F) << 2;
+// b2a_base64_into(data, buf)
+// Encodes into buf and returns the number of bytes written.  Unlike
+// b2a_base64 no newline is appended, so successive calls on chunks whose
+// length is a multiple of 3 produce one continuous encoding.
+mp_obj_t mod_binascii_b2a_base64_into(mp_obj_t data, mp_obj_t buf) {
+    mp_buffer_info_t bufinfo, outinfo;
+    mp_get_buffer_raise(data, &bufinfo, MP_BUFFER_READ);
+    mp_get_buffer_raise(buf, &outinfo, MP_BUFFER_WRITE);
+    check_out_buf(BASE64_ENCODED_LEN(bufinfo.len), outinfo.len);
+    return MP_OBJ_NEW_SMALL_INT(base64_encode(outinfo.buf, bufinfo.buf, bufinfo.len));
+}
+MP_DEFINE_CONST_FUN_OBJ_2(mod_binascii_b2a_base64_into_obj, mod_binascii_b2a_base64_into);
+
+#if MICROPY_PY_UBINASCII
+
+// Size of the staging buffer for raw input, a multiple of 3
+#define BASE64ENCIO_RAW_SIZE (384)
+
+// Base64EncIO(stream)
+// A readable stream giving the base64 encoding of the data read from the
+// wrapped stream, without line breaks.  Only one staging buffer of input
+// is held in RAM, so arbitrarily large files can be encoded on the fly.
+typedef struct _mp_obj_base64encio_t {
+    mp_obj_base_t base;
+    mp_obj_t src_stream;
+    bool eof;
+    byte pending_len;
+    byte pending_off;
+    // encoded group which didn't fit in the caller's buffer
+    byte pending[4];
+    size_t raw_len;
+    byte raw[BASE64ENCIO_RAW_SIZE];
+} mp_obj_base64encio_t;
+
+STATIC mp_obj_t base64encio_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    mp_arg_check_num(n_args, n_kw, 1, 1, false);
+    mp_get_stream_raise(args[0], MP_STREAM_OP_READ);
+    mp_obj_base64encio_t *o = m_new_obj(mp_obj_base64encio_t);
+    o->base.type = type;
+    o->src_stream = args[0];
+    o->eof = false;
+    o->pending_len = 0;
+    o->pending_off = 0;
+    o->raw_len = 0;
+    return MP_OBJ_FROM_PTR(o);
+}
+
+STATIC mp_uint_t base64encio_read(mp_obj_t o_in, void *buf, mp_uint_t size, int *errcode) {
+    mp_obj_base64encio_t *o = MP_OBJ_TO_PTR(o_in);
+    byte *out = buf;
+    byte *out_end = out + size;
+
+    for (;;) {
+        while (o->pending_off < o->pending_len && out < out_end) {
+            *out++ = o->pending[o->pending_off++];
         }
-        else {
-            *out++ = (in[0] & 0x03) << 4;
-            *out++ = 64;
+        if (out == out_end) {
+            break;
+        }
+
+        if (o->raw_len < 3 && !o->eof) {
+            if (out != buf) {
+                // return what we have rather than block for more input
+                break;
+            }
+            const mp_stream_p_t *stream = mp_get_stream_raise(o->src_stream, MP_STREAM_OP_READ);
+            mp_uint_t out_sz = stream->read(o->src_stream, o->raw + o->raw_len,
+                BASE64ENCIO_RAW_SIZE - o->raw_len, errcode);
+            if (out_sz == MP_STREAM_ERROR) {
+                return MP_STREAM_ERROR;
+            }
+            if (out_sz == 0) {
+                o->eof = true;
+            }
+            o->raw_len += out_sz;
+            continue;
         }
-        *out = 64;
-    }
 
-    // Second pass, we convert number base 64 values to actual base64 ascii encoding
-    out = (byte*)vstr.buf;
-    for (mp_uint_t j = vstr.len - 1; j--;) {
-        if (*out < 26) {
-            *out += 'A';
-        } else if (*out < 52) {
-            *out += 'a' - 26;
-        } else if (*out < 62) {
-            *out += '0' - 52;
-        } else if (*out == 62) {
-            *out ='+';
-        } else if (*out == 63) {
-            *out = '/';
+        // encode as many whole groups as fit straight into the caller's buffer
+        size_t groups = MIN(o->raw_len / 3, (size_t)(out_end - out) / 4);
+        size_t in_len = groups * 3;
+        if (groups != 0) {
+            out += base64_encode(out, o->raw, in_len);
+        } else if (o->raw_len != 0) {
+            // no room for a whole group, or the final partial group at EOF
+            in_len = MIN(o->raw_len, 3);
+            base64_encode(o->pending, o->raw, in_len);
+            o->pending_len = 4;
+            o->pending_off = 0;
         } else {
-            *out = '=';
+            // EOF and nothing left
+            break;
         }
-        out++;
+        o->raw_len -= in_len;
+        memmove(o->raw, o->raw + in_len, o->raw_len);
     }
-    *out = '\n';
-    return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
+
+    return out - (byte*)buf;
 }
-MP_DEFINE_CONST_FUN_OBJ_1(mod_binascii_b2a_base64_obj, mod_binascii_b2a_base64);
+
+STATIC const mp_rom_map_elem_t base64encio_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(base64encio_locals_dict, base64encio_locals_dict_table);
+
+STATIC const mp_stream_p_t base64encio_stream_p = {
+    .read = base64encio_read,
+};
+
+STATIC const mp_obj_type_t base64encio_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_Base64EncIO,
+    .make_new = base64encio_make_new,
+    .protocol = &base64encio_stream_p,
+    .locals_dict = (void*)&base64encio_locals_dict,
+};
+
+#endif //MICROPY_PY_UBINASCII
 
 #if MICROPY_PY_UBINASCII_CRC32
 #include "uzlib/tinf.h"
@@ -239,6 +419,10 @@ STATIC const mp_rom_map_elem_t mp_module_binascii_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_unhexlify), MP_ROM_PTR(&mod_binascii_unhexlify_obj) },
     { MP_ROM_QSTR(MP_QSTR_a2b_base64), MP_ROM_PTR(&mod_binascii_a2b_base64_obj) },
     { MP_ROM_QSTR(MP_QSTR_b2a_base64), MP_ROM_PTR(&mod_binascii_b2a_base64_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hexlify_into), MP_ROM_PTR(&mod_binascii_hexlify_into_obj) },
+    { MP_ROM_QSTR(MP_QSTR_a2b_base64_into), MP_ROM_PTR(&mod_binascii_a2b_base64_into_obj) },
+    { MP_ROM_QSTR(MP_QSTR_b2a_base64_into), MP_ROM_PTR(&mod_binascii_b2a_base64_into_obj) },
+    { MP_ROM_QSTR(MP_QSTR_Base64EncIO), MP_ROM_PTR(&base64encio_type) },
     #if MICROPY_PY_UBINASCII_CRC32
     { MP_ROM_QSTR(MP_QSTR_crc32), MP_ROM_PTR(&mod_binascii_crc32_obj) },
     #endif
@@ -29,6 +29,86 @@
 
 #include "py/nlr.h"
 #include "py/runtime.h"
+#include "py/stream.h"
+#include "py/objarray.h"
+#include "extmod/moduhashlib.h"
+
+// The helpers below are shared with ports which provide their own
+// uhashlib (esp32/moduhashlib.c), so they are built in any case.
+
+// Convert a binary digest to a lowercase hex str, as returned by hexdigest()
+mp_obj_t mod_uhashlib_hexlify(mp_obj_t digest_in) {
+    static const char hexchars[] = "0123456789abcdef";
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(digest_in, &bufinfo, MP_BUFFER_READ);
+    const byte *digest = bufinfo.buf;
+    vstr_t vstr;
+    vstr_init_len(&vstr, bufinfo.len * 2);
+    char *out = vstr.buf;
+    for (size_t i = 0; i < bufinfo.len; i++) {
+        *out++ = hexchars[digest[i] >> 4];
+        *out++ = hexchars[digest[i] & 0xf];
+    }
+    return mp_obj_new_str_from_vstr(&mp_type_str, &vstr);
+}
+
+// Ports reading from flash set this to the sector size
+#ifndef MICROPY_PY_UHASHLIB_FILE_DIGEST_BUF
+#define MICROPY_PY_UHASHLIB_FILE_DIGEST_BUF (1024)
+#endif
+#define HASH_FILE_DIGEST_BUF_SIZE MICROPY_PY_UHASHLIB_FILE_DIGEST_BUF
+
+// file_digest(stream, digest='sha256')
+// Hash the remaining contents of a stream, reading it through one buffer
+// which is reused for every chunk.  digest is a hash name or a constructor;
+// names are looked up in the globals of the calling uhashlib module.
+mp_obj_t mod_uhashlib_file_digest(size_t n_args, const mp_obj_t *args, mp_obj_t default_hash, const mp_obj_dict_t *globals) {
+    mp_obj_t stream = args[0];
+    mp_get_stream_raise(stream, MP_STREAM_OP_READ);
+
+    mp_obj_t hash_new = default_hash;
+    if (n_args > 1) {
+        hash_new = args[1];
+        if (MP_OBJ_IS_STR(hash_new)) {
+            size_t name_len;
+            const char *name = mp_obj_str_get_data(hash_new, &name_len);
+            qstr name_qstr = qstr_find_strn(name, name_len);
+            mp_map_elem_t *elem = NULL;
+            if (name_qstr != MP_QSTR_NULL) {
+                elem = mp_map_lookup((mp_map_t*)&globals->map,
+                    MP_OBJ_NEW_QSTR(name_qstr), MP_MAP_LOOKUP);
+            }
+            if (elem == NULL || !MP_OBJ_IS_TYPE(elem->value, &mp_type_type)) {
+                mp_raise_ValueError("unsupported hash type");
+            }
+            hash_new = elem->value;
+        }
+    }
+    mp_obj_t hash = mp_call_function_0(hash_new);
+
+    // the chunk is passed to update() as a bytearray referencing the buffer;
+    // update() may keep that bytearray, so the buffer is left to the GC
+    mp_obj_t dest[3];
+    mp_load_method(hash, MP_QSTR_update, dest);
+    byte *buf = m_new(byte, HASH_FILE_DIGEST_BUF_SIZE);
+    dest[2] = mp_obj_new_bytearray_by_ref(HASH_FILE_DIGEST_BUF_SIZE, buf);
+    mp_obj_array_t *chunk = MP_OBJ_TO_PTR(dest[2]);
+    for (;;) {
+        int errcode;
+        mp_uint_t out_sz = mp_stream_rw(stream, buf, HASH_FILE_DIGEST_BUF_SIZE, &errcode,
+            MP_STREAM_RW_READ | MP_STREAM_RW_ONCE);
+        if (errcode != 0) {
+            mp_raise_OSError(errcode);
+        }
+        if (out_sz == 0) {
+            break;
+        }
+        chunk->len = out_sz;
+        mp_call_method_n_kw(1, 0, dest);
+    }
+
+    return hash;
+}
 
 #if MICROPY_PY_UHASHLIB
 
@@ -110,9 +190,22 @@ STATIC mp_obj_t sha1_digest(mp_obj_t self_in) {
 MP_DEFINE_CONST_FUN_OBJ_1(sha1_digest_obj, sha1_digest);
 #endif
 
+STATIC mp_obj_t hash_hexdigest(mp_obj_t self_in) {
+    return mod_uhashlib_hexlify(hash_digest(self_in));
+}
+MP_DEFINE_CONST_FUN_OBJ_1(hash_hexdigest_obj, hash_hexdigest);
+
+#if MICROPY_PY_UHASHLIB_SHA1
+STATIC mp_obj_t sha1_hexdigest(mp_obj_t self_in) {
+    return mod_uhashlib_hexlify(sha1_digest(self_in));
+}
+MP_DEFINE_CONST_FUN_OBJ_1(sha1_hexdigest_obj, sha1_hexdigest);
+#endif
+
 STATIC const mp_rom_map_elem_t hash_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_update), MP_ROM_PTR(&hash_update_obj) },
     { MP_ROM_QSTR(MP_QSTR_digest), MP_ROM_PTR(&hash_digest_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hexdigest), MP_ROM_PTR(&hash_hexdigest_obj) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(hash_locals_dict, hash_locals_dict_table);
@@ -128,6 +221,7 @@ STATIC const mp_obj_type_t sha256_type = {
 STATIC const mp_rom_map_elem_t sha1_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_update), MP_ROM_PTR(&sha1_update_obj) },
     { MP_ROM_QSTR(MP_QSTR_digest), MP_ROM_PTR(&sha1_digest_obj) },
+    { MP_ROM_QSTR(MP_QSTR_hexdigest), MP_ROM_PTR(&sha1_hexdigest_obj) },
 };
 STATIC MP_DEFINE_CONST_DICT(sha1_locals_dict, sha1_locals_dict_table);
 
@@ -139,12 +233,20 @@ STATIC const mp_obj_type_t sha1_type = {
 };
 #endif
 
+STATIC const mp_obj_dict_t mp_module_hashlib_globals;
+
+STATIC mp_obj_t mod_hashlib_file_digest(size_t n_args, const mp_obj_t *args) {
+    return mod_uhashlib_file_digest(n_args, args, MP_OBJ_FROM_PTR(&sha256_type), &mp_module_hashlib_globals);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_hashlib_file_digest_obj, 1, 2, mod_hashlib_file_digest);
+
 STATIC const mp_rom_map_elem_t mp_module_hashlib_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_uhashlib) },
     { MP_ROM_QSTR(MP_QSTR_sha256), MP_ROM_PTR(&sha256_type) },
     #if MICROPY_PY_UHASHLIB_SHA1
     { MP_ROM_QSTR(MP_QSTR_sha1), MP_ROM_PTR(&sha1_type) },
     #endif
+    { MP_ROM_QSTR(MP_QSTR_file_digest), MP_ROM_PTR(&mod_hashlib_file_digest_obj) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_hashlib_globals, mp_module_hashlib_globals_table);
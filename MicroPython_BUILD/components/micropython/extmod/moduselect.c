@@ -36,6 +36,20 @@
 #include "py/mperrno.h"
 #include "py/mphal.h"
 
+#if MICROPY_PY_USELECT_SELECT_FD
+#include <errno.h>
+#include MICROPY_PY_USELECT_SELECT_HEADER
+
+// Longest wait in select() before pending events are handled again, and
+// the one used while streams without a file descriptor have to be polled
+#define SELECT_SLICE_MS (100)
+#define SELECT_SLICE_MIXED_MS (10)
+
+// poll_obj_t.fd of a stream without a file descriptor, and of a closed one
+#define POLL_FD_NONE (-1)
+#define POLL_FD_CLOSED (-2)
+#endif
+
 // Flags for poll()
 #define FLAG_ONESHOT (1)
 
@@ -48,6 +62,10 @@ typedef struct _poll_obj_t {
     mp_uint_t (*ioctl)(mp_obj_t obj, mp_uint_t request, mp_uint_t arg, int *errcode);
     mp_uint_t flags;
     mp_uint_t flags_ret;
+    #if MICROPY_PY_USELECT_SELECT_FD
+    // queried on every poll, a closed stream's number may be reused
+    int fd;
+    #endif
 } poll_obj_t;
 
 STATIC void poll_map_add(mp_map_t *poll_map, const mp_obj_t *obj, mp_uint_t obj_len, mp_uint_t flags, bool or_flags) {
@@ -73,43 +91,198 @@ STATIC void poll_map_add(mp_map_t *poll_map, const mp_obj_t *obj, mp_uint_t obj_
     }
 }
 
+// account for an object's poll result, returns 1 if it is ready
+STATIC mp_uint_t poll_obj_ready(mp_uint_t ret, mp_uint_t *rwx_num) {
+    if (ret == 0) {
+        return 0;
+    }
+    if (rwx_num != NULL) {
+        if (ret & MP_STREAM_POLL_RD) {
+            rwx_num[0] += 1;
+        }
+        if (ret & MP_STREAM_POLL_WR) {
+            rwx_num[1] += 1;
+        }
+        if ((ret & ~(MP_STREAM_POLL_RD | MP_STREAM_POLL_WR)) != 0) {
+            rwx_num[2] += 1;
+        }
+    }
+    return 1;
+}
+
+#if MICROPY_PY_USELECT_SELECT_FD
+STATIC int poll_obj_get_fd(poll_obj_t *poll_obj) {
+    int errcode = 0;
+    mp_uint_t fd = poll_obj->ioctl(poll_obj->obj, MP_STREAM_GET_FILENO, 0, &errcode);
+    if (fd != MP_STREAM_ERROR) {
+        return (int)fd;
+    }
+    return errcode == MP_EBADF ? POLL_FD_CLOSED : POLL_FD_NONE;
+}
+
+// After select() failed with EBADF: finds the descriptors which are no
+// longer valid, eg closed under the stream, and reports them as POLLNVAL
+// and drops them from the fd sets.  Returns the number found.
+STATIC mp_uint_t poll_map_drop_bad_fds(mp_map_t *poll_map, mp_uint_t *rwx_num, fd_set *rfds, fd_set *wfds, fd_set *efds) {
+    mp_uint_t n_bad = 0;
+    for (mp_uint_t i = 0; i < poll_map->alloc; ++i) {
+        if (!MP_MAP_SLOT_IS_FILLED(poll_map, i)) {
+            continue;
+        }
+        poll_obj_t *poll_obj = (poll_obj_t*)poll_map->table[i].value;
+        if (poll_obj->fd < 0 || poll_obj->flags == 0) {
+            continue;
+        }
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(poll_obj->fd, &fds);
+        struct timeval tv = { 0 };
+        if (select(poll_obj->fd + 1, &fds, NULL, NULL, &tv) < 0 && errno == EBADF) {
+            FD_CLR(poll_obj->fd, rfds);
+            FD_CLR(poll_obj->fd, wfds);
+            FD_CLR(poll_obj->fd, efds);
+            poll_obj->fd = POLL_FD_CLOSED;
+            poll_obj->flags_ret = MP_STREAM_POLL_NVAL;
+            n_bad += poll_obj_ready(MP_STREAM_POLL_NVAL, rwx_num);
+        }
+    }
+    return n_bad;
+}
+#endif
+
 // poll each object in the map
-STATIC mp_uint_t poll_map_poll(mp_map_t *poll_map, mp_uint_t *rwx_num) {
+// Objects with a file descriptor are checked with one select(), which waits
+// up to wait_ms if no other object is ready; *waited tells if it did.
+// A closed object is reported as POLLNVAL.
+STATIC mp_uint_t poll_map_poll(mp_map_t *poll_map, mp_uint_t *rwx_num, mp_uint_t wait_ms, bool *waited) {
     mp_uint_t n_ready = 0;
+    *waited = false;
+    #if MICROPY_PY_USELECT_SELECT_FD
+    fd_set rfds, wfds, efds;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_ZERO(&efds);
+    int max_fd = -1;
+    bool mixed = false;
+    #else
+    (void)wait_ms;
+    #endif
     for (mp_uint_t i = 0; i < poll_map->alloc; ++i) {
         if (!MP_MAP_SLOT_IS_FILLED(poll_map, i)) {
             continue;
         }
 
         poll_obj_t *poll_obj = (poll_obj_t*)poll_map->table[i].value;
+        #if MICROPY_PY_USELECT_SELECT_FD
+        poll_obj->fd = poll_obj_get_fd(poll_obj);
+        if (poll_obj->fd == POLL_FD_CLOSED) {
+            poll_obj->flags_ret = (poll_obj->flags != 0) ? MP_STREAM_POLL_NVAL : 0;
+            n_ready += poll_obj_ready(poll_obj->flags_ret, rwx_num);
+            continue;
+        }
+        if (poll_obj->fd >= 0) {
+            // checked below, together with all other descriptors
+            poll_obj->flags_ret = 0;
+            if (poll_obj->flags & MP_STREAM_POLL_RD) {
+                FD_SET(poll_obj->fd, &rfds);
+            }
+            if (poll_obj->flags & MP_STREAM_POLL_WR) {
+                FD_SET(poll_obj->fd, &wfds);
+            }
+            if (poll_obj->flags & (MP_STREAM_POLL_ERR | MP_STREAM_POLL_HUP)) {
+                FD_SET(poll_obj->fd, &efds);
+            }
+            if (poll_obj->flags != 0 && poll_obj->fd > max_fd) {
+                max_fd = poll_obj->fd;
+            }
+            continue;
+        }
+        mixed = true;
+        #endif
         int errcode;
         mp_int_t ret = poll_obj->ioctl(poll_obj->obj, MP_STREAM_POLL, poll_obj->flags, &errcode);
-        poll_obj->flags_ret = ret;
 
         if (ret == -1) {
-            // error doing ioctl
-            mp_raise_OSError(errcode);
+            if (errcode != MP_EBADF) {
+                // error doing ioctl
+                mp_raise_OSError(errcode);
+            }
+            ret = MP_STREAM_POLL_NVAL;
         }
+        poll_obj->flags_ret = ret;
 
-        if (ret != 0) {
-            // object is ready
-            n_ready += 1;
-            if (rwx_num != NULL) {
-                if (ret & MP_STREAM_POLL_RD) {
-                    rwx_num[0] += 1;
-                }
-                if (ret & MP_STREAM_POLL_WR) {
-                    rwx_num[1] += 1;
-                }
-                if ((ret & ~(MP_STREAM_POLL_RD | MP_STREAM_POLL_WR)) != 0) {
-                    rwx_num[2] += 1;
-                }
+        n_ready += poll_obj_ready(ret, rwx_num);
+    }
+
+    #if MICROPY_PY_USELECT_SELECT_FD
+    if (max_fd >= 0) {
+        if (n_ready > 0) {
+            wait_ms = 0;
+        } else if (wait_ms > (mixed ? SELECT_SLICE_MIXED_MS : SELECT_SLICE_MS)) {
+            wait_ms = mixed ? SELECT_SLICE_MIXED_MS : SELECT_SLICE_MS;
+        }
+        // select() changes the sets, these are kept to retry after EBADF
+        fd_set rfds_in = rfds, wfds_in = wfds, efds_in = efds;
+        int r, err = 0;
+        for (;;) {
+            struct timeval tv = { .tv_sec = wait_ms / 1000, .tv_usec = (wait_ms % 1000) * 1000 };
+            MP_THREAD_GIL_EXIT();
+            r = select(max_fd + 1, &rfds, &wfds, &efds, &tv);
+            MP_THREAD_GIL_ENTER();
+            err = errno;
+            if (r >= 0 || err != EBADF) {
+                break;
+            }
+            mp_uint_t n_bad = poll_map_drop_bad_fds(poll_map, rwx_num, &rfds_in, &wfds_in, &efds_in);
+            if (n_bad == 0) {
+                break;
             }
+            // report the bad ones now, with whatever else is ready
+            n_ready += n_bad;
+            wait_ms = 0;
+            rfds = rfds_in;
+            wfds = wfds_in;
+            efds = efds_in;
+        }
+        *waited = (wait_ms > 0);
+        if (r < 0) {
+            mp_raise_OSError(err);
+        }
+        for (mp_uint_t i = 0; r > 0 && i < poll_map->alloc; ++i) {
+            if (!MP_MAP_SLOT_IS_FILLED(poll_map, i)) {
+                continue;
+            }
+            poll_obj_t *poll_obj = (poll_obj_t*)poll_map->table[i].value;
+            if (poll_obj->fd < 0) {
+                continue;
+            }
+            mp_uint_t ret = 0;
+            if (FD_ISSET(poll_obj->fd, &rfds)) {
+                ret |= MP_STREAM_POLL_RD;
+            }
+            if (FD_ISSET(poll_obj->fd, &wfds)) {
+                ret |= MP_STREAM_POLL_WR;
+            }
+            if (FD_ISSET(poll_obj->fd, &efds)) {
+                ret |= MP_STREAM_POLL_HUP;
+            }
+            poll_obj->flags_ret = ret;
+            n_ready += poll_obj_ready(ret, rwx_num);
         }
     }
+    #endif
     return n_ready;
 }
 
+// time left until timeout, (mp_uint_t)-1 if there is no timeout
+STATIC mp_uint_t poll_time_left(mp_uint_t start_tick, mp_uint_t timeout) {
+    if (timeout == (mp_uint_t)-1) {
+        return timeout;
+    }
+    mp_uint_t elapsed = mp_hal_ticks_ms() - start_tick;
+    return (elapsed >= timeout) ? 0 : timeout - elapsed;
+}
+
 /// \function select(rlist, wlist, xlist[, timeout])
 STATIC mp_obj_t select_select(uint n_args, const mp_obj_t *args) {
     // get array data from tuple/list arguments
@@ -145,7 +318,8 @@ STATIC mp_obj_t select_select(uint n_args, const mp_obj_t *args) {
     rwx_len[0] = rwx_len[1] = rwx_len[2] = 0;
     for (;;) {
         // poll the objects
-        mp_uint_t n_ready = poll_map_poll(&poll_map, rwx_len);
+        bool waited;
+        mp_uint_t n_ready = poll_map_poll(&poll_map, rwx_len, poll_time_left(start_tick, timeout), &waited);
 
         if (n_ready > 0 || (timeout != -1 && mp_hal_ticks_ms() - start_tick >= timeout)) {
             // one or more objects are ready, or we had a timeout
@@ -172,7 +346,11 @@ STATIC mp_obj_t select_select(uint n_args, const mp_obj_t *args) {
             mp_map_deinit(&poll_map);
             return mp_obj_new_tuple(3, list_array);
         }
-        MICROPY_EVENT_POLL_HOOK
+        if (waited) {
+            mp_handle_pending();
+        } else {
+            MICROPY_EVENT_POLL_HOOK
+        }
     }
 }
 MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mp_select_select_obj, 3, 4, select_select);
@@ -248,11 +426,16 @@ STATIC mp_uint_t poll_poll_internal(uint n_args, const mp_obj_t *args) {
     mp_uint_t n_ready;
     for (;;) {
         // poll the objects
-        n_ready = poll_map_poll(&self->poll_map, NULL);
+        bool waited;
+        n_ready = poll_map_poll(&self->poll_map, NULL, poll_time_left(start_tick, timeout), &waited);
         if (n_ready > 0 || (timeout != -1 && mp_hal_ticks_ms() - start_tick >= timeout)) {
             break;
         }
-        MICROPY_EVENT_POLL_HOOK
+        if (waited) {
+            mp_handle_pending();
+        } else {
+            MICROPY_EVENT_POLL_HOOK
+        }
     }
 
     return n_ready;
@@ -366,6 +549,7 @@ STATIC const mp_rom_map_elem_t mp_module_select_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR_POLLOUT), MP_ROM_INT(MP_STREAM_POLL_WR) },
     { MP_ROM_QSTR(MP_QSTR_POLLERR), MP_ROM_INT(MP_STREAM_POLL_ERR) },
     { MP_ROM_QSTR(MP_QSTR_POLLHUP), MP_ROM_INT(MP_STREAM_POLL_HUP) },
+    { MP_ROM_QSTR(MP_QSTR_POLLNVAL), MP_ROM_INT(MP_STREAM_POLL_NVAL) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_select_globals, mp_module_select_globals_table);
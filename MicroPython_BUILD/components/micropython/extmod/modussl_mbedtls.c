@@ -29,6 +29,7 @@
 #if MICROPY_PY_USSL && MICROPY_SSL_MBEDTLS
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h> // needed because mp_is_nonblocking_error uses system error codes
 
@@ -36,6 +37,10 @@
 #include "py/runtime.h"
 #include "py/stream.h"
 #include "py/obj.h"
+#include "py/objtuple.h"
+#if MICROPY_PY_THREAD
+#include "py/mpthread.h"
+#endif
 
 #include "sdkconfig.h"
 
@@ -51,16 +56,68 @@
 #include "mbedtls/debug.h"
 #endif
 
-typedef struct _mp_obj_ssl_socket_t {
+#if defined(MBEDTLS_SSL_CACHE_C)
+#include "mbedtls/ssl_cache.h"
+#endif
+#if defined(MBEDTLS_SSL_TICKET_C)
+#include "mbedtls/ssl_ticket.h"
+#endif
+
+// Number of sessions a server side context keeps for session ID resumption
+#define SSL_SERVER_CACHE_ENTRIES (4)
+// Number of server handshakes of a context running at the same time whose resumption is reported
+#define SSL_SERVER_HANDSHAKES (4)
+// Longest "server_hostname:port" for which the client session is kept
+#define SSL_SESSION_KEY_LEN (72)
+
+#if MICROPY_PY_THREAD
+#define SSL_CONTEXT_LOCK(ctx) mp_thread_mutex_lock(&(ctx)->mutex, 1)
+#define SSL_CONTEXT_UNLOCK(ctx) mp_thread_mutex_unlock(&(ctx)->mutex)
+#define SSL_THREAD() ((void*)mp_thread_get_state())
+#else
+#define SSL_CONTEXT_LOCK(ctx)
+#define SSL_CONTEXT_UNLOCK(ctx)
+#define SSL_THREAD() ((void*)&mp_state_ctx)
+#endif
+
+// Configuration, certificates and RNG shared by all sockets wrapped with the same context
+typedef struct _mp_obj_ssl_context_t {
     mp_obj_base_t base;
-    mp_obj_t sock;
+    #if MICROPY_PY_THREAD
+    // The sockets of a context may be used by several threads: the CTR-DRBG, the client
+    // session and the server session cache and ticket keys are only used under this lock
+    mp_thread_mutex_t mutex;
+    #endif
     mbedtls_entropy_context entropy;
     mbedtls_ctr_drbg_context ctr_drbg;
-    mbedtls_ssl_context ssl;
     mbedtls_ssl_config conf;
     mbedtls_x509_crt cacert;
     mbedtls_x509_crt cert;
     mbedtls_pk_context pkey;
+    bool server_side;
+    bool sessions;
+    bool initialized;
+    // client side: last session, resumed on the next connection to the same host and port
+    bool have_session;
+    mbedtls_ssl_session session;
+    char session_key[SSL_SESSION_KEY_LEN];
+    // server side: threads whose handshake in progress resumed a session
+    void *resumed_by[SSL_SERVER_HANDSHAKES];
+    #if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_context cache;
+    #endif
+    #if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_context ticket;
+    #endif
+} mp_obj_ssl_context_t;
+
+typedef struct _mp_obj_ssl_socket_t {
+    mp_obj_base_t base;
+    mp_obj_t sock;
+    mbedtls_ssl_context ssl;
+    mp_obj_ssl_context_t *ctx;
+    bool own_ctx;
+    bool resumed;
 } mp_obj_ssl_socket_t;
 
 struct ssl_args {
@@ -70,18 +127,26 @@ struct ssl_args {
     mp_arg_val_t server_hostname;
 };
 
+struct ssl_context_args {
+    mp_arg_val_t server_side;
+    mp_arg_val_t key;
+    mp_arg_val_t cert;
+    mp_arg_val_t cadata;
+    mp_arg_val_t verify_mode;
+    mp_arg_val_t max_fragment;
+    mp_arg_val_t sessions;
+};
+
 STATIC const mp_obj_type_t ussl_socket_type;
+STATIC const mp_obj_type_t ussl_context_type;
+
+// Client context used by the module level wrap_socket(), created on first use
+STATIC mp_obj_ssl_context_t *ssl_default_ctx = NULL;
 
 static void mbedtls_debug(void *ctx, int level, const char *file, int line, const char *str) {
     printf("DBG:%s:%04d: %s\n", file, line, str);
 }
 
-// TODO: FIXME!
-int null_entropy_func(void *data, unsigned char *output, size_t len) {
-    // enjoy random bytes
-    return 0;
-}
-
 int _mbedtls_ssl_send(void *ctx, const byte *buf, size_t len) {
     mp_obj_t sock = *(mp_obj_t*)ctx;
 
@@ -116,85 +181,392 @@ int _mbedtls_ssl_recv(void *ctx, byte *buf, size_t len) {
     }
 }
 
+// The CTR-DRBG of the context, used by all its sockets
+STATIC int ssl_context_random(void *p, unsigned char *output, size_t len) {
+    mp_obj_ssl_context_t *ctx = p;
+    SSL_CONTEXT_LOCK(ctx);
+    int ret = mbedtls_ctr_drbg_random(&ctx->ctr_drbg, output, len);
+    SSL_CONTEXT_UNLOCK(ctx);
+    return ret;
+}
 
-STATIC mp_obj_ssl_socket_t *socket_new(mp_obj_t sock, struct ssl_args *args) {
-    mp_obj_ssl_socket_t *o = m_new_obj(mp_obj_ssl_socket_t);
-    o->base.type = &ussl_socket_type;
+// Server side, called under the lock: the handshake of the calling thread resumes a session.
+// mbedtls 2.x does not tell it for a given connection, socket_new() takes the mark back.
+STATIC void ssl_context_mark_resumed(mp_obj_ssl_context_t *ctx) {
+    for (int i = 0; i < SSL_SERVER_HANDSHAKES; i++) {
+        if (ctx->resumed_by[i] == NULL) {
+            ctx->resumed_by[i] = SSL_THREAD();
+            break;
+        }
+    }
+}
 
+STATIC bool ssl_context_take_resumed(mp_obj_ssl_context_t *ctx) {
+    bool resumed = false;
+    SSL_CONTEXT_LOCK(ctx);
+    for (int i = 0; i < SSL_SERVER_HANDSHAKES; i++) {
+        if (ctx->resumed_by[i] == SSL_THREAD()) {
+            ctx->resumed_by[i] = NULL;
+            resumed = true;
+        }
+    }
+    SSL_CONTEXT_UNLOCK(ctx);
+    return resumed;
+}
+
+#if defined(MBEDTLS_SSL_CACHE_C)
+STATIC int ssl_cache_get(void *p, mbedtls_ssl_session *session) {
+    mp_obj_ssl_context_t *ctx = p;
+    SSL_CONTEXT_LOCK(ctx);
+    int ret = mbedtls_ssl_cache_get(&ctx->cache, session);
+    if (ret == 0) {
+        ssl_context_mark_resumed(ctx);
+    }
+    SSL_CONTEXT_UNLOCK(ctx);
+    return ret;
+}
+
+STATIC int ssl_cache_set(void *p, const mbedtls_ssl_session *session) {
+    mp_obj_ssl_context_t *ctx = p;
+    SSL_CONTEXT_LOCK(ctx);
+    int ret = mbedtls_ssl_cache_set(&ctx->cache, session);
+    SSL_CONTEXT_UNLOCK(ctx);
+    return ret;
+}
+#endif
+
+#if defined(MBEDTLS_SSL_TICKET_C)
+STATIC int ssl_ticket_write(void *p, const mbedtls_ssl_session *session,
+        unsigned char *start, const unsigned char *end, size_t *tlen, uint32_t *lifetime) {
+    mp_obj_ssl_context_t *ctx = p;
+    SSL_CONTEXT_LOCK(ctx);
+    int ret = mbedtls_ssl_ticket_write(&ctx->ticket, session, start, end, tlen, lifetime);
+    SSL_CONTEXT_UNLOCK(ctx);
+    return ret;
+}
+
+STATIC int ssl_ticket_parse(void *p, mbedtls_ssl_session *session, unsigned char *buf, size_t len) {
+    mp_obj_ssl_context_t *ctx = p;
+    SSL_CONTEXT_LOCK(ctx);
+    int ret = mbedtls_ssl_ticket_parse(&ctx->ticket, session, buf, len);
+    if (ret == 0) {
+        ssl_context_mark_resumed(ctx);
+    }
+    SSL_CONTEXT_UNLOCK(ctx);
+    return ret;
+}
+#endif
+
+STATIC void ssl_context_free(mp_obj_ssl_context_t *ctx) {
+    if (!ctx->initialized) {
+        return;
+    }
+    ctx->initialized = false;
+    ctx->have_session = false;
+    mbedtls_ssl_session_free(&ctx->session);
+    #if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_free(&ctx->ticket);
+    #endif
+    #if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_free(&ctx->cache);
+    #endif
+    mbedtls_pk_free(&ctx->pkey);
+    mbedtls_x509_crt_free(&ctx->cert);
+    mbedtls_x509_crt_free(&ctx->cacert);
+    mbedtls_ssl_config_free(&ctx->conf);
+    mbedtls_ctr_drbg_free(&ctx->ctr_drbg);
+    mbedtls_entropy_free(&ctx->entropy);
+}
+
+STATIC void ssl_context_init(mp_obj_ssl_context_t *ctx, struct ssl_context_args *args) {
+    const char *err_msg = NULL;
+    int frag_code = MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
     int ret;
-    mbedtls_ssl_init(&o->ssl);
-    mbedtls_ssl_config_init(&o->conf);
-    mbedtls_x509_crt_init(&o->cacert);
-    mbedtls_x509_crt_init(&o->cert);
-    mbedtls_pk_init(&o->pkey);
-    mbedtls_ctr_drbg_init(&o->ctr_drbg);
+
+    switch (args->max_fragment.u_int) {
+        case 0: break;
+        case 512: frag_code = MBEDTLS_SSL_MAX_FRAG_LEN_512; break;
+        case 1024: frag_code = MBEDTLS_SSL_MAX_FRAG_LEN_1024; break;
+        case 2048: frag_code = MBEDTLS_SSL_MAX_FRAG_LEN_2048; break;
+        case 4096: frag_code = MBEDTLS_SSL_MAX_FRAG_LEN_4096; break;
+        default: mp_raise_ValueError("max_fragment must be 512, 1024, 2048 or 4096");
+    }
+    if (args->verify_mode.u_int < MBEDTLS_SSL_VERIFY_NONE || args->verify_mode.u_int > MBEDTLS_SSL_VERIFY_REQUIRED) {
+        mp_raise_ValueError("invalid verify_mode");
+    }
+
+    ctx->server_side = args->server_side.u_bool;
+    ctx->sessions = args->sessions.u_bool;
+    ctx->have_session = false;
+    ctx->session_key[0] = '\0';
+    memset(ctx->resumed_by, 0, sizeof(ctx->resumed_by));
+    #if MICROPY_PY_THREAD
+    mp_thread_mutex_init(&ctx->mutex);
+    #endif
+
+    mbedtls_ssl_config_init(&ctx->conf);
+    mbedtls_x509_crt_init(&ctx->cacert);
+    mbedtls_x509_crt_init(&ctx->cert);
+    mbedtls_pk_init(&ctx->pkey);
+    mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
+    mbedtls_entropy_init(&ctx->entropy);
+    mbedtls_ssl_session_init(&ctx->session);
+    #if defined(MBEDTLS_SSL_CACHE_C)
+    mbedtls_ssl_cache_init(&ctx->cache);
+    #endif
+    #if defined(MBEDTLS_SSL_TICKET_C)
+    mbedtls_ssl_ticket_init(&ctx->ticket);
+    #endif
+    ctx->initialized = true;
 	#ifdef CONFIG_MBEDTLS_DEBUG
     // Debug level (0-4)
     mbedtls_debug_set_threshold(0);
 	#endif
 
-    mbedtls_entropy_init(&o->entropy);
+    // The DRBG is seeded once per context, not per connection,
+    // so it is affordable to use the real entropy source
     const byte seed[] = "upy";
-    ret = mbedtls_ctr_drbg_seed(&o->ctr_drbg, null_entropy_func/*mbedtls_entropy_func*/, &o->entropy, seed, sizeof(seed));
+    ret = mbedtls_ctr_drbg_seed(&ctx->ctr_drbg, mbedtls_entropy_func, &ctx->entropy, seed, sizeof(seed));
     if (ret != 0) {
-        printf("ret=%d\n", ret);
-        assert(0);
+        goto error;
     }
 
-    ret = mbedtls_ssl_config_defaults(&o->conf,
-                    args->server_side.u_bool ? MBEDTLS_SSL_IS_SERVER : MBEDTLS_SSL_IS_CLIENT,
+    ret = mbedtls_ssl_config_defaults(&ctx->conf,
+                    ctx->server_side ? MBEDTLS_SSL_IS_SERVER : MBEDTLS_SSL_IS_CLIENT,
                     MBEDTLS_SSL_TRANSPORT_STREAM,
                     MBEDTLS_SSL_PRESET_DEFAULT);
     if (ret != 0) {
-        assert(0);
+        goto error;
     }
 
-    mbedtls_ssl_conf_authmode(&o->conf, MBEDTLS_SSL_VERIFY_NONE);
-    mbedtls_ssl_conf_rng(&o->conf, mbedtls_ctr_drbg_random, &o->ctr_drbg);
-    mbedtls_ssl_conf_dbg(&o->conf, mbedtls_debug, NULL);
-
-    ret = mbedtls_ssl_setup(&o->ssl, &o->conf);
-    if (ret != 0) {
-        assert(0);
-    }
+    mbedtls_ssl_conf_authmode(&ctx->conf, args->verify_mode.u_int);
+    mbedtls_ssl_conf_rng(&ctx->conf, ssl_context_random, ctx);
+    mbedtls_ssl_conf_dbg(&ctx->conf, mbedtls_debug, NULL);
 
-    if (args->server_hostname.u_obj != mp_const_none) {
-        const char *sni = mp_obj_str_get_str(args->server_hostname.u_obj);
-        ret = mbedtls_ssl_set_hostname(&o->ssl, sni);
+    if (args->cadata.u_obj != mp_const_none) {
+        size_t ca_len;
+        const byte *ca = (const byte*)mp_obj_str_get_data(args->cadata.u_obj, &ca_len);
+        // len should include terminating null
+        ret = mbedtls_x509_crt_parse(&ctx->cacert, ca, ca_len + 1);
         if (ret != 0) {
-            assert(0);
+            err_msg = "invalid cadata";
+            goto error;
         }
+        mbedtls_ssl_conf_ca_chain(&ctx->conf, &ctx->cacert, NULL);
     }
 
-    o->sock = sock;
-    mbedtls_ssl_set_bio(&o->ssl, &o->sock, _mbedtls_ssl_send, _mbedtls_ssl_recv, NULL);
-
-    if (args->key.u_obj != MP_OBJ_NULL) {
+    if (args->key.u_obj != mp_const_none) {
         size_t key_len;
         const byte *key = (const byte*)mp_obj_str_get_data(args->key.u_obj, &key_len);
         // len should include terminating null
-        ret = mbedtls_pk_parse_key(&o->pkey, key, key_len + 1, NULL, 0);
-        assert(ret == 0);
+        ret = mbedtls_pk_parse_key(&ctx->pkey, key, key_len + 1, NULL, 0);
+        if (ret != 0) {
+            err_msg = "invalid key";
+            goto error;
+        }
 
+        if (args->cert.u_obj == mp_const_none) {
+            err_msg = "cert required with key";
+            goto error;
+        }
         size_t cert_len;
         const byte *cert = (const byte*)mp_obj_str_get_data(args->cert.u_obj, &cert_len);
         // len should include terminating null
-        ret = mbedtls_x509_crt_parse(&o->cert, cert, cert_len + 1);
-        assert(ret == 0);
+        ret = mbedtls_x509_crt_parse(&ctx->cert, cert, cert_len + 1);
+        if (ret != 0) {
+            err_msg = "invalid cert";
+            goto error;
+        }
+
+        ret = mbedtls_ssl_conf_own_cert(&ctx->conf, &ctx->cert, &ctx->pkey);
+        if (ret != 0) {
+            goto error;
+        }
+    }
+
+    #if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    // Smaller records let the peer send data in pieces fitting a smaller receive buffer
+    if (frag_code != MBEDTLS_SSL_MAX_FRAG_LEN_NONE) {
+        ret = mbedtls_ssl_conf_max_frag_len(&ctx->conf, frag_code);
+        if (ret != 0) {
+            goto error;
+        }
+    }
+    #else
+    (void)frag_code;
+    #endif
+
+    if (ctx->server_side) {
+        if (ctx->sessions) {
+            // Let the clients resume their sessions by session ID or session ticket
+            #if defined(MBEDTLS_SSL_CACHE_C)
+            mbedtls_ssl_cache_set_max_entries(&ctx->cache, SSL_SERVER_CACHE_ENTRIES);
+            mbedtls_ssl_conf_session_cache(&ctx->conf, ctx, ssl_cache_get, ssl_cache_set);
+            #endif
+            #if defined(MBEDTLS_SSL_TICKET_C)
+            // The ticket functions run under the context lock, so they can use the DRBG directly
+            ret = mbedtls_ssl_ticket_setup(&ctx->ticket, mbedtls_ctr_drbg_random, &ctx->ctr_drbg,
+                    MBEDTLS_CIPHER_AES_256_GCM, 86400);
+            if (ret != 0) {
+                goto error;
+            }
+            mbedtls_ssl_conf_session_tickets_cb(&ctx->conf, ssl_ticket_write, ssl_ticket_parse, ctx);
+            #endif
+        }
+    }
+    #if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    else {
+        mbedtls_ssl_conf_session_tickets(&ctx->conf,
+            ctx->sessions ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+    }
+    #endif
+    return;
+
+error:
+    ssl_context_free(ctx);
+    if (err_msg != NULL) {
+        mp_raise_ValueError(err_msg);
+    }
+    printf("mbedtls error: -%x\n", -ret);
+    mp_raise_OSError(MP_EIO);
+}
+
+STATIC mp_obj_ssl_context_t *ssl_get_default_context(void) {
+    if (ssl_default_ctx == NULL) {
+        // Not on the GC heap, the context lives until reset
+        mp_obj_ssl_context_t *ctx = calloc(1, sizeof(mp_obj_ssl_context_t));
+        if (ctx == NULL) {
+            mp_raise_OSError(MP_ENOMEM);
+        }
+        ctx->base.type = &ussl_context_type;
+
+        struct ssl_context_args args = {
+            .server_side = { .u_bool = false },
+            .key = { .u_obj = mp_const_none },
+            .cert = { .u_obj = mp_const_none },
+            .cadata = { .u_obj = mp_const_none },
+            .verify_mode = { .u_int = MBEDTLS_SSL_VERIFY_NONE },
+            .max_fragment = { .u_int = 0 },
+            .sessions = { .u_bool = true },
+        };
+        nlr_buf_t nlr;
+        if (nlr_push(&nlr) == 0) {
+            ssl_context_init(ctx, &args);
+            nlr_pop();
+        } else {
+            free(ctx);
+            nlr_jump(nlr.ret_val);
+        }
+        ssl_default_ctx = ctx;
+    }
+    return ssl_default_ctx;
+}
 
-        ret = mbedtls_ssl_conf_own_cert(&o->conf, &o->cert, &o->pkey);
-        assert(ret == 0);
+// Key of the client session kept for a connection: "server_hostname:port", the port
+// asked from the socket.  Returns false when either is unknown or the key is too long.
+STATIC bool ssl_session_key(mp_obj_t sock, mp_obj_t server_hostname, char *key) {
+    if (server_hostname == mp_const_none) {
+        return false;
     }
+    const char *host = mp_obj_str_get_str(server_hostname);
+    mp_obj_t dest[2];
+    mp_load_method_maybe(sock, MP_QSTR_getpeername, dest);
+    if ((host[0] == '\0') || (dest[0] == MP_OBJ_NULL)) {
+        return false;
+    }
+    mp_obj_t addr = mp_call_method_n_kw(0, 0, dest);
+    if (!MP_OBJ_IS_TYPE(addr, &mp_type_tuple)) {
+        return false;
+    }
+    size_t len;
+    mp_obj_t *items;
+    mp_obj_tuple_get(addr, &len, &items);
+    mp_int_t port = (len == 2) ? mp_obj_get_int(items[1]) : 0;
+    if (port <= 0) {
+        return false;
+    }
+    int n = snprintf(key, SSL_SESSION_KEY_LEN, "%s:%d", host, (int)port);
+    return (n > 0) && (n < SSL_SESSION_KEY_LEN);
+}
+
+STATIC mp_obj_ssl_socket_t *socket_new(mp_obj_t sock, mp_obj_ssl_context_t *ctx, bool own_ctx, mp_obj_t server_hostname) {
+    char key[SSL_SESSION_KEY_LEN];
+    bool keep_session = !ctx->server_side && ctx->sessions && ssl_session_key(sock, server_hostname, key);
+    // A resumed session keeps its master secret, a full handshake makes a new one
+    bool offered = false;
+    unsigned char master[sizeof(ctx->session.master)];
+
+    mp_obj_ssl_socket_t *o = m_new_obj(mp_obj_ssl_socket_t);
+    o->base.type = &ussl_socket_type;
+    o->sock = sock;
+    o->ctx = ctx;
+    o->own_ctx = own_ctx;
+    o->resumed = false;
+
+    int ret;
+    mbedtls_ssl_init(&o->ssl);
+
+    ret = mbedtls_ssl_setup(&o->ssl, &ctx->conf);
+    if (ret != 0) {
+        goto error;
+    }
+
+    if (server_hostname != mp_const_none) {
+        ret = mbedtls_ssl_set_hostname(&o->ssl, mp_obj_str_get_str(server_hostname));
+        if (ret != 0) {
+            goto error;
+        }
+    }
+
+    // Offer the session kept from the last connection to the same host and port
+    if (keep_session) {
+        SSL_CONTEXT_LOCK(ctx);
+        if (ctx->have_session && (strcmp(ctx->session_key, key) == 0)) {
+            offered = (mbedtls_ssl_set_session(&o->ssl, &ctx->session) == 0);
+            memcpy(master, ctx->session.master, sizeof(master));
+        }
+        SSL_CONTEXT_UNLOCK(ctx);
+    }
+    if (ctx->server_side) {
+        // a mark left by a failed handshake of this thread
+        ssl_context_take_resumed(ctx);
+    }
+
+    mbedtls_ssl_set_bio(&o->ssl, &o->sock, _mbedtls_ssl_send, _mbedtls_ssl_recv, NULL);
 
     while ((ret = mbedtls_ssl_handshake(&o->ssl)) != 0) {
         if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
             //assert(0);
             printf("mbedtls_ssl_handshake error: -%x\n", -ret);
-            mp_raise_OSError(MP_EIO);
+            goto error;
         }
     }
 
+    if (ctx->server_side) {
+        o->resumed = ssl_context_take_resumed(ctx);
+    } else if (keep_session) {
+        SSL_CONTEXT_LOCK(ctx);
+        mbedtls_ssl_session_free(&ctx->session);
+        mbedtls_ssl_session_init(&ctx->session);
+        ctx->have_session = (mbedtls_ssl_get_session(&o->ssl, &ctx->session) == 0);
+        strcpy(ctx->session_key, key);
+        o->resumed = offered && ctx->have_session && (memcmp(ctx->session.master, master, sizeof(master)) == 0);
+        SSL_CONTEXT_UNLOCK(ctx);
+    }
+    memset(master, 0, sizeof(master));
+
     return o;
+
+error:
+    memset(master, 0, sizeof(master));
+    if (ctx->server_side) {
+        ssl_context_take_resumed(ctx);
+    }
+    mbedtls_ssl_free(&o->ssl);
+    if (own_ctx) {
+        ssl_context_free(ctx);
+    }
+    mp_raise_OSError(MP_EIO);
 }
 
 STATIC mp_obj_t mod_ssl_getpeercert(mp_obj_t o_in, mp_obj_t binary_form) {
@@ -207,6 +579,12 @@ STATIC mp_obj_t mod_ssl_getpeercert(mp_obj_t o_in, mp_obj_t binary_form) {
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(mod_ssl_getpeercert_obj, mod_ssl_getpeercert);
 
+STATIC mp_obj_t socket_session_reused(mp_obj_t self_in) {
+    mp_obj_ssl_socket_t *o = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_bool(o->resumed);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(socket_session_reused_obj, socket_session_reused);
+
 STATIC void socket_print(const mp_print_t *print, mp_obj_t self_in, mp_print_kind_t kind) {
     (void)kind;
     mp_obj_ssl_socket_t *self = MP_OBJ_TO_PTR(self_in);
@@ -258,13 +636,11 @@ STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_setblocking_obj, socket_setblocking);
 STATIC mp_obj_t socket_close(mp_obj_t self_in) {
     mp_obj_ssl_socket_t *self = MP_OBJ_TO_PTR(self_in);
 
-    mbedtls_pk_free(&self->pkey);
-    mbedtls_x509_crt_free(&self->cert);
-    mbedtls_x509_crt_free(&self->cacert);
     mbedtls_ssl_free(&self->ssl);
-    mbedtls_ssl_config_free(&self->conf);
-    mbedtls_ctr_drbg_free(&self->ctr_drbg);
-    mbedtls_entropy_free(&self->entropy);
+    if (self->own_ctx) {
+        ssl_context_free(self->ctx);
+        self->own_ctx = false;
+    }
 
     return mp_stream_close(self->sock);
 }
@@ -278,6 +654,7 @@ STATIC const mp_rom_map_elem_t ussl_socket_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_setblocking), MP_ROM_PTR(&socket_setblocking_obj) },
     { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&socket_close_obj) },
     { MP_ROM_QSTR(MP_QSTR_getpeercert), MP_ROM_PTR(&mod_ssl_getpeercert_obj) },
+    { MP_ROM_QSTR(MP_QSTR_session_reused), MP_ROM_PTR(&socket_session_reused_obj) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(ussl_socket_locals_dict, ussl_socket_locals_dict_table);
@@ -298,11 +675,75 @@ STATIC const mp_obj_type_t ussl_socket_type = {
     .locals_dict = (void*)&ussl_socket_locals_dict,
 };
 
+STATIC mp_obj_t ssl_context_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *all_args) {
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_server_side, MP_ARG_BOOL, {.u_bool = false} },
+        { MP_QSTR_key, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_cert, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_cadata, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_verify_mode, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = MBEDTLS_SSL_VERIFY_NONE} },
+        { MP_QSTR_max_fragment, MP_ARG_KW_ONLY | MP_ARG_INT, {.u_int = 0} },
+        { MP_QSTR_sessions, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = true} },
+    };
+
+    struct ssl_context_args args;
+    mp_map_t kw_args;
+    mp_map_init_fixed_table(&kw_args, n_kw, all_args + n_args);
+    mp_arg_parse_all(n_args, all_args, &kw_args,
+        MP_ARRAY_SIZE(allowed_args), allowed_args, (mp_arg_val_t*)&args);
+
+    mp_obj_ssl_context_t *ctx = m_new_obj_with_finaliser(mp_obj_ssl_context_t);
+    ctx->base.type = &ussl_context_type;
+    ctx->initialized = false;
+    ssl_context_init(ctx, &args);
+
+    return MP_OBJ_FROM_PTR(ctx);
+}
+
+STATIC mp_obj_t ssl_context_wrap_socket(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
+    static const mp_arg_t allowed_args[] = {
+        { MP_QSTR_server_hostname, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+    };
+
+    mp_obj_ssl_context_t *ctx = MP_OBJ_TO_PTR(pos_args[0]);
+    mp_obj_t sock = pos_args[1];
+
+    mp_arg_val_t args[MP_ARRAY_SIZE(allowed_args)];
+    mp_arg_parse_all(n_args - 2, pos_args + 2, kw_args, MP_ARRAY_SIZE(allowed_args), allowed_args, args);
+
+    if (!ctx->initialized) {
+        mp_raise_OSError(MP_EBADF);
+    }
+    return MP_OBJ_FROM_PTR(socket_new(sock, ctx, false, args[0].u_obj));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_KW(ssl_context_wrap_socket_obj, 2, ssl_context_wrap_socket);
+
+STATIC mp_obj_t ssl_context_del(mp_obj_t self_in) {
+    mp_obj_ssl_context_t *ctx = MP_OBJ_TO_PTR(self_in);
+    ssl_context_free(ctx);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(ssl_context_del_obj, ssl_context_del);
+
+STATIC const mp_rom_map_elem_t ussl_context_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR_wrap_socket), MP_ROM_PTR(&ssl_context_wrap_socket_obj) },
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&ssl_context_del_obj) },
+};
+
+STATIC MP_DEFINE_CONST_DICT(ussl_context_locals_dict, ussl_context_locals_dict_table);
+
+STATIC const mp_obj_type_t ussl_context_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_SSLContext,
+    .make_new = ssl_context_make_new,
+    .locals_dict = (void*)&ussl_context_locals_dict,
+};
+
 STATIC mp_obj_t mod_ssl_wrap_socket(size_t n_args, const mp_obj_t *pos_args, mp_map_t *kw_args) {
     // TODO: Implement more args
     static const mp_arg_t allowed_args[] = {
-        { MP_QSTR_key, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
-        { MP_QSTR_cert, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = MP_OBJ_NULL} },
+        { MP_QSTR_key, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
+        { MP_QSTR_cert, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
         { MP_QSTR_server_side, MP_ARG_KW_ONLY | MP_ARG_BOOL, {.u_bool = false} },
         { MP_QSTR_server_hostname, MP_ARG_KW_ONLY | MP_ARG_OBJ, {.u_obj = mp_const_none} },
     };
@@ -314,13 +755,38 @@ STATIC mp_obj_t mod_ssl_wrap_socket(size_t n_args, const mp_obj_t *pos_args, mp_
     mp_arg_parse_all(n_args - 1, pos_args + 1, kw_args,
         MP_ARRAY_SIZE(allowed_args), allowed_args, (mp_arg_val_t*)&args);
 
-    return MP_OBJ_FROM_PTR(socket_new(sock, &args));
+    if (!args.server_side.u_bool && (args.key.u_obj == mp_const_none)) {
+        // Plain client sockets share one context and resume their sessions
+        return MP_OBJ_FROM_PTR(socket_new(sock, ssl_get_default_context(), false, args.server_hostname.u_obj));
+    }
+
+    // Context used only by this socket, freed when the socket is closed,
+    // or by the finaliser of the context if the socket is dropped unclosed
+    struct ssl_context_args ctx_args = {
+        .server_side = args.server_side,
+        .key = args.key,
+        .cert = args.cert,
+        .cadata = { .u_obj = mp_const_none },
+        .verify_mode = { .u_int = MBEDTLS_SSL_VERIFY_NONE },
+        .max_fragment = { .u_int = 0 },
+        .sessions = { .u_bool = false },
+    };
+    mp_obj_ssl_context_t *ctx = m_new_obj_with_finaliser(mp_obj_ssl_context_t);
+    ctx->base.type = &ussl_context_type;
+    ctx->initialized = false;
+    ssl_context_init(ctx, &ctx_args);
+
+    return MP_OBJ_FROM_PTR(socket_new(sock, ctx, true, args.server_hostname.u_obj));
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_KW(mod_ssl_wrap_socket_obj, 1, mod_ssl_wrap_socket);
 
 STATIC const mp_rom_map_elem_t mp_module_ssl_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_ussl) },
     { MP_ROM_QSTR(MP_QSTR_wrap_socket), MP_ROM_PTR(&mod_ssl_wrap_socket_obj) },
+    { MP_ROM_QSTR(MP_QSTR_SSLContext), MP_ROM_PTR(&ussl_context_type) },
+    { MP_ROM_QSTR(MP_QSTR_CERT_NONE), MP_ROM_INT(MBEDTLS_SSL_VERIFY_NONE) },
+    { MP_ROM_QSTR(MP_QSTR_CERT_OPTIONAL), MP_ROM_INT(MBEDTLS_SSL_VERIFY_OPTIONAL) },
+    { MP_ROM_QSTR(MP_QSTR_CERT_REQUIRED), MP_ROM_INT(MBEDTLS_SSL_VERIFY_REQUIRED) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_ssl_globals, mp_module_ssl_globals_table);
@@ -32,6 +32,7 @@
 #include "py/runtime0.h"
 #include "py/runtime.h"
 #include "py/smallint.h"
+#include "extmod/modutimeq.h"
 
 #if MICROPY_PY_UTIMEQ
 
@@ -41,20 +42,6 @@
 
 // the algorithm here is modelled on CPython's heapq.py
 
-struct qentry {
-    mp_uint_t time;
-    mp_uint_t id;
-    mp_obj_t callback;
-    mp_obj_t args;
-};
-
-typedef struct _mp_obj_utimeq_t {
-    mp_obj_base_t base;
-    mp_uint_t alloc;
-    mp_uint_t len;
-    struct qentry items[];
-} mp_obj_utimeq_t;
-
 STATIC mp_uint_t utimeq_id;
 
 STATIC mp_obj_utimeq_t *get_heap(mp_obj_t heap_in) {
@@ -76,15 +63,19 @@ STATIC bool time_less_than(struct qentry *item, struct qentry *parent) {
     return res && res < (MODULO / 2);
 }
 
-STATIC mp_obj_t utimeq_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
-    mp_arg_check_num(n_args, n_kw, 1, 1, false);
-    mp_uint_t alloc = mp_obj_get_int(args[0]);
+mp_obj_utimeq_t *mp_utimeq_new(mp_uint_t alloc) {
     mp_obj_utimeq_t *o = m_new_obj_var(mp_obj_utimeq_t, struct qentry, alloc);
-    o->base.type = type;
+    o->base.type = &mp_type_utimeq;
     memset(o->items, 0, sizeof(*o->items) * alloc);
     o->alloc = alloc;
     o->len = 0;
-    return MP_OBJ_FROM_PTR(o);
+    return o;
+}
+
+STATIC mp_obj_t utimeq_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
+    (void)type;
+    mp_arg_check_num(n_args, n_kw, 1, 1, false);
+    return MP_OBJ_FROM_PTR(mp_utimeq_new(mp_obj_get_int(args[0])));
 }
 
 STATIC void heap_siftdown(mp_obj_utimeq_t *heap, mp_uint_t start_pos, mp_uint_t pos) {
@@ -123,20 +114,53 @@ STATIC void heap_siftup(mp_obj_utimeq_t *heap, mp_uint_t pos) {
     heap_siftdown(heap, start_pos, pos);
 }
 
-STATIC mp_obj_t mod_utimeq_heappush(size_t n_args, const mp_obj_t *args) {
-    (void)n_args;
-    mp_obj_t heap_in = args[0];
-    mp_obj_utimeq_t *heap = get_heap(heap_in);
+void mp_utimeq_push(mp_obj_utimeq_t *heap, mp_uint_t time, mp_obj_t callback, mp_obj_t args) {
     if (heap->len == heap->alloc) {
         mp_raise_msg(&mp_type_IndexError, "queue overflow");
     }
     mp_uint_t l = heap->len;
-    heap->items[l].time = MP_OBJ_SMALL_INT_VALUE(args[1]);
+    heap->items[l].time = time;
     heap->items[l].id = utimeq_id++;
-    heap->items[l].callback = args[2];
-    heap->items[l].args = args[3];
+    heap->items[l].callback = callback;
+    heap->items[l].args = args;
     heap_siftdown(heap, 0, heap->len);
     heap->len++;
+}
+
+void mp_utimeq_pop(mp_obj_utimeq_t *heap, struct qentry *item) {
+    *item = heap->items[0];
+    heap->len -= 1;
+    heap->items[0] = heap->items[heap->len];
+    heap->items[heap->len].callback = MP_OBJ_NULL; // so we don't retain a pointer
+    heap->items[heap->len].args = MP_OBJ_NULL;
+    if (heap->len) {
+        heap_siftup(heap, 0);
+    }
+}
+
+bool mp_utimeq_remove(mp_obj_utimeq_t *heap, mp_obj_t callback) {
+    mp_uint_t pos = 0;
+    while (pos < heap->len && heap->items[pos].callback != callback) {
+        pos++;
+    }
+    if (pos == heap->len) {
+        return false;
+    }
+    heap->len -= 1;
+    heap->items[pos] = heap->items[heap->len];
+    heap->items[heap->len].callback = MP_OBJ_NULL;
+    heap->items[heap->len].args = MP_OBJ_NULL;
+    if (pos < heap->len) {
+        // the last entry may belong above or below the removed one
+        heap_siftup(heap, pos);
+        heap_siftdown(heap, 0, pos);
+    }
+    return true;
+}
+
+STATIC mp_obj_t mod_utimeq_heappush(size_t n_args, const mp_obj_t *args) {
+    (void)n_args;
+    mp_utimeq_push(get_heap(args[0]), MP_OBJ_SMALL_INT_VALUE(args[1]), args[2], args[3]);
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(mod_utimeq_heappush_obj, 4, 4, mod_utimeq_heappush);
@@ -151,17 +175,11 @@ STATIC mp_obj_t mod_utimeq_heappop(mp_obj_t heap_in, mp_obj_t list_ref) {
         mp_raise_TypeError("");
     }
 
-    struct qentry *item = &heap->items[0];
-    ret->items[0] = MP_OBJ_NEW_SMALL_INT(item->time);
-    ret->items[1] = item->callback;
-    ret->items[2] = item->args;
-    heap->len -= 1;
-    heap->items[0] = heap->items[heap->len];
-    heap->items[heap->len].callback = MP_OBJ_NULL; // so we don't retain a pointer
-    heap->items[heap->len].args = MP_OBJ_NULL;
-    if (heap->len) {
-        heap_siftup(heap, 0);
-    }
+    struct qentry item;
+    mp_utimeq_pop(heap, &item);
+    ret->items[0] = MP_OBJ_NEW_SMALL_INT(item.time);
+    ret->items[1] = item.callback;
+    ret->items[2] = item.args;
     return mp_const_none;
 }
 STATIC MP_DEFINE_CONST_FUN_OBJ_2(mod_utimeq_heappop_obj, mod_utimeq_heappop);
@@ -209,7 +227,7 @@ STATIC const mp_rom_map_elem_t utimeq_locals_dict_table[] = {
 
 STATIC MP_DEFINE_CONST_DICT(utimeq_locals_dict, utimeq_locals_dict_table);
 
-STATIC const mp_obj_type_t utimeq_type = {
+const mp_obj_type_t mp_type_utimeq = {
     { &mp_type_type },
     .name = MP_QSTR_utimeq,
     .make_new = utimeq_make_new,
@@ -219,7 +237,7 @@ STATIC const mp_obj_type_t utimeq_type = {
 
 STATIC const mp_rom_map_elem_t mp_module_utimeq_globals_table[] = {
     { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_utimeq) },
-    { MP_ROM_QSTR(MP_QSTR_utimeq), MP_ROM_PTR(&utimeq_type) },
+    { MP_ROM_QSTR(MP_QSTR_utimeq), MP_ROM_PTR(&mp_type_utimeq) },
 };
 
 STATIC MP_DEFINE_CONST_DICT(mp_module_utimeq_globals, mp_module_utimeq_globals_table);
@@ -0,0 +1,30 @@
+#ifndef MICROPY_INCLUDED_EXTMOD_MODUTIMEQ_H
+#define MICROPY_INCLUDED_EXTMOD_MODUTIMEQ_H
+
+#include "py/obj.h"
+
+struct qentry {
+    mp_uint_t time;
+    mp_uint_t id;
+    mp_obj_t callback;
+    mp_obj_t args;
+};
+
+typedef struct _mp_obj_utimeq_t {
+    mp_obj_base_t base;
+    mp_uint_t alloc;
+    mp_uint_t len;
+    struct qentry items[];
+} mp_obj_utimeq_t;
+
+extern const mp_obj_type_t mp_type_utimeq;
+
+// C access to the queue, for native schedulers built on top of it;
+// time is in ticks_ms() units, push raises IndexError when the queue is full
+mp_obj_utimeq_t *mp_utimeq_new(mp_uint_t alloc);
+void mp_utimeq_push(mp_obj_utimeq_t *heap, mp_uint_t time, mp_obj_t callback, mp_obj_t args);
+void mp_utimeq_pop(mp_obj_utimeq_t *heap, struct qentry *item);
+// remove the entry with the given callback, false if there is none
+bool mp_utimeq_remove(mp_obj_utimeq_t *heap, mp_obj_t callback);
+
+#endif // MICROPY_INCLUDED_EXTMOD_MODUTIMEQ_H
@@ -220,6 +220,7 @@ const mp_obj_module_t mp_module_uzlib = {
 #include "uzlib/tinfzlib.c"
 #include "uzlib/tinfgzip.c"
 #include "uzlib/adler32.c"
+#define UZLIB_CRC32_SLICE_BY_8 (MICROPY_PY_UZLIB_CRC32_SLICE8)
 #include "uzlib/crc32.c"
 
 #endif // MICROPY_PY_UZLIB
@@ -36,10 +36,19 @@
 
 #if MICROPY_PY_WEBSOCKET
 
+// Server side of RFC 6455 only, as used by webrepl: frames are sent
+// unmasked, which a client must not do, and received frames are
+// unmasked with the mask they carry, if any.
+
 enum { FRAME_HEADER, FRAME_OPT, PAYLOAD, CONTROL };
 
 enum { BLOCKING_WRITE = 0x80 };
 
+// Frames up to this size (header included) are assembled and sent with one write
+#define WEBSOCKET_COALESCE_SIZE (128)
+// Maximal number of buffers sent as one frame by writev()
+#define WEBSOCKET_MAX_PARTS (8)
+
 typedef struct _mp_obj_websocket_t {
     mp_obj_base_t base;
     mp_obj_t sock;
@@ -49,15 +58,26 @@ typedef struct _mp_obj_websocket_t {
     byte to_recv;
     byte mask_pos;
     byte buf_pos;
-    byte buf[6];
+    // Frame header, then extended payload length and mask
+    byte buf[12];
     byte opts;
     // Copy of last data frame flags
     byte ws_flags;
     // Copy of current frame flags
     byte last_flags;
+    // Size of the extended payload length of current frame (0, 2 or 8)
+    byte len_sz;
+    // Payload of the control frame being received (max 125 bytes per RFC 6455)
+    byte ctrl_len;
+    byte ctrl[125];
+    // Error of a failed PONG or CLOSE answer, a frame may be cut short,
+    // so the connection can't be used any more
+    int err;
 } mp_obj_websocket_t;
 
-STATIC mp_uint_t websocket_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode);
+typedef uint32_t __attribute__((__may_alias__)) websocket_word_t;
+
+STATIC mp_uint_t websocket_send_frame(mp_obj_websocket_t *self, byte opcode, const mp_buffer_info_t *parts, size_t n_parts, int *errcode);
 
 STATIC mp_obj_t websocket_make_new(const mp_obj_type_t *type, size_t n_args, size_t n_kw, const mp_obj_t *args) {
     mp_arg_check_num(n_args, n_kw, 1, 2, false);
@@ -69,15 +89,56 @@ STATIC mp_obj_t websocket_make_new(const mp_obj_type_t *type, size_t n_args, siz
     o->mask_pos = 0;
     o->buf_pos = 0;
     o->opts = FRAME_TXT;
+    o->err = 0;
     if (n_args > 1 && args[1] == mp_const_true) {
         o->opts |= BLOCKING_WRITE;
     }
     return  MP_OBJ_FROM_PTR(o);
 }
 
+// XOR payload with the frame mask, a 32-bit word at a time once the buffer is aligned
+STATIC void websocket_mask(byte *p, size_t sz, const byte *mask, byte *mask_pos) {
+    byte pos = *mask_pos;
+    *mask_pos = pos + sz;
+    if ((mask[0] | mask[1] | mask[2] | mask[3]) == 0) {
+        // Unmasked frame
+        return;
+    }
+    while (sz != 0 && ((uintptr_t)p & 3) != 0) {
+        *p++ ^= mask[pos++ & 3];
+        sz--;
+    }
+    if (sz >= 4) {
+        // Mask rotated to the current position, in memory order
+        byte rot[4] = { mask[pos & 3], mask[(pos + 1) & 3], mask[(pos + 2) & 3], mask[(pos + 3) & 3] };
+        websocket_word_t m;
+        memcpy(&m, rot, sizeof(m));
+        websocket_word_t *w = (websocket_word_t*)p;
+        for (size_t n = sz >> 2; n != 0; n--) {
+            *w++ ^= m;
+        }
+        p = (byte*)w;
+        sz &= 3;
+    }
+    while (sz--) {
+        *p++ ^= mask[pos++ & 3];
+    }
+}
+
+STATIC void websocket_frame_done(mp_obj_websocket_t *self) {
+    self->state = FRAME_HEADER;
+    self->to_recv = 2;
+    self->mask_pos = 0;
+    self->buf_pos = 0;
+}
+
 STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
     mp_obj_websocket_t *self =  MP_OBJ_TO_PTR(self_in);
     const mp_stream_p_t *stream_p = mp_get_stream_raise(self->sock, MP_STREAM_OP_READ);
+    if (self->err != 0) {
+        *errcode = self->err;
+        return MP_STREAM_ERROR;
+    }
     while (1) {
         if (self->to_recv != 0) {
             mp_uint_t out_sz = stream_p->read(self->sock, self->buf + self->buf_pos, self->to_recv, errcode);
@@ -87,16 +148,13 @@ STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int
             self->buf_pos += out_sz;
             self->to_recv -= out_sz;
             if (self->to_recv != 0) {
-                *errcode = MP_EAGAIN;
-                return MP_STREAM_ERROR;
+                // Rest of the header; a non-blocking socket reports EAGAIN itself
+                continue;
             }
         }
 
         switch (self->state) {
             case FRAME_HEADER: {
-                // TODO: Split frame handling below is untested so far, so conservatively disable it
-                assert(self->buf[0] & 0x80);
-
                 // "Control frames MAY be injected in the middle of a fragmented message."
                 // So, they must be processed before data frames (and not alter
                 // self->ws_flags)
@@ -104,7 +162,9 @@ STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int
                 self->last_flags = frame_type;
                 frame_type &= FRAME_OPCODE_MASK;
 
-                if ((self->buf[0] & FRAME_OPCODE_MASK) == FRAME_CONT) {
+                if (frame_type >= FRAME_CLOSE) {
+                    // Control frame, handled internally
+                } else if (frame_type == FRAME_CONT) {
                     // Preserve previous frame type
                     self->ws_flags = (self->ws_flags & FRAME_OPCODE_MASK) | (self->buf[0] & ~FRAME_OPCODE_MASK);
                 } else {
@@ -115,15 +175,16 @@ STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int
                 // without masks.
                 memset(self->mask, 0, sizeof(self->mask));
 
-                int to_recv = 0;
                 size_t sz = self->buf[1] & 0x7f;
+                self->len_sz = 0;
                 if (sz == 126) {
                     // Msg size is next 2 bytes
-                    to_recv += 2;
+                    self->len_sz = 2;
                 } else if (sz == 127) {
                     // Msg size is next 8 bytes
-                    assert(0);
+                    self->len_sz = 8;
                 }
+                int to_recv = self->len_sz;
                 if (self->buf[1] & 0x80) {
                     // Next 4 bytes is mask
                     to_recv += 4;
@@ -132,6 +193,7 @@ STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int
                 self->buf_pos = 0;
                 self->to_recv = to_recv;
                 self->msg_sz = sz; // May be overridden by FRAME_OPT
+                self->ctrl_len = 0;
                 if (to_recv != 0) {
                     self->state = FRAME_OPT;
                 } else {
@@ -145,13 +207,20 @@ STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int
             }
 
             case FRAME_OPT: {
-                if ((self->buf_pos & 3) == 2) {
-                    // First two bytes are message length
-                    self->msg_sz = (self->buf[0] << 8) | self->buf[1];
+                const byte *p = self->buf;
+                if (self->len_sz == 2) {
+                    self->msg_sz = (p[0] << 8) | p[1];
+                } else if (self->len_sz == 8) {
+                    if (p[0] | p[1] | p[2] | p[3]) {
+                        // Payloads of 4GB and more are not supported
+                        *errcode = MP_EINVAL;
+                        return MP_STREAM_ERROR;
+                    }
+                    self->msg_sz = ((uint32_t)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
                 }
-                if (self->buf_pos >= 4) {
+                if (self->buf_pos > self->len_sz) {
                     // Last 4 bytes is mask
-                    memcpy(self->mask, self->buf + self->buf_pos - 4, 4);
+                    memcpy(self->mask, self->buf + self->len_sz, 4);
                 }
                 self->buf_pos = 0;
                 if ((self->last_flags & FRAME_OPCODE_MASK) >= FRAME_CLOSE) {
@@ -162,74 +231,98 @@ STATIC mp_uint_t websocket_read(mp_obj_t self_in, void *buf, mp_uint_t size, int
                 continue;
             }
 
-            case PAYLOAD:
             case CONTROL: {
-                mp_uint_t out_sz = 0;
+                // Control frame payload is collected internally,
+                // so that ping/pong/close never reach the caller
+                if (self->msg_sz > sizeof(self->ctrl)) {
+                    *errcode = MP_EINVAL;
+                    return MP_STREAM_ERROR;
+                }
+                if (self->ctrl_len < self->msg_sz) {
+                    mp_uint_t out_sz = stream_p->read(self->sock, self->ctrl + self->ctrl_len, self->msg_sz - self->ctrl_len, errcode);
+                    if (out_sz == 0 || out_sz == MP_STREAM_ERROR) {
+                        return out_sz;
+                    }
+                    websocket_mask(self->ctrl + self->ctrl_len, out_sz, self->mask, &self->mask_pos);
+                    self->ctrl_len += out_sz;
+                    continue;
+                }
+
+                websocket_frame_done(self);
+
+                byte frame_type = self->last_flags & FRAME_OPCODE_MASK;
+                mp_buffer_info_t payload = { .buf = self->ctrl, .len = self->ctrl_len };
+                if (frame_type == FRAME_CLOSE) {
+                    // Echo the status code back and report EOF, also if the
+                    // answer fails: the peer may have gone already
+                    payload.len = MIN(payload.len, 2);
+                    websocket_send_frame(self, FRAME_CLOSE, &payload, 1, &self->err);
+                    return 0;
+                } else if (frame_type == FRAME_PING) {
+                    if (websocket_send_frame(self, FRAME_PONG, &payload, 1, &self->err) == MP_STREAM_ERROR) {
+                        *errcode = self->err;
+                        return MP_STREAM_ERROR;
+                    }
+                }
+
+                //DEBUG_printf("Finished receiving ctrl message %x, ignoring\n", self->last_flags);
+                continue;
+            }
+
+            case PAYLOAD: {
                 if (self->msg_sz == 0) {
-                    // In case message had zero payload
-                    goto no_payload;
+                    // Empty (data) frame received is not EOF
+                    websocket_frame_done(self);
+                    continue;
                 }
 
                 size_t sz = MIN(size, self->msg_sz);
-                out_sz = stream_p->read(self->sock, buf, sz, errcode);
+                mp_uint_t out_sz = stream_p->read(self->sock, buf, sz, errcode);
                 if (out_sz == 0 || out_sz == MP_STREAM_ERROR) {
                     return out_sz;
                 }
 
-                sz = out_sz;
-                for (byte *p = buf; sz--; p++) {
-                    *p ^= self->mask[self->mask_pos++ & 3];
-                }
+                websocket_mask(buf, out_sz, self->mask, &self->mask_pos);
 
                 self->msg_sz -= out_sz;
                 if (self->msg_sz == 0) {
-                    byte last_state;
-no_payload:
-                    last_state = self->state;
-                    self->state = FRAME_HEADER;
-                    self->to_recv = 2;
-                    self->mask_pos = 0;
-                    self->buf_pos = 0;
-
-                    // Handle control frame
-                    if (last_state == CONTROL) {
-                        byte frame_type = self->last_flags & FRAME_OPCODE_MASK;
-                        if (frame_type == FRAME_CLOSE) {
-                            static char close_resp[2] = {0x88, 0};
-                            int err;
-                            websocket_write(self_in, close_resp, sizeof(close_resp), &err);
-                            return 0;
-                        }
-
-                        //DEBUG_printf("Finished receiving ctrl message %x, ignoring\n", self->last_flags);
-                        continue;
-                    }
+                    websocket_frame_done(self);
                 }
-
-                if (out_sz != 0) {
-                    return out_sz;
-                }
-                // Empty (data) frame received is not EOF
-                continue;
+                return out_sz;
             }
-
         }
     }
 }
 
-STATIC mp_uint_t websocket_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
-    mp_obj_websocket_t *self =  MP_OBJ_TO_PTR(self_in);
-    assert(size < 0x10000);
-    byte header[4] = {0x80 | (self->opts & FRAME_OPCODE_MASK)};
+// Send one frame; payload parts are written as they are, without being copied
+// together, unless the whole frame is small enough to go out in a single write
+STATIC mp_uint_t websocket_send_frame(mp_obj_websocket_t *self, byte opcode, const mp_buffer_info_t *parts, size_t n_parts, int *errcode) {
+    if (self->err != 0) {
+        *errcode = self->err;
+        return MP_STREAM_ERROR;
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < n_parts; i++) {
+        size += parts[i].len;
+    }
+
+    byte header[10] = {0x80 | opcode};
     int hdr_sz;
     if (size < 126) {
         header[1] = size;
         hdr_sz = 2;
-    } else {
+    } else if (size < 0x10000) {
         header[1] = 126;
         header[2] = size >> 8;
         header[3] = size & 0xff;
         hdr_sz = 4;
+    } else {
+        header[1] = 127;
+        header[6] = size >> 24;
+        header[7] = (size >> 16) & 0xff;
+        header[8] = (size >> 8) & 0xff;
+        header[9] = size & 0xff;
+        hdr_sz = 10;
     }
 
     mp_obj_t dest[3];
@@ -239,9 +332,21 @@ STATIC mp_uint_t websocket_write(mp_obj_t self_in, const void *buf, mp_uint_t si
         mp_call_method_n_kw(1, 0, dest);
     }
 
-    mp_uint_t out_sz = mp_stream_write_exactly(self->sock, header, hdr_sz, errcode);
-    if (*errcode == 0) {
-        out_sz = mp_stream_write_exactly(self->sock, buf, size, errcode);
+    *errcode = 0;
+    if (hdr_sz + size <= WEBSOCKET_COALESCE_SIZE) {
+        byte frame[WEBSOCKET_COALESCE_SIZE];
+        memcpy(frame, header, hdr_sz);
+        size_t pos = hdr_sz;
+        for (size_t i = 0; i < n_parts; i++) {
+            memcpy(frame + pos, parts[i].buf, parts[i].len);
+            pos += parts[i].len;
+        }
+        mp_stream_write_exactly(self->sock, frame, pos, errcode);
+    } else {
+        mp_stream_write_exactly(self->sock, header, hdr_sz, errcode);
+        for (size_t i = 0; i < n_parts && *errcode == 0; i++) {
+            mp_stream_write_exactly(self->sock, parts[i].buf, parts[i].len, errcode);
+        }
     }
 
     if (self->opts & BLOCKING_WRITE) {
@@ -252,8 +357,38 @@ STATIC mp_uint_t websocket_write(mp_obj_t self_in, const void *buf, mp_uint_t si
     if (*errcode != 0) {
         return MP_STREAM_ERROR;
     }
-    return out_sz;
+    return size;
+}
+
+STATIC mp_uint_t websocket_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
+    mp_obj_websocket_t *self =  MP_OBJ_TO_PTR(self_in);
+    mp_buffer_info_t payload = { .buf = (void*)buf, .len = size };
+    return websocket_send_frame(self, self->opts & FRAME_OPCODE_MASK, &payload, 1, errcode);
+}
+
+// Send all buffers of the list as the payload of one frame
+STATIC mp_obj_t websocket_writev(mp_obj_t self_in, mp_obj_t parts_in) {
+    mp_obj_websocket_t *self = MP_OBJ_TO_PTR(self_in);
+    size_t n_parts;
+    mp_obj_t *items;
+    mp_obj_get_array(parts_in, &n_parts, &items);
+    if (n_parts > WEBSOCKET_MAX_PARTS) {
+        mp_raise_ValueError("too many buffers");
+    }
+
+    mp_buffer_info_t parts[WEBSOCKET_MAX_PARTS];
+    for (size_t i = 0; i < n_parts; i++) {
+        mp_get_buffer_raise(items[i], &parts[i], MP_BUFFER_READ);
+    }
+
+    int errcode;
+    mp_uint_t out_sz = websocket_send_frame(self, self->opts & FRAME_OPCODE_MASK, parts, n_parts, &errcode);
+    if (out_sz == MP_STREAM_ERROR) {
+        mp_raise_OSError(errcode);
+    }
+    return MP_OBJ_NEW_SMALL_INT(out_sz);
 }
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(websocket_writev_obj, websocket_writev);
 
 STATIC mp_uint_t websocket_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
     mp_obj_websocket_t *self = MP_OBJ_TO_PTR(self_in);
@@ -284,6 +419,7 @@ STATIC const mp_rom_map_elem_t websocket_locals_dict_table[] = {
     { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
     { MP_ROM_QSTR(MP_QSTR_readline), MP_ROM_PTR(&mp_stream_unbuffered_readline_obj) },
     { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj) },
+    { MP_ROM_QSTR(MP_QSTR_writev), MP_ROM_PTR(&websocket_writev_obj) },
     { MP_ROM_QSTR(MP_QSTR_ioctl), MP_ROM_PTR(&mp_stream_ioctl_obj) },
     { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&websocket_close_obj) },
 };
@@ -980,6 +980,18 @@ typedef double mp_float_t;
 #define MICROPY_PY_USELECT (0)
 #endif
 
+// Whether "uselect" waits on the OS file descriptors of the registered
+// streams (MP_STREAM_GET_FILENO) with one select() call, instead of polling
+// every stream in turn. Streams without a descriptor are still polled.
+#ifndef MICROPY_PY_USELECT_SELECT_FD
+#define MICROPY_PY_USELECT_SELECT_FD (0)
+#endif
+
+// Header providing select() and fd_set for MICROPY_PY_USELECT_SELECT_FD
+#ifndef MICROPY_PY_USELECT_SELECT_HEADER
+#define MICROPY_PY_USELECT_SELECT_HEADER <sys/select.h>
+#endif
+
 // Whether to provide "utime" module functions implementation
 // in terms of mp_hal_* functions.
 #ifndef MICROPY_PY_UTIME_MP_HAL
@@ -1023,6 +1035,12 @@ typedef double mp_float_t;
 #define MICROPY_PY_UZLIB (0)
 #endif
 
+// Whether uzlib's CRC32 (also used by ubinascii.crc32) uses slicing-by-8
+// tables (8 KiB of constant data) instead of the compact 16-entry table
+#ifndef MICROPY_PY_UZLIB_CRC32_SLICE8
+#define MICROPY_PY_UZLIB_CRC32_SLICE8 (0)
+#endif
+
 #ifndef MICROPY_PY_UJSON
 #define MICROPY_PY_UJSON (0)
 #endif
@@ -1040,6 +1058,11 @@ typedef double mp_float_t;
 #define MICROPY_PY_UTIMEQ (0)
 #endif
 
+// Native event loop core (_uasyncio), needs utimeq and uselect
+#ifndef MICROPY_PY_UASYNCIO
+#define MICROPY_PY_UASYNCIO (0)
+#endif
+
 #ifndef MICROPY_PY_UHASHLIB
 #define MICROPY_PY_UHASHLIB (0)
 #endif
@@ -250,28 +250,70 @@ wrong_args:
     mp_raise_TypeError("wrong number of arguments");
 }
 
+// Haystacks at least this long are searched with Horspool's algorithm, shorter
+// ones aren't worth the cost of building the skip table.
+#define FIND_SUBBYTES_HORSPOOL_MIN_HLEN (64)
+
+// Boyer-Moore-Horspool forward search, requires 2 <= nlen <= hlen.
+// Skip distances are stored in bytes and capped at 255, which only makes
+// the skip more conservative for very long needles.
+STATIC const byte *find_subbytes_horspool(const byte *haystack, size_t hlen, const byte *needle, size_t nlen) {
+    byte skip[256];
+    memset(skip, nlen < 255 ? nlen : 255, sizeof(skip));
+    for (size_t i = 0; i < nlen - 1; i++) {
+        size_t dist = nlen - 1 - i;
+        skip[needle[i]] = dist < 255 ? dist : 255;
+    }
+    const byte last = needle[nlen - 1];
+    const byte *p = haystack;
+    const byte *p_end = haystack + hlen - nlen;
+    while (p <= p_end) {
+        byte c = p[nlen - 1];
+        if (c == last && memcmp(p, needle, nlen - 1) == 0) {
+            return p;
+        }
+        p += skip[c];
+    }
+    return NULL;
+}
+
 // like strstr but with specified length and allows \0 bytes
-// TODO replace with something more efficient/standard
+// The forward search uses memchr to find candidates for the first byte of the
+// needle, which the C library does a word at a time, or Horspool for long
+// haystacks.  The backward search is only used by rfind/rindex/rsplit/
+// rpartition so it is kept simple.
 const byte *find_subbytes(const byte *haystack, size_t hlen, const byte *needle, size_t nlen, int direction) {
-    if (hlen >= nlen) {
-        size_t str_index, str_index_end;
-        if (direction > 0) {
-            str_index = 0;
-            str_index_end = hlen - nlen;
-        } else {
-            str_index = hlen - nlen;
-            str_index_end = 0;
+    if (hlen < nlen) {
+        return NULL;
+    }
+    if (nlen == 0) {
+        return direction > 0 ? haystack : haystack + hlen;
+    }
+    if (direction > 0) {
+        if (nlen > 1 && hlen >= FIND_SUBBYTES_HORSPOOL_MIN_HLEN) {
+            return find_subbytes_horspool(haystack, hlen, needle, nlen);
+        }
+        const byte *p = haystack;
+        const byte *p_end = haystack + hlen - nlen;
+        while (p <= p_end) {
+            p = memchr(p, needle[0], p_end - p + 1);
+            if (p == NULL) {
+                break;
+            }
+            if (memcmp(p + 1, needle + 1, nlen - 1) == 0) {
+                return p;
+            }
+            p++;
         }
-        for (;;) {
-            if (memcmp(&haystack[str_index], needle, nlen) == 0) {
-                //found
-                return haystack + str_index;
+    } else {
+        const byte first = needle[0];
+        for (const byte *p = haystack + hlen - nlen;; p--) {
+            if (*p == first && memcmp(p + 1, needle + 1, nlen - 1) == 0) {
+                return p;
             }
-            if (str_index == str_index_end) {
-                //not found
+            if (p == haystack) {
                 break;
             }
-            str_index += direction;
         }
     }
     return NULL;
@@ -429,15 +471,38 @@ STATIC mp_obj_t str_join(mp_obj_t self_in, mp_obj_t arg) {
     // get separation string
     GET_STR_DATA_LEN(self_in, sep_str, sep_len);
 
+    if (!MP_OBJ_IS_TYPE(arg, &mp_type_list) && !MP_OBJ_IS_TYPE(arg, &mp_type_tuple)) {
+        // arg is a general iterable, so stream its items into a growable
+        // buffer instead of materialising them as a list first
+        vstr_t vstr;
+        vstr_init(&vstr, 16);
+        mp_obj_iter_buf_t iter_buf;
+        mp_obj_t iterable = mp_getiter(arg, &iter_buf);
+        mp_obj_t item;
+        bool first = true;
+        while ((item = mp_iternext(iterable)) != MP_OBJ_STOP_ITERATION) {
+            if (mp_obj_get_type(item) != self_type) {
+                mp_raise_TypeError(
+                    "join expects a list of str/bytes objects consistent with self object");
+            }
+            GET_STR_DATA_LEN(item, s, l);
+            size_t extra = l + (first ? 0 : sep_len);
+            if (vstr.len + extra > vstr.alloc) {
+                // grow geometrically so appends are amortised O(1)
+                vstr_hint_size(&vstr, MAX(extra, vstr.len));
+            }
+            if (!first) {
+                vstr_add_strn(&vstr, (const char*)sep_str, sep_len);
+            }
+            vstr_add_strn(&vstr, (const char*)s, l);
+            first = false;
+        }
+        return mp_obj_new_str_from_vstr(self_type, &vstr);
+    }
+
     // process args
     size_t seq_len;
     mp_obj_t *seq_items;
-
-    if (!MP_OBJ_IS_TYPE(arg, &mp_type_list) && !MP_OBJ_IS_TYPE(arg, &mp_type_tuple)) {
-        // arg is not a list nor a tuple, try to convert it to a list
-        // TODO: Try to optimize?
-        arg = mp_type_list.make_new(&mp_type_list, 1, 0, &arg);
-    }
     mp_obj_get_array(arg, &seq_len, &seq_items);
 
     // count required length
@@ -524,21 +589,17 @@ mp_obj_t mp_obj_str_split(size_t n_args, const mp_obj_t *args) {
         }
 
         for (;;) {
-            const byte *start = s;
-            for (;;) {
-                if (splits == 0 || s + sep_len > top) {
-                    s = top;
-                    break;
-                } else if (memcmp(s, sep_str, sep_len) == 0) {
-                    break;
-                }
-                s++;
+            // once the split limit is reached the rest goes in as is, without searching
+            const byte *p = NULL;
+            if (splits != 0) {
+                p = find_subbytes(s, top - s, (const byte*)sep_str, sep_len, 1);
             }
-            mp_obj_list_append(res, mp_obj_new_str_of_type(self_type, start, s - start));
-            if (s >= top) {
+            if (p == NULL) {
+                mp_obj_list_append(res, mp_obj_new_str_of_type(self_type, s, top - s));
                 break;
             }
-            s += sep_len;
+            mp_obj_list_append(res, mp_obj_new_str_of_type(self_type, s, p - s));
+            s = p + sep_len;
             if (splits > 0) {
                 splits--;
             }
@@ -631,16 +692,11 @@ STATIC mp_obj_t str_rsplit(size_t n_args, const mp_obj_t *args) {
         const byte *beg = s;
         const byte *last = s + len;
         for (;;) {
-            s = last - sep_len;
-            for (;;) {
-                if (splits == 0 || s < beg) {
-                    break;
-                } else if (memcmp(s, sep_str, sep_len) == 0) {
-                    break;
-                }
-                s--;
+            s = NULL;
+            if (splits != 0) {
+                s = find_subbytes(beg, last - beg, (const byte*)sep_str, sep_len, -1);
             }
-            if (s < beg || splits == 0) {
+            if (s == NULL) {
                 res->items[idx] = mp_obj_new_str_of_type(self_type, beg, last - beg);
                 break;
             }
@@ -1561,6 +1617,9 @@ not_enough_args:
 
 // The implementation is optimized, returning the original string if there's
 // nothing to replace.
+// matches of str.replace() remembered by the first pass, on the stack
+#define STR_REPLACE_OFFSETS_MAX (32)
+
 STATIC mp_obj_t str_replace(size_t n_args, const mp_obj_t *args) {
     mp_check_self(MP_OBJ_IS_STR_OR_BYTES(args[0]));
 
@@ -1603,6 +1662,69 @@ STATIC mp_obj_t str_replace(size_t n_args, const mp_obj_t *args) {
     byte *data = NULL;
     vstr_t vstr;
 
+    if (old_len == new_len && old_len > 0) {
+        // the replaced string has the same length as the original one so it
+        // can be made in a single pass: copy the original on the first match
+        // and then overwrite each occurrence in place
+        size_t num_replacements_done = 0;
+        const byte *offset_ptr = str;
+        const byte *old_occurrence;
+        while (num_replacements_done != (size_t)max_rep
+            && (old_occurrence = find_subbytes(offset_ptr, str + str_len - offset_ptr, old, old_len, 1)) != NULL) {
+            if (data == NULL) {
+                vstr_init_len(&vstr, str_len);
+                data = (byte*)vstr.buf;
+                memcpy(data, str, str_len);
+            }
+            memcpy(data + (old_occurrence - str), new, new_len);
+            offset_ptr = old_occurrence + old_len;
+            num_replacements_done++;
+        }
+        if (data == NULL) {
+            // no substr found, return original string
+            return args[0];
+        }
+        return mp_obj_new_str_from_vstr(self_type, &vstr);
+    }
+
+    if (old_len > 0) {
+        // record the match offsets while counting them, so the replaced string
+        // is built without searching again; only with more matches than fit in
+        // 'offsets' the string is scanned again by the 2 passes below
+        size_t offsets[STR_REPLACE_OFFSETS_MAX];
+        size_t num_found = 0;
+        bool overflow = false;
+        const byte *offset_ptr = str;
+        const byte *old_occurrence;
+        while (num_found != (size_t)max_rep
+            && (old_occurrence = find_subbytes(offset_ptr, str + str_len - offset_ptr, old, old_len, 1)) != NULL) {
+            if (num_found == STR_REPLACE_OFFSETS_MAX) {
+                overflow = true;
+                break;
+            }
+            offsets[num_found++] = old_occurrence - str;
+            offset_ptr = old_occurrence + old_len;
+        }
+        if (num_found == 0) {
+            // no substr found, return original string
+            return args[0];
+        }
+        if (!overflow) {
+            vstr_init_len(&vstr, str_len - num_found * old_len + num_found * new_len);
+            data = (byte*)vstr.buf;
+            size_t src = 0;
+            for (size_t i = 0; i < num_found; i++) {
+                memcpy(data, str + src, offsets[i] - src);
+                data += offsets[i] - src;
+                memcpy(data, new, new_len);
+                data += new_len;
+                src = offsets[i] + old_len;
+            }
+            memcpy(data, str + src, str_len - src);
+            return mp_obj_new_str_from_vstr(self_type, &vstr);
+        }
+    }
+
     // do 2 passes over the string:
     //   first pass computes the required length of the replaced string
     //   second pass does the replacements
@@ -1693,15 +1815,12 @@ STATIC mp_obj_t str_count(size_t n_args, const mp_obj_t *args) {
         return MP_OBJ_NEW_SMALL_INT(unichar_charlen((const char*)start, end - start) + 1);
     }
 
-    // count the occurrences
+    // count the (non-overlapping) occurrences
     mp_int_t num_occurrences = 0;
-    for (const byte *haystack_ptr = start; haystack_ptr + needle_len <= end;) {
-        if (memcmp(haystack_ptr, needle, needle_len) == 0) {
-            num_occurrences++;
-            haystack_ptr += needle_len;
-        } else {
-            haystack_ptr = utf8_next_char(haystack_ptr);
-        }
+    for (const byte *haystack_ptr = start;
+        (haystack_ptr = find_subbytes(haystack_ptr, end - haystack_ptr, needle, needle_len, 1)) != NULL;
+        haystack_ptr += needle_len) {
+        num_occurrences++;
     }
 
     return MP_OBJ_NEW_SMALL_INT(num_occurrences);
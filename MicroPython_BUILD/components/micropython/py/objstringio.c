@@ -93,10 +93,17 @@ STATIC mp_uint_t stringio_write(mp_obj_t o_in, const void *buf, mp_uint_t size,
     }
     mp_uint_t org_len = o->vstr->len;
     if (new_pos > o->vstr->alloc) {
+        // Grow by at least half the current allocation, so that building
+        // a string from many small writes is amortised O(1) per write
+        mp_uint_t extra = new_pos - o->vstr->alloc;
+        if (extra < o->vstr->alloc / 2) {
+            extra = o->vstr->alloc / 2;
+        }
         // Take all what's already allocated...
         o->vstr->len = o->vstr->alloc;
         // ... and add more
-        vstr_add_len(o->vstr, new_pos - o->vstr->alloc);
+        vstr_add_len(o->vstr, extra);
+        o->vstr->len = org_len;
     }
     // If there was a seek past EOF, clear the hole
     if (o->pos > org_len) {
@@ -42,12 +42,14 @@
 #define MP_STREAM_SET_OPTS      (7)  // Set stream options
 #define MP_STREAM_GET_DATA_OPTS (8)  // Get data/message options
 #define MP_STREAM_SET_DATA_OPTS (9)  // Set data/message options
+#define MP_STREAM_GET_FILENO    (10) // Get OS file descriptor, for select(); EBADF if closed
 
 // These poll ioctl values are compatible with Linux
 #define MP_STREAM_POLL_RD  (0x0001)
 #define MP_STREAM_POLL_WR  (0x0004)
 #define MP_STREAM_POLL_ERR (0x0008)
 #define MP_STREAM_POLL_HUP (0x0010)
+#define MP_STREAM_POLL_NVAL (0x0020)
 
 // Argument structure for MP_STREAM_SEEK
 struct mp_stream_seek_t {
@@ -0,0 +1,20 @@
+# str/bytes.replace() with old and new of different lengths: matches
+# remembered by the first pass, more matches than it keeps, and a count
+print("abcabcab".replace("ab", "X"))
+print("abcabcab".replace("ab", "XYZ"))
+print("abcabcab".replace("ab", ""))
+print("abcabcab".replace("ab", "XYZ", 2))
+print("abcabcab".replace("abc", "--", -1))
+print("aaaa".replace("aa", "b"))
+print("aaa".replace("a", "bb", 0))
+print("no match".replace("xy", "z"))
+print("abc".replace("", "-"))
+print("abc".replace("", "-", 2))
+s = "x," * 100
+print(s.replace(",", ";;") == ";;".join(["x"] * 100) + ";;")
+print(s.replace("x,", "") == "")
+print(s.replace(",", "", 40) == "x" * 40 + "x," * 60)
+print(s.replace(",", ".-", 32) == "x.-" * 32 + "x," * 68)
+print(s.replace(",", ".-", 33) == "x.-" * 33 + "x," * 67)
+print(b"a-b-c".replace(b"-", b"::"))
+print(b"-" * 50 == b"-" * 50, (b"-" * 50).replace(b"-", b"ab") == b"ab" * 50)
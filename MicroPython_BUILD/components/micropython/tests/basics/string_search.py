@@ -0,0 +1,66 @@
+# str/bytes find, rfind, count, split, rsplit, replace and 'in' against
+# a naive search, on short and long (Horspool) haystacks
+
+def naive_find(h, n, start=0):
+    for i in range(start, len(h) - len(n) + 1):
+        if h[i:i + len(n)] == n:
+            return i
+    return -1
+
+def naive_rfind(h, n):
+    for i in range(len(h) - len(n), -1, -1):
+        if h[i:i + len(n)] == n:
+            return i
+    return -1
+
+def naive_count(h, n):
+    if not n:
+        return len(h) + 1
+    c = i = 0
+    while True:
+        i = naive_find(h, n, i)
+        if i < 0:
+            return c
+        c += 1
+        i += len(n)
+
+seed = 1
+def rnd(n):
+    global seed
+    seed = (seed * 1103515245 + 12345) & 0x7fffffff
+    return (seed >> 16) % n
+
+def make(alphabet, n):
+    return ''.join(alphabet[rnd(len(alphabet))] for _ in range(n))
+
+bad = 0
+for case in range(400):
+    h = make('ab\x00c', rnd(300))
+    if rnd(3) == 0 and len(h) > 4:
+        a = rnd(len(h))
+        n = h[a:a + 1 + rnd(70)]
+    else:
+        n = make('ab\x00c', 1 + rnd(6))
+    for hh, nn in ((h, n), (bytes(h, 'latin1'), bytes(n, 'latin1'))):
+        if hh.find(nn) != naive_find(hh, nn) or hh.rfind(nn) != naive_rfind(hh, nn):
+            bad += 1
+        if hh.count(nn) != naive_count(hh, nn) or (nn in hh) != (naive_find(hh, nn) >= 0):
+            bad += 1
+        if hh.split(nn) != hh.split(nn, -1) or len(hh.split(nn)) != naive_count(hh, nn) + 1:
+            bad += 1
+        if len(hh.split(nn, 2)) != min(naive_count(hh, nn), 2) + 1:
+            bad += 1
+        if hh.rsplit(nn, 1)[-1] != (hh[naive_rfind(hh, nn) + len(nn):] if nn in hh else hh):
+            bad += 1
+print('random cases, mismatches:', bad)
+
+long = 'x' * 1000 + 'needle' + 'y' * 1000 + 'needle'
+print(long.find('needle'), long.rfind('needle'), long.count('needle'))
+print(long.find('needle', 1001), long.find('needlf'), 'eedle' in long)
+print(len(long.replace('needle', 'NEEDLE')), long.replace('needle', 'NEEDLE').count('NEEDLE'))
+print(len(long.replace('needle', 'n')), long.split('needle')[1] == 'y' * 1000)
+print('abcabc'.replace('bc', 'XY'), 'abcabc'.replace('bc', 'XY', 1), 'aaa'.replace('a', 'b', 0))
+print('a,b,,c'.split(','), 'a,b,,c'.split(',', 1), 'a,b,,c'.rsplit(',', 1))
+print(b'\xff\xfe\xff'.count(b'\xff'), b'\xc3\xa9\xc3\xa9'.count(b'\xa9'))
+print('héllo wörld'.find('wö'), 'héllo'.count('l'), 'héllo'.rfind('l'))
+print(''.count(''), 'abc'.count(''), 'abc'.find(''), 'abc'.rfind(''))
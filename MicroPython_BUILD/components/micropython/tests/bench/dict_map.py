@@ -0,0 +1,39 @@
+# dict memory per entry (gc.mem_alloc), lookup, insert and iteration
+# time per entry, for str keys and int keys
+import gc, utime
+
+def per_entry_ns(t, count):
+    return utime.ticks_diff(utime.ticks_us(), t) * 1000 // count
+
+for n in (10, 100, 1000, 10000):
+    keys = ['k%d' % i for i in range(n)]
+    gc.collect()
+    m0 = gc.mem_alloc()
+    d = {}
+    for k in keys:
+        d[k] = 1
+    gc.collect()
+    mem = (gc.mem_alloc() - m0) / n
+
+    t = utime.ticks_us()
+    for _ in range(20):
+        for k in keys:
+            d[k]
+    lookup = per_entry_ns(t, 20 * n)
+
+    t = utime.ticks_us()
+    for _ in range(5):
+        e = {}
+        for i in range(n):
+            e[i] = i
+    insert = per_entry_ns(t, 5 * n)
+
+    t = utime.ticks_us()
+    for _ in range(20):
+        for k in d:
+            pass
+    it = per_entry_ns(t, 20 * n)
+
+    print('%5d entries: %5.1f bytes/entry, lookup %4d ns, insert %4d ns, iterate %3d ns'
+        % (n, mem, lookup, insert, it))
+    del d, e, keys
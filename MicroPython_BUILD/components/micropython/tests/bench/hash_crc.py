@@ -0,0 +1,15 @@
+# uhashlib.sha256 and ubinascii.crc32 throughput on 1 MiB, in MB/s
+import uhashlib, ubinascii, utime
+
+buf = bytes(range(256)) * 4096
+
+def bench(name, f, n=5):
+    t = utime.ticks_us()
+    for _ in range(n):
+        f()
+    dt = utime.ticks_diff(utime.ticks_us(), t)
+    print('%-12s %7.1f MB/s' % (name, n * len(buf) / dt))
+
+bench('sha256', lambda: uhashlib.sha256(buf).digest())
+bench('sha256 4k', lambda: [uhashlib.sha256(buf[i:i + 4096]).digest() for i in range(0, len(buf), 4096)])
+bench('crc32', lambda: ubinascii.crc32(buf))
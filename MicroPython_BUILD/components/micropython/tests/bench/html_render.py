@@ -0,0 +1,38 @@
+# renders an HTML table of 400 rows (about 21 KB) by string concatenation,
+# into a uio.StringIO and with ''.join() over a generator; prints the time
+# of one page in microseconds
+import uio, utime
+
+ROWS = 400
+HEAD = '<html><head><title>Sensors</title></head><body><table>\n'
+TAIL = '</table></body></html>\n'
+
+def row(i):
+    return '<tr><td>%d</td><td>sensor-%d</td><td>%d.%d</td></tr>\n' % (i, i % 16, i * 7 % 100, i % 10)
+
+def concat():
+    s = HEAD
+    for i in range(ROWS):
+        s += row(i)
+    return s + TAIL
+
+def stringio():
+    f = uio.StringIO()
+    f.write(HEAD)
+    for i in range(ROWS):
+        f.write(row(i))
+    f.write(TAIL)
+    return f.getvalue()
+
+def join():
+    return HEAD + ''.join(row(i) for i in range(ROWS)) + TAIL
+
+page = concat()
+assert stringio() == page and join() == page
+print('page %d bytes' % len(page))
+
+for name, f in (('s += row', concat), ('StringIO', stringio), ('join(gen)', join)):
+    t = utime.ticks_us()
+    for _ in range(20):
+        f()
+    print('%-10s %8d us' % (name, utime.ticks_diff(utime.ticks_us(), t) // 20))
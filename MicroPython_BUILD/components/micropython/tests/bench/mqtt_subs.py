@@ -0,0 +1,67 @@
+# network.mqtt subscription tree (espmqtt/mqtt_subs.c) holding 1010 topic
+# filters: topics matched per second in the client, and messages per
+# second through the client (receive queue, matching, reply), one at a
+# time over the loopback interface.
+# server: ../host/mqtt/mqttc subs 2>/dev/null
+import sys, utime
+import usocket as socket
+
+addr, port = sys.argv[1].split()
+
+ROUNDS = 100000
+MESSAGES = 2000
+TOPICS = (b'sensors/1/temp', b'$SYS/broker/uptime', b'dev/500/x/state', b'other')
+
+
+def read_exact(s, n):
+    data = b''
+    while len(data) < n:
+        d = s.recv(n - len(data))
+        if not d:
+            raise OSError('closed')
+        data += d
+    return data
+
+
+def read_packet(s):
+    hdr = read_exact(s, 1)[0]
+    length = 0
+    shift = 0
+    while True:
+        b = read_exact(s, 1)[0]
+        length |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            break
+    return hdr >> 4, read_exact(s, length)
+
+
+# returns the payload of the reply
+def publish(s, topic, data=b''):
+    body = bytes([len(topic) >> 8, len(topic) & 0xff]) + topic + data
+    s.write(bytes([0x30, len(body)]) + body)
+    typ, body = read_packet(s)
+    return body[2 + ((body[0] << 8) | body[1]):].decode()
+
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(socket.getaddrinfo(addr, int(port))[0][-1])
+srv.listen(1)
+s, _ = srv.accept()
+s.settimeout(10)
+read_packet(s)
+s.write(b'\x20\x02\x00\x00')
+typ, body = read_packet(s)
+s.write(b'\x90\x03' + body[:2] + b'\x00')
+
+reply = publish(s, b'bench', b'%d' % ROUNDS).split()
+print('match: %d topics/s' % int(float(reply[3])))
+
+t = utime.ticks_us()
+for i in range(MESSAGES):
+    publish(s, TOPICS[i & 3])
+t = utime.ticks_diff(utime.ticks_us(), t)
+print('messages one at a time: %d msg/s' % (MESSAGES * 1000000 // t))
+s.close()
+srv.close()
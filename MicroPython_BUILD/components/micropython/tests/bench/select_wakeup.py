@@ -0,0 +1,29 @@
+# uselect.poll() with 24 idle socketpairs registered: CPU time spent while
+# waiting, and the delay between a write from another thread and the
+# wakeup.  Build the host port with SELECT_FD=0 to compare with polling
+# every stream through its ioctl.
+import uselect, usocket, utime, host
+
+N = 24
+WAKEUPS = 20
+
+pairs = [usocket.socketpair() for _ in range(N)]
+p = uselect.poll()
+for a, b in pairs:
+    p.register(a, uselect.POLLIN)
+
+lat = []
+c = host.cputime()
+t = utime.ticks_us()
+for i in range(WAKEUPS):
+    a, b = pairs[i % N]
+    host.write_later(b, 50)
+    res = p.poll(1000)
+    lat.append(utime.ticks_diff(utime.ticks_us(), host.written_at()))
+    assert len(res) == 1 and res[0][0] is a
+    a.read(1)
+t = utime.ticks_diff(utime.ticks_us(), t)
+c = host.cputime() - c
+lat.sort()
+print('wall %d ms, cpu %d ms, wakeup p50 %d us, max %d us'
+      % (t // 1000, c // 1000, lat[WAKEUPS // 2], lat[-1]))
@@ -0,0 +1,53 @@
+# Handshake time of ussl client sockets against the local TLS server of
+# host/ssl (the host build with a server side SSLContext, RSA 2048):
+# a new SSLContext per socket, as every wrap_socket() call set up before
+# SSLContext, one context with full handshakes, and one context resuming
+# its session.  CPU time is that of the client.  Needs USSL=1.
+# server: ../host/micropython ../host/ssl/server.py 2>/dev/null
+import sys
+import usocket as socket
+import utime
+import host
+
+try:
+    import ussl
+except ImportError:
+    print('SKIP')
+    sys.exit()
+
+N = 20
+
+addr, port, _ = sys.argv[1].split()
+ai = socket.getaddrinfo(addr, int(port))[0][-1]
+
+
+def connect(ctx):
+    s = socket.socket()
+    s.setsockopt(socket.IPPROTO_TCP, 1, 1)  # TCP_NODELAY
+    s.connect(ai)
+    ss = ctx.wrap_socket(s, server_hostname='localhost')
+    ss.write(b'0\n')
+    ss.readline()
+    ss.close()
+    return ss.session_reused()
+
+
+def bench(name, new_ctx, sessions):
+    ctx = ussl.SSLContext(sessions=sessions)
+    connect(ctx)
+    resumed = 0
+    c = host.cputime()
+    t = utime.ticks_us()
+    for i in range(N):
+        if new_ctx:
+            ctx = ussl.SSLContext(sessions=sessions)
+        resumed += connect(ctx)
+    t = utime.ticks_diff(utime.ticks_us(), t)
+    c = host.cputime() - c
+    print('%-22s %5.2f ms, cpu %5.2f ms per handshake, %d/%d resumed'
+          % (name, t / N / 1000, c / N / 1000, resumed, N))
+
+
+bench('context per socket', True, False)
+bench('shared context', False, False)
+bench('shared, resumed', False, True)
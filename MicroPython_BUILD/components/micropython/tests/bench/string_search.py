@@ -0,0 +1,21 @@
+# str find/count/replace/split on HTTP-like text of 1 KB to 1 MB;
+# prints the time of one call in microseconds
+import utime
+
+def bench(name, f, n):
+    t = utime.ticks_us()
+    for _ in range(n):
+        f()
+    print('%-10s %8d us' % (name, utime.ticks_diff(utime.ticks_us(), t) // n))
+
+for size in (1024, 65536, 1024 * 1024):
+    line = 'GET /index.html HTTP/1.1\r\nHost: x\r\n'
+    hay = (line * (size // len(line) + 1))[:size] + '\r\n\r\nEND'
+    print('-- %d bytes' % size)
+    bench('find', lambda: hay.find('\r\n\r\n'), 20)
+    bench('find end', lambda: hay.find('END'), 20)
+    bench('count', lambda: hay.count('Host'), 20)
+    bench('in', lambda: 'zzz' in hay, 20)
+    bench('replace', lambda: hay.replace('Host', 'HOST'), 10)
+    bench('replace2', lambda: hay.replace('\r\n', '\n'), 10)
+    bench('split', lambda: hay.split('\r\n'), 10)
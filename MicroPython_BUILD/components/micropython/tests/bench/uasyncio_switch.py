@@ -0,0 +1,70 @@
+# _uasyncio task switch time and task creation rate, against a minimal
+# Python scheduler on utimeq as in micropython-lib uasyncio.core.
+# The heap is collected between batches, outside the timing: without
+# collections every allocation scans the ever growing used part of the
+# heap, which would be measured instead of the loop.
+import _uasyncio, utimeq, utime, gc
+
+
+class PyLoop:
+    def __init__(self, n=64):
+        self.runq = []
+        self.waitq = utimeq.utimeq(n)
+        self.cur = [0, 0, 0]
+
+    def create_task(self, coro):
+        self.runq.append(coro)
+
+    def run_forever(self):
+        runq = self.runq
+        while runq or self.waitq:
+            while self.waitq and utime.ticks_diff(utime.ticks_ms(), self.waitq.peektime()) >= 0:
+                self.waitq.pop(self.cur)
+                runq.append(self.cur[1])
+            for i in range(len(runq)):
+                coro = runq.pop(0)
+                try:
+                    ret = next(coro)
+                except StopIteration:
+                    continue
+                if ret is None:
+                    runq.append(coro)
+                elif isinstance(ret, int):
+                    self.waitq.push(utime.ticks_add(utime.ticks_ms(), ret), coro, None)
+
+
+def switcher(n):
+    for i in range(n):
+        yield
+
+
+def short():
+    yield
+
+
+def bench(name, new_loop):
+    tasks, switches = 32, 2000
+    loop = new_loop()
+    for i in range(tasks):
+        loop.create_task(switcher(switches))
+    gc.collect()
+    t = utime.ticks_us()
+    loop.run_forever()
+    t = utime.ticks_diff(utime.ticks_us(), t)
+    switch_ns = t * 1000 // (tasks * switches)
+
+    loop = new_loop()
+    n = 20000
+    t = 0
+    for j in range(n // 50):
+        gc.collect()
+        t0 = utime.ticks_us()
+        for i in range(50):
+            loop.create_task(short())
+        loop.run_forever()
+        t += utime.ticks_diff(utime.ticks_us(), t0)
+    print('%-7s switch %4d ns, %5d k tasks/s' % (name, switch_ns, n * 1000 // t))
+
+
+bench('python', PyLoop)
+bench('native', lambda: _uasyncio.Loop(64, 64))
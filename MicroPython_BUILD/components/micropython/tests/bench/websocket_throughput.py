@@ -0,0 +1,60 @@
+# websocket over a socketpair: reading and unmasking 16 KB masked frames
+# into an unaligned buffer, and writing 40-byte frames to a SOCK_DGRAM
+# pair, where each socket write is one datagram.
+import usocket, utime, host
+import websocket
+
+MASK = b'\x37\xfa\x21\x3d'
+N = 16384
+TOTAL = 32 * 1024 * 1024
+SMALL = 20000
+
+payload = bytes((i * 31 + 7) & 0xff for i in range(N))
+masked = bytearray(payload)
+for i in range(N):
+    masked[i] ^= MASK[i & 3]
+frame = bytes([0x82, 0x80 | 126, N >> 8, N & 0xff]) + MASK + masked
+
+a, b = usocket.socketpair()
+ws = websocket.websocket(a)
+buf = bytearray(N + 1)
+mv = memoryview(buf)
+
+b.write(frame)
+got = 0
+while got < N:
+    got += ws.readinto(mv[1 + got:])
+assert bytes(mv[1:]) == payload
+
+c = host.cputime()
+t = utime.ticks_us()
+for i in range(TOTAL // N):
+    b.write(frame)
+    got = 0
+    while got < N:
+        got += ws.readinto(mv[1 + got:])
+t = utime.ticks_diff(utime.ticks_us(), t)
+c = host.cputime() - c
+print('read 16 KB frames: %d MB/s, cpu %d ms' % (TOTAL // t, c // 1000))
+
+a, b = usocket.socketpair(usocket.AF_UNIX, usocket.SOCK_DGRAM)
+ws = websocket.websocket(a)
+small = bytes(40)
+writes = 0
+c = host.cputime()
+t = utime.ticks_us()
+for i in range(SMALL):
+    ws.write(small)
+    if i % 100 == 99:
+        b.setblocking(False)
+        try:
+            while True:
+                b.recv(100)
+                writes += 1
+        except OSError:
+            pass
+        b.setblocking(True)
+t = utime.ticks_diff(utime.ticks_us(), t)
+c = host.cputime() - c
+print('write 40 byte frames: %d frames/s, %.2f socket writes per frame, cpu %d ms'
+      % (SMALL * 1000000 // t, writes / SMALL, c // 1000))
@@ -0,0 +1,158 @@
+# _uasyncio native event loop
+import _uasyncio as A, usocket
+
+loop = A.Loop(2, 4)
+log = []
+
+def sleeper(n, ms):
+    for i in range(n):
+        yield ms
+        log.append((ms, i))
+    return n * ms
+
+def main():
+    t1 = yield sleeper(3, 10)
+    t2 = yield sleeper(2, 25)
+    r1 = yield t1
+    r2 = yield t2
+    return (r1, r2)
+
+print(loop.run_until_complete(main()))
+print(log)
+
+# await syntax and cancelling a sleeping task
+async def waiter():
+    try:
+        await A.sleep_ms(1000)
+    except A.CancelledError:
+        return 'cancelled'
+
+async def cancel_sleeper():
+    t = loop.create_task(waiter())
+    await A.sleep_ms(20)
+    print('cancel', loop.cancel(t))
+    return (yield t)
+
+print(loop.run_until_complete(cancel_sleeper()))
+
+# cancelled sleeps give back their timer queue entry
+def cancel_many():
+    for i in range(20):
+        ts = []
+        for _ in range(4):
+            ts.append((yield waiter()))
+        yield
+        for t in ts:
+            loop.cancel(t)
+        for t in ts:
+            yield t
+    return 'ok'
+
+print(loop.run_until_complete(cancel_many()))
+
+# more runnable tasks than the initial run queue holds
+def short(i):
+    yield
+    return i
+
+def many():
+    ts = []
+    for i in range(50):
+        ts.append((yield short(i)))
+    total = 0
+    for t in ts:
+        total += yield t
+    return total
+
+print(loop.run_until_complete(many()))
+
+# I/O
+a, b = usocket.socketpair()
+
+def reader(s):
+    yield A.wait_io_read(s)
+    return s.read(1)
+
+def io():
+    t = yield reader(a)
+    yield 10
+    b.write(b'x')
+    return (yield t)
+
+print(loop.run_until_complete(io()))
+
+# many readers woken by one poll
+pairs = [usocket.socketpair() for _ in range(8)]
+
+def io_many():
+    ts = []
+    for x, y in pairs:
+        ts.append((yield reader(x)))
+    yield 10
+    for x, y in pairs:
+        y.write(b'y')
+    res = []
+    for t in ts:
+        res.append((yield t))
+    return res
+
+print(loop.run_until_complete(io_many()))
+
+# park / call_soon
+def parked():
+    v = yield False
+    return v
+
+def park():
+    t = yield parked()
+    yield
+    loop.call_soon(t, 42)
+    return (yield t)
+
+print(loop.run_until_complete(park()))
+
+# exceptions go to the joining task, or out of the loop
+def bad():
+    yield
+    1 / 0
+
+def join_bad():
+    try:
+        yield (yield bad())
+    except ZeroDivisionError:
+        return 'caught'
+
+print(loop.run_until_complete(join_bad()))
+loop.create_task(bad())
+try:
+    loop.run_forever()
+except ZeroDivisionError:
+    print('propagated')
+
+# cancelling an I/O wait
+def cancel_io():
+    t = yield reader(a)
+    yield 5
+    loop.cancel(t)
+    try:
+        yield t
+    except A.CancelledError:
+        return 'io cancelled'
+
+print(loop.run_until_complete(cancel_io()))
+
+# more sleepers than the wait queue was created with (4), all of them wake
+woken = []
+def sleeper(i):
+    yield 20 - i
+    woken.append(i)
+
+def many():
+    ts = []
+    for i in range(10):
+        ts.append((yield sleeper(i)))
+    for t in ts:
+        yield t
+    return sorted(woken)
+
+print(loop.run_until_complete(many()))
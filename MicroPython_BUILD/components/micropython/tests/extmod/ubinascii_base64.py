@@ -0,0 +1,70 @@
+# ubinascii: base64 codecs, the _into variants and Base64EncIO
+import ubinascii, uio
+
+for n in range(7):
+    data = b'foobar'[:n]
+    enc = ubinascii.b2a_base64(data)
+    print(data, enc, ubinascii.a2b_base64(enc) == data)
+
+# decoding skips characters outside the alphabet and stops at the padding
+print(ubinascii.a2b_base64(b'Zm9v\nYmFy\n'))
+print(ubinascii.a2b_base64(b'Zm9 vYg==='))
+print(ubinascii.a2b_base64(b'Zg==Zm9v'))
+print(ubinascii.a2b_base64(b'!@#$'))
+for bad in (b'Zm9vY', b'Zm9vYg', b'Zm9vYg=', b'Z==='):
+    try:
+        ubinascii.a2b_base64(bad)
+    except ValueError as e:
+        print('ValueError:', e)
+
+data = bytes(range(256))
+enc = ubinascii.b2a_base64(data)[:-1]
+buf = bytearray(400)
+n = ubinascii.b2a_base64_into(data, buf)
+print(n, bytes(buf[:n]) == enc)
+n = ubinascii.a2b_base64_into(enc, buf)
+print(n, bytes(buf[:n]) == data)
+print(ubinascii.b2a_base64_into(b'', bytearray(0)), ubinascii.a2b_base64_into(b'', bytearray(0)))
+
+# chunks of a multiple of 3 bytes continue one encoding
+out = bytearray(len(enc))
+pos = 0
+for i in range(0, len(data), 48):
+    pos += ubinascii.b2a_base64_into(data[i:i + 48], memoryview(out)[pos:])
+print(pos, out == enc)
+
+# short destination buffers raise instead of writing past the end
+for dest in (0, 3, 7):
+    try:
+        ubinascii.b2a_base64_into(b'abcd', bytearray(dest))
+    except ValueError as e:
+        print('ValueError:', e)
+for src, dest in ((b'Zm9v', 2), (b'Zm9vYg==', 3), (b'Zm9vYmE=', 4)):
+    try:
+        ubinascii.a2b_base64_into(src, bytearray(dest))
+    except ValueError as e:
+        print('ValueError:', e)
+print(ubinascii.a2b_base64_into(b'Zm9vYmE=', bytearray(5)))
+
+# Base64EncIO with read sizes that split encoded groups and input blocks
+data = bytes((i * 31 + 7) & 0xff for i in range(1000))
+enc = ubinascii.b2a_base64(data)[:-1]
+for size in (1, 2, 3, 4, 5, 7, 100, 513, 2000):
+    s = ubinascii.Base64EncIO(uio.BytesIO(data))
+    out = b''
+    while True:
+        chunk = s.read(size)
+        if not chunk:
+            break
+        out += chunk
+    print(size, out == enc)
+for n in range(5):
+    print(n, ubinascii.Base64EncIO(uio.BytesIO(data[:n])).read())
+s = ubinascii.Base64EncIO(uio.BytesIO(b'foobar'))
+buf = bytearray(3)
+print(s.readinto(buf), buf, s.read())
+print(s.read())
+try:
+    ubinascii.Base64EncIO(1)
+except (TypeError, OSError) as e:
+    print(type(e).__name__)
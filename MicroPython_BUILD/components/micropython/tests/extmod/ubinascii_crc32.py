@@ -0,0 +1,13 @@
+# ubinascii.crc32 with the slicing-by-8 tables: all alignments and lengths
+import ubinascii
+
+data = bytes((i * 7 + 3) & 0xff for i in range(300))
+h = 0
+for start in range(9):
+    for n in (0, 1, 7, 8, 9, 15, 16, 17, 64, 255):
+        h = ubinascii.crc32(data[start:start + n], h)
+print(hex(h))
+print(hex(ubinascii.crc32(b'123456789')))
+print(hex(ubinascii.crc32(b'56789', ubinascii.crc32(b'1234'))))
+print(hex(ubinascii.crc32(b'', 0x12345678)))
+print(hex(ubinascii.crc32(bytes(100000))))
@@ -0,0 +1,38 @@
+# ubinascii: hexlify, hexlify_into and unhexlify
+import ubinascii
+
+data = bytes(range(0, 256, 15))
+print(ubinascii.hexlify(data))
+print(ubinascii.hexlify(data, ':'))
+print(ubinascii.hexlify(b''), ubinascii.hexlify(b'', ':'))
+print(ubinascii.unhexlify(ubinascii.hexlify(data)) == data)
+print(ubinascii.unhexlify(b'DEADbeef'))
+
+buf = bytearray(64)
+n = ubinascii.hexlify_into(data, buf)
+print(n, bytes(buf[:n]) == ubinascii.hexlify(data))
+n = ubinascii.hexlify_into(data, buf, '-')
+print(n, bytes(buf[:n]) == ubinascii.hexlify(data, '-'))
+print(ubinascii.hexlify_into(b'', bytearray(0)))
+buf = bytearray(b'xxxxxx')
+print(ubinascii.hexlify_into(b'\x01\xab', memoryview(buf)[1:]), buf)
+
+# the destination must hold the whole result
+for data, dest, sep in ((b'abc', 5, None), (b'abc', 6, ' '), (b'a', 1, None)):
+    try:
+        if sep is None:
+            ubinascii.hexlify_into(data, bytearray(dest))
+        else:
+            ubinascii.hexlify_into(data, bytearray(dest), sep)
+    except ValueError as e:
+        print('ValueError:', e)
+try:
+    ubinascii.hexlify_into(b'abc', b'readonly')
+except TypeError:
+    print('TypeError')
+
+for bad in (b'abc', b'0g', b'zz'):
+    try:
+        ubinascii.unhexlify(bad)
+    except ValueError as e:
+        print('ValueError:', e)
@@ -0,0 +1,36 @@
+# uhashlib: incremental update, hexdigest and file_digest
+import uhashlib, uio
+
+data = bytes(range(256)) * 40 + b'tail'
+print(uhashlib.sha256(data).hexdigest())
+h = uhashlib.sha256()
+for i in range(0, len(data), 63):
+    h.update(data[i:i + 63])
+print(h.hexdigest())
+h = uhashlib.sha256()
+h.update(memoryview(data)[:64])
+h.update(bytearray(data[64:]))
+print(h.digest() == uhashlib.sha256(data).digest())
+print(uhashlib.sha256(b'').hexdigest())
+print(uhashlib.sha256(b'a' * 55).hexdigest())
+print(uhashlib.sha256(b'a' * 56).hexdigest())
+
+print(uhashlib.file_digest(uio.BytesIO(data)).hexdigest())
+print(uhashlib.file_digest(uio.BytesIO(data), 'sha256').hexdigest())
+print(uhashlib.file_digest(uio.BytesIO(data), uhashlib.sha256).hexdigest())
+for bad in ('md5', 'file_digest'):
+    try:
+        uhashlib.file_digest(uio.BytesIO(data), bad)
+    except ValueError as e:
+        print('ValueError:', e)
+
+# an update() that keeps its argument still holds a valid bytearray afterwards
+class Keep:
+    def __init__(self):
+        self.chunks = []
+    def update(self, chunk):
+        self.chunks.append(chunk)
+k = uhashlib.file_digest(uio.BytesIO(data), Keep)
+import gc
+gc.collect()
+print(len(k.chunks) > 0, bytes(k.chunks[-1]) == data[-len(k.chunks[-1]):])
@@ -0,0 +1,55 @@
+# uselect.poll() and select() on sockets
+import uselect, usocket
+
+pairs = [usocket.socketpair() for _ in range(4)]
+socks = [a for a, b in pairs]
+
+p = uselect.poll()
+for s in socks:
+    p.register(s, uselect.POLLIN)
+print(p.poll(10))
+
+pairs[2][1].write(b'x')
+res = p.poll(1000)
+print(len(res), res[0][0] is socks[2], res[0][1] == uselect.POLLIN)
+print(socks[2].read(1))
+
+# a stream with no events registered is left out
+p.modify(socks[1], 0)
+pairs[1][1].write(b'y')
+print(p.poll(10))
+p.unregister(socks[1])
+print(socks[1].read(1))
+
+print(uselect.select(socks, [], [], 0))
+pairs[3][1].write(b'z')
+r, w, x = uselect.select(socks, socks[:2], [], 100)
+print(r == [socks[3]], len(w), x)
+
+# a closed stream is reported as POLLNVAL, the others are still polled
+import host
+print(socks[3].read(1))
+p = uselect.poll()
+for s in socks:
+    p.register(s, uselect.POLLIN)
+socks[0].close()
+print(p.poll(10) == [(socks[0], uselect.POLLNVAL)])
+pairs[3][1].write(b'w')
+res = p.poll(10)
+print(len(res), (socks[0], uselect.POLLNVAL) in res, (socks[3], uselect.POLLIN) in res)
+print(socks[3].read(1))
+
+# the number of the closed stream reused by a new one is not reported for it
+a, b = usocket.socketpair()
+b.write(b'v')
+print(p.poll(10) == [(socks[0], uselect.POLLNVAL)])
+p.unregister(socks[0])
+print(p.poll(10))
+
+# a descriptor closed under its stream no longer breaks select() for the rest
+host.close_fd(socks[2])
+pairs[1][1].write(b'u')
+res = p.poll(1000)
+print(len(res), (socks[2], uselect.POLLNVAL) in res, (socks[1], uselect.POLLIN) in res)
+p.unregister(socks[2])
+print(p.poll(10) == [(socks[1], uselect.POLLIN)])
@@ -0,0 +1,113 @@
+# websocket frames read from a socketpair: 7, 16 and 64-bit lengths, masked
+# or not, reads of any size, fragments with control frames in between, the
+# PONG and CLOSE answers, a failed PONG; frames written to a SOCK_DGRAM pair, so that each
+# socket write is seen on its own.
+import usocket
+import websocket
+
+MASK = b'\x37\xfa\x21\x3d'
+
+
+def frame(op, payload, fin=True, mask=MASK):
+    n = len(payload)
+    h = bytearray([(0x80 if fin else 0) | op])
+    m = 0x80 if mask else 0
+    if n < 126:
+        h.append(m | n)
+    elif n < 65536:
+        h += bytes([m | 126, n >> 8, n & 0xff])
+    else:
+        h += bytes([m | 127, 0, 0, 0, 0, n >> 24, (n >> 16) & 0xff, (n >> 8) & 0xff, n & 0xff])
+    if not mask:
+        return bytes(h) + payload
+    p = bytearray(payload)
+    for i in range(n):
+        p[i] ^= mask[i & 3]
+    return bytes(h) + mask + p
+
+
+def read_exact(s, n):
+    data = b''
+    while len(data) < n:
+        d = s.read(n - len(data))
+        if not d:
+            break
+        data += d
+    return data
+
+
+def pattern(n, k=0):
+    return bytes((i * 13 + k) & 0xff for i in range(n))
+
+
+# the datagrams written since the last call
+def writes(s):
+    res = []
+    try:
+        while True:
+            res.append(s.recv(100000))
+    except OSError:
+        pass
+    return res
+
+
+a, b = usocket.socketpair()
+ws = websocket.websocket(a)
+
+ok = True
+for n in (0, 1, 5, 125, 126, 1000, 65535, 65536, 70001):
+    for mask in (MASK, None):
+        p = pattern(n, n)
+        b.write(frame(2, p, mask=mask) + frame(1, b'end', mask=mask))
+        ok = ok and read_exact(ws, n + 3) == p + b'end'
+print('lengths', ok)
+
+# the mask position is kept between reads of 1 to 7 bytes
+p = pattern(5000)
+b.write(frame(2, p))
+data = b''
+k = 1
+while len(data) < 5000:
+    buf = bytearray(min(k, 5000 - len(data)))
+    data += buf[:ws.readinto(buf)]
+    k = k % 7 + 1
+print('small reads', data == p)
+
+# a message in three fragments with a PING and a PONG in between
+b.write(frame(1, b'hello ', fin=False) + frame(9, b'ping!') + frame(0, b'wor', fin=False)
+        + frame(10, b'unsolicited') + frame(0, b'ld'))
+print(read_exact(ws, 11), 'opcode', ws.ioctl(8))
+print('pong', read_exact(b, 7))
+
+b.write(frame(8, b'\x03\xe8bye'))
+print('close', ws.read(10), read_exact(b, 4))
+
+# the PONG can't be written to a closed peer: the error is raised, and
+# again by any later read or write, as a frame may be cut short (32, EPIPE)
+a, b = usocket.socketpair()
+ws = websocket.websocket(a)
+b.write(frame(9, b'ping!') + frame(1, b'data'))
+b.close()
+for f in (lambda: ws.read(10), lambda: ws.read(10), lambda: ws.write(b'x')):
+    try:
+        f()
+    except OSError as e:
+        print('pong failed', e.args[0])
+
+c, d = usocket.socketpair(usocket.AF_UNIX, usocket.SOCK_DGRAM)
+d.setblocking(False)
+ws = websocket.websocket(c)
+
+ws.write(b'abc')
+print(writes(d))
+ws.write(pattern(300))
+w = writes(d)
+print(w[0], [len(x) for x in w], w[1] == pattern(300))
+ws.write(pattern(70000))
+w = writes(d)
+print(w[0], [len(x) for x in w], w[1] == pattern(70000))
+print(ws.writev([b'ab', bytearray(b'cd'), memoryview(b'xef')[1:]]), writes(d))
+parts = [pattern(1000, 1), pattern(2000, 2), pattern(3000, 3)]
+print(ws.writev(parts))
+w = writes(d)
+print(w[0], [len(x) for x in w], w[1:] == parts)
@@ -0,0 +1,57 @@
+# The read cache of spiffs (spiffs_cache.c) with the 8 pages of the esp32
+# build: sequential reads get the following data pages read ahead with
+# one flash read, the pages of a file read again stay cached while other
+# files are read, and what is read is what was written.
+# server: ../host/spiffs/spiffsd
+
+import sys
+import usocket as socket
+
+host, port = sys.argv[1].split()
+
+s = socket.socket()
+s.connect(socket.getaddrinfo(host, int(port))[0][-1])
+buf = b''
+
+# 256 byte pages with a 5 byte header
+DATA_PAGES = (65536 + 250) // 251
+
+
+def cmd(line):
+    global buf
+    s.send(line.encode() + b'\n')
+    while b'\n' not in buf:
+        buf += s.recv(256)
+    res, buf = buf.split(b'\n', 1)
+    return res.decode()
+
+
+# ok, bytes, flash reads, cache hits, cache misses, pages read ahead
+def read(line):
+    res = cmd(line).split()
+    print(line, '->', res[0], res[1])
+    return [int(n) for n in res[2:]]
+
+
+print(cmd('format'))
+print(cmd('write /small 100'), cmd('write /mid 12000'), cmd('write /big 65536'))
+
+reads, hits, misses, ahead = read('read /big 512')
+print('read ahead', ahead > DATA_PAGES // 2)
+print('fewer flash reads than data pages', reads < DATA_PAGES * 3 // 4)
+reads, hits, misses, ahead = read('read /big 100')
+print('read ahead', ahead > DATA_PAGES // 2)
+
+# a page reread out of order still comes from the cache or the flash
+read('rread /big 512')
+read('rread /mid 100')
+read('read /mid 1000')
+
+# a file read again is served from the cache
+first = read('read /small 100')[0]
+print('cached', read('read /small 100')[0] == 0)
+# and mostly stays there while another file is read twice
+read('read /mid 512')
+read('read /mid 512')
+print('kept', read('read /small 100')[0] < first)
+s.close()
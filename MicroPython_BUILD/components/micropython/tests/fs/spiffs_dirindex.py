@@ -0,0 +1,82 @@
+# The directory index of spiffs_vfs.c (spiffs_dirindex.c) kept up to date
+# by creating, removing and renaming files and directories, compared with
+# one built from the flash after each step, and listings that remove the
+# entries they return.
+# server: ../host/spiffs/spiffsd
+
+import sys
+import usocket as socket
+
+host, port = sys.argv[1].split()
+
+s = socket.socket()
+s.connect(socket.getaddrinfo(host, int(port))[0][-1])
+buf = b''
+
+
+def cmd(line):
+    global buf
+    s.send(line.encode() + b'\n')
+    while b'\n' not in buf:
+        buf += s.recv(256)
+    res, buf = buf.split(b'\n', 1)
+    return res.decode()
+
+
+def show(line):
+    print(line, '->', cmd(line))
+
+
+show('format')
+show('ls /')
+for line in ('mkdir /lib', 'write /lib/b.py 10', 'write /lib/a.py 300', 'mkdir /lib/sub',
+             'write /lib/sub/c 5', 'write /boot.py 20', 'write /main.py 20'):
+    cmd(line)
+show('ls /')
+show('ls /lib')
+show('ls /lib/sub')
+show('stat /lib')
+show('stat /lib/a.py')
+show('stat /lib/x.py')
+show('stat /lib/a')
+show('check')
+
+# a file and a directory with the same name
+show('write /lib 7')
+show('stat /lib')
+show('ls /')
+
+# the deeper nodes go with their last entry
+show('rm /lib/sub/c')
+show('ls /lib')
+show('rm /lib/sub')
+show('ls /lib')
+show('stat /lib/sub')
+show('check')
+
+show('mv /boot.py /lib/boot.py')
+show('ls /')
+show('ls /lib')
+show('check')
+
+# the index rebuilt at mount lists the same
+show('mount')
+show('ls /')
+show('ls /lib')
+
+# the listing goes on in name order after the index changed
+for i in range(12):
+    cmd('write /tmp/f{:02d} 1'.format(i))
+show('lsrm /tmp')
+show('ls /tmp')
+show('stat /tmp')
+show('check')
+
+# names are compared by component, not by prefix
+for line in ('write /ab 1', 'write /a/b 1', 'write /a.b 1', 'write /a 1'):
+    cmd(line)
+show('ls /')
+show('ls /a')
+show('stat /ab')
+show('check')
+s.close()
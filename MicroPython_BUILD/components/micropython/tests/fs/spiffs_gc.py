@@ -0,0 +1,68 @@
+# Incremental garbage collection of spiffs (spiffs_gc_step): a step does
+# nothing while enough blocks are free, otherwise it erases one block that
+# has deleted pages, moving what is still used out of it first.  The files
+# read back the same after the steps and after mounting again.
+# server: ../host/spiffs/spiffsd
+
+import sys
+import usocket as socket
+
+host, port = sys.argv[1].split()
+
+s = socket.socket()
+s.connect(socket.getaddrinfo(host, int(port))[0][-1])
+buf = b''
+
+RESERVE = 6
+
+
+def cmd(line):
+    global buf
+    s.send(line.encode() + b'\n')
+    while b'\n' not in buf:
+        buf += s.recv(256)
+    res, buf = buf.split(b'\n', 1)
+    return res.decode()
+
+
+# free blocks, used pages, deleted pages
+def info():
+    return [int(n) for n in cmd('info').split()[1:]]
+
+
+# result, free blocks, blocks erased
+def gc(reserve):
+    return [int(n) for n in cmd('gc {}'.format(reserve)).split()[1:]]
+
+
+print(cmd('format'))
+print('empty', gc(RESERVE))
+
+# rewriting a file leaves its old pages deleted until gc
+print(cmd('write /keep 40000'))
+rewrites = 0
+while info()[0] >= RESERVE and rewrites < 50:
+    cmd('write /log 20000')
+    rewrites += 1
+free, used, deleted = info()
+print('below the reserve', free < RESERVE, deleted > 0)
+
+steps = []
+while len(steps) < 32:
+    res = gc(RESERVE)
+    if res[0] == 0:
+        break
+    steps.append(res)
+print('steps', len(steps) > 0)
+print('one block per step', all(erased == 1 for res, free_blocks, erased in steps))
+print('one more free block per step', [res[1] for res in steps] == list(range(free + 1, free + 1 + len(steps))))
+print('reserve kept', info()[0] >= RESERVE)
+print('reserve met', gc(RESERVE))
+print('deleted pages gone', info()[2] < deleted)
+
+print(cmd('read /keep 512').split()[:2], cmd('read /log 512').split()[:2])
+print(cmd('check'))
+print(cmd('mount'))
+print(cmd('read /keep 512').split()[:2], cmd('read /log 512').split()[:2])
+print(cmd('ls /'))
+s.close()
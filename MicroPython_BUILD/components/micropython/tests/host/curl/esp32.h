@@ -0,0 +1,5 @@
+// Included before the esp32 sources built with CURL=1: what the headers
+// of the esp32 port (mphalport.h) and ESP-IDF include for them.
+#include <sys/stat.h>
+#include "py/runtime.h"
+#include "py/mphal.h"
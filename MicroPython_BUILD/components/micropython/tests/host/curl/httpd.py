@@ -0,0 +1,70 @@
+# HTTP/1.1 server of tests/net/curl_*.py, one thread per connection.
+# Prints its address and a directory for the files the test writes,
+# which is removed when the server is terminated.
+#
+#   /conns      the number of connections accepted so far
+#   /big        1000000 bytes, byte i is (i * 7 + 3) & 0xff
+#   /slow<n>    '/slow<n>' after 0.5 s
+#   other       'hello <path>'
+
+import http.server
+import shutil
+import signal
+import socketserver
+import sys
+import tempfile
+import threading
+import time
+
+BIG = bytes((i * 7 + 3) & 0xff for i in range(1000000))
+
+conns = 0
+lock = threading.Lock()
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def setup(self):
+        global conns
+        with lock:
+            conns += 1
+        super().setup()
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        if self.path == '/conns':
+            data = str(conns).encode()
+        elif self.path == '/big':
+            data = BIG
+        elif self.path.startswith('/slow'):
+            time.sleep(0.5)
+            data = self.path.encode()
+        else:
+            data = ('hello ' + self.path).encode()
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+    # the tests abort transfers, the connection is reset
+    def handle_error(self, request, client_address):
+        pass
+
+
+def terminate(sig, frame):
+    shutil.rmtree(tmp, ignore_errors=True)
+    sys.exit(0)
+
+
+tmp = tempfile.mkdtemp(prefix='curl_test.')
+signal.signal(signal.SIGTERM, terminate)
+server = Server(('127.0.0.1', 0), Handler)
+print('127.0.0.1', server.server_address[1], tmp, flush=True)
+server.serve_forever()
@@ -0,0 +1 @@
+// the curl options of the esp32 build, CONFIG_MICROPY_USE_CURL is set by the Makefile
@@ -0,0 +1,118 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// esp32/libs/ftp.c served on the loopback interface, for tests/net.
+//
+// The internal and external file systems are the flash/ and sd/
+// directories of a new directory in /tmp, removed when ftpd is
+// terminated.  The address is printed once the server listens, then
+// it runs the loop of ftp_task().
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "libs/ftp.h"
+
+char native_vfs_mounted[2] = {1, 1};
+char ftpd_flash_dir[32];
+char ftpd_sdcard_dir[32];
+
+extern TaskHandle_t FtpTaskHandle;
+
+static volatile sig_atomic_t terminated;
+
+static void on_signal(int sig) {
+    terminated = 1;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    return remove(path);
+}
+
+static uint32_t ticks_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+int main(void) {
+    char root[] = "/tmp/ftpd.XXXXXX";
+    if (mkdtemp(root) == NULL) {
+        perror("ftpd");
+        return 2;
+    }
+    snprintf(ftpd_flash_dir, sizeof(ftpd_flash_dir), "%s/flash", root);
+    snprintf(ftpd_sdcard_dir, sizeof(ftpd_sdcard_dir), "%s/sd", root);
+    mkdir(ftpd_flash_dir, 0755);
+    mkdir(ftpd_sdcard_dir, 0755);
+    signal(SIGTERM, on_signal);
+    signal(SIGINT, on_signal);
+
+    FtpTaskHandle = (TaskHandle_t)1;
+    strcpy(ftp_user, FTP_DEF_USER);
+    strcpy(ftp_pass, FTP_DEF_PASS);
+    ftp_init();
+    ftp_enable();
+
+    int status = 0;
+    bool listening = false;
+    int busy = 0;
+    uint32_t start = ticks_ms();
+    uint32_t t = start;
+    while (!terminated) {
+        uint32_t now = ticks_ms();
+        int res = ftp_run(now - t);
+        t = now;
+        if (!listening) {
+            if (ftp_getstate() == E_FTP_STE_READY) {
+                printf("127.0.0.1 %d\n", FTP_CMD_PORT);
+                fflush(stdout);
+                listening = true;
+            } else if (now - start > 1000) {
+                fprintf(stderr, "ftpd: can't listen on port %d\n", FTP_CMD_PORT);
+                status = 1;
+                break;
+            }
+        }
+        // the same as ftp_task()
+        if (res == 0) {
+            res = ftp_wait(100);
+        }
+        if (res == 0) {
+            busy = 0;
+        } else if (++busy >= 16) {
+            busy = 0;
+            vTaskDelay(1);
+        }
+    }
+    nftw(root, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    return status;
+}
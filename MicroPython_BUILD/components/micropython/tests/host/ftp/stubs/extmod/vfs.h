@@ -0,0 +1 @@
+// nothing of it is used by ftp.c on the host
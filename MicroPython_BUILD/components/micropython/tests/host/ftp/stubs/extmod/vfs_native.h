@@ -0,0 +1,8 @@
+// the "physical" mount points are directories created by ftpd
+extern char native_vfs_mounted[2];
+extern char ftpd_flash_dir[];
+extern char ftpd_sdcard_dir[];
+#define VFS_NATIVE_MOUNT_POINT          ftpd_flash_dir
+#define VFS_NATIVE_SDCARD_MOUNT_POINT   ftpd_sdcard_dir
+#define VFS_NATIVE_INTERNAL_MP          "/flash"
+#define VFS_NATIVE_EXTERNAL_MP          "/sd"
@@ -0,0 +1,3 @@
+// py/mpstate.h of the esp32 port pulls in the whole VM, ftp.c only
+// needs the path length
+#define MICROPY_ALLOC_PATH_MAX      (128)
@@ -0,0 +1 @@
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
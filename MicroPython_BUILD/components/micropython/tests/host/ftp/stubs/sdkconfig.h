@@ -0,0 +1,7 @@
+// the FTP server options of the esp32 build
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#define CONFIG_MICROPY_USE_FTPSERVER            1
+#define CONFIG_MICROPY_FTPSERVER_TIMEOUT        300
+#define CONFIG_MICROPY_FTPSERVER_BUFFER_SIZE    1024
+#define CONFIG_MICROPY_FTPSERVER_CLIENTS        2
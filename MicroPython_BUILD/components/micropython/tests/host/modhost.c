@@ -0,0 +1,140 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013-2015 Damien P. George
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// Helpers for the tests and benchmarks that only make sense on the host.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "py/runtime.h"
+#include "py/smallint.h"
+#include "py/stream.h"
+#include "py/mphal.h"
+
+// host.cputime(): CPU time used by the process, in microseconds; the
+// benchmarks report it next to the wall time to show idle polling
+STATIC mp_obj_t host_cputime(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    uint64_t us = (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    return mp_obj_new_int_from_ull(us);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(host_cputime_obj, host_cputime);
+
+typedef struct _host_later_t {
+    int fd;
+    unsigned int delay_ms;
+} host_later_t;
+
+static host_later_t later;
+static volatile mp_uint_t later_written_us;
+
+STATIC void *host_later_thread(void *arg) {
+    host_later_t *l = arg;
+    usleep(l->delay_ms * 1000);
+    later_written_us = mp_hal_ticks_us();
+    ssize_t r = write(l->fd, "x", 1);
+    (void)r;
+    return NULL;
+}
+
+// host.write_later(stream, ms): write one byte to the stream from another
+// thread after ms milliseconds, as an interrupt or the network would
+STATIC mp_obj_t host_write_later(mp_obj_t stream_in, mp_obj_t ms_in) {
+    const mp_stream_p_t *stream_p = mp_get_stream_raise(stream_in, MP_STREAM_OP_IOCTL);
+    int errcode;
+    mp_uint_t fd = stream_p->ioctl(stream_in, MP_STREAM_GET_FILENO, 0, &errcode);
+    if (fd == MP_STREAM_ERROR) {
+        mp_raise_OSError(errcode);
+    }
+    later.fd = fd;
+    later.delay_ms = mp_obj_get_int(ms_in);
+    later_written_us = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, host_later_thread, &later);
+    pthread_detach(thread);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(host_write_later_obj, host_write_later);
+
+// host.written_at(): utime.ticks_us() at the last write_later() write
+STATIC mp_obj_t host_written_at(void) {
+    return mp_obj_new_int_from_uint(later_written_us & (MICROPY_PY_UTIME_TICKS_PERIOD - 1));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_0(host_written_at_obj, host_written_at);
+
+// host.close_fd(stream): close the file descriptor of a stream behind its
+// back, as the network stack does with a socket it has dropped
+STATIC mp_obj_t host_close_fd(mp_obj_t stream_in) {
+    const mp_stream_p_t *stream_p = mp_get_stream_raise(stream_in, MP_STREAM_OP_IOCTL);
+    int errcode;
+    mp_uint_t fd = stream_p->ioctl(stream_in, MP_STREAM_GET_FILENO, 0, &errcode);
+    if (fd == MP_STREAM_ERROR) {
+        mp_raise_OSError(errcode);
+    }
+    close(fd);
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(host_close_fd_obj, host_close_fd);
+
+// host.read_file(path): the contents of a file as bytes, for the data
+// files of the tests (the host port has no open())
+STATIC mp_obj_t host_read_file(mp_obj_t path_in) {
+    FILE *f = fopen(mp_obj_str_get_str(path_in), "rb");
+    if (f == NULL) {
+        mp_raise_OSError(errno);
+    }
+    vstr_t vstr;
+    vstr_init(&vstr, 4096);
+    size_t n;
+    while ((n = fread(vstr_add_len(&vstr, 4096), 1, 4096, f)) == 4096) {
+    }
+    vstr_cut_tail_bytes(&vstr, 4096 - n);
+    fclose(f);
+    return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(host_read_file_obj, host_read_file);
+
+STATIC const mp_rom_map_elem_t host_module_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_host) },
+    { MP_ROM_QSTR(MP_QSTR_cputime), MP_ROM_PTR(&host_cputime_obj) },
+    { MP_ROM_QSTR(MP_QSTR_write_later), MP_ROM_PTR(&host_write_later_obj) },
+    { MP_ROM_QSTR(MP_QSTR_written_at), MP_ROM_PTR(&host_written_at_obj) },
+    { MP_ROM_QSTR(MP_QSTR_read_file), MP_ROM_PTR(&host_read_file_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close_fd), MP_ROM_PTR(&host_close_fd_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(host_module_globals, host_module_globals_table);
+
+const mp_obj_module_t mp_module_host = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t*)&host_module_globals,
+};
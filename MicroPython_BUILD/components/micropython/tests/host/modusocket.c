@@ -0,0 +1,412 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013-2015 Damien P. George
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+// usocket of the host build: the subset of esp32/modsocket.c that the
+// tests use, on the BSD sockets of the host.  socketpair() connects two
+// sockets without the network, for the stream and uselect tests.
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "py/runtime.h"
+#include "py/mperrno.h"
+#include "py/stream.h"
+#include "lib/netutils/netutils.h"
+
+typedef struct _socket_obj_t {
+    mp_obj_base_t base;
+    int fd;
+    uint8_t domain;
+    uint8_t type;
+    uint8_t proto;
+    bool blocking;
+} socket_obj_t;
+
+STATIC const mp_obj_type_t socket_type;
+
+NORETURN static void exception_from_errno(int _errno) {
+    if (_errno == EINPROGRESS) {
+        _errno = MP_EINPROGRESS;
+    }
+    mp_raise_OSError(_errno);
+}
+
+STATIC socket_obj_t *socket_new(int fd, int domain, int type, int proto) {
+    socket_obj_t *sock = m_new_obj_with_finaliser(socket_obj_t);
+    sock->base.type = &socket_type;
+    sock->fd = fd;
+    sock->domain = domain;
+    sock->type = type;
+    sock->proto = proto;
+    sock->blocking = true;
+    return sock;
+}
+
+STATIC mp_obj_t format_addr(const struct sockaddr_storage *addr) {
+    if (addr->ss_family != AF_INET) {
+        return mp_const_none;
+    }
+    const struct sockaddr_in *in = (const struct sockaddr_in*)addr;
+    return netutils_format_inet_addr((uint8_t*)&in->sin_addr, ntohs(in->sin_port), NETUTILS_BIG);
+}
+
+STATIC void parse_addr(mp_obj_t addr_in, struct sockaddr_in *addr) {
+    mp_obj_t *elem;
+    mp_obj_get_array_fixed_n(addr_in, 2, &elem);
+    const char *host = mp_obj_str_get_str(elem[0]);
+    if (host[0] == '\0') {
+        host = "0.0.0.0";
+    }
+    struct addrinfo hints = { .ai_family = AF_INET };
+    struct addrinfo *res;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        mp_raise_OSError(MP_EINVAL);
+    }
+    *addr = *(struct sockaddr_in*)res->ai_addr;
+    addr->sin_port = htons(mp_obj_get_int(elem[1]));
+    freeaddrinfo(res);
+}
+
+STATIC mp_obj_t socket_close(mp_obj_t self_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (self->fd >= 0) {
+        close(self->fd);
+        self->fd = -1;
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(socket_close_obj, socket_close);
+
+STATIC mp_obj_t socket_bind(mp_obj_t self_in, mp_obj_t addr_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    struct sockaddr_in addr;
+    parse_addr(addr_in, &addr);
+    if (bind(self->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        exception_from_errno(errno);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_bind_obj, socket_bind);
+
+STATIC mp_obj_t socket_listen(mp_obj_t self_in, mp_obj_t backlog) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    if (listen(self->fd, mp_obj_get_int(backlog)) < 0) {
+        exception_from_errno(errno);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_listen_obj, socket_listen);
+
+STATIC mp_obj_t socket_accept(mp_obj_t self_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept(self->fd, (struct sockaddr*)&addr, &addr_len);
+    if (fd < 0) {
+        exception_from_errno(errno);
+    }
+    mp_obj_t client[2] = {
+        MP_OBJ_FROM_PTR(socket_new(fd, self->domain, self->type, self->proto)),
+        format_addr(&addr),
+    };
+    return mp_obj_new_tuple(2, client);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(socket_accept_obj, socket_accept);
+
+STATIC mp_obj_t socket_connect(mp_obj_t self_in, mp_obj_t addr_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    struct sockaddr_in addr;
+    parse_addr(addr_in, &addr);
+    if (connect(self->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        exception_from_errno(errno);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_connect_obj, socket_connect);
+
+STATIC mp_obj_t socket_getpeername(mp_obj_t self_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getpeername(self->fd, (struct sockaddr*)&addr, &addr_len) < 0) {
+        exception_from_errno(errno);
+    }
+    return format_addr(&addr);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(socket_getpeername_obj, socket_getpeername);
+
+STATIC mp_obj_t socket_setsockopt(size_t n_args, const mp_obj_t *args) {
+    (void)n_args; // always 4
+    socket_obj_t *self = MP_OBJ_TO_PTR(args[0]);
+    int level = mp_obj_get_int(args[1]);
+    int opt = mp_obj_get_int(args[2]);
+    int val = mp_obj_get_int(args[3]);
+    if (setsockopt(self->fd, level, opt, &val, sizeof(val)) < 0) {
+        exception_from_errno(errno);
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(socket_setsockopt_obj, 4, 4, socket_setsockopt);
+
+STATIC mp_obj_t socket_setblocking(mp_obj_t self_in, mp_obj_t flag) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    self->blocking = mp_obj_is_true(flag);
+    int flags = fcntl(self->fd, F_GETFL, 0);
+    fcntl(self->fd, F_SETFL, self->blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_setblocking_obj, socket_setblocking);
+
+STATIC mp_obj_t socket_settimeout(mp_obj_t self_in, mp_obj_t timeout) {
+    // only the blocking and non-blocking modes are supported
+    bool blocking = (timeout == mp_const_none) || (mp_obj_get_float(timeout) != 0);
+    return socket_setblocking(self_in, mp_obj_new_bool(blocking));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_settimeout_obj, socket_settimeout);
+
+STATIC mp_obj_t socket_recv(mp_obj_t self_in, mp_obj_t len_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    vstr_t vstr;
+    vstr_init_len(&vstr, mp_obj_get_int(len_in));
+    ssize_t r = recv(self->fd, vstr.buf, vstr.len, 0);
+    if (r < 0) {
+        vstr_clear(&vstr);
+        exception_from_errno(errno);
+    }
+    vstr.len = r;
+    return mp_obj_new_str_from_vstr(&mp_type_bytes, &vstr);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_recv_obj, socket_recv);
+
+STATIC mp_obj_t socket_send(mp_obj_t self_in, mp_obj_t buf_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(buf_in, &bufinfo, MP_BUFFER_READ);
+    ssize_t r = send(self->fd, bufinfo.buf, bufinfo.len, MSG_NOSIGNAL);
+    if (r < 0) {
+        exception_from_errno(errno);
+    }
+    return mp_obj_new_int(r);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_send_obj, socket_send);
+
+STATIC mp_obj_t socket_sendall(mp_obj_t self_in, mp_obj_t buf_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    mp_buffer_info_t bufinfo;
+    mp_get_buffer_raise(buf_in, &bufinfo, MP_BUFFER_READ);
+    const uint8_t *p = bufinfo.buf;
+    size_t left = bufinfo.len;
+    while (left > 0) {
+        ssize_t r = send(self->fd, p, left, MSG_NOSIGNAL);
+        if (r < 0) {
+            exception_from_errno(errno);
+        }
+        p += r;
+        left -= r;
+    }
+    return mp_const_none;
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_sendall_obj, socket_sendall);
+
+STATIC mp_obj_t socket_fileno(mp_obj_t self_in) {
+    socket_obj_t *self = MP_OBJ_TO_PTR(self_in);
+    return mp_obj_new_int(self->fd);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_1(socket_fileno_obj, socket_fileno);
+
+STATIC mp_obj_t socket_makefile(size_t n_args, const mp_obj_t *args) {
+    (void)n_args;
+    return args[0];
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(socket_makefile_obj, 1, 3, socket_makefile);
+
+STATIC mp_uint_t socket_stream_read(mp_obj_t self_in, void *buf, mp_uint_t size, int *errcode) {
+    socket_obj_t *sock = MP_OBJ_TO_PTR(self_in);
+    ssize_t r = recv(sock->fd, buf, size, 0);
+    if (r < 0) {
+        *errcode = (errno == EAGAIN) ? MP_EAGAIN : errno;
+        return MP_STREAM_ERROR;
+    }
+    return r;
+}
+
+STATIC mp_uint_t socket_stream_write(mp_obj_t self_in, const void *buf, mp_uint_t size, int *errcode) {
+    socket_obj_t *sock = MP_OBJ_TO_PTR(self_in);
+    ssize_t r = send(sock->fd, buf, size, MSG_NOSIGNAL);
+    if (r < 0) {
+        *errcode = (errno == EAGAIN) ? MP_EAGAIN : errno;
+        return MP_STREAM_ERROR;
+    }
+    return r;
+}
+
+STATIC mp_uint_t socket_stream_ioctl(mp_obj_t self_in, mp_uint_t request, uintptr_t arg, int *errcode) {
+    socket_obj_t *sock = MP_OBJ_TO_PTR(self_in);
+    if (sock->fd < 0) {
+        // closed
+        if (request == MP_STREAM_POLL) {
+            return MP_STREAM_POLL_NVAL;
+        }
+        *errcode = MP_EBADF;
+        return MP_STREAM_ERROR;
+    }
+    if (request == MP_STREAM_POLL) {
+        fd_set rfds; FD_ZERO(&rfds);
+        fd_set wfds; FD_ZERO(&wfds);
+        fd_set efds; FD_ZERO(&efds);
+        struct timeval timeout = { .tv_sec = 0, .tv_usec = 0 };
+        if (arg & MP_STREAM_POLL_RD) FD_SET(sock->fd, &rfds);
+        if (arg & MP_STREAM_POLL_WR) FD_SET(sock->fd, &wfds);
+        if (arg & MP_STREAM_POLL_HUP) FD_SET(sock->fd, &efds);
+        if (select(sock->fd + 1, &rfds, &wfds, &efds, &timeout) < 0) {
+            if (errno == EBADF) {
+                return MP_STREAM_POLL_NVAL;
+            }
+            *errcode = MP_EIO;
+            return MP_STREAM_ERROR;
+        }
+        mp_uint_t ret = 0;
+        if (FD_ISSET(sock->fd, &rfds)) ret |= MP_STREAM_POLL_RD;
+        if (FD_ISSET(sock->fd, &wfds)) ret |= MP_STREAM_POLL_WR;
+        if (FD_ISSET(sock->fd, &efds)) ret |= MP_STREAM_POLL_HUP;
+        return ret;
+    } else if (request == MP_STREAM_GET_FILENO) {
+        return sock->fd;
+    }
+    *errcode = MP_EINVAL;
+    return MP_STREAM_ERROR;
+}
+
+STATIC const mp_rom_map_elem_t socket_locals_dict_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___del__), MP_ROM_PTR(&socket_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR_close), MP_ROM_PTR(&socket_close_obj) },
+    { MP_ROM_QSTR(MP_QSTR_bind), MP_ROM_PTR(&socket_bind_obj) },
+    { MP_ROM_QSTR(MP_QSTR_listen), MP_ROM_PTR(&socket_listen_obj) },
+    { MP_ROM_QSTR(MP_QSTR_accept), MP_ROM_PTR(&socket_accept_obj) },
+    { MP_ROM_QSTR(MP_QSTR_connect), MP_ROM_PTR(&socket_connect_obj) },
+    { MP_ROM_QSTR(MP_QSTR_getpeername), MP_ROM_PTR(&socket_getpeername_obj) },
+    { MP_ROM_QSTR(MP_QSTR_send), MP_ROM_PTR(&socket_send_obj) },
+    { MP_ROM_QSTR(MP_QSTR_sendall), MP_ROM_PTR(&socket_sendall_obj) },
+    { MP_ROM_QSTR(MP_QSTR_recv), MP_ROM_PTR(&socket_recv_obj) },
+    { MP_ROM_QSTR(MP_QSTR_setsockopt), MP_ROM_PTR(&socket_setsockopt_obj) },
+    { MP_ROM_QSTR(MP_QSTR_settimeout), MP_ROM_PTR(&socket_settimeout_obj) },
+    { MP_ROM_QSTR(MP_QSTR_setblocking), MP_ROM_PTR(&socket_setblocking_obj) },
+    { MP_ROM_QSTR(MP_QSTR_makefile), MP_ROM_PTR(&socket_makefile_obj) },
+    { MP_ROM_QSTR(MP_QSTR_fileno), MP_ROM_PTR(&socket_fileno_obj) },
+
+    { MP_ROM_QSTR(MP_QSTR_read), MP_ROM_PTR(&mp_stream_read_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readinto), MP_ROM_PTR(&mp_stream_readinto_obj) },
+    { MP_ROM_QSTR(MP_QSTR_readline), MP_ROM_PTR(&mp_stream_unbuffered_readline_obj) },
+    { MP_ROM_QSTR(MP_QSTR_write), MP_ROM_PTR(&mp_stream_write_obj) },
+};
+STATIC MP_DEFINE_CONST_DICT(socket_locals_dict, socket_locals_dict_table);
+
+STATIC const mp_stream_p_t socket_stream_p = {
+    .read = socket_stream_read,
+    .write = socket_stream_write,
+    .ioctl = socket_stream_ioctl,
+};
+
+STATIC const mp_obj_type_t socket_type = {
+    { &mp_type_type },
+    .name = MP_QSTR_socket,
+    .protocol = &socket_stream_p,
+    .locals_dict = (mp_obj_dict_t*)&socket_locals_dict,
+};
+
+STATIC mp_obj_t get_socket(size_t n_args, const mp_obj_t *args) {
+    int domain = n_args > 0 ? mp_obj_get_int(args[0]) : AF_INET;
+    int type = n_args > 1 ? mp_obj_get_int(args[1]) : SOCK_STREAM;
+    int proto = n_args > 2 ? mp_obj_get_int(args[2]) : 0;
+    int fd = socket(domain, type, proto);
+    if (fd < 0) {
+        exception_from_errno(errno);
+    }
+    return MP_OBJ_FROM_PTR(socket_new(fd, domain, type, proto));
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(get_socket_obj, 0, 3, get_socket);
+
+// socketpair([family[, type]]): a SOCK_DGRAM pair keeps the boundaries of
+// the writes, for the tests that count them
+STATIC mp_obj_t get_socketpair(size_t n_args, const mp_obj_t *args) {
+    int domain = (n_args > 0) ? mp_obj_get_int(args[0]) : AF_UNIX;
+    int type = (n_args > 1) ? mp_obj_get_int(args[1]) : SOCK_STREAM;
+    int sv[2];
+    if (socketpair(domain, type, 0, sv) < 0) {
+        exception_from_errno(errno);
+    }
+    mp_obj_t pair[2] = {
+        MP_OBJ_FROM_PTR(socket_new(sv[0], domain, type, 0)),
+        MP_OBJ_FROM_PTR(socket_new(sv[1], domain, type, 0)),
+    };
+    return mp_obj_new_tuple(2, pair);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_VAR_BETWEEN(get_socketpair_obj, 0, 2, get_socketpair);
+
+STATIC mp_obj_t socket_getaddrinfo(mp_obj_t host, mp_obj_t port) {
+    mp_obj_t addr[2] = { host, port };
+    struct sockaddr_in in;
+    parse_addr(mp_obj_new_tuple(2, addr), &in);
+    mp_obj_t items[5] = {
+        MP_OBJ_NEW_SMALL_INT(AF_INET),
+        MP_OBJ_NEW_SMALL_INT(SOCK_STREAM),
+        MP_OBJ_NEW_SMALL_INT(0),
+        MP_OBJ_NEW_QSTR(MP_QSTR_),
+        netutils_format_inet_addr((uint8_t*)&in.sin_addr, ntohs(in.sin_port), NETUTILS_BIG),
+    };
+    mp_obj_t entry = mp_obj_new_tuple(5, items);
+    return mp_obj_new_list(1, &entry);
+}
+STATIC MP_DEFINE_CONST_FUN_OBJ_2(socket_getaddrinfo_obj, socket_getaddrinfo);
+
+STATIC const mp_rom_map_elem_t mp_module_socket_globals_table[] = {
+    { MP_ROM_QSTR(MP_QSTR___name__), MP_ROM_QSTR(MP_QSTR_usocket) },
+    { MP_ROM_QSTR(MP_QSTR_socket), MP_ROM_PTR(&get_socket_obj) },
+    { MP_ROM_QSTR(MP_QSTR_socketpair), MP_ROM_PTR(&get_socketpair_obj) },
+    { MP_ROM_QSTR(MP_QSTR_getaddrinfo), MP_ROM_PTR(&socket_getaddrinfo_obj) },
+
+    { MP_ROM_QSTR(MP_QSTR_AF_INET), MP_ROM_INT(AF_INET) },
+    { MP_ROM_QSTR(MP_QSTR_AF_UNIX), MP_ROM_INT(AF_UNIX) },
+    { MP_ROM_QSTR(MP_QSTR_SOCK_STREAM), MP_ROM_INT(SOCK_STREAM) },
+    { MP_ROM_QSTR(MP_QSTR_SOCK_DGRAM), MP_ROM_INT(SOCK_DGRAM) },
+    { MP_ROM_QSTR(MP_QSTR_IPPROTO_TCP), MP_ROM_INT(IPPROTO_TCP) },
+    { MP_ROM_QSTR(MP_QSTR_SOL_SOCKET), MP_ROM_INT(SOL_SOCKET) },
+    { MP_ROM_QSTR(MP_QSTR_SO_REUSEADDR), MP_ROM_INT(SO_REUSEADDR) },
+};
+STATIC MP_DEFINE_CONST_DICT(mp_module_socket_globals, mp_module_socket_globals_table);
+
+const mp_obj_module_t mp_module_usocket = {
+    .base = { &mp_type_module },
+    .globals = (mp_obj_dict_t*)&mp_module_socket_globals,
+};
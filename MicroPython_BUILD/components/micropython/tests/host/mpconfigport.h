@@ -0,0 +1,165 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2013-2015 Damien P. George
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Options of the host build used to run the tests and benchmarks.
+// It follows esp32/mpconfigport.h for everything the tests touch.
+
+#include <stdint.h>
+#include <alloca.h>
+
+#define MICROPY_ALLOC_PATH_MAX              (256)
+#define MICROPY_ENABLE_COMPILER             (1)
+#define MICROPY_ENABLE_GC                   (1)
+#define MICROPY_ENABLE_FINALISER            (1)
+#define MICROPY_HELPER_LEXER_UNIX           (1)
+#define MICROPY_READER_POSIX                (1)
+#define MICROPY_LONGINT_IMPL                (MICROPY_LONGINT_IMPL_MPZ)
+#define MICROPY_ENABLE_SOURCE_LINE          (1)
+#define MICROPY_ERROR_REPORTING             (MICROPY_ERROR_REPORTING_DETAILED)
+#define MICROPY_FLOAT_IMPL                  (MICROPY_FLOAT_IMPL_DOUBLE)
+#define MICROPY_CPYTHON_COMPAT              (1)
+#define MICROPY_USE_INTERNAL_PRINTF         (0)
+#define MICROPY_STREAMS_NON_BLOCK           (1)
+#define MICROPY_ENABLE_SCHEDULER            (1)
+#define MICROPY_SCHEDULER_DEPTH             (8)
+#define MICROPY_GCREGS_SETJMP               (1)
+#define MICROPY_KBD_EXCEPTION               (0)
+#define MICROPY_STACK_CHECK                 (0)
+
+#define MICROPY_PY_BUILTINS_STR_UNICODE     (1)
+#define MICROPY_PY_BUILTINS_STR_PARTITION   (1)
+#define MICROPY_PY_BUILTINS_STR_SPLITLINES  (1)
+#define MICROPY_PY_BUILTINS_BYTEARRAY       (1)
+#define MICROPY_PY_BUILTINS_MEMORYVIEW      (1)
+#define MICROPY_PY_BUILTINS_SET             (1)
+#define MICROPY_PY_BUILTINS_SLICE           (1)
+#define MICROPY_PY_BUILTINS_PROPERTY        (1)
+#define MICROPY_PY_BUILTINS_ENUMERATE       (1)
+#define MICROPY_PY_BUILTINS_REVERSED        (1)
+#define MICROPY_PY_BUILTINS_MIN_MAX         (1)
+#define MICROPY_PY___FILE__                 (1)
+#define MICROPY_PY_MICROPYTHON_MEM_INFO     (1)
+#define MICROPY_PY_ARRAY                    (1)
+#define MICROPY_PY_COLLECTIONS              (1)
+#define MICROPY_PY_COLLECTIONS_ORDEREDDICT  (1)
+#define MICROPY_PY_GC                       (1)
+#define MICROPY_PY_IO                       (1)
+#define MICROPY_PY_IO_BYTESIO               (1)
+#define MICROPY_PY_STRUCT                   (1)
+#define MICROPY_PY_SYS                      (1)
+#define MICROPY_PY_SYS_EXIT                 (1)
+#define MICROPY_PY_UERRNO                   (1)
+#define MICROPY_PY_UTIME_MP_HAL             (1)
+#define MICROPY_PY_UZLIB                    (1)
+#define MICROPY_PY_UZLIB_CRC32_SLICE8       (1)
+#define MICROPY_PY_UJSON                    (1)
+#define MICROPY_PY_UHEAPQ                   (1)
+#define MICROPY_PY_UTIMEQ                   (1)
+#define MICROPY_PY_UASYNCIO                 (1)
+#define MICROPY_PY_UHASHLIB                 (1)
+#define MICROPY_PY_UBINASCII                (1)
+#define MICROPY_PY_UBINASCII_CRC32          (1)
+#define MICROPY_PY_WEBSOCKET                (1)
+
+// uselect waits on the descriptors of host sockets with select(),
+// as the esp32 port does on lwIP sockets; build with SELECT_FD=0 to
+// compare with polling every object through its ioctl
+#define MICROPY_PY_USELECT                  (1)
+#ifndef MICROPY_PY_USELECT_SELECT_FD
+#define MICROPY_PY_USELECT_SELECT_FD        (1)
+#endif
+#define MICROPY_PY_USELECT_SELECT_HEADER    <sys/select.h>
+
+#ifndef MICROPY_PY_USSL
+#define MICROPY_PY_USSL                     (0)
+#endif
+#define MICROPY_SSL_MBEDTLS                 (MICROPY_PY_USSL)
+
+#define MICROPY_PY_THREAD                   (0)
+
+#ifdef __LP64__
+typedef long mp_int_t;
+typedef unsigned long mp_uint_t;
+#else
+typedef int mp_int_t;
+typedef unsigned int mp_uint_t;
+#endif
+typedef long mp_off_t;
+
+#define MICROPY_HW_BOARD_NAME               "host"
+#define MICROPY_HW_MCU_NAME                 "host"
+
+#include <unistd.h>
+#define MP_PLAT_PRINT_STRN(str, len) do { ssize_t _r = write(1, str, len); (void)_r; } while (0)
+
+// Idle polling without select(), the same period as on the esp32
+#define MICROPY_EVENT_POLL_HOOK \
+    do { \
+        extern void mp_handle_pending(void); \
+        mp_handle_pending(); \
+        usleep(1000); \
+    } while (0);
+
+extern const struct _mp_obj_module_t mp_module_utime;
+extern const struct _mp_obj_module_t mp_module_usocket;
+extern const struct _mp_obj_module_t mp_module_host;
+extern const struct _mp_obj_module_t mp_module_ussl;
+extern const struct _mp_obj_module_t mp_module_network;
+extern const struct _mp_obj_module_t mp_module_curl;
+
+#if MICROPY_PY_USSL
+#define MICROPY_PORT_BUILTIN_MODULE_USSL { MP_ROM_QSTR(MP_QSTR_ussl), MP_ROM_PTR(&mp_module_ussl) },
+#else
+#define MICROPY_PORT_BUILTIN_MODULE_USSL
+#endif
+#ifdef CONFIG_MICROPY_USE_MQTT
+#define MICROPY_PORT_BUILTIN_MODULE_NETWORK { MP_ROM_QSTR(MP_QSTR_network), MP_ROM_PTR(&mp_module_network) },
+#else
+#define MICROPY_PORT_BUILTIN_MODULE_NETWORK
+#endif
+#ifdef CONFIG_MICROPY_USE_CURL
+#define MICROPY_PORT_BUILTIN_MODULE_CURL { MP_ROM_QSTR(MP_QSTR_curl), MP_ROM_PTR(&mp_module_curl) },
+#else
+#define MICROPY_PORT_BUILTIN_MODULE_CURL
+#endif
+
+#define MICROPY_PORT_BUILTIN_MODULES \
+    { MP_ROM_QSTR(MP_QSTR_utime), MP_ROM_PTR(&mp_module_utime) }, \
+    { MP_ROM_QSTR(MP_QSTR_usocket), MP_ROM_PTR(&mp_module_usocket) }, \
+    { MP_ROM_QSTR(MP_QSTR_host), MP_ROM_PTR(&mp_module_host) }, \
+    MICROPY_PORT_BUILTIN_MODULE_USSL \
+    MICROPY_PORT_BUILTIN_MODULE_NETWORK \
+    MICROPY_PORT_BUILTIN_MODULE_CURL \
+
+#define MICROPY_PORT_BUILTIN_MODULE_WEAK_LINKS \
+    { MP_ROM_QSTR(MP_QSTR_time), MP_ROM_PTR(&mp_module_utime) }, \
+    { MP_ROM_QSTR(MP_QSTR_socket), MP_ROM_PTR(&mp_module_usocket) }, \
+
+#define MICROPY_MODULE_WEAK_LINKS           (1)
+
+#define MP_STATE_PORT MP_STATE_VM
+
+#define MICROPY_PORT_ROOT_POINTERS
@@ -0,0 +1,390 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// espmqtt client on the loopback interface, for tests/net/mqtt_*.py.
+//
+// The test is the broker: it listens on MQTT_TEST_PORT, the address
+// printed here, and the client connects to it with auto reconnect
+// (retrying every second until the test listens).  What the client
+// publishes is given by the scenario in argv[1]:
+//
+//   inflight   after the first CONNACK, publish 6 messages with QoS
+//              1,2,1,2,1,1; after the second one, publish one QoS1
+//              message, then, once nothing is in flight any more, a
+//              QoS0 message with the number of messages in flight.
+//
+//   rx         subscribe to '#' and put the received messages into the
+//              receive queue of network.mqtt (mqtt_rx.c); a thread in
+//              place of the MicroPython task empties it, a little slower
+//              than the client fills it.  The message on topic "end" is
+//              answered with the number of messages received and dropped
+//              and the CRC32 of their topics and payloads.
+//
+//   store      publish STORE_MESSAGES QoS1 messages through the persistent
+//              queue (mqtt_store.c, STORE_SIZE bytes in a temporary
+//              directory) replayed at STORE_REPLAY_RATE msg/s: they are
+//              published as fast as the queue takes them, waiting only
+//              while it holds more than half of its size, so it is never
+//              empty.  Once all are acknowledged, a QoS0 message with the
+//              number of messages the queue dropped and of the files left.
+//
+//   subs       subscribe to '#' and match the topic of every received
+//              message against the topic filters of subs_filters[] and
+//              SUBS_BULK more "dev/<n>/+/state" in a subscription tree
+//              (mqtt_subs.c), as network.mqtt does to find the callbacks.
+//              Each message is answered with its topic and the filters it
+//              matches.  A message on topic "bench" with N as payload is
+//              answered with the matches of N rounds over subs_topics[]
+//              and the number of topics matched per second.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <dirent.h>
+#include <zlib.h>
+
+#include "mqtt.h"
+#include "mqtt_rx.h"
+#include "mqtt_subs.h"
+
+#define MQTT_TEST_PORT  (1884)
+// as in esp32/modmqtt.c
+#define MQTT_RX_QUEUE_SIZE  (((CONFIG_MQTT_MAX_PAYLOAD_SIZE + CONFIG_MQTT_BUFFER_SIZE_BYTE) * 2 + 3) & ~3)
+
+static volatile int connections;
+
+static void on_connected(mqtt_client *client, mqtt_event_data_t *event) {
+    connections++;
+}
+
+static void wait_connections(int n) {
+    while (connections < n) {
+        usleep(1000);
+    }
+}
+
+static void publish(mqtt_client *client, int qos, const char *fmt, int n) {
+    char data[32];
+    int len = snprintf(data, sizeof(data), fmt, n);
+    if (mqtt_publish(client, "test/inflight", data, len, qos, 0) < 0) {
+        fprintf(stderr, "publish %s failed\n", data);
+    }
+}
+
+static void run_inflight(mqtt_client *client) {
+    static const int qos[] = {1, 2, 1, 2, 1, 1};
+
+    wait_connections(1);
+    for (int i = 0; i < 6; i++) {
+        publish(client, qos[i], "msg %d", i + 1);
+    }
+    wait_connections(2);
+    publish(client, 1, "msg %d", 7);
+    while (client->inflight_count > 0) {
+        usleep(1000);
+    }
+    publish(client, 0, "in flight %d", client->inflight_count);
+}
+
+#define STORE_MESSAGES      (1000)
+#define STORE_SIZE          (16 * 1024)
+#define STORE_REPLAY_RATE   (500)
+
+static char store_dir[] = "/tmp/mqttc.XXXXXX";
+
+static int store_files(void) {
+    DIR *dir = opendir(store_dir);
+    struct dirent *e;
+    int n = 0;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+static void store_remove(void) {
+    DIR *dir = opendir(store_dir);
+    struct dirent *e;
+    char path[300];
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", store_dir, e->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    rmdir(store_dir);
+}
+
+static void on_term(int sig) {
+    store_remove();
+    _exit(0);
+}
+
+static uint32_t store_queued(mqtt_store_t *store, bool *unacked) {
+    mqtt_store_lock(store, portMAX_DELAY);
+    uint32_t n = store->file_size + store->wbuf_len - store->ack_pos;
+    *unacked = mqtt_store_unacked(store);
+    mqtt_store_unlock(store);
+    return n;
+}
+
+static void run_store(mqtt_client *client) {
+    mqtt_store_t *store = client->store;
+    char data[64];
+    bool unacked;
+
+    for (int i = 0; i < STORE_MESSAGES; i++) {
+        while (store_queued(store, &unacked) > STORE_SIZE / 2) {
+            usleep(1000);
+        }
+        int len = snprintf(data, sizeof(data), "msg %d ", i);
+        memset(data + len, '.', 50 - len);
+        mqtt_publish(client, "test/store", data, 50, 1, 0);
+    }
+    do {
+        usleep(1000);
+        store_queued(store, &unacked);
+    } while (unacked || (client->inflight_count > 0));
+    int len = snprintf(data, sizeof(data), "dropped %u files %d", store->dropped, store_files());
+    mqtt_publish(client, "test/store", data, len, 0, 0);
+}
+
+static pthread_mutex_t rx_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rx_cond = PTHREAD_COND_INITIALIZER;
+
+// mp_sched_schedule() of the dispatch function
+static void rx_notify(mqtt_rx_t *rx) {
+    pthread_mutex_lock(&rx_mutex);
+    rx->pending = true;
+    pthread_cond_signal(&rx_cond);
+    pthread_mutex_unlock(&rx_mutex);
+}
+
+static void data_cb(mqtt_client *client, mqtt_event_data_t *event) {
+    mqtt_rx_put((mqtt_rx_t *)client->settings->mpy_rx, event);
+}
+
+// the loop of mqtt_dispatch()
+static void *rx_dispatch(void *arg) {
+    mqtt_client *client = arg;
+    mqtt_rx_t *rx = client->settings->mpy_rx;
+    mqtt_rx_msg_t *msg;
+    uint32_t crc = 0;
+    int received = 0;
+
+    while (1) {
+        pthread_mutex_lock(&rx_mutex);
+        while (!rx->pending) {
+            pthread_cond_wait(&rx_cond, &rx_mutex);
+        }
+        rx->pending = false;
+        pthread_mutex_unlock(&rx_mutex);
+        __sync_synchronize();
+
+        while ((msg = mqtt_rx_peek(rx)) != NULL) {
+            crc = crc32(crc, msg->data, msg->topic_len + msg->data_len);
+            received++;
+            usleep(200);
+            bool end = (msg->topic_len == 3) && (memcmp(msg->data, "end", 3) == 0);
+            mqtt_rx_release(rx, msg);
+            if (end) {
+                char data[64];
+                int len = snprintf(data, sizeof(data), "received %d dropped %u crc %08x", received, rx->dropped, crc);
+                mqtt_publish(client, "test/rx", data, len, 0, 0);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void run_rx(mqtt_client *client, void *(*dispatch)(void *)) {
+    pthread_t t;
+
+    wait_connections(1);
+    pthread_create(&t, NULL, dispatch, client);
+    mqtt_subscribe(client, "#", 0);
+}
+
+#define SUBS_BULK   (1000)
+
+static const char *subs_filters[] = {
+    "#", "sensors/#", "sensors/+/temp", "sensors/1/temp", "+/+/temp",
+    "$SYS/#", "+/broker/#", "sensors/1/#", "sensors/+", "dev/500/+/state",
+};
+#define SUBS_FILTERS    (sizeof(subs_filters) / sizeof(subs_filters[0]))
+
+// the topics of tests/net/mqtt_subs.py
+static const char *subs_topics[] = {
+    "sensors/1/temp", "sensors/2/temp", "sensors/1", "sensors", "sensors/1/temp/raw",
+    "$SYS/broker/uptime", "home/broker/load", "a//temp", "dev/500/x/state",
+    "dev/7/x/state", "dev/7/x", "other",
+};
+#define SUBS_TOPICS     (sizeof(subs_topics) / sizeof(subs_topics[0]))
+
+typedef struct {
+    char *buf;
+    int len;
+    int size;
+} subs_reply_t;
+
+static void subs_name_cb(void *data, void *arg) {
+    subs_reply_t *r = arg;
+    intptr_t i = (intptr_t)data - 1;
+    const char *name = (i < SUBS_FILTERS) ? subs_filters[i] : "dev/<n>/+/state";
+    r->len += snprintf(r->buf + r->len, r->size - r->len, " %s", name);
+}
+
+static void subs_count_cb(void *data, void *arg) {
+    (*(int *)arg)++;
+}
+
+static mqtt_sub_node_t *subs_tree(void) {
+    mqtt_sub_node_t *root = NULL;
+    char filter[32];
+
+    for (intptr_t i = 0; i < SUBS_FILTERS; i++) {
+        mqtt_sub_add(&root, subs_filters[i], (void *)(i + 1), NULL);
+    }
+    for (intptr_t i = 0; i < SUBS_BULK; i++) {
+        snprintf(filter, sizeof(filter), "dev/%d/+/state", (int)i);
+        // "dev/500/+/state" is in subs_filters[] already, keep its data
+        if (strcmp(filter, "dev/500/+/state") != 0) {
+            mqtt_sub_add(&root, filter, (void *)(SUBS_FILTERS + 1 + i), NULL);
+        }
+    }
+    return root;
+}
+
+static void subs_bench(mqtt_client *client, mqtt_sub_node_t *root, int rounds) {
+    struct timespec t0, t1;
+    char data[64];
+    int matches = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int n = 0; n < rounds; n++) {
+        for (int i = 0; i < SUBS_TOPICS; i++) {
+            mqtt_sub_match(root, subs_topics[i], strlen(subs_topics[i]), subs_count_cb, &matches);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    int len = snprintf(data, sizeof(data), "matches %d rate %.0f", matches, (rounds * SUBS_TOPICS) / t);
+    mqtt_publish(client, "test/subs", data, len, 0, 0);
+}
+
+// the loop of mqtt_dispatch() finding the subscription callbacks
+static void *subs_dispatch(void *arg) {
+    mqtt_client *client = arg;
+    mqtt_rx_t *rx = client->settings->mpy_rx;
+    mqtt_sub_node_t *root = subs_tree();
+    mqtt_rx_msg_t *msg;
+    char data[CONFIG_MQTT_BUFFER_SIZE_BYTE];
+
+    while (1) {
+        pthread_mutex_lock(&rx_mutex);
+        while (!rx->pending) {
+            pthread_cond_wait(&rx_cond, &rx_mutex);
+        }
+        rx->pending = false;
+        pthread_mutex_unlock(&rx_mutex);
+        __sync_synchronize();
+
+        while ((msg = mqtt_rx_peek(rx)) != NULL) {
+            const char *topic = (const char *)msg->data;
+            if ((msg->topic_len == 5) && (memcmp(topic, "bench", 5) == 0)) {
+                snprintf(data, sizeof(data), "%.*s", (int)msg->data_len, topic + msg->topic_len);
+                mqtt_rx_release(rx, msg);
+                subs_bench(client, root, atoi(data));
+                continue;
+            }
+            subs_reply_t r = {data, 0, sizeof(data)};
+            r.len = snprintf(data, sizeof(data), "%.*s", (int)msg->topic_len, topic);
+            mqtt_sub_match(root, topic, msg->topic_len, subs_name_cb, &r);
+            mqtt_rx_release(rx, msg);
+            mqtt_publish(client, "test/subs", data, r.len, 0, 0);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = (argc == 2) ? argv[1] : "";
+    if ((strcmp(scenario, "inflight") != 0) && (strcmp(scenario, "rx") != 0) &&
+        (strcmp(scenario, "store") != 0) && (strcmp(scenario, "subs") != 0)) {
+        fprintf(stderr, "usage: mqttc inflight|rx|store|subs\n");
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    static mqtt_settings settings;
+    static mqtt_client client;
+    strcpy(settings.host, "127.0.0.1");
+    settings.port = MQTT_TEST_PORT;
+    strcpy(settings.client_id, "mqttc");
+    settings.keepalive = 60;
+    settings.auto_reconnect = true;
+    settings.connected_cb = on_connected;
+    client.settings = &settings;
+    client.name = "mqttc";
+    if ((strcmp(scenario, "rx") == 0) || (strcmp(scenario, "subs") == 0)) {
+        settings.mpy_rx = mqtt_rx_new(MQTT_RX_QUEUE_SIZE, rx_notify, &client);
+        settings.data_cb = data_cb;
+    }
+    if (strcmp(scenario, "store") == 0) {
+        char path[32];
+        if (mkdtemp(store_dir) == NULL) {
+            perror("mkdtemp");
+            return 1;
+        }
+        signal(SIGTERM, on_term);
+        snprintf(path, sizeof(path), "%s/q", store_dir);
+        client.store = mqtt_store_open(path, STORE_SIZE);
+        settings.replay_rate = STORE_REPLAY_RATE;
+    }
+
+    printf("127.0.0.1 %d\n", MQTT_TEST_PORT);
+    fflush(stdout);
+    if (mqtt_start(&client) != 0) {
+        fprintf(stderr, "mqtt_start failed\n");
+        return 1;
+    }
+    if (strcmp(scenario, "rx") == 0) {
+        run_rx(&client, rx_dispatch);
+    } else if (strcmp(scenario, "subs") == 0) {
+        run_rx(&client, subs_dispatch);
+    } else if (strcmp(scenario, "store") == 0) {
+        run_store(&client);
+    } else {
+        run_inflight(&client);
+    }
+    // the test closes the connection, run-tests terminates the client
+    pause();
+    return 0;
+}
@@ -0,0 +1,96 @@
+# Writes the broker side of the stream replayed by tests/net/mqtt_rx.py:
+# CONNACK, SUBACK, then PUBLISH messages of the sizes seen by the receive
+# queue of network.mqtt, and a last one on topic "end".  The payloads come
+# from a seeded generator, the stream is the same on every run.
+#
+# usage: python3 mkstream.py mqtt_rx.stream (make in this directory)
+
+import random
+import struct
+import sys
+
+# as in esp32/modmqtt.c and stubs/sdkconfig.h
+MAX_PAYLOAD = 2048
+BUFFER_SIZE = 1024
+QUEUE_SIZE = (MAX_PAYLOAD + BUFFER_SIZE) * 2
+ENTRY_HDR = 12
+
+
+def packet(typ, flags, body):
+    hdr = bytes([(typ << 4) | flags])
+    n = len(body)
+    while True:
+        b = n & 0x7f
+        n >>= 7
+        hdr += bytes([b | (0x80 if n else 0)])
+        if not n:
+            return hdr + body
+
+
+def publish(topic, data, qos, msg_id):
+    body = struct.pack('>H', len(topic)) + topic
+    if qos:
+        body += struct.pack('>H', msg_id)
+    return packet(3, qos << 1, body + data)
+
+
+def entry_size(topic, data):
+    return (ENTRY_HDR + len(topic) + min(len(data), MAX_PAYLOAD) + 3) & ~3
+
+
+class Stream:
+    def __init__(self):
+        self.data = packet(2, 0, b'\x00\x00') + packet(9, 0, b'\x00\x01\x00')
+        self.head = 0
+        self.msg_id = 0
+        self.rnd = random.Random(46)
+
+    def add(self, topic, data, qos=0):
+        # an entry ending exactly at the queue end wraps only if the
+        # consumer has moved on, keep the positions independent of timing
+        if self.head + entry_size(topic, data) == QUEUE_SIZE:
+            data += b'....'
+        self.msg_id += 1
+        self.data += publish(topic, data, qos, self.msg_id)
+        # where the receive queue puts the entry when no message is dropped
+        n = entry_size(topic, data)
+        if self.head + n > QUEUE_SIZE:
+            self.head = 0
+        self.head += n
+
+    def payload(self, n):
+        return bytes(self.rnd.getrandbits(8) for i in range(n))
+
+
+s = Stream()
+
+# small and medium messages, a third of them QoS1
+for i in range(200):
+    n = s.rnd.choice((0, 1, 7, 64, 200, 500, 1000, 1500))
+    s.add(b'sensors/%d/value' % (i % 8), s.payload(n), 1 if i % 3 == 0 else 0)
+
+# payloads longer than the input buffer, and one truncated to MAX_PAYLOAD
+for n in (1100, 2048, 3000):
+    s.add(b'sensors/blob', s.payload(n))
+
+# the largest entry (a topic filling the input buffer and a full payload)
+# starting from an empty queue whose head is too far in to take it at
+# the end and not far enough to wrap with the queue still holding data
+big_topic = b't/' + b'x' * (BUFFER_SIZE - 10 - 2)
+big = entry_size(big_topic, b'x' * MAX_PAYLOAD)
+target = QUEUE_SIZE - big + 4
+assert target <= big
+while s.head != target:
+    gap = (target - s.head) % QUEUE_SIZE
+    n = min(gap, 1500) - ENTRY_HDR - len(b'fill')
+    if n < 0:
+        n = 500
+    s.add(b'fill', s.payload(n))
+s.add(big_topic, s.payload(MAX_PAYLOAD))
+
+for i in range(20):
+    s.add(b'sensors/%d/value' % i, s.payload(s.rnd.choice((10, 300, 2000))))
+s.add(b'end', b'')
+
+with open(sys.argv[1], 'wb') as f:
+    f.write(s.data)
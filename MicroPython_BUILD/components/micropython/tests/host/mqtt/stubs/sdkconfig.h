@@ -0,0 +1,6 @@
+// the MQTT client options of the esp32 build
+#define CONFIG_MICROPY_USE_MQTT         1
+#define CONFIG_MQTT_PROTOCOL_311        1
+#define CONFIG_MQTT_PRIORITY            5
+#define CONFIG_MQTT_BUFFER_SIZE_BYTE    1024
+#define CONFIG_MQTT_MAX_PAYLOAD_SIZE    2048
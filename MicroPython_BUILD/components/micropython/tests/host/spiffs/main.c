@@ -0,0 +1,389 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// spiffs with the directory index of spiffs_vfs.c on a RAM flash, for
+// tests/fs/spiffs_*.py.
+//
+// The flash is FLASH_SIZE bytes with the block and page sizes of the
+// esp32 build.  The address it listens on is printed, then the commands
+// of one connection are run, one line each, answered with one line:
+//
+//   format             erase the flash, format and mount it
+//   mount              unmount and mount again, the index is rebuilt
+//   mkdir PATH         create the directory marker PATH/.
+//   write PATH N       create or truncate PATH and write N bytes
+//   rm PATH            remove the file or the directory marker PATH/.
+//   mv OLD NEW         rename a file
+//   ls PATH            the entries of directory PATH in index order,
+//                      directories with a trailing '/'
+//   lsrm PATH          the same, removing each file once it is listed
+//   stat PATH          "file", "dir", "file dir" or "none"
+//   check              "ok" if the index equals one built from the flash
+//   read PATH N        read PATH N bytes at a time and check what was
+//                      written, "ok <bytes> <flash reads> <cache hits>
+//                      <cache misses> <pages read ahead>"
+//   rread PATH N       the same, reading from the end to the start
+//   info               "ok <free blocks> <used pages> <deleted pages>"
+//   gc N               one SPIFFS_gc_step() keeping N blocks free, "ok
+//                      <result> <free blocks> <blocks erased>"
+//
+// The errors are answered with "err <spiffs error>".
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "spiffs_dirindex.h"
+
+#define FLASH_SIZE      (256 * 1024)
+// as in spiffs_vfs.h and spiffs_vfs.c
+#define ERASE_SIZE      (4096)
+#define LOG_PAGE_SIZE   (256)
+#define LOG_BLOCK_SIZE  (8192)
+#define CACHE_PAGES     (8)
+#define FDS             (8)
+
+static uint8_t flash[FLASH_SIZE];
+static uint32_t flash_reads;
+static uint32_t flash_erases;
+
+static spiffs fs;
+static spiffs_config cfg;
+static uint8_t work[LOG_PAGE_SIZE * 8];
+static uint8_t fds[sizeof(spiffs_fd) * FDS];
+static uint8_t cache[sizeof(spiffs_cache) + CACHE_PAGES * (sizeof(spiffs_cache_page) + LOG_PAGE_SIZE)];
+
+static struct spiffs_dirindex dirindex;
+
+// mutex.c on top of the FreeRTOS stubs, there are no interrupts
+void mtx_init(struct mtx *mutex, const char *name, const char *type, int opts) {
+    mutex->sem = xSemaphoreCreateMutex();
+}
+
+void mtx_lock(struct mtx *mutex) {
+    xSemaphoreTake(mutex->sem, portMAX_DELAY);
+}
+
+void mtx_unlock(struct mtx *mutex) {
+    xSemaphoreGive(mutex->sem);
+}
+
+void mtx_destroy(struct mtx *mutex) {
+    vSemaphoreDelete(mutex->sem);
+    mutex->sem = 0;
+}
+
+// NOR flash: writing only clears bits
+static s32_t flash_read(u32_t addr, u32_t size, u8_t *dst) {
+    flash_reads++;
+    memcpy(dst, flash + addr, size);
+    return SPIFFS_OK;
+}
+
+static s32_t flash_write(u32_t addr, u32_t size, u8_t *src) {
+    for (u32_t i = 0; i < size; i++) {
+        flash[addr + i] &= src[i];
+    }
+    return SPIFFS_OK;
+}
+
+static s32_t flash_erase(u32_t addr, u32_t size) {
+    flash_erases += size;
+    memset(flash + addr, 0xff, size);
+    return SPIFFS_OK;
+}
+
+// as dirindex_build() in spiffs_vfs.c
+static int index_build(struct spiffs_dirindex *index) {
+    spiffs_DIR d;
+    struct spiffs_dirent e;
+
+    if (spiffs_dirindex_init(index)) return -1;
+    SPIFFS_opendir(&fs, "/", &d);
+    while (SPIFFS_readdir(&d, &e)) {
+        if (spiffs_dirindex_add(index, (const char *)e.name, e.obj_id)) return -1;
+    }
+    SPIFFS_closedir(&d);
+    return 0;
+}
+
+static int fs_mount(void) {
+    int res = SPIFFS_mount(&fs, &cfg, work, fds, sizeof(fds), cache, sizeof(cache), NULL);
+    if (res < 0) return res;
+    spiffs_dirindex_destroy(&dirindex);
+    return index_build(&dirindex);
+}
+
+// the nodes of a and b and their siblings hold the same entries
+static int index_equal(struct spiffs_dirindex_node *a, struct spiffs_dirindex_node *b) {
+    while (a && b) {
+        if (strcmp(a->name, b->name) || (a->file_id != b->file_id) || (a->dir_id != b->dir_id)) return 0;
+        if (!index_equal(a->child, b->child)) return 0;
+        a = a->next;
+        b = b->next;
+    }
+    return (a == NULL) && (b == NULL);
+}
+
+// the content of path written by cmd_write()
+static uint8_t file_byte(const char *path, int pos) {
+    return (uint8_t)(pos + strlen(path));
+}
+
+static int cmd_write(const char *path, int n) {
+    spiffs_obj_id file_id, dir_id;
+    int exists = spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id) && file_id;
+    spiffs_file f = SPIFFS_open(&fs, path, SPIFFS_O_CREAT | SPIFFS_O_TRUNC | SPIFFS_O_RDWR, 0);
+    if (f < 0) return f;
+
+    uint8_t buf[1000];
+    int res = 0;
+    for (int pos = 0; (res >= 0) && (pos < n); pos += sizeof(buf)) {
+        int len = (n - pos < sizeof(buf)) ? n - pos : sizeof(buf);
+        for (int i = 0; i < len; i++) {
+            buf[i] = file_byte(path, pos + i);
+        }
+        res = SPIFFS_write(&fs, f, buf, len);
+    }
+    spiffs_stat st;
+    if (res >= 0) res = SPIFFS_fstat(&fs, f, &st);
+    SPIFFS_close(&fs, f);
+    if (res < 0) return res;
+    if (!exists) spiffs_dirindex_add(&dirindex, path, st.obj_id);
+    return 0;
+}
+
+// read path n bytes at a time, from the start or from the end
+static void cmd_read(FILE *out, const char *path, int n, int backwards) {
+    flash_reads = 0;
+    fs.cache_hits = 0;
+    fs.cache_misses = 0;
+    fs.cache_prefetched = 0;
+
+    spiffs_file f = SPIFFS_open(&fs, path, SPIFFS_O_RDONLY, 0);
+    spiffs_stat st;
+    int res = (f < 0) ? f : SPIFFS_fstat(&fs, f, &st);
+    uint8_t buf[1024];
+    int size = (res < 0) ? 0 : st.size;
+    int total = 0;
+    if ((n <= 0) || (n > sizeof(buf))) res = SPIFFS_ERR_INTERNAL;
+    for (int i = 0; (res >= 0) && (i * n < size); i++) {
+        int pos = backwards ? ((size - 1) / n - i) * n : i * n;
+        int len = (size - pos < n) ? size - pos : n;
+        res = SPIFFS_lseek(&fs, f, pos, SPIFFS_SEEK_SET);
+        if (res >= 0) res = SPIFFS_read(&fs, f, buf, len);
+        for (int j = 0; (res >= 0) && (j < len); j++) {
+            if (buf[j] != file_byte(path, pos + j)) res = SPIFFS_ERR_INTERNAL;
+        }
+        total += len;
+    }
+    if (f >= 0) SPIFFS_close(&fs, f);
+
+    if (res < 0) {
+        fprintf(out, "err %d\n", res);
+    } else {
+        fprintf(out, "ok %d %u %u %u %u\n", total, flash_reads, fs.cache_hits, fs.cache_misses, fs.cache_prefetched);
+    }
+}
+
+static int cmd_mkdir(const char *path) {
+    char name[SPIFFS_OBJ_NAME_LEN];
+    snprintf(name, sizeof(name), "%s/.", path);
+    spiffs_file f = SPIFFS_open(&fs, name, SPIFFS_O_CREAT | SPIFFS_O_EXCL | SPIFFS_O_RDWR, 0);
+    if (f < 0) return f;
+    spiffs_stat st;
+    int res = SPIFFS_fstat(&fs, f, &st);
+    SPIFFS_close(&fs, f);
+    if (res < 0) return res;
+    spiffs_dirindex_add(&dirindex, name, st.obj_id);
+    return 0;
+}
+
+static int cmd_rm(const char *path) {
+    char name[SPIFFS_OBJ_NAME_LEN];
+    spiffs_obj_id file_id, dir_id;
+    spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id);
+    if (file_id) {
+        strlcpy(name, path, sizeof(name));
+    } else {
+        snprintf(name, sizeof(name), "%s/.", path);
+    }
+    int res = SPIFFS_remove(&fs, name);
+    if (res < 0) return res;
+    spiffs_dirindex_remove(&dirindex, name);
+    return 0;
+}
+
+static int cmd_mv(const char *src, const char *dst) {
+    spiffs_obj_id file_id, dir_id;
+    spiffs_dirindex_lookup(&dirindex, src, &file_id, &dir_id);
+    int res = SPIFFS_rename(&fs, src, dst);
+    if (res < 0) return res;
+    spiffs_dirindex_remove(&dirindex, src);
+    if (file_id) spiffs_dirindex_add(&dirindex, dst, file_id);
+    return 0;
+}
+
+// the entries of path, as readdir() of spiffs_vfs.c
+static void cmd_ls(FILE *out, const char *path, int remove) {
+    struct spiffs_dirindex_pos pos;
+    char name[SPIFFS_OBJ_NAME_LEN];
+    int is_dir;
+    const char *sep = "";
+
+    memset(&pos, 0, sizeof(pos));
+    while (spiffs_dirindex_next(&dirindex, path, &pos, name, sizeof(name), &is_dir)) {
+        fprintf(out, "%s%s%s", sep, name, is_dir ? "/" : "");
+        sep = " ";
+        if (remove && !is_dir) {
+            char file[SPIFFS_OBJ_NAME_LEN * 2];
+            snprintf(file, sizeof(file), "%s/%s", strcmp(path, "/") ? path : "", name);
+            cmd_rm(file);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+static void cmd_stat(FILE *out, const char *path) {
+    spiffs_obj_id file_id, dir_id;
+    if (!spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id)) {
+        fprintf(out, "none\n");
+    } else {
+        fprintf(out, "%s%s%s\n", file_id ? "file" : "", (file_id && dir_id) ? " " : "", dir_id ? "dir" : "");
+    }
+}
+
+static void cmd_check(FILE *out) {
+    struct spiffs_dirindex built;
+    if (index_build(&built)) {
+        fprintf(out, "err no memory\n");
+        return;
+    }
+    fprintf(out, "%s\n", index_equal(dirindex.root, built.root) ? "ok" : "differs");
+    spiffs_dirindex_destroy(&built);
+}
+
+static void run(FILE *in, FILE *out) {
+    char line[256];
+    while (fgets(line, sizeof(line), in)) {
+        char cmd[16], a[SPIFFS_OBJ_NAME_LEN], b[SPIFFS_OBJ_NAME_LEN];
+        int n = sscanf(line, "%15s %63s %63s", cmd, a, b);
+        int res = 0;
+        if (n < 1) {
+            continue;
+        } else if (!strcmp(cmd, "format")) {
+            SPIFFS_unmount(&fs);
+            flash_erase(0, FLASH_SIZE);
+            res = SPIFFS_mount(&fs, &cfg, work, fds, sizeof(fds), cache, sizeof(cache), NULL);
+            SPIFFS_unmount(&fs);
+            res = SPIFFS_format(&fs);
+            if (res == 0) res = fs_mount();
+        } else if (!strcmp(cmd, "mount")) {
+            SPIFFS_unmount(&fs);
+            res = fs_mount();
+        } else if (!strcmp(cmd, "mkdir") && (n == 2)) {
+            res = cmd_mkdir(a);
+        } else if (!strcmp(cmd, "write") && (n == 3)) {
+            res = cmd_write(a, atoi(b));
+        } else if (!strcmp(cmd, "rm") && (n == 2)) {
+            res = cmd_rm(a);
+        } else if (!strcmp(cmd, "mv") && (n == 3)) {
+            res = cmd_mv(a, b);
+        } else if ((!strcmp(cmd, "ls") || !strcmp(cmd, "lsrm")) && (n == 2)) {
+            cmd_ls(out, a, cmd[2] == 'r');
+            continue;
+        } else if (!strcmp(cmd, "stat") && (n == 2)) {
+            cmd_stat(out, a);
+            continue;
+        } else if ((!strcmp(cmd, "read") || !strcmp(cmd, "rread")) && (n == 3)) {
+            cmd_read(out, a, atoi(b), cmd[0] == 'r' && cmd[1] == 'r');
+            continue;
+        } else if (!strcmp(cmd, "info")) {
+            fprintf(out, "ok %u %u %u\n", fs.free_blocks, fs.stats_p_allocated, fs.stats_p_deleted);
+            continue;
+        } else if (!strcmp(cmd, "gc") && (n == 2)) {
+            flash_erases = 0;
+            res = SPIFFS_gc_step(&fs, atoi(a));
+            if (res >= 0) {
+                fprintf(out, "ok %d %u %u\n", res, fs.free_blocks, flash_erases / LOG_BLOCK_SIZE);
+                continue;
+            }
+        } else if (!strcmp(cmd, "check")) {
+            cmd_check(out);
+            continue;
+        } else {
+            fprintf(out, "err unknown command\n");
+            continue;
+        }
+        if (res < 0) {
+            fprintf(out, "err %d\n", res);
+        } else {
+            fprintf(out, "ok\n");
+        }
+    }
+}
+
+int main(void) {
+    cfg.phys_addr = 0;
+    cfg.phys_size = FLASH_SIZE;
+    cfg.phys_erase_block = ERASE_SIZE;
+    cfg.log_page_size = LOG_PAGE_SIZE;
+    cfg.log_block_size = LOG_BLOCK_SIZE;
+    cfg.hal_read_f = flash_read;
+    cfg.hal_write_f = flash_write;
+    cfg.hal_erase_f = flash_erase;
+    spiffs_mutex = xSemaphoreCreateMutex();
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(s, 1) < 0) ||
+        (getsockname(s, (struct sockaddr *)&addr, &addr_len) < 0)) {
+        perror("spiffsd");
+        return 1;
+    }
+    printf("127.0.0.1 %d\n", ntohs(addr.sin_port));
+    fflush(stdout);
+
+    int c = accept(s, NULL, NULL);
+    if (c < 0) {
+        perror("spiffsd");
+        return 1;
+    }
+    FILE *in = fdopen(c, "r");
+    FILE *out = fdopen(dup(c), "w");
+    setvbuf(out, NULL, _IOLBF, 0);
+    run(in, out);
+    return 0;
+}
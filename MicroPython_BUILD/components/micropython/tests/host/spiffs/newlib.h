@@ -0,0 +1,14 @@
+// Included before the spiffs sources: strlcpy() of the newlib of the
+// esp32 build, which glibc only has since 2.38.
+#include <string.h>
+
+static inline size_t host_strlcpy(char *dst, const char *src, size_t size) {
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = (len < size) ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy host_strlcpy
@@ -0,0 +1,3 @@
+// extmod/modussl_mbedtls.c includes the sdkconfig.h of the esp32 build,
+// none of its options are used on the host.  The mbedtls configuration is
+// that of the mbedtls 2.x installed on the host (USSL=1 in ../Makefile).
@@ -0,0 +1,52 @@
+# TLS server of tests/net/ssl_*.py and tests/bench/ssl_*.py, run by the host
+# build itself: one server side ussl.SSLContext (key.pem and cert.pem, a
+# self-signed RSA 2048 certificate for "localhost") for two ports.  It prints
+# its address and both ports.
+#
+# A client sends a line with a number n and gets a line "resumed <0|1>",
+# whether its session was resumed, followed by n bytes, byte i being
+# i & 0xff, then the connection is closed.
+
+import usocket as socket
+import uselect
+import ussl
+import host
+
+PORTS = (4433, 4434)
+
+ctx = ussl.SSLContext(True, key=host.read_file('../host/ssl/key.pem'),
+                      cert=host.read_file('../host/ssl/cert.pem'))
+DATA = bytes(range(256)) * 64
+
+poll = uselect.poll()
+for port in PORTS:
+    srv = socket.socket()
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind(socket.getaddrinfo('127.0.0.1', port)[0][-1])
+    srv.listen(4)
+    poll.register(srv, uselect.POLLIN)
+print('127.0.0.1', *PORTS)
+
+
+def serve(s):
+    s.settimeout(10)
+    # TCP_NODELAY: mbedtls writes each handshake message on its own
+    s.setsockopt(socket.IPPROTO_TCP, 1, 1)
+    try:
+        ss = ctx.wrap_socket(s)
+    except OSError:
+        s.close()
+        return
+    try:
+        n = int(ss.readline())
+        ss.write(b'resumed %d\n' % ss.session_reused())
+        while n > 0:
+            n -= ss.write(DATA[:min(n, len(DATA))])
+    except (OSError, ValueError):
+        pass
+    ss.close()
+
+
+while True:
+    for srv, ev in poll.poll():
+        serve(srv.accept()[0])
@@ -0,0 +1 @@
+// not used on the host
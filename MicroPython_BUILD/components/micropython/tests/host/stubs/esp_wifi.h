@@ -0,0 +1,9 @@
+// the station interface, see tcpip_adapter.h
+#include "tcpip_adapter.h"
+
+typedef enum { WIFI_MODE_STA = 1, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+
+static inline int esp_wifi_get_mode(wifi_mode_t *mode) {
+    *mode = WIFI_MODE_STA;
+    return 0;
+}
@@ -0,0 +1,191 @@
+// FreeRTOS calls used by the esp32 sources built on the host, on top of
+// pthreads.  One tick is one millisecond, tasks are detached threads.
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE              (1)
+#define pdFALSE             (0)
+#define portMAX_DELAY       (0xffffffff)
+#define portTICK_RATE_MS    (1)
+#define portTICK_PERIOD_MS  (1)
+
+static inline TickType_t xTaskGetTickCount(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline void vTaskDelay(TickType_t ticks) {
+    usleep(ticks * 1000);
+}
+
+static inline BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, (void *(*)(void *))func, arg) != 0) {
+        return pdFALSE;
+    }
+    pthread_detach(t);
+    if (handle) {
+        *handle = (TaskHandle_t)t;
+    }
+    return pdTRUE;
+}
+
+static inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+// a task that is notified polls on the host
+#define xTaskNotifyGive(task)   ((void)(task))
+#define taskYIELD()             sched_yield()
+
+static inline void vTaskDelete(TaskHandle_t task) {
+    if (task == NULL) {
+        pthread_exit(NULL);
+    }
+    pthread_cancel((pthread_t)task);
+}
+
+// queue of fixed size items
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int item_size, len, count, head;
+    uint8_t *items;
+} queue_t;
+
+typedef queue_t *QueueHandle_t;
+typedef queue_t *SemaphoreHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size) {
+    queue_t *q = calloc(1, sizeof(queue_t));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->len = len;
+    q->item_size = item_size;
+    q->items = malloc(len * item_size);
+    return q;
+}
+
+static inline void vQueueDelete(QueueHandle_t q) {
+    // tasks of the client may still be using it
+}
+
+// wait with the mutex taken until the queue is not full (or not empty)
+static inline bool queue_wait(queue_t *q, bool for_space, TickType_t ticks) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (ticks == portMAX_DELAY) {
+        ts.tv_sec += 1000000;
+    } else {
+        ts.tv_sec += ticks / 1000;
+        ts.tv_nsec += (ticks % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+    }
+    while (for_space ? (q->count == q->len) : (q->count == 0)) {
+        if ((ticks == 0) || (pthread_cond_timedwait(&q->cond, &q->mutex, &ts) != 0)) {
+            return !(for_space ? (q->count == q->len) : (q->count == 0));
+        }
+    }
+    return true;
+}
+
+static inline BaseType_t queue_send(QueueHandle_t q, const void *item, TickType_t ticks, bool to_front) {
+    pthread_mutex_lock(&q->mutex);
+    if (!queue_wait(q, true, ticks)) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    int i;
+    if (to_front) {
+        q->head = (q->head + q->len - 1) % q->len;
+        i = q->head;
+    } else {
+        i = (q->head + q->count) % q->len;
+    }
+    memcpy(q->items + i * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+#define xQueueSend(q, item, ticks) queue_send(q, item, ticks, false)
+#define xQueueSendToFront(q, item, ticks) queue_send(q, item, ticks, true)
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks) {
+    pthread_mutex_lock(&q->mutex);
+    if (!queue_wait(q, false, ticks)) {
+        pthread_mutex_unlock(&q->mutex);
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return pdTRUE;
+}
+
+static inline UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t n = q->len - q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return n;
+}
+
+static inline void xQueueReset(QueueHandle_t q) {
+    pthread_mutex_lock(&q->mutex);
+    q->count = 0;
+    q->head = 0;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+// a mutex is a queue holding one token
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    uint8_t token = 0;
+    SemaphoreHandle_t s = xQueueCreate(1, 1);
+    xQueueSend(s, &token, 0);
+    return s;
+}
+
+// a binary semaphore is created empty
+static inline SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, 1);
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+    uint8_t token;
+    return xQueueReceive(s, &token, ticks);
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+    uint8_t token = 0;
+    return xQueueSend(s, &token, 0);
+}
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t s) {
+}
+
+#endif
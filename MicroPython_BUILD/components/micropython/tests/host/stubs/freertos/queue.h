@@ -0,0 +1 @@
+// declared in FreeRTOS.h
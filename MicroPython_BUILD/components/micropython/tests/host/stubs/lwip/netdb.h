@@ -0,0 +1 @@
+#include <netdb.h>
@@ -0,0 +1,10 @@
+// lwIP has the BSD socket API, with sin_len in sockaddr_in, and fcntl()
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#define closesocket close
+#define sin_len sin_zero[0]
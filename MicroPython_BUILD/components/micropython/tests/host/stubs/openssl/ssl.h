@@ -0,0 +1,13 @@
+// the tests don't use SSL
+typedef struct SSL_CTX SSL_CTX;
+typedef struct SSL SSL;
+static inline void *TLSv1_2_client_method(void) { return NULL; }
+static inline SSL_CTX *SSL_CTX_new(void *method) { return NULL; }
+static inline void SSL_CTX_free(SSL_CTX *ctx) { }
+static inline SSL *SSL_new(SSL_CTX *ctx) { return NULL; }
+static inline int SSL_set_fd(SSL *ssl, int fd) { return 0; }
+static inline int SSL_connect(SSL *ssl) { return 0; }
+static inline int SSL_read(SSL *ssl, void *buf, int len) { return -1; }
+static inline int SSL_write(SSL *ssl, const void *buf, int len) { return -1; }
+static inline void SSL_shutdown(SSL *ssl) { }
+static inline void SSL_free(SSL *ssl) { }
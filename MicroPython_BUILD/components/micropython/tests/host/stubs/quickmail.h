@@ -0,0 +1,16 @@
+// curl.sendmail() is not available on the host, sending fails
+#include <stdio.h>
+typedef void *quickmail;
+#define QUICKMAIL_PROT_SMTP     1
+#define QUICKMAIL_PROT_SMTPS    2
+static int quickmail_verbose, quickmail_progress;
+static inline quickmail quickmail_create(const char *from, const char *subject) { return NULL; }
+static inline void quickmail_add_to(quickmail m, const char *s) {}
+static inline void quickmail_add_cc(quickmail m, const char *s) {}
+static inline void quickmail_add_header(quickmail m, const char *s) {}
+static inline void quickmail_set_body(quickmail m, const char *s) {}
+static inline void quickmail_add_attachment_file(quickmail m, const char *path, const char *mimetype) {}
+static inline const char *quickmail_protocol_send(quickmail m, const char *server, unsigned port, int protocol, const char *user, const char *pass) { return "not available"; }
+static inline void quickmail_destroy(quickmail m) {}
+static inline void quickmail_cleanup(void) {}
+static inline void quickmail_set_debug_log(quickmail m, FILE *f) {}
@@ -0,0 +1,6 @@
+// the ROM CRC32 of the esp32 is the zlib one
+#include <stdint.h>
+#include <zlib.h>
+static inline uint32_t crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    return crc32(crc, buf, len);
+}
@@ -0,0 +1,21 @@
+// the station has an address on the loopback interface, clients are allowed to start
+#ifndef TCPIP_ADAPTER_H
+#define TCPIP_ADAPTER_H
+
+#include <arpa/inet.h>
+#include <stdint.h>
+
+typedef enum { TCPIP_ADAPTER_IF_STA = 0, TCPIP_ADAPTER_IF_AP } tcpip_adapter_if_t;
+typedef struct { struct { uint32_t addr; } ip, netmask, gw; } tcpip_adapter_ip_info_t;
+
+#define WIFI_IF_STA     TCPIP_ADAPTER_IF_STA
+
+static inline int tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t *info) {
+    (void)tcpip_if;
+    info->ip.addr = htonl(INADDR_LOOPBACK);
+    info->netmask.addr = htonl(0xff000000);
+    info->gw.addr = 0;
+    return 0;
+}
+
+#endif
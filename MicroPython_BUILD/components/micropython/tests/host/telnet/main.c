@@ -0,0 +1,112 @@
+/*
+ * This file is part of the MicroPython project, http://micropython.org/
+ *
+ * The MIT License (MIT)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// esp32/libs/telnet.c served on the loopback interface, for tests/net.
+//
+// The address is printed once the server listens.  After the login
+// every line the client sends is written back as the hex dump of what
+// the parser let through, with the number of Ctrl-C seen so far.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "telnet.h"
+
+extern TaskHandle_t TelnetTaskHandle;
+
+int mp_interrupt_char = 3;
+static int interrupts;
+
+static volatile sig_atomic_t terminated;
+
+void mp_keyboard_interrupt(void) {
+    interrupts++;
+}
+
+uint32_t mp_hal_ticks_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig) {
+    terminated = 1;
+}
+
+int main(void) {
+    signal(SIGTERM, on_signal);
+    signal(SIGINT, on_signal);
+
+    TelnetTaskHandle = (TaskHandle_t)1;
+    strcpy(telnet_user, TELNET_DEF_USER);
+    strcpy(telnet_pass, TELNET_DEF_PASS);
+    telnet_init();
+    telnet_enable();
+
+    char line[1024];
+    int len = 0;
+    int status = 0;
+    bool listening = false;
+    uint32_t start = mp_hal_ticks_ms();
+    while (!terminated) {
+        telnet_run();
+        if (!listening) {
+            if (telnet_getstate() == E_TELNET_STE_LISTEN) {
+                printf("127.0.0.1 %d\n", TELNET_PORT);
+                fflush(stdout);
+                listening = true;
+            } else if (mp_hal_ticks_ms() - start > 1000) {
+                fprintf(stderr, "telnetd: can't listen on port %d\n", TELNET_PORT);
+                status = 1;
+                break;
+            }
+        }
+        bool idle = true;
+        while (telnet_rx_any()) {
+            int c = telnet_rx_char();
+            idle = false;
+            if (c == '\n') {
+                char reply[3 * sizeof(line) + 16];
+                int n = 0;
+                for (int i = 0; i < len; i++) {
+                    n += sprintf(reply + n, "%02x", (unsigned char)line[i]);
+                }
+                n += sprintf(reply + n, " %d\r\n", interrupts);
+                telnet_tx_strn(reply, n);
+                len = 0;
+            } else if (len < sizeof(line)) {
+                line[len++] = c;
+            }
+        }
+        if (idle) {
+            vTaskDelay(1);
+        }
+    }
+    telnet_deinit();
+    return status;
+}
@@ -0,0 +1,3 @@
+// generated by the esp32 build
+#define MICROPY_GIT_TAG     "host"
+#define MICROPY_BUILD_DATE  "today"
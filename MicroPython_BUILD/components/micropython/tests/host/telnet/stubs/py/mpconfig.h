@@ -0,0 +1,6 @@
+// the board names of the welcome message; the real one brings in the
+// C library headers telnet.c relies on
+#include <stdio.h>
+#include <stdlib.h>
+#define MICROPY_HW_BOARD_NAME   "telnetd"
+#define MICROPY_HW_MCU_NAME     "host"
@@ -0,0 +1,5 @@
+// the HAL functions used by telnet.c, defined in telnetd main.c
+#include <stdint.h>
+extern int mp_interrupt_char;
+void mp_keyboard_interrupt(void);
+uint32_t mp_hal_ticks_ms(void);
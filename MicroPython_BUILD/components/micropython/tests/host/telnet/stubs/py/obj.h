@@ -0,0 +1 @@
+// nothing of it is used by telnet.c on the host
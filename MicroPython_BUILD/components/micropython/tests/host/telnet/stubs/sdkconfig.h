@@ -0,0 +1,4 @@
+// the telnet server options of the esp32 build
+#define CONFIG_MICROPY_USE_TELNET               1
+#define CONFIG_MICROPY_TELNET_RX_BUFFER_SIZE    1024
+#define CONFIG_MICROPY_TELNET_TX_BUFFER_SIZE    4096
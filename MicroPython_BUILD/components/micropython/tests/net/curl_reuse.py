@@ -0,0 +1,98 @@
+# curl keeps the connections of finished requests open for the next ones
+# (curl.options(keepalive=1), the default), streams large bodies in
+# chunks to a callback or a file, and runs curl.getmany() requests
+# concurrently on a few connections.  Needs the host build with CURL=1.
+# server: python3 ../host/curl/httpd.py
+
+import sys
+import utime as time
+
+try:
+    import curl
+except ImportError:
+    print('SKIP')
+    sys.exit()
+import host
+
+addr, port, tmp = sys.argv[1].split()
+URL = 'http://%s:%s' % (addr, port)
+
+curl.options(print=False, verbose=0, progress=0, maxfsize=2000000)
+
+
+def conns():
+    return int(curl.get(URL + '/conns')[2])
+
+
+# connections opened by 10 requests
+c0 = conns()
+for i in range(10):
+    res = curl.get(URL + '/a%d' % i)
+print('get', res[0], res[2])
+print('keepalive, new connections', conns() - c0)
+curl.options(print=False, keepalive=0)
+c0 = conns()
+for i in range(10):
+    curl.get(URL + '/b%d' % i)
+# /conns itself takes a new one
+print('no keepalive, new connections', conns() - c0 - 1)
+curl.options(print=False, keepalive=1, chunksize=4096)
+
+# a 1 MB body in chunks of the chunk size, the last one shorter
+pos = 0
+bad = 0
+sizes = []
+
+
+def check(mv):
+    global pos, bad
+    sizes.append(len(mv))
+    for i in range(len(mv)):
+        if mv[i] != ((pos + i) * 7 + 3) & 0xff:
+            bad += 1
+    pos += len(mv)
+
+
+res = curl.get(URL + '/big', check)
+print('callback', res[0], 'bytes', pos, 'bad', bad, 'chunks', len(sizes), 'size', max(sizes))
+
+res = curl.get(URL + '/big', tmp + '/big.bin')
+data = host.read_file(tmp + '/big.bin')
+print('file', res[0], 'bytes', len(data), 'intact', data == bytes((i * 7 + 3) & 0xff for i in range(len(data))))
+
+# returning False aborts the transfer, a view kept by the callback is
+# emptied when it returns
+n = 0
+kept = None
+
+
+def stop(mv):
+    global n, kept
+    n += 1
+    kept = mv
+    return n < 3
+
+
+res = curl.get(URL + '/big', stop)
+print('aborted', res[0] != 0, 'after chunks', n, 'kept view', len(kept))
+
+
+def fail(mv):
+    raise ValueError('from the callback')
+
+
+try:
+    curl.get(URL + '/big', fail)
+except ValueError as e:
+    print('ValueError', e)
+print('then', curl.get(URL + '/after')[2])
+
+# 8 requests taking 0.5 s each on at most 4 connections: 2 rounds, 4 s one by one
+c0 = conns()
+t = time.ticks_ms()
+res = curl.getmany([URL + '/slow%d' % i for i in range(8)])
+t = time.ticks_diff(time.ticks_ms(), t)
+print('getmany', [r[0] for r in res], res[7][2], 'concurrent', t < 3000)
+c1 = conns()
+curl.getmany([URL + '/slow%d' % i for i in range(8)])
+print('getmany new connections', c1 - c0, 'then', conns() - c1)
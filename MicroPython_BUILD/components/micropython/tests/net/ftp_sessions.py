@@ -0,0 +1,149 @@
+# esp32/libs/ftp.c on loopback: transfers larger than the buffers, REST,
+# SIZE, MLSD and two sessions at once
+# server: ../host/ftp/ftpd 2>/dev/null
+
+import sys
+import usocket as socket
+import uhashlib
+
+host, port = sys.argv[1].split()
+
+
+def connect(host, port):
+    s = socket.socket()
+    s.connect(socket.getaddrinfo(host, port)[0][-1])
+    return s
+
+
+class Client:
+    def __init__(self):
+        self.s = connect(host, int(port))
+        self.lines = []
+        self.welcome = self.reply()
+
+    # the first line of the reply, the other lines of a multi-line one go to self.lines
+    def reply(self):
+        line = self.s.readline().decode().rstrip()
+        self.lines = []
+        if line[3:4] == '-':
+            while True:
+                l = self.s.readline().decode().rstrip()
+                if l.startswith(line[:3] + ' '):
+                    break
+                self.lines.append(l.strip())
+        return line
+
+    def cmd(self, c):
+        self.s.write(c.encode() + b'\r\n')
+        return self.reply()
+
+    def code(self, c):
+        return self.cmd(c)[:3]
+
+    def pasv(self):
+        r = self.cmd('PASV')
+        n = r[r.index('(') + 1:r.index(')')].split(',')
+        return connect('.'.join(n[:4]), int(n[4]) * 256 + int(n[5]))
+
+    def retr(self, cmd):
+        d = self.pasv()
+        r1 = self.code(cmd)
+        data = bytearray()
+        while True:
+            b = d.recv(4096)
+            if not b:
+                break
+            data.extend(b)
+        d.close()
+        return r1, self.reply()[:3], data
+
+    def stor(self, cmd, data):
+        d = self.pasv()
+        r1 = self.code(cmd)
+        d.write(data)
+        d.close()
+        return r1, self.reply()[:3]
+
+    def quit(self):
+        r = self.code('QUIT')
+        self.s.close()
+        return r
+
+
+def digest(data):
+    return uhashlib.sha256(data).digest()
+
+
+# 100 buffers and a half
+data = bytearray(100 * 1024 + 512)
+x = 1
+for i in range(len(data)):
+    x = (x * 1103515245 + 12345) & 0x7fffffff
+    data[i] = x >> 16
+
+c = Client()
+print(c.welcome[:3])
+print(c.code('USER micro'), c.code('PASS python'))
+print(c.cmd('FEAT')[:3], c.lines)
+print(c.cmd('PWD'))
+print(c.code('CWD /flash'), c.cmd('PWD'))
+
+print('stor', c.stor('STOR big.bin', data))
+print(c.cmd('SIZE big.bin'))
+r1, r2, got = c.retr('RETR big.bin')
+print('retr', r1, r2, len(got), digest(got) == digest(data))
+
+# resumed download
+print(c.code('REST 60000'))
+r1, r2, got = c.retr('RETR big.bin')
+print('rest retr', r1, r2, len(got), digest(got) == digest(data[60000:]))
+
+# resumed upload overwrites from the offset
+print('stor', c.stor('STOR small.bin', b'0123456789'))
+print(c.code('REST 4'))
+print('rest stor', c.stor('STOR small.bin', b'ab'))
+print(c.retr('RETR small.bin'))
+
+# a file of exactly one buffer and an empty one
+print('stor', c.stor('STOR one.bin', data[:1024]))
+r1, r2, got = c.retr('RETR one.bin')
+print('retr', r1, r2, got == data[:1024])
+print('stor', c.stor('STOR empty.bin', b''))
+print(c.retr('RETR empty.bin'))
+
+# rename, the source does not survive another command in between
+print('rnfr', c.code('RNFR small.bin'), c.retr('RETR one.bin')[:2], c.code('RNTO moved.bin'))
+print('rnto', c.code('RNTO moved.bin'))
+print('rename', c.code('RNFR small.bin'), c.code('RNTO moved.bin'), c.code('SIZE small.bin'), c.cmd('SIZE moved.bin'))
+print('rename', c.code('RNFR moved.bin'), c.code('RNTO small.bin'))
+
+r1, r2, got = c.retr('MLSD')
+print('mlsd', r1, r2, sorted(l.split(';')[-1].strip() for l in bytes(got).decode().split('\r\n') if l))
+
+# two downloads at once, read in turns
+c2 = Client()
+print(c2.code('USER micro'), c2.code('PASS python'), c2.code('CWD /flash'))
+d1 = c.pasv()
+d2 = c2.pasv()
+print(c.code('RETR big.bin'), c2.code('RETR big.bin'))
+got = [bytearray(), bytearray()]
+open_ = [d1, d2]
+while open_[0] or open_[1]:
+    for i in range(2):
+        if open_[i]:
+            b = open_[i].recv(2048)
+            if b:
+                got[i].extend(b)
+            else:
+                open_[i].close()
+                open_[i] = None
+print(c.reply()[:3], c2.reply()[:3])
+print('concurrent', [digest(g) == digest(data) for g in got])
+
+# no third session
+c3 = Client()
+print('third', c3.welcome[:3])
+c3.s.close()
+
+print([c.code('DELE ' + name) for name in ('big.bin', 'small.bin', 'one.bin', 'empty.bin')])
+print(c2.quit(), c.quit())
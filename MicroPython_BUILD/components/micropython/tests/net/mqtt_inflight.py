@@ -0,0 +1,121 @@
+# espmqtt resends the QoS1/2 messages not acknowledged when the connection
+# was lost: the PUBLISH with DUP set and the same id, in publish order, or
+# the PUBREL once PUBREC was received; new messages take other ids.
+# This test is the broker.
+# server: ../host/mqtt/mqttc inflight 2>/dev/null
+
+import sys
+import usocket as socket
+
+host, port = sys.argv[1].split()
+
+NAMES = {1: 'CONNECT', 3: 'PUBLISH', 4: 'PUBACK', 5: 'PUBREC', 6: 'PUBREL', 7: 'PUBCOMP', 12: 'PINGREQ', 14: 'DISCONNECT'}
+
+
+def read_exact(s, n):
+    data = b''
+    while len(data) < n:
+        d = s.recv(n - len(data))
+        if not d:
+            raise OSError('closed')
+        data += d
+    return data
+
+
+# returns (type, flags, body)
+def read_packet(s):
+    while True:
+        hdr = read_exact(s, 1)[0]
+        length = 0
+        shift = 0
+        while True:
+            b = read_exact(s, 1)[0]
+            length |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        body = read_exact(s, length)
+        if hdr >> 4 != 12:
+            return hdr >> 4, hdr & 0x0f, body
+        s.send(b'\xd0\x00')
+
+
+def send_ack(s, typ, msg_id):
+    s.send(bytes([(typ << 4) | (2 if typ == 6 else 0), 2, msg_id >> 8, msg_id & 0xff]))
+
+
+# a readable description of the packet, and the message id if it has one
+def describe(p):
+    typ, flags, body = p
+    name = NAMES.get(typ, str(typ))
+    if typ == 3:
+        qos = (flags >> 1) & 3
+        tlen = (body[0] << 8) | body[1]
+        pos = 2 + tlen
+        msg_id = 0
+        if qos:
+            msg_id = (body[pos] << 8) | body[pos + 1]
+            pos += 2
+        return '%s qos=%d dup=%d id=%d %s' % (name, qos, flags >> 3, msg_id, body[pos:].decode()), msg_id
+    if typ in (4, 5, 6, 7):
+        msg_id = (body[0] << 8) | body[1]
+        return '%s id=%d' % (name, msg_id), msg_id
+    return name, 0
+
+
+def accept(srv):
+    s, _ = srv.accept()
+    s.settimeout(10)
+    typ, flags, body = read_packet(s)
+    # clean session flag of the CONNECT
+    print(NAMES[typ], 'clean', (body[9] >> 1) & 1)
+    s.send(b'\x20\x02\x00\x00')
+    return s
+
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(socket.getaddrinfo(host, int(port))[0][-1])
+srv.listen(1)
+
+# first connection: only the first two messages are acknowledged,
+# the PUBREL of the second one is never answered
+print('connection 1')
+s = accept(srv)
+ids = []
+for i in range(6):
+    text, msg_id = describe(read_packet(s))
+    ids.append(msg_id)
+    print(text)
+send_ack(s, 4, ids[0])
+send_ack(s, 5, ids[1])
+print(describe(read_packet(s))[0])
+s.close()
+
+# second connection: the client sends again what is not acknowledged
+# before anything else
+print('connection 2')
+s = accept(srv)
+for i in range(5):
+    text, msg_id = describe(read_packet(s))
+    print(text)
+send_ack(s, 7, ids[1])
+send_ack(s, 4, ids[2])
+send_ack(s, 5, ids[3])
+send_ack(s, 4, ids[4])
+send_ack(s, 4, ids[5])
+# the PUBREL of the fourth message and the new message come in any order
+got = []
+for i in range(2):
+    got.append(describe(read_packet(s)))
+got.sort()
+for text, msg_id in got:
+    print(text)
+    if text.startswith('PUBREL'):
+        send_ack(s, 7, msg_id)
+    else:
+        print('new id', msg_id not in ids)
+        send_ack(s, 4, msg_id)
+print(describe(read_packet(s))[0])
+s.close()
+srv.close()
@@ -0,0 +1,99 @@
+# The receive queue of network.mqtt (espmqtt/mqtt_rx.c) fed from a stream
+# of broker packets: messages of all sizes, payloads longer than the input
+# buffer, and an entry too large to be put at the end of the empty queue,
+# which has to restart at offset 0.  No message may be dropped.
+# The packets are written by ../host/mqtt/mkstream.py when mqttc is built.
+# This test is the broker.
+# server: ../host/mqtt/mqttc rx 2>/dev/null
+
+import sys
+import usocket as socket
+import ubinascii
+import host
+
+addr, port = sys.argv[1].split()
+
+MAX_PAYLOAD = 2048
+
+
+def read_exact(s, n):
+    data = b''
+    while len(data) < n:
+        d = s.recv(n - len(data))
+        if not d:
+            raise OSError('closed')
+        data += d
+    return data
+
+
+# returns (type, flags, body), PUBACKs of the client are skipped
+def read_packet(s):
+    while True:
+        hdr = read_exact(s, 1)[0]
+        length = 0
+        shift = 0
+        while True:
+            b = read_exact(s, 1)[0]
+            length |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        body = read_exact(s, length)
+        if hdr >> 4 != 4:
+            return hdr >> 4, hdr & 0x0f, body
+
+
+# the packets of the stream, as (type, flags, offset of the body, end)
+def packets(stream):
+    pos = 0
+    while pos < len(stream):
+        hdr = stream[pos]
+        pos += 1
+        length = 0
+        shift = 0
+        while True:
+            b = stream[pos]
+            pos += 1
+            length |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        yield hdr >> 4, hdr & 0x0f, pos, pos + length
+        pos += length
+
+
+stream = host.read_file(sys.argv[0][:sys.argv[0].rfind('/') + 1] + '../host/mqtt/mqtt_rx.stream')
+
+# what the client should receive: topics and payloads, payloads cut to MAX_PAYLOAD
+count = 0
+crc = 0
+first = None
+for typ, flags, start, end in packets(stream):
+    if first is None:
+        first = end
+    if typ == 3:
+        body = memoryview(stream)[start:end]
+        tlen = (body[0] << 8) | body[1]
+        pos = 2 + tlen + (2 if flags & 6 else 0)
+        crc = ubinascii.crc32(body[2:2 + tlen], crc)
+        crc = ubinascii.crc32(body[pos:pos + MAX_PAYLOAD], crc)
+        count += 1
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(socket.getaddrinfo(addr, int(port))[0][-1])
+srv.listen(1)
+s, _ = srv.accept()
+s.settimeout(10)
+print('CONNECT', read_packet(s)[0] == 1)
+# CONNACK, then the rest after the SUBSCRIBE
+s.write(stream[:first])
+print('SUBSCRIBE', read_packet(s)[0] == 8)
+s.write(memoryview(stream)[first:])
+
+typ, flags, body = read_packet(s)
+print('PUBLISH', typ == 3, body[2:9])
+result = body[9:].decode().split()
+print(result[0], int(result[1]) == count, result[2], result[3], result[4], int(result[5], 16) == crc & 0xffffffff)
+s.close()
+srv.close()
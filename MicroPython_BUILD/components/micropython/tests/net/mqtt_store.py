@@ -0,0 +1,90 @@
+# espmqtt with the persistent queue and a publisher faster than the replay:
+# the queue is never empty, the acknowledged segments are removed while it
+# is in use, so no message is dropped.  The connection is lost twice, the
+# replay restarts from the first message not acknowledged, the messages
+# sent again have DUP set.  This test is the broker.
+# server: ../host/mqtt/mqttc store 2>/dev/null
+
+import sys
+import usocket as socket
+
+addr, port = sys.argv[1].split()
+
+MESSAGES = 1000
+
+
+def read_exact(s, n):
+    data = b''
+    while len(data) < n:
+        d = s.recv(n - len(data))
+        if not d:
+            raise OSError('closed')
+        data += d
+    return data
+
+
+# returns (type, flags, body)
+def read_packet(s):
+    while True:
+        hdr = read_exact(s, 1)[0]
+        length = 0
+        shift = 0
+        while True:
+            b = read_exact(s, 1)[0]
+            length |= (b & 0x7f) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        body = read_exact(s, length)
+        if hdr >> 4 != 12:
+            return hdr >> 4, hdr & 0x0f, body
+        s.send(b'\xd0\x00')
+
+
+def accept(srv):
+    s, _ = srv.accept()
+    s.settimeout(10)
+    read_packet(s)
+    s.send(b'\x20\x02\x00\x00')
+    return s
+
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(socket.getaddrinfo(addr, int(port))[0][-1])
+srv.listen(1)
+
+# numbers of the messages in the order they first arrive
+order = []
+seen = set()
+no_dup = 0
+result = None
+connections = 0
+# the connection is closed after these many messages, then at the end
+for last in (300, 600, MESSAGES + 1):
+    s = accept(srv)
+    connections += 1
+    while len(order) < last and result is None:
+        typ, flags, body = read_packet(s)
+        tlen = (body[0] << 8) | body[1]
+        pos = 2 + tlen
+        if (flags >> 1) & 3:
+            s.send(bytes([0x40, 2, body[pos], body[pos + 1]]))
+            pos += 2
+        data = body[pos:].split()
+        if data[0] != b'msg':
+            result = body[pos:].decode()
+            break
+        n = int(data[1])
+        if n in seen:
+            no_dup += not flags >> 3
+        else:
+            seen.add(n)
+            order.append(n)
+    s.close()
+srv.close()
+
+print('connections', connections)
+print('messages', len(order), 'in order', order == list(range(MESSAGES)))
+print('sent again without DUP', no_dup)
+print(result)
@@ -0,0 +1,73 @@
+# The subscription tree of network.mqtt (espmqtt/mqtt_subs.c): '+' matches
+# one level, also an empty one, '#' the rest and the parent level, neither
+# matches a topic starting with '$' at the first level, and a topic matched
+# by several overlapping filters is given to each of them once.  The tree
+# holds 1000 more filters "dev/<n>/+/state".  tests/bench/mqtt_subs.py
+# reports the rate.  This test is the broker.
+# server: ../host/mqtt/mqttc subs 2>/dev/null
+
+import sys
+import usocket as socket
+
+addr, port = sys.argv[1].split()
+
+# as subs_topics[] of ../host/mqtt/main.c
+TOPICS = ('sensors/1/temp', 'sensors/2/temp', 'sensors/1', 'sensors', 'sensors/1/temp/raw',
+          '$SYS/broker/uptime', 'home/broker/load', 'a//temp', 'dev/500/x/state',
+          'dev/7/x/state', 'dev/7/x', 'other')
+ROUNDS = 1000
+
+
+def read_exact(s, n):
+    data = b''
+    while len(data) < n:
+        d = s.recv(n - len(data))
+        if not d:
+            raise OSError('closed')
+        data += d
+    return data
+
+
+# returns (type, body)
+def read_packet(s):
+    hdr = read_exact(s, 1)[0]
+    length = 0
+    shift = 0
+    while True:
+        b = read_exact(s, 1)[0]
+        length |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            break
+    return hdr >> 4, read_exact(s, length)
+
+
+def publish(s, topic, data=b''):
+    body = bytes([len(topic) >> 8, len(topic) & 0xff]) + topic + data
+    s.write(bytes([0x30, len(body)]) + body)
+    typ, body = read_packet(s)
+    return body[2 + ((body[0] << 8) | body[1]):].decode()
+
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.bind(socket.getaddrinfo(addr, int(port))[0][-1])
+srv.listen(1)
+s, _ = srv.accept()
+s.settimeout(10)
+print('CONNECT', read_packet(s)[0] == 1)
+s.write(b'\x20\x02\x00\x00')
+typ, body = read_packet(s)
+print('SUBSCRIBE', typ == 8)
+s.write(b'\x90\x03' + body[:2] + b'\x00')
+
+total = 0
+for topic in TOPICS:
+    reply = publish(s, topic.encode()).split()
+    print(reply[0], sorted(reply[1:]))
+    total += len(reply) - 1
+
+reply = publish(s, b'bench', b'%d' % ROUNDS).split()
+print('bench', reply[0], int(reply[1]) == ROUNDS * total, reply[2], float(reply[3]) > 0)
+s.close()
+srv.close()
@@ -0,0 +1,70 @@
+# A ussl.SSLContext keeps the session of its last client connection and
+# resumes it on the next connection to the same server_hostname and port;
+# the server context resumes it from its session ticket.  Without a host
+# name, or with sessions=False, every handshake is a full one.
+# ussl.wrap_socket() shares one context.  Needs the host build with USSL=1.
+# server: ../host/micropython ../host/ssl/server.py 2>/dev/null
+
+import sys
+
+try:
+    import ussl
+except ImportError:
+    print('SKIP')
+    sys.exit()
+import usocket as socket
+
+addr, port1, port2 = sys.argv[1].split()
+
+
+# prints whether the client and the server resumed the session
+def connect(ctx, port, hostname='localhost', size=0):
+    s = socket.socket()
+    s.connect(socket.getaddrinfo(addr, int(port))[0][-1])
+    s.settimeout(10)
+    if ctx is None:
+        ss = ussl.wrap_socket(s, server_hostname=hostname)
+    else:
+        ss = ctx.wrap_socket(s, server_hostname=hostname)
+    ss.write(b'%d\n' % size)
+    server = ss.readline().split()[1]
+    data = b''
+    while len(data) < size:
+        data += ss.read(size - len(data))
+    ss.close()
+    print('port', 1 if port == port1 else 2, 'client', ss.session_reused(), 'server', server == b'1')
+    return data
+
+
+ctx = ussl.SSLContext()
+for i in range(3):
+    connect(ctx, port1)
+
+print('another port')
+connect(ctx, port2)
+connect(ctx, port2)
+connect(ctx, port1)
+
+print('no server_hostname')
+connect(ctx, port1, None)
+connect(ctx, port1, None)
+
+print('sessions=False')
+ctx2 = ussl.SSLContext(sessions=False)
+connect(ctx2, port1)
+connect(ctx2, port1)
+
+print('wrap_socket')
+connect(None, port1)
+connect(None, port1)
+
+print('max_fragment=512')
+ctx3 = ussl.SSLContext(max_fragment=512)
+data = connect(ctx3, port1, size=5000)
+print(len(data), data == bytes(i & 0xff for i in range(5000)))
+connect(ctx3, port1)
+
+try:
+    ussl.SSLContext(max_fragment=100)
+except ValueError as e:
+    print('ValueError', e)
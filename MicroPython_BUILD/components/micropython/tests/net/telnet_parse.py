@@ -0,0 +1,68 @@
+# The input parser of esp32/libs/telnet.c with commands split across
+# received chunks: subnegotiations longer than the kept tail of a chunk,
+# IAC at the end of a chunk, CR NUL and Ctrl-C inside a subnegotiation.
+# telnetd writes back each line as the hex dump of what was let through
+# and the number of Ctrl-C seen so far.
+# server: ../host/telnet/telnetd 2>/dev/null
+
+import sys
+import usocket as socket
+import utime
+
+host, port = sys.argv[1].split()
+
+IAC = b'\xff'
+SB = b'\xfa'
+SE = b'\xf0'
+WILL = b'\xfb'
+ECHO = b'\x01'
+TTYPE = b'\x18'
+
+s = socket.socket()
+s.connect(socket.getaddrinfo(host, int(port))[0][-1])
+buf = b''
+
+
+def read_until(marker):
+    global buf
+    while marker not in buf:
+        d = s.recv(256)
+        if not d:
+            raise OSError('closed')
+        buf += d
+    i = buf.index(marker) + len(marker)
+    data, buf = buf[:i], buf[i:]
+    return data
+
+
+# every chunk in its own segment, telnetd reads them one by one
+def send(*chunks):
+    for c in chunks:
+        s.write(c)
+        utime.sleep_ms(100)
+    return read_until(b'\r\n').decode().rstrip()
+
+
+read_until(b'Login as: ')
+s.write(b'micro\r\n')
+# the options after the prompt, input before them is discarded
+read_until(b'Password: ' + IAC + WILL + ECHO)
+read_until(IAC + WILL + b'"')
+s.write(b'python\r\n')
+read_until(b'information.\r\n')
+# skip what the login left in the input
+while not send(b'sync\n').startswith('73796e63'):
+    pass
+
+print('plain', send(b'ab\n'))
+term = b'xterm-256color'
+print('long sb', send(b'a' + IAC + SB + TTYPE + b'\x00' + term[:5], term[5:], IAC + SE + b'b\n'))
+print('sb iac se', send(b'a' + IAC + SB + TTYPE + b'\x00' + term + IAC, SE + b'b\n'))
+print('sb iac iac', send(b'a' + IAC + SB + TTYPE + b'\x00' + IAC, IAC + term + IAC + SE + b'b\n'))
+print('sb in one', send(b'a' + IAC + SB + TTYPE + b'\x00' + term + IAC + SE + b'b\n'))
+print('iac', send(b'c' + IAC, WILL, ECHO + b'd\n'))
+print('iac iac', send(b'i' + IAC, IAC + b'j\n'))
+print('cr nul', send(b'e\r', b'\x00f\n'))
+print('ctrl-c in sb', send(IAC + SB + TTYPE + b'\x03', b'\x03' + IAC + SE + b'g\n'))
+print('ctrl-c', send(b'\x03h\n'))
+s.close()
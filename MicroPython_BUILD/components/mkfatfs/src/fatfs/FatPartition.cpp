@@ -17,8 +17,6 @@
 
 static const char *TAG = "FatPartition";
 
-std::vector<uint8_t> g_flashmem;
-
 
 FatPartition::FatPartition(const esp_partition_t *partition)
 {
@@ -40,9 +38,9 @@ esp_err_t FatPartition::erase_sector(size_t sector)
 esp_err_t FatPartition::erase_range(size_t start_address, size_t size)
 {
     esp_err_t result = ESP_FAIL;
-    if (g_flashmem.size() >= (start_address + size)) {
+    if (g_flashmemSize >= (start_address + size)) {
       result = ESP_OK;
-      memset(&g_flashmem[0] + start_address, 0xff, size);
+      memset(g_flashmem + start_address, 0xff, size);
     }
     if (result == ESP_OK) {
 	//The z portion is a length specifier which says the argument will be size_t in length.
@@ -56,9 +54,9 @@ esp_err_t FatPartition::erase_range(size_t start_address, size_t size)
 esp_err_t FatPartition::write(size_t dest_addr, const void *src, size_t size)
 {
     esp_err_t result = ESP_FAIL;
-    if (g_flashmem.size() >= (dest_addr + size)) {
+    if (g_flashmemSize >= (dest_addr + size)) {
       result = ESP_OK;
-      memcpy(&g_flashmem[0] + dest_addr, src, size);
+      memcpy(g_flashmem + dest_addr, src, size);
     }
     return result;
 }
@@ -66,9 +64,9 @@ esp_err_t FatPartition::write(size_t dest_addr, const void *src, size_t size)
 esp_err_t FatPartition::read(size_t src_addr, void *dest, size_t size)
 {
     esp_err_t result = ESP_FAIL;
-    if (g_flashmem.size() >= (src_addr + size)) {
+    if (g_flashmemSize >= (src_addr + size)) {
       result = ESP_OK;
-      memcpy(dest, &g_flashmem[0] + src_addr, size);
+      memcpy(dest, g_flashmem + src_addr, size);
     }
     return result;
 }
@@ -4,8 +4,7 @@
 #include "esp_err.h"
 #include "esp_partition.h"
 #include "Flash_Access.h"
-
-extern std::vector<uint8_t> g_flashmem;
+#include "image_file.h"
 
 /**
 * @brief This class is used to access partition. Class implements Flash_Access interface
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <stdlib.h>
+#include <string.h>
 #include <new>
 #include <sys/lock.h>
 #include "WL_Config.h"
@@ -83,6 +84,8 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
     }
 
     wl_ext_cfg_t cfg;
+    // The config, padding included, is stored in the image with its CRC
+    memset(&cfg, 0, sizeof(cfg));
     cfg.full_mem_size = partition->size;
     cfg.start_addr = WL_DEFAULT_START_ADDR;
     cfg.version = WL_CURRENT_VERSION;
@@ -77,9 +77,16 @@ DRESULT ff_disk_ioctl (BYTE pdrv, BYTE cmd, void* buff)
     return s_impls[pdrv]->ioctl(pdrv, cmd, buff);
 }
 
+static time_t s_fattime = (time_t) -1;
+
+void ff_diskio_set_fattime(time_t t)
+{
+    s_fattime = t;
+}
+
 DWORD get_fattime(void)
 {
-    time_t t = time(NULL);
+    time_t t = (s_fattime != (time_t) -1) ? s_fattime : time(NULL);
     struct tm *tmr = gmtime(&t);
     int year = tmr->tm_year < 80 ? 0 : tmr->tm_year - 80;
     return    ((DWORD)(year) << 25)
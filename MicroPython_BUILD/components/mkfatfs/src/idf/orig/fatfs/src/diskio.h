@@ -9,6 +9,7 @@
 extern "C" {
 #endif
 
+#include <time.h>
 #include "integer.h"
 #include "sdmmc_cmd.h"
 #include "driver/sdmmc_host.h"
@@ -89,6 +90,13 @@ void ff_diskio_register_sdmmc(BYTE pdrv, sdmmc_card_t* card);
  */
 esp_err_t ff_diskio_get_drive(BYTE* out_pdrv);
 
+/**
+ * Set the time get_fattime() returns instead of the current time
+ *
+ * @param t  seconds since the epoch, or -1 to go back to the current time
+ */
+void ff_diskio_set_fattime(time_t t);
+
 /* Disk Status Bits (DSTATUS) */
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
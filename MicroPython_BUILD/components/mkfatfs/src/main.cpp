@@ -19,6 +19,8 @@
 #include <time.h>
 #include <memory>
 #include <cstdlib>
+#include <fstream>
+#include <sstream>
 #include "tclap/CmdLine.h"
 #include "tclap/UnlabeledValueArg.h"
 
@@ -33,10 +35,13 @@
 #include "wear_levelling.h"
 #include "esp_err.h"
 #include "esp_vfs_fat.h"
+#include "diskio.h"
+#include "diskio_spiflash.h"
 //#include "esp_vfs.h" //do not include, dirent.h conflict
 
 #include "fatfs/fatfs.h"
 #include "fatfs/FatPartition.h"
+#include "image_util.h"
 
 static const char *BASE_PATH = "/spiflash";
 
@@ -48,9 +53,20 @@ static Action s_action = ACTION_NONE;
 static std::string s_dirName;
 static std::string s_imageName;
 static int s_imageSize;
+static bool s_useMmap = false;
+static std::string s_manifestName;
+static time_t s_timestamp;
 
 static wl_handle_t s_wl_handle;
 static FATFS* s_fs = NULL;
+static char s_drv[3] = "0:";    // FatFs drive of the mounted image
+
+// Smallest whole number of clusters holding at least 32 KB; file data is
+// moved in and out of the image in chunks of this size.
+static size_t ioChunkSize() {
+    size_t cluster = (size_t)s_fs->csize * s_fs->ssize;
+    return ((32 * 1024 + cluster - 1) / cluster) * cluster;
+}
 
 
 // WHITECAT BEGIN
@@ -73,8 +89,6 @@ int addDir(const char* name) {
 // WHITECAT END
 
 int addFile(char* name, const char* path) {
-    //spiffs_metadata_t meta;
-
     FILE* src = fopen(path, "rb");
     if (!src) {
         std::cerr << "error: failed to open " << path << " for reading" << std::endl;
@@ -82,13 +96,13 @@ int addFile(char* name, const char* path) {
     }
 
 
-    std::string nameInFat = BASE_PATH;
+    std::string nameInFat = s_drv;
     nameInFat += name;
 
-    const int flags = O_CREAT | O_TRUNC | O_RDWR;
-    int fd = emulate_esp_vfs_open(nameInFat.c_str(), flags, 0);
-    if (fd < 0) {
+    FIL dst;
+    if (f_open(&dst, nameInFat.c_str(), FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
         std::cerr << "error: failed to open \"" << nameInFat << "\" for writing" << std::endl;
+        fclose(src);
         return 0; //0 does not stop copying files
     }
 
@@ -102,35 +116,40 @@ int addFile(char* name, const char* path) {
         std::cout << "file size: " << size << std::endl;
     }
 
+    // Allocate the whole file as one contiguous cluster chain up front, so
+    // f_write() does not extend the FAT chain cluster by cluster. Without
+    // enough contiguous free space the file just grows as it is written.
+    if (size > 0 && f_expand(&dst, size, 1) != FR_OK) {
+        if (g_debugLevel > 0) {
+            std::cout << "no contiguous space, file will be fragmented" << std::endl;
+        }
+    }
+
+    std::vector<uint8_t> buffer(ioChunkSize());
     size_t left = size;
-    uint8_t data_byte;
     while (left > 0){
-        if (1 != fread(&data_byte, 1, 1, src)) {
+        size_t chunk = (left < buffer.size()) ? left : buffer.size();
+        if (chunk != fread(&buffer[0], 1, chunk, src)) {
             std::cerr << "fread error!" << std::endl;
             fclose(src);
-            emulate_esp_vfs_close(fd);
+            f_close(&dst);
             return 1;
         }
-        ssize_t res = emulate_esp_vfs_write(fd, &data_byte, 1);
-        if (res < 0) {
-            std::cerr << "esp_vfs_write() error" << std::endl;
+        UINT written = 0;
+        FRESULT res = f_write(&dst, &buffer[0], chunk, &written);
+        if (res != FR_OK || written != chunk) {
+            std::cerr << "f_write() error" << std::endl;
             if (g_debugLevel > 0) {
                 std::cout << "data left: " << left << std::endl;
             }
             fclose(src);
-            emulate_esp_vfs_close(fd);
+            f_close(&dst);
             return 1;
         }
-        left -= 1;
+        left -= chunk;
     }
 
-    emulate_esp_vfs_close(fd);
-
-    // Get the system time to file timestamps
-//    meta.atime = time(NULL);
-//    meta.ctime = meta.atime;
-//    meta.mtime = meta.atime;
-//    SPIFFS_update_meta(&s_fs, name, &meta);
+    f_close(&dst);
 
     fclose(src);
 
@@ -138,23 +157,18 @@ int addFile(char* name, const char* path) {
 }
 
 int addFiles(const char* dirname, const char* subPath) {
-    DIR *dir;
-    struct dirent *ent;
+    std::vector<std::string> entries;
     bool error = false;
     std::string dirPath = dirname;
     dirPath += subPath;
 
     // Open directory
-    if ((dir = opendir (dirPath.c_str())) != NULL) {
+    if (readDirSorted(dirPath, entries)) {
 
         // Read files from directory.
-        while ((ent = readdir (dir)) != NULL) {
-            // Ignore dir itself.
-            if (ent->d_name[0] == '.')				
-                continue;            	
-
+        for (size_t i = 0; i < entries.size(); i++) {
             std::string fullpath = dirPath;
-            fullpath += ent->d_name;
+            fullpath += entries[i];
             struct stat path_stat;
             stat (fullpath.c_str(), &path_stat);
 
@@ -163,7 +177,7 @@ int addFiles(const char* dirname, const char* subPath) {
                 if (S_ISDIR(path_stat.st_mode)) {
                     // Prepare new sub path.
                     std::string newSubPath = subPath;
-                    newSubPath += ent->d_name;
+                    newSubPath += entries[i];
 					
 					// WHITECAT BEGIN
 					addDir(newSubPath.c_str());
@@ -173,21 +187,21 @@ int addFiles(const char* dirname, const char* subPath) {
 
                     if (addFiles(dirname, newSubPath.c_str()) != 0)
                     {
-                        std::cerr << "Error for adding content from " << ent->d_name << "!" << std::endl;
+                        std::cerr << "Error for adding content from " << entries[i] << "!" << std::endl;
                     }
 
                     continue;
                 }
                 else
                 {
-                    std::cerr << "skipping " << ent->d_name << std::endl;
+                    std::cerr << "skipping " << entries[i] << std::endl;
                     continue;
                 }
             }
 
             // Filepath with dirname as root folder.
             std::string filepath = subPath;
-            filepath += ent->d_name;
+            filepath += entries[i];
             std::cout << "adding to image: " << filepath << std::endl;
 
             // Add File to image.
@@ -200,7 +214,6 @@ int addFiles(const char* dirname, const char* subPath) {
                 break;
             }
         } // end while
-        closedir (dir);
     } else {
         std::cerr << "warning: can't read source directory: \"" << dirPath << "\"" << std::endl;
         return 1;
@@ -209,32 +222,38 @@ int addFiles(const char* dirname, const char* subPath) {
     return (error) ? 1 : 0;
 }
 
-/*
-void listFiles() {
-    spiffs_DIR dir;
-    spiffs_dirent ent;
+void listFiles(const std::string& name) {
+    // FatFs does not accept a trailing "/" other than for the root
+    std::string nameInFat = s_drv;
+    nameInFat += name.substr(0, (name.size() > 1) ? name.size() - 1 : 1);
 
-    SPIFFS_opendir(&s_fs, 0, &dir);
-    spiffs_dirent* it;
-    while (true) {
-        it = SPIFFS_readdir(&dir, &ent);
-        if (!it)
-            break;
-
-        std::cout << it->size << '\t' << it->name << std::endl;
+    FF_DIR dir;
+    if (f_opendir(&dir, nameInFat.c_str()) != FR_OK) {
+        return;
+    }
+    FILINFO info;
+    while (f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0) {
+        std::string entryName = name + info.fname;
+        if (info.fattrib & AM_DIR) {
+            listFiles(entryName + "/");
+            continue;
+        }
+        std::cout << info.fsize << '\t' << entryName << std::endl;
     }
-    SPIFFS_closedir(&dir);
+    f_closedir(&dir);
 }
-*/
 
 
 
-bool fatfsMount(){
+bool fatfsMount(bool format_if_mount_failed = true){
   bool result;
   esp_vfs_fat_mount_config_t mountConfig;
   mountConfig.max_files = 4;
-  mountConfig.format_if_mount_failed = true;
+  mountConfig.format_if_mount_failed = format_if_mount_failed;
   result = (ESP_OK == emulate_esp_vfs_fat_spiflash_mount(BASE_PATH, &mountConfig, &s_wl_handle, &s_fs, s_imageSize));
+  if (result) {
+    s_drv[0] = '0' + ff_diskio_get_pdrv_wl(s_wl_handle);
+  }
 
   return result;
 }
@@ -304,38 +323,107 @@ bool dirCreate(const char* path) {
 
 /**
  * @brief Unpack file from file system.
- * @param spiffsFile SPIFFS dir entry pointer.
+ * @param name File path in the image, relative to the drive.
  * @param destPath Destination file path path.
  * @return True or false.
- *
- * @author Pascal Gollor (http://www.pgollor.de/cms/)
  */
-/*
-bool unpackFile(spiffs_dirent *spiffsFile, const char *destPath) {
-    u8_t buffer[spiffsFile->size];
-    std::string filename = (const char*)(spiffsFile->name);
-
-    // Open file from spiffs file system.
-    spiffs_file src = SPIFFS_open(&s_fs, (char *)(filename.c_str()), SPIFFS_RDONLY, 0);
-
-    // read content into buffer
-    SPIFFS_read(&s_fs, src, buffer, spiffsFile->size);
+bool unpackFile(const std::string& name, const char *destPath) {
+    std::string nameInFat = s_drv;
+    nameInFat += name;
 
-    // Close spiffs file.
-    SPIFFS_close(&s_fs, src);
+    // Open file from fat file system.
+    FIL src;
+    if (f_open(&src, nameInFat.c_str(), FA_READ) != FR_OK) {
+        return false;
+    }
 
     // Open file.
     FILE* dst = fopen(destPath, "wb");
+    if (!dst) {
+        f_close(&src);
+        return false;
+    }
 
-    // Write content into file.
-    fwrite(buffer, sizeof(u8_t), sizeof(buffer), dst);
+    // Stream content through a fixed size buffer.
+    bool result = true;
+    std::vector<uint8_t> buffer(ioChunkSize());
+    while (true) {
+        UINT count = 0;
+        if (f_read(&src, &buffer[0], buffer.size(), &count) != FR_OK) {
+            result = false;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+        if (fwrite(&buffer[0], 1, count, dst) != count) {
+            result = false;
+            break;
+        }
+    }
 
-    // Close file.
     fclose(dst);
-    return true;
+    f_close(&src);
+
+    return result;
 }
-*/
 
+/**
+ * @brief Unpack a directory of the file system, recursively.
+ * @param name Directory path in the image, ending with "/".
+ * @param sDest Host directory to unpack into, ending with "/".
+ * @return True or false.
+ */
+bool unpackDir(const std::string& name, const std::string& sDest) {
+    // FatFs does not accept a trailing "/" other than for the root
+    std::string nameInFat = s_drv;
+    nameInFat += name.substr(0, (name.size() > 1) ? name.size() - 1 : 1);
+
+    // Open directory.
+    FF_DIR dir;
+    if (f_opendir(&dir, nameInFat.c_str()) != FR_OK) {
+        std::cerr << "Can not open directory " << name << "!" << std::endl;
+        return false;
+    }
+
+    bool result = true;
+    FILINFO info;
+    while (result && f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0) {
+        std::string entryName = name + info.fname;
+        std::string sDestPath = sDest + info.fname;
+
+        if (info.fattrib & AM_DIR) {
+            // Create subdir if subdir not exists.
+            if (!dirExists(sDestPath.c_str()) && !dirCreate(sDestPath.c_str())) {
+                result = false;
+                break;
+            }
+            result = unpackDir(entryName + "/", sDestPath + "/");
+            continue;
+        }
+
+        // Unpack file to destination directory.
+        if (! unpackFile(entryName, sDestPath.c_str()) ) {
+            std::cout << "Can not unpack " << entryName << "!" << std::endl;
+            result = false;
+            break;
+        }
+
+        // Output stuff.
+        std::cout
+            << entryName
+            << '\t'
+            << " > " << sDestPath
+            << '\t'
+            << "size: " << info.fsize << " Bytes"
+            << std::endl;
+    }
+
+    // Close directory.
+    f_closedir(&dir);
+
+    return result;
+}
 
 /**
  * @brief Unpack files from file system.
@@ -343,14 +431,8 @@ bool unpackFile(spiffs_dirent *spiffsFile, const char *destPath) {
  * @return True or false.
  *
  * @author Pascal Gollor (http://www.pgollor.de/cms/)
- *
- * todo: Do unpack stuff for directories.
  */
 bool unpackFiles(std::string sDest) {
-/*
-    spiffs_DIR dir;
-    spiffs_dirent ent;
-
     // Add "./" to path if is not given.
     if (sDest.find("./") == std::string::npos && sDest.find("/") == std::string::npos) {
         sDest = "./" + sDest;
@@ -366,56 +448,11 @@ bool unpackFiles(std::string sDest) {
         }
     }
 
-    // Open directory.
-    SPIFFS_opendir(&s_fs, 0, &dir);
-
-    // Read content from directory.
-    spiffs_dirent* it = SPIFFS_readdir(&dir, &ent);
-    while (it) {
-        // Check if content is a file.
-        if ((int)(it->type) == 1) {
-            std::string name = (const char*)(it->name);
-            std::string sDestFilePath = sDest + name;
-            size_t pos = name.find_last_of("/");
-
-            // If file is in sub directory?
-            if (pos > 0) {
-                // Subdir path.
-                std::string path = sDest;
-                path += name.substr(0, pos);
-
-                // Create subddir if subdir not exists.
-                if (!dirExists(path.c_str())) {
-                    if (!dirCreate(path.c_str())) {
-                        return false;
-                    }
-                }
-            }
-
-            // Unpack file to destination directory.
-            if (! unpackFile(it, sDestFilePath.c_str()) ) {
-                std::cout << "Can not unpack " << it->name << "!" << std::endl;
-                return false;
-            }
-
-            // Output stuff.
-            std::cout
-                << it->name
-                << '\t'
-                << " > " << sDestFilePath
-                << '\t'
-                << "size: " << it->size << " Bytes"
-                << std::endl;
-        }
-
-        // Get next file handle.
-        it = SPIFFS_readdir(&dir, &ent);
-    } // end while
+    if (sDest[sDest.size() - 1] != '/') {
+        sDest += "/";
+    }
 
-    // Close directory.
-    SPIFFS_closedir(&dir);
-*/
-    return true;
+    return unpackDir("/", sDest);
 }
 
 // Actions
@@ -423,11 +460,21 @@ bool unpackFiles(std::string sDest) {
 int actionPack() {
     int ret = 0; //0 - ok
 
-    g_flashmem.resize(s_imageSize, 0xff);
+    std::string manifest;
+    if (!s_manifestName.empty()) {
+        std::ostringstream header;
+        header << "mkfatfs " << APP_VERSION << std::endl;
+        header << "config size=" << s_imageSize << " timestamp=" << (long long)s_timestamp << std::endl;
+        manifest = buildManifest(header.str(), s_dirName);
+        if (imageUpToDate(s_manifestName, manifest, s_imageName, s_imageSize)) {
+            std::cout << "image is up to date" << std::endl;
+            return 0;
+        }
+    }
 
-    FILE* fdres = fopen(s_imageName.c_str(), "wb");
-    if (!fdres) {
+    if (!imageCreate(s_imageName.c_str(), s_imageSize, s_useMmap)) {
         std::cerr << "error: failed to open image file" << std::endl;
+        imageClose();
         return 1;
     }
 
@@ -437,6 +484,7 @@ int actionPack() {
       }
     } else {
       std::cerr << "Mount failed" << std::endl;
+      imageClose();
       return 1;
     }  
 
@@ -451,8 +499,31 @@ int actionPack() {
     ret = addFiles(s_dirName.c_str(), "/");
     fatfsUnmount();
 
-    fwrite(&g_flashmem[0], 4, g_flashmem.size()/4, fdres);
-    fclose(fdres);
+    std::string imageHash;
+    if (!manifest.empty()) {
+        CRYAL_SHA256_CTX ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, g_flashmem, g_flashmemSize);
+        imageHash = sha256Hex(&ctx);
+    }
+
+    if (!imageClose()) {
+        std::cerr << "error: failed to write image file" << std::endl;
+        return 1;
+    }
+
+    if (!manifest.empty()) {
+        // a failed pack must not leave a manifest claiming the image is current
+        remove(s_manifestName.c_str());
+        if (ret == 0) {
+            std::ofstream out(s_manifestName.c_str(), std::ios::binary);
+            out << manifest << manifestImageLine(imageHash, s_imageSize);
+            if (!out) {
+                std::cerr << "error: failed to write manifest file" << std::endl;
+                return 1;
+            }
+        }
+    }
 
     if (g_debugLevel > 0) {
       std::cout << "Image file is written to \"" << s_imageName << "\"" << std::endl;
@@ -469,56 +540,51 @@ int actionPack() {
  */
 int actionUnpack(void) {
     int ret = 0;
-/*
-    g_flashmem.resize(s_imageSize, 0xff);
 
-    // open spiffs image
-    FILE* fdsrc = fopen(s_imageName.c_str(), "rb");
-    if (!fdsrc) {
+    // open fat image
+    if (!imageOpen(s_imageName.c_str(), s_imageSize)) {
         std::cerr << "error: failed to open image file" << std::endl;
         return 1;
     }
 
-    // read content into g_flashmem
-    ret = fread(&g_flashmem[0], 4, g_flashmem.size()/4, fdsrc);
-
-    // close fiel handle
-    fclose(fdsrc);
-
-    // mount file system
-    spiffsMount();
+    // mount file system, never format an image being unpacked
+    if (!fatfsMount(false)) {
+        std::cerr << "Mount failed" << std::endl;
+        imageClose();
+        return 1;
+    }
 
     // unpack files
+    ret = 0;
     if (! unpackFiles(s_dirName)) {
         ret = 1;
     }
 
     // unmount file system
-    spiffsUnmount();
-*/
+    fatfsUnmount();
+    imageClose();
+
     return ret;
 }
 
 
 int actionList() {
     int ret = 0;
-/*
-    g_flashmem.resize(s_imageSize, 0xff);
 
-    FILE* fdsrc = fopen(s_imageName.c_str(), "rb");
-    if (!fdsrc) {
+    if (!imageOpen(s_imageName.c_str(), s_imageSize)) {
         std::cerr << "error: failed to open image file" << std::endl;
         return 1;
     }
 
-    ret = fread(&g_flashmem[0], 4, g_flashmem.size()/4, fdsrc);
-    fclose(fdsrc);
-    spiffsMount();
-    listFiles();
-    spiffsUnmount();
-    
-    ret = 0;
-*/
+    if (!fatfsMount(false)) {
+        std::cerr << "Mount failed" << std::endl;
+        imageClose();
+        return 1;
+    }
+    listFiles("/");
+    fatfsUnmount();
+    imageClose();
+
     return ret;
 }
 
@@ -557,9 +623,15 @@ void processArgs(int argc, const char** argv) {
     TCLAP::UnlabeledValueArg<std::string> outNameArg( "image_file", "spiffs image file", true, "", "image_file"  );
     TCLAP::ValueArg<int> imageSizeArg( "s", "size", "fs image size, in bytes", false, 0x10000, "number" );
     TCLAP::ValueArg<int> debugArg( "d", "debug", "Debug level. 0 means no debug output.", false, 0, "0-5" );
+    TCLAP::SwitchArg mmapArg( "m", "mmap", "pack directly into the memory mapped image file instead of a copy in memory", false);
+    TCLAP::ValueArg<std::string> manifestArg( "M", "manifest", "with --create, write a manifest with the SHA-256 of each file and of the image, and skip packing if it shows the image is up to date", false, "", "manifest_file");
+    TCLAP::ValueArg<long> timestampArg( "T", "timestamp", "timestamp given to the files and the volume serial, in seconds since the epoch (default: SOURCE_DATE_EPOCH or the current time)", false, -1, "seconds");
 
     cmd.add( imageSizeArg );
     cmd.add(debugArg);
+    cmd.add(mmapArg);
+    cmd.add(manifestArg);
+    cmd.add(timestampArg);
     std::vector<TCLAP::Arg*> args = {&packArg, &unpackArg, &listArg, &visualizeArg};
     cmd.xorAdd( args );
     cmd.add( outNameArg );
@@ -584,8 +656,12 @@ void processArgs(int argc, const char** argv) {
 
     s_imageName = outNameArg.getValue();
     s_imageSize = imageSizeArg.getValue();
+    s_useMmap = mmapArg.getValue();
+    s_manifestName = manifestArg.getValue();
 
-
+    // One timestamp for every file, fixed for reproducible images
+    s_timestamp = imageTimestamp(timestampArg.getValue());
+    ff_diskio_set_fattime(s_timestamp);
 }
 
 int main(int argc, const char * argv[]) {
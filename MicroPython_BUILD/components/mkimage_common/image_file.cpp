@@ -0,0 +1,106 @@
+//
+//  image_file.cpp
+//  Flash image backing shared by mkspiffs and mkfatfs
+//
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+#include "image_file.h"
+
+uint8_t* g_flashmem = NULL;
+size_t g_flashmemSize = 0;
+
+static std::vector<uint8_t> s_flashmemBuf;
+static FILE* s_imageFile = NULL;
+static bool s_flashmemMapped = false;
+
+bool imageCreate(const char* path, size_t size, bool mapped) {
+    s_imageFile = fopen(path, "wb+");
+    if (!s_imageFile) {
+        return false;
+    }
+    g_flashmemSize = size;
+#if !defined(_WIN32)
+    if (mapped) {
+        // Erased flash reads as 0xff, so fill the file rather than leaving
+        // it sparse. Going through the page cache keeps it out of our RSS.
+        std::vector<uint8_t> erased(64 * 1024, 0xff);
+        for (size_t pos = 0; pos < size; pos += erased.size()) {
+            size_t len = (size - pos < erased.size()) ? size - pos : erased.size();
+            if (fwrite(&erased[0], 1, len, s_imageFile) != len) {
+                return false;
+            }
+        }
+        fflush(s_imageFile);
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(s_imageFile), 0);
+        if (mem == MAP_FAILED) {
+            std::cerr << "error: failed to map the image file" << std::endl;
+            return false;
+        }
+        g_flashmem = (uint8_t*)mem;
+        s_flashmemMapped = true;
+        return true;
+    }
+#else
+    if (mapped) {
+        std::cerr << "warning: --mmap is not supported on this platform" << std::endl;
+    }
+#endif
+    s_flashmemBuf.resize(size, 0xff);
+    g_flashmem = &s_flashmemBuf[0];
+    return true;
+}
+
+bool imageOpen(const char* path, size_t size) {
+    FILE* fdsrc = fopen(path, "rb");
+    if (!fdsrc) {
+        return false;
+    }
+    g_flashmemSize = size;
+#if !defined(_WIN32)
+    struct stat st;
+    // a short image can't be mapped, pages past its end are not accessible
+    if (fstat(fileno(fdsrc), &st) == 0 && (size_t)st.st_size >= size) {
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fdsrc), 0);
+        if (mem != MAP_FAILED) {
+            fclose(fdsrc);
+            g_flashmem = (uint8_t*)mem;
+            s_flashmemMapped = true;
+            return true;
+        }
+    }
+#endif
+    s_flashmemBuf.resize(size, 0xff);
+    g_flashmem = &s_flashmemBuf[0];
+    if (fread(g_flashmem, 1, size, fdsrc) != size) {
+        std::cerr << "warning: image file is smaller than the image size" << std::endl;
+    }
+    fclose(fdsrc);
+    return true;
+}
+
+bool imageClose() {
+    bool result = true;
+#if !defined(_WIN32)
+    if (s_flashmemMapped) {
+        munmap(g_flashmem, g_flashmemSize);
+    }
+#endif
+    if (s_imageFile) {
+        if (g_flashmem && !s_flashmemMapped) {
+            result = (fwrite(g_flashmem, 1, g_flashmemSize, s_imageFile) == g_flashmemSize);
+        }
+        result = (fclose(s_imageFile) == 0) && result;
+        s_imageFile = NULL;
+    }
+    g_flashmem = NULL;
+    g_flashmemSize = 0;
+    s_flashmemMapped = false;
+    std::vector<uint8_t>().swap(s_flashmemBuf);
+    return result;
+}
@@ -0,0 +1,33 @@
+//
+//  image_file.h
+//  Flash image backing shared by mkspiffs and mkfatfs
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Flash contents the file system works on: a heap buffer, or the image
+// file mapped into memory.
+extern uint8_t* g_flashmem;
+extern size_t g_flashmemSize;
+
+/**
+ * @brief Create the image file and the flash contents backing it.
+ * @param mapped Map the file and work on it in place instead of in memory.
+ * @return True or false.
+ */
+bool imageCreate(const char* path, size_t size, bool mapped);
+
+/**
+ * @brief Open an existing image. It is mapped copy-on-write where
+ * possible, so the image file itself is never modified.
+ * @return True or false.
+ */
+bool imageOpen(const char* path, size_t size);
+
+/**
+ * @brief Write back an image from imageCreate() and release the flash contents.
+ * @return True or false.
+ */
+bool imageClose();
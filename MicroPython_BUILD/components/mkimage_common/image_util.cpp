@@ -0,0 +1,116 @@
+//
+//  image_util.cpp
+//  Reproducible image helpers shared by mkspiffs and mkfatfs
+//
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "image_util.h"
+
+bool readDirSorted(const std::string& dirPath, std::vector<std::string>& entries) {
+    DIR *dir;
+    struct dirent *ent;
+
+    if ((dir = opendir (dirPath.c_str())) == NULL) {
+        return false;
+    }
+    while ((ent = readdir (dir)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        entries.push_back(ent->d_name);
+    }
+    closedir (dir);
+    std::sort(entries.begin(), entries.end());
+    return true;
+}
+
+std::string sha256Hex(CRYAL_SHA256_CTX* ctx) {
+    SHA256_BYTE hash[SHA256_BLOCK_SIZE];
+    sha256_final(ctx, hash);
+    char hex[SHA256_BLOCK_SIZE * 2 + 1];
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        snprintf(hex + i * 2, 3, "%02x", hash[i]);
+    }
+    return hex;
+}
+
+std::string sha256File(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return "";
+    }
+    CRYAL_SHA256_CTX ctx;
+    sha256_init(&ctx);
+    std::vector<uint8_t> buf(64 * 1024);
+    size_t n;
+    while ((n = fread(&buf[0], 1, buf.size(), f)) > 0) {
+        sha256_update(&ctx, &buf[0], n);
+    }
+    bool failed = ferror(f);
+    fclose(f);
+    return failed ? "" : sha256Hex(&ctx);
+}
+
+static void collectManifest(const std::string& dirName, const std::string& subPath, std::ostream& out) {
+    std::vector<std::string> entries;
+    std::string dirPath = dirName + subPath;
+
+    if (!readDirSorted(dirPath, entries)) {
+        return;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string fullpath = dirPath + entries[i];
+        std::string name = subPath + entries[i];
+        struct stat path_stat;
+        stat (fullpath.c_str(), &path_stat);
+
+        if (S_ISREG(path_stat.st_mode)) {
+            out << "file " << sha256File(fullpath) << " " << name << std::endl;
+        } else if (S_ISDIR(path_stat.st_mode)) {
+            out << "dir " << name << std::endl;
+            collectManifest(dirName, name + "/", out);
+        }
+    }
+}
+
+std::string buildManifest(const std::string& header, const std::string& dirName) {
+    std::ostringstream out;
+    out << header;
+    collectManifest(dirName, "/", out);
+    return out.str();
+}
+
+std::string manifestImageLine(const std::string& hash, size_t imageSize) {
+    return "image " + hash + " " + std::to_string(imageSize) + "\n";
+}
+
+bool imageUpToDate(const std::string& manifestPath, const std::string& manifest,
+                   const std::string& imagePath, size_t imageSize) {
+    std::ifstream in(manifestPath.c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::string old((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (old.compare(0, manifest.size(), manifest) != 0) {
+        return false;
+    }
+    std::string hash = sha256File(imagePath);
+    return !hash.empty() && old == manifest + manifestImageLine(hash, imageSize);
+}
+
+time_t imageTimestamp(long seconds) {
+    const char* sourceDateEpoch = getenv("SOURCE_DATE_EPOCH");
+    if (seconds >= 0) {
+        return (time_t)seconds;
+    } else if (sourceDateEpoch && *sourceDateEpoch) {
+        return (time_t)strtoll(sourceDateEpoch, NULL, 10);
+    }
+    return time(NULL);
+}
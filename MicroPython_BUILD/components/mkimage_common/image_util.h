@@ -0,0 +1,55 @@
+//
+//  image_util.h
+//  Reproducible image helpers shared by mkspiffs and mkfatfs
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include <time.h>
+extern "C" {
+#include "sha256/sha256.h"
+}
+
+/**
+ * @brief Read the entries of a host directory, without the hidden ones,
+ * sorted by name so the image does not depend on the readdir() order.
+ * @return false if the directory can't be opened
+ */
+bool readDirSorted(const std::string& dirPath, std::vector<std::string>& entries);
+
+/**
+ * @brief Finish a SHA-256 and return it as a hex string.
+ */
+std::string sha256Hex(CRYAL_SHA256_CTX* ctx);
+
+/**
+ * @brief SHA-256 of a host file as a hex string, empty if it can't be read.
+ */
+std::string sha256File(const std::string& path);
+
+/**
+ * @brief Manifest of what goes into the image: the header, which names the
+ * tool, its version and the image geometry, then the directories and the
+ * SHA-256 of each file under dirName, in the order the tools add them.
+ * The image hash line is appended after packing.
+ */
+std::string buildManifest(const std::string& header, const std::string& dirName);
+
+/**
+ * @brief The manifest line recording the packed image.
+ */
+std::string manifestImageLine(const std::string& hash, size_t imageSize);
+
+/**
+ * @brief Check if the manifest file matches the inputs and the image file
+ * still has the hash recorded in it, so packing would give the same image.
+ */
+bool imageUpToDate(const std::string& manifestPath, const std::string& manifest,
+                   const std::string& imagePath, size_t imageSize);
+
+/**
+ * @brief The timestamp given to every file: the --timestamp value if it
+ * is not negative, else SOURCE_DATE_EPOCH if set, else the current time.
+ */
+time_t imageTimestamp(long seconds);
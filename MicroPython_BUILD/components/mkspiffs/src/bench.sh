@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Pack a synthetic tree of 1000 files (512 bytes to 12 KB, in 10
+# directories) and report the packing speed, reading the host files
+# inline (-j 0) and with reader threads (-j 4).
+#
+# usage: bench.sh [path to mkspiffs]
+
+MKSPIFFS=${1:-./mkspiffs}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/tree"
+awk 'BEGIN { s = 1; for (i = 0; i < 1000; i++) {
+        s = (s * 1103515245 + 12345) % 2147483648
+        printf "%d %d %d\n", i % 10, i, 512 + s % 11776 } }' |
+while read dir file size; do
+    mkdir -p "$WORK/tree/d$dir"
+    head -c "$size" /dev/urandom > "$WORK/tree/d$dir/f$file.bin"
+done
+BYTES=$(cat "$WORK"/tree/*/* | wc -c)
+
+for jobs in 0 4; do
+    START=$(date +%s.%N)
+    "$MKSPIFFS" -c "$WORK/tree" -b 4096 -p 256 -s 16777216 -j $jobs "$WORK/image.bin" > /dev/null || exit 1
+    END=$(date +%s.%N)
+    echo "$BYTES $START $END $jobs" | awk '{ printf "-j %d: %d files, %.1f MB in %.3f s, %.1f MB/s\n",
+        $4, 1000, $1 / 1e6, $3 - $2, $1 / 1e6 / ($3 - $2) }'
+done
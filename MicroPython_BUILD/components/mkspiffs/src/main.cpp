@@ -10,6 +10,9 @@
 
 #include <iostream>
 #include "spiffs/spiffs.h"
+#include "spiffs/spiffs_nucleus.h"
+#include "image_file.h"
+#include "image_util.h"
 #include <vector>
 #include <dirent.h>
 #include <sys/types.h>
@@ -20,16 +23,35 @@
 #include <time.h>
 #include <memory>
 #include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
 #include "tclap/CmdLine.h"
 #include "tclap/UnlabeledValueArg.h"
 
-static std::vector<uint8_t> s_flashmem;
+static bool s_useMmap = false;
+static bool s_json = false;
 
 static std::string s_dirName;
 static std::string s_imageName;
+static std::string s_deltaName;
+static std::string s_manifestName;
+static time_t s_timestamp;
 static int s_imageSize;
 static int s_pageSize;
 static int s_blockSize;
+static int s_jobs;
+static std::string s_simWorkload;
+static int s_simOps;
+static int s_simFill;
+static int s_simGcReserve;
 
 typedef struct {
 	time_t mtime;
@@ -38,7 +60,7 @@ typedef struct {
 	uint8_t spare[SPIFFS_OBJ_META_LEN - (sizeof(time_t)*3)];
 } spiffs_metadata_t;
 
-enum Action { ACTION_NONE, ACTION_PACK, ACTION_UNPACK, ACTION_LIST, ACTION_VISUALIZE };
+enum Action { ACTION_NONE, ACTION_PACK, ACTION_UNPACK, ACTION_LIST, ACTION_VISUALIZE, ACTION_UPDATE, ACTION_SIMULATE };
 static Action s_action = ACTION_NONE;
 
 static spiffs s_fs;
@@ -48,18 +70,52 @@ static std::vector<uint8_t> s_spiffsFds;
 static std::vector<uint8_t> s_spiffsCache;
 
 
+// Flash timing model used by --simulate, typical figures for the SPI NOR
+// flash on ESP32 modules: 40 MHz quad I/O reads, 256 byte program pages
+// and 4 KB sector erases.
+static const double FLASH_READ_SETUP_US = 1.0;
+static const double FLASH_READ_US_PER_BYTE = 0.05;
+static const double FLASH_PROGRAM_PAGE_SIZE = 256;
+static const double FLASH_PROGRAM_US_PER_PAGE = 700.0;
+static const double FLASH_ERASE_US_PER_SECTOR = 45000.0;
+static const double FLASH_SECTOR_SIZE = 4096;
+
+// Flash accesses made through the HAL
+struct FlashStats {
+    uint64_t reads, readBytes;
+    uint64_t writes, writeBytes;
+    uint64_t erases, eraseBytes;
+    double busyUs;                      // simulated time the flash was busy
+    std::vector<uint32_t> blockErases;  // erases per spiffs block
+};
+static FlashStats s_flashStats;
+
 static s32_t api_spiffs_read(u32_t addr, u32_t size, u8_t *dst){
-    memcpy(dst, &s_flashmem[0] + addr, size);
+    memcpy(dst, g_flashmem + addr, size);
+    s_flashStats.reads++;
+    s_flashStats.readBytes += size;
+    s_flashStats.busyUs += FLASH_READ_SETUP_US + size * FLASH_READ_US_PER_BYTE;
     return SPIFFS_OK;
 }
 
 static s32_t api_spiffs_write(u32_t addr, u32_t size, u8_t *src){
-    memcpy(&s_flashmem[0] + addr, src, size);
+    memcpy(g_flashmem + addr, src, size);
+    s_flashStats.writes++;
+    s_flashStats.writeBytes += size;
+    u32_t firstPage = addr / FLASH_PROGRAM_PAGE_SIZE;
+    u32_t lastPage = (addr + size - 1) / FLASH_PROGRAM_PAGE_SIZE;
+    s_flashStats.busyUs += (lastPage - firstPage + 1) * FLASH_PROGRAM_US_PER_PAGE;
     return SPIFFS_OK;
 }
 
 static s32_t api_spiffs_erase(u32_t addr, u32_t size){
-    memset(&s_flashmem[0] + addr, 0xff, size);
+    memset(g_flashmem + addr, 0xff, size);
+    s_flashStats.erases++;
+    s_flashStats.eraseBytes += size;
+    s_flashStats.busyUs += (size / FLASH_SECTOR_SIZE) * FLASH_ERASE_US_PER_SECTOR;
+    if (addr / s_blockSize < s_flashStats.blockErases.size()) {
+        s_flashStats.blockErases[addr / s_blockSize]++;
+    }
     return SPIFFS_OK;
 }
 
@@ -73,7 +129,7 @@ int spiffsTryMount(){
     spiffs_config cfg = {0};
 
     cfg.phys_addr = 0x0000;
-    cfg.phys_size = (u32_t) s_flashmem.size();
+    cfg.phys_size = (u32_t) g_flashmemSize;
 
     cfg.phys_erase_block = s_blockSize;
     cfg.log_block_size = s_blockSize;
@@ -119,6 +175,7 @@ void spiffsUnmount(){
 // WHITECAT BEGIN
 int addDir(const char* name) {
 	spiffs_metadata_t meta;
+	memset(&meta, 0, sizeof(meta));
 
 	std::string fileName = name;
     fileName += "/.";
@@ -142,8 +199,7 @@ int addDir(const char* name) {
 
     SPIFFS_close(&s_fs, dst);
     if (strlen(name) > 0) {
-		// Get the system time to file timestamps
-		meta.atime = time(NULL);
+		meta.atime = s_timestamp;
 		meta.ctime = meta.atime;
 		meta.mtime = meta.atime;
 		SPIFFS_update_meta(&s_fs, fileName.c_str(), &meta);
@@ -153,89 +209,276 @@ int addDir(const char* name) {
 }
 // WHITECAT END
 
-int addFile(char* name, const char* path) {
-	spiffs_metadata_t meta;
-
-	FILE* src = fopen(path, "rb");
-    if (!src) {
-        std::cerr << "error: failed to open " << path << " for reading" << std::endl;
-        return 1;
-    }
+/**
+ * @brief Host file contents read ahead of the spiffs writer.
+ *
+ * A pool of reader threads loads the files in the order the writer will
+ * add them, staying at most s_prefetchWindow files or
+ * s_prefetchMaxBytes bytes ahead. The writer still adds files one by one
+ * in directory traversal order, so the image does not depend on the
+ * number of threads.
+ */
+class FilePrefetcher {
+public:
+    enum State { PENDING, READY, OPEN_FAILED, READ_FAILED };
 
-    spiffs_file dst = SPIFFS_open(&s_fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    FilePrefetcher() : _next(0), _consumed(0), _bytesAhead(0), _stop(false) {}
+    ~FilePrefetcher() { stop(); }
 
-    // read file size
-    fseek(src, 0, SEEK_END);
-    size_t size = ftell(src);
-    fseek(src, 0, SEEK_SET);
+    void start(const std::vector<std::string>& paths, int jobs) {
+        for (size_t i = 0; i < paths.size(); i++) {
+            _entries.push_back(Entry(paths[i]));
+            _sequence[paths[i]] = i;
+        }
+        for (int i = 0; i < jobs; i++) {
+            _threads.push_back(std::thread(&FilePrefetcher::run, this));
+        }
+    }
 
-    if (g_debugLevel > 0) {
-        std::cout << "file size: " << size << std::endl;
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cond.notify_all();
+        for (size_t i = 0; i < _threads.size(); i++) {
+            _threads[i].join();
+        }
+        _threads.clear();
     }
 
-    size_t left = size;
-    uint8_t data_byte;
-    while (left > 0){
-        if (1 != fread(&data_byte, 1, 1, src)) {
-            std::cerr << "fread error!" << std::endl;
+    // Take the contents of path. Files queued before it were skipped by the
+    // caller and are dropped. Returns false if path was not queued or was
+    // already dropped, in which case the caller reads it.
+    bool take(const std::string& path, State& state, std::vector<uint8_t>& data) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        std::map<std::string, size_t>::const_iterator it = _sequence.find(path);
+        if (_threads.empty() || it == _sequence.end() || it->second < _consumed) {
+            return false;
+        }
+        while (_consumed < it->second) {
+            popFront(lock);
+        }
+        Entry& e = _entries.front();
+        while (e.state == PENDING) {
+            _cond.wait(lock);
+        }
+        state = e.state;
+        _bytesAhead -= e.data.size();
+        data.swap(e.data);
+        popFront(lock);
+        lock.unlock();
+        _cond.notify_all();
+        return true;
+    }
 
-            fclose(src);
-            SPIFFS_close(&s_fs, dst);
-            return 1;
+private:
+    struct Entry {
+        Entry(const std::string& p) : path(p), state(PENDING) {}
+        std::string path;
+        State state;
+        std::vector<uint8_t> data;
+    };
+
+    // Removes the front entry, waiting for a reader that has started on it
+    void popFront(std::unique_lock<std::mutex>& lock) {
+        if (_next == _consumed) {
+            // no reader has picked it up
+            _next++;
+        } else {
+            while (_entries.front().state == PENDING) {
+                _cond.wait(lock);
+            }
         }
-        int res = SPIFFS_write(&s_fs, dst, &data_byte, 1);
-        if (res < 0) {
-            std::cerr << "SPIFFS_write error(" << s_fs.err_code << "): ";
+        _bytesAhead -= _entries.front().data.size();
+        _entries.pop_front();
+        _consumed++;
+    }
+
+    static const size_t s_prefetchWindow = 64;
+    static const size_t s_prefetchMaxBytes = 32 * 1024 * 1024;
 
-            if (s_fs.err_code == SPIFFS_ERR_FULL) {
-                std::cerr << "File system is full." << std::endl;
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            while (!_stop && _next < _consumed + _entries.size()
+                   && (_next >= _consumed + s_prefetchWindow || _bytesAhead >= s_prefetchMaxBytes)) {
+                _cond.wait(lock);
+            }
+            if (_stop || _next >= _consumed + _entries.size()) {
+                return;
+            }
+            // deque references stay valid while only the front is erased
+            Entry& e = _entries[_next - _consumed];
+            _next++;
+            std::string path = e.path;
+            lock.unlock();
+
+            std::vector<uint8_t> data;
+            State state = READY;
+            FILE* src = fopen(path.c_str(), "rb");
+            if (!src) {
+                state = OPEN_FAILED;
             } else {
-                std::cerr << "unknown";
+                fseek(src, 0, SEEK_END);
+                data.resize(ftell(src));
+                fseek(src, 0, SEEK_SET);
+                if (data.size() > 0 && fread(&data[0], 1, data.size(), src) != data.size()) {
+                    state = READ_FAILED;
+                }
+                fclose(src);
             }
-            std::cerr << std::endl;
+
+            lock.lock();
+            _bytesAhead += data.size();
+            e.data.swap(data);
+            e.state = state;
+            _cond.notify_all();
+        }
+    }
+
+    std::deque<Entry> _entries;
+    std::map<std::string, size_t> _sequence;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    size_t _next;
+    size_t _consumed;
+    size_t _bytesAhead;
+    bool _stop;
+};
+
+static FilePrefetcher s_prefetcher;
+
+static void printWriteError() {
+    std::cerr << "SPIFFS_write error(" << s_fs.err_code << "): ";
+
+    if (s_fs.err_code == SPIFFS_ERR_FULL) {
+        std::cerr << "File system is full." << std::endl;
+    } else {
+        std::cerr << "unknown";
+    }
+    std::cerr << std::endl;
+}
+
+// Write a host file to spiffs a block at a time, so data goes through the
+// spiffs nucleus in page multiples instead of byte by byte.
+static int writeFileData(spiffs_file dst, const uint8_t* data, size_t size) {
+    size_t left = size;
+    while (left > 0) {
+        size_t chunk = (left < (size_t)s_blockSize) ? left : (size_t)s_blockSize;
+        int res = SPIFFS_write(&s_fs, dst, (void*)data, chunk);
+        if (res < 0) {
+            printWriteError();
 
             if (g_debugLevel > 0) {
                 std::cout << "data left: " << left << std::endl;
             }
+            return 1;
+        }
+        data += chunk;
+        left -= chunk;
+    }
+    return 0;
+}
 
+int addFile(char* name, const char* path) {
+	spiffs_metadata_t meta;
+	memset(&meta, 0, sizeof(meta));
+    std::vector<uint8_t> data;
+    FilePrefetcher::State state;
+
+    if (!s_prefetcher.take(path, state, data)) {
+        // not prefetched, read it here
+        state = FilePrefetcher::READY;
+        FILE* src = fopen(path, "rb");
+        if (!src) {
+            state = FilePrefetcher::OPEN_FAILED;
+        } else {
+            fseek(src, 0, SEEK_END);
+            data.resize(ftell(src));
+            fseek(src, 0, SEEK_SET);
+            if (data.size() > 0 && fread(&data[0], 1, data.size(), src) != data.size()) {
+                state = FilePrefetcher::READ_FAILED;
+            }
             fclose(src);
-            SPIFFS_close(&s_fs, dst);
-            return 1;
         }
-        left -= 1;
+    }
+
+    if (state == FilePrefetcher::OPEN_FAILED) {
+        std::cerr << "error: failed to open " << path << " for reading" << std::endl;
+        return 1;
+    }
+
+    spiffs_file dst = SPIFFS_open(&s_fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+
+    if (g_debugLevel > 0) {
+        std::cout << "file size: " << data.size() << std::endl;
+    }
+
+    if (state == FilePrefetcher::READ_FAILED) {
+        std::cerr << "fread error!" << std::endl;
+
+        SPIFFS_close(&s_fs, dst);
+        return 1;
+    }
+
+    if (data.size() > 0 && writeFileData(dst, &data[0], data.size()) != 0) {
+        SPIFFS_close(&s_fs, dst);
+        return 1;
     }
 
 	SPIFFS_close(&s_fs, dst);
 
-	// Get the system time to file timestamps
-	meta.atime = time(NULL);
+	meta.atime = s_timestamp;
 	meta.ctime = meta.atime;
 	meta.mtime = meta.atime;
 	SPIFFS_update_meta(&s_fs, name, &meta);
 
-    fclose(src);
-
     return 0;
 }
 
+/**
+ * @brief Collect the host files addFiles() will add, in the same order.
+ */
+void collectFiles(const char* dirname, const char* subPath, std::vector<std::string>& paths) {
+    std::vector<std::string> entries;
+    std::string dirPath = dirname;
+    dirPath += subPath;
+
+    if (!readDirSorted(dirPath, entries)) {
+        return;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string fullpath = dirPath;
+        fullpath += entries[i];
+        struct stat path_stat;
+        stat (fullpath.c_str(), &path_stat);
+
+        if (S_ISREG(path_stat.st_mode)) {
+            paths.push_back(fullpath);
+        } else if (S_ISDIR(path_stat.st_mode)) {
+            std::string newSubPath = subPath;
+            newSubPath += entries[i];
+            newSubPath += "/";
+            collectFiles(dirname, newSubPath.c_str(), paths);
+        }
+    }
+}
+
 int addFiles(const char* dirname, const char* subPath) {
-    DIR *dir;
-    struct dirent *ent;
+    std::vector<std::string> entries;
     bool error = false;
     std::string dirPath = dirname;
     dirPath += subPath;
 
     // Open directory
-    if ((dir = opendir (dirPath.c_str())) != NULL) {
+    if (readDirSorted(dirPath, entries)) {
 
         // Read files from directory.
-        while ((ent = readdir (dir)) != NULL) {
-            // Ignore dir itself.
-            if (ent->d_name[0] == '.')				
-                continue;            	
-
+        for (size_t i = 0; i < entries.size(); i++) {
             std::string fullpath = dirPath;
-            fullpath += ent->d_name;
+            fullpath += entries[i];
             struct stat path_stat;
             stat (fullpath.c_str(), &path_stat);
 
@@ -244,7 +487,7 @@ int addFiles(const char* dirname, const char* subPath) {
                 if (S_ISDIR(path_stat.st_mode)) {
                     // Prepare new sub path.
                     std::string newSubPath = subPath;
-                    newSubPath += ent->d_name;
+                    newSubPath += entries[i];
 					
 					// WHITECAT BEGIN
 					addDir(newSubPath.c_str());
@@ -254,21 +497,21 @@ int addFiles(const char* dirname, const char* subPath) {
 
                     if (addFiles(dirname, newSubPath.c_str()) != 0)
                     {
-                        std::cerr << "Error for adding content from " << ent->d_name << "!" << std::endl;
+                        std::cerr << "Error for adding content from " << entries[i] << "!" << std::endl;
                     }
 
                     continue;
                 }
                 else
                 {
-                    std::cerr << "skipping " << ent->d_name << std::endl;
+                    std::cerr << "skipping " << entries[i] << std::endl;
                     continue;
                 }
             }
 
             // Filepath with dirname as root folder.
             std::string filepath = subPath;
-            filepath += ent->d_name;
+            filepath += entries[i];
             std::cout << filepath << std::endl;
 
             // Add File to image.
@@ -281,7 +524,6 @@ int addFiles(const char* dirname, const char* subPath) {
                 break;
             }
         } // end while
-        closedir (dir);
     } else {
         std::cerr << "warning: can't read source directory" << std::endl;
         return 1;
@@ -359,29 +601,36 @@ bool dirCreate(const char* path) {
  * @author Pascal Gollor (http://www.pgollor.de/cms/)
  */
 bool unpackFile(spiffs_dirent *spiffsFile, const char *destPath) {
-    u8_t buffer[spiffsFile->size];
     std::string filename = (const char*)(spiffsFile->name);
 
+    // Open file.
+    FILE* dst = fopen(destPath, "wb");
+    if (!dst) {
+        return false;
+    }
+
     // Open file from spiffs file system.
     spiffs_file src = SPIFFS_open(&s_fs, (char *)(filename.c_str()), SPIFFS_RDONLY, 0);
 
-    // read content into buffer
-    SPIFFS_read(&s_fs, src, buffer, spiffsFile->size);
+    // Copy content a block at a time.
+    bool result = (src >= 0);
+    std::vector<u8_t> buffer(s_blockSize);
+    size_t left = spiffsFile->size;
+    while (result && left > 0) {
+        size_t chunk = (left < buffer.size()) ? left : buffer.size();
+        result = (SPIFFS_read(&s_fs, src, &buffer[0], chunk) == (s32_t)chunk)
+              && (fwrite(&buffer[0], sizeof(u8_t), chunk, dst) == chunk);
+        left -= chunk;
+    }
 
     // Close spiffs file.
     SPIFFS_close(&s_fs, src);
 
-    // Open file.
-    FILE* dst = fopen(destPath, "wb");
-
-    // Write content into file.
-    fwrite(buffer, sizeof(u8_t), sizeof(buffer), dst);
-
     // Close file.
     fclose(dst);
 
 
-    return true;
+    return result;
 }
 
 /**
@@ -424,6 +673,16 @@ bool unpackFiles(std::string sDest) {
             std::string sDestFilePath = sDest + name;
             size_t pos = name.find_last_of("/");
 
+            // "<dir>/." entries only mark directories, see addDir().
+            if (pos != std::string::npos && name.compare(pos, std::string::npos, "/.") == 0) {
+                std::string path = sDest + name.substr(0, pos);
+                if (pos > 0 && !dirExists(path.c_str()) && !dirCreate(path.c_str())) {
+                    return false;
+                }
+                it = SPIFFS_readdir(&dir, &ent);
+                continue;
+            }
+
             // If file is in sub directory?
             if (pos > 0) {
                 // Subdir path.
@@ -464,14 +723,172 @@ bool unpackFiles(std::string sDest) {
     return true;
 }
 
+/**
+ * @brief Collect the names addFiles() would give a directory's contents in
+ * the image, including the "<dir>/." entries that mark directories.
+ */
+void collectNames(const char* dirname, const char* subPath, std::set<std::string>& names) {
+    std::vector<std::string> entries;
+    std::string dirPath = dirname;
+    dirPath += subPath;
+
+    if (!readDirSorted(dirPath, entries)) {
+        return;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string fullpath = dirPath;
+        fullpath += entries[i];
+        struct stat path_stat;
+        stat (fullpath.c_str(), &path_stat);
+
+        std::string name = subPath;
+        name += entries[i];
+        if (S_ISREG(path_stat.st_mode)) {
+            names.insert(name);
+        } else if (S_ISDIR(path_stat.st_mode)) {
+            names.insert(name + "/.");
+            collectNames(dirname, (name + "/").c_str(), names);
+        }
+    }
+}
+
+/**
+ * @brief Check if a file in the image has the same contents as a host file.
+ */
+bool fileMatches(const char* name, const char* path) {
+    spiffs_stat st;
+    if (SPIFFS_stat(&s_fs, name, &st) != SPIFFS_OK) {
+        return false;
+    }
+    FILE* src = fopen(path, "rb");
+    if (!src) {
+        return false;
+    }
+    fseek(src, 0, SEEK_END);
+    bool result = ((size_t)ftell(src) == st.size);
+    fseek(src, 0, SEEK_SET);
+
+    spiffs_file fd = SPIFFS_open(&s_fs, name, SPIFFS_RDONLY, 0);
+    std::vector<uint8_t> hostBuf(s_blockSize);
+    std::vector<uint8_t> imageBuf(s_blockSize);
+    size_t left = st.size;
+    while (result && left > 0) {
+        size_t chunk = (left < hostBuf.size()) ? left : hostBuf.size();
+        result = (fread(&hostBuf[0], 1, chunk, src) == chunk)
+              && (SPIFFS_read(&s_fs, fd, &imageBuf[0], chunk) == (s32_t)chunk)
+              && (memcmp(&hostBuf[0], &imageBuf[0], chunk) == 0);
+        left -= chunk;
+    }
+    SPIFFS_close(&s_fs, fd);
+    fclose(src);
+    return result;
+}
+
+/**
+ * @brief Add the files of a host directory that are missing or differ in
+ * the image, the same way addFiles() would.
+ * @return 0 success, 1 error
+ */
+int updateFiles(const char* dirname, const char* subPath) {
+    std::vector<std::string> entries;
+    bool error = false;
+    std::string dirPath = dirname;
+    dirPath += subPath;
+
+    if (!readDirSorted(dirPath, entries)) {
+        std::cerr << "warning: can't read source directory" << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        std::string fullpath = dirPath;
+        fullpath += entries[i];
+        struct stat path_stat;
+        stat (fullpath.c_str(), &path_stat);
+
+        std::string filepath = subPath;
+        filepath += entries[i];
+
+        if (S_ISDIR(path_stat.st_mode)) {
+            spiffs_stat st;
+            if (SPIFFS_stat(&s_fs, (filepath + "/.").c_str(), &st) != SPIFFS_OK) {
+                addDir(filepath.c_str());
+            }
+            if (updateFiles(dirname, (filepath + "/").c_str()) != 0) {
+                error = true;
+                break;
+            }
+            continue;
+        }
+        if (!S_ISREG(path_stat.st_mode) || fileMatches(filepath.c_str(), fullpath.c_str())) {
+            continue;
+        }
+
+        std::cout << filepath << std::endl;
+        if (addFile((char*)filepath.c_str(), fullpath.c_str()) != 0) {
+            std::cerr << "error adding file!" << std::endl;
+            error = true;
+            break;
+        }
+    }
+
+    return (error) ? 1 : 0;
+}
+
+/**
+ * @brief Remove files and directory markers that are not in names.
+ */
+void removeStaleFiles(const std::set<std::string>& names) {
+    spiffs_DIR dir;
+    spiffs_dirent ent;
+    std::vector<std::string> stale;
+
+    // collect first, removing while iterating would skip entries
+    SPIFFS_opendir(&s_fs, 0, &dir);
+    spiffs_dirent* it;
+    while ((it = SPIFFS_readdir(&dir, &ent)) != NULL) {
+        std::string name = (const char*)(it->name);
+        if (name != "/." && names.find(name) == names.end()) {
+            stale.push_back(name);
+        }
+    }
+    SPIFFS_closedir(&dir);
+
+    // SPIFFS_remove() does not give back its file descriptor, so remove
+    // through our own one
+    for (size_t i = 0; i < stale.size(); i++) {
+        std::cout << "removing " << stale[i] << std::endl;
+        spiffs_file fd = SPIFFS_open(&s_fs, stale[i].c_str(), SPIFFS_RDWR, 0);
+        if (fd < 0 || SPIFFS_fremove(&s_fs, fd) != SPIFFS_OK) {
+            std::cerr << "error removing " << stale[i] << std::endl;
+        }
+        SPIFFS_close(&s_fs, fd);
+    }
+}
+
+static void writeLE32(FILE* f, uint32_t v) {
+    uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    fwrite(b, 1, sizeof(b), f);
+}
+
 // Actions
 
 int actionPack() {
-    s_flashmem.resize(s_imageSize, 0xff);
+    std::string manifest;
+    if (!s_manifestName.empty()) {
+        std::ostringstream header;
+        header << "mkspiffs " << MKSPIFFS_VERSION << std::endl;
+        header << "config size=" << s_imageSize << " page=" << s_pageSize
+               << " block=" << s_blockSize << " timestamp=" << (long long)s_timestamp << std::endl;
+        manifest = buildManifest(header.str(), s_dirName);
+        if (imageUpToDate(s_manifestName, manifest, s_imageName, s_imageSize)) {
+            std::cout << "image is up to date" << std::endl;
+            return 0;
+        }
+    }
 
-    FILE* fdres = fopen(s_imageName.c_str(), "wb");
-    if (!fdres) {
+    if (!imageCreate(s_imageName.c_str(), s_imageSize, s_useMmap)) {
         std::cerr << "error: failed to open image file" << std::endl;
+        imageClose();
         return 1;
     }
 
@@ -481,12 +898,143 @@ int actionPack() {
 	addDir("");
 	// WHITECAT END
 	
+    if (s_jobs > 0) {
+        std::vector<std::string> paths;
+        collectFiles(s_dirName.c_str(), "/", paths);
+        s_prefetcher.start(paths, s_jobs);
+    }
+
     int result = addFiles(s_dirName.c_str(), "/");
+    s_prefetcher.stop();
     spiffsUnmount();
 
-    fwrite(&s_flashmem[0], 4, s_flashmem.size()/4, fdres);
+    std::string imageHash;
+    if (!manifest.empty()) {
+        CRYAL_SHA256_CTX ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, g_flashmem, g_flashmemSize);
+        imageHash = sha256Hex(&ctx);
+    }
+
+    if (!imageClose()) {
+        std::cerr << "error: failed to write image file" << std::endl;
+        return 1;
+    }
+
+    if (!manifest.empty()) {
+        // a failed pack must not leave a manifest claiming the image is current
+        remove(s_manifestName.c_str());
+        if (result == 0) {
+            std::ofstream out(s_manifestName.c_str(), std::ios::binary);
+            out << manifest << manifestImageLine(imageHash, s_imageSize);
+            if (!out) {
+                std::cerr << "error: failed to write manifest file" << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief Update action: bring an existing image in line with a directory.
+ *
+ * Only the files that were added, changed or removed go through spiffs, so
+ * most erase blocks of the image stay untouched. The changed blocks are
+ * listed, written back into the image file in place and, if requested,
+ * saved to a delta file holding the "SPFD" magic, little endian u32 block
+ * size and block count, then for each block its u32 offset and contents.
+ * @return 0 success, 1 error
+ */
+int actionUpdate() {
+    if (!imageOpen(s_imageName.c_str(), s_imageSize)) {
+        std::cerr << "error: failed to open image file" << std::endl;
+        return 1;
+    }
+    std::vector<uint8_t> original(g_flashmem, g_flashmem + g_flashmemSize);
+
+    if (!spiffsMount()) {
+        std::cerr << "error: failed to mount image" << std::endl;
+        imageClose();
+        return 1;
+    }
+
+    std::set<std::string> names;
+    collectNames(s_dirName.c_str(), "/", names);
+    removeStaleFiles(names);
+    int result = updateFiles(s_dirName.c_str(), "/");
+    spiffsUnmount();
+    if (result != 0) {
+        // leave the image as it was, a partial update is no use to anyone
+        imageClose();
+        return result;
+    }
+
+    // Find the changed erase blocks
+    std::vector<uint32_t> changed;
+    for (size_t addr = 0; addr < g_flashmemSize; addr += s_blockSize) {
+        size_t len = (g_flashmemSize - addr < (size_t)s_blockSize) ? g_flashmemSize - addr : s_blockSize;
+        if (memcmp(&original[addr], g_flashmem + addr, len) != 0) {
+            changed.push_back(addr);
+        }
+    }
+    std::cout << "changed blocks: " << changed.size() << " of "
+              << (g_flashmemSize + s_blockSize - 1) / s_blockSize << std::endl;
+    for (size_t i = 0; i < changed.size(); i++) {
+        char line[16];
+        snprintf(line, sizeof(line), "0x%08x", changed[i]);
+        std::cout << line << std::endl;
+    }
+
+    // Write back only the changed blocks
+    size_t blockLen = s_blockSize;
+    FILE* fdres = fopen(s_imageName.c_str(), "r+b");
+    if (!fdres) {
+        std::cerr << "error: failed to open image file" << std::endl;
+        imageClose();
+        return 1;
+    }
+    std::vector<uint32_t> writes = changed;
+    fseek(fdres, 0, SEEK_END);
+    if ((size_t)ftell(fdres) < g_flashmemSize) {
+        // a short image file gets written out in full
+        writes.assign(1, 0);
+        blockLen = g_flashmemSize;
+    }
+    for (size_t i = 0; i < writes.size(); i++) {
+        size_t len = std::min(blockLen, g_flashmemSize - writes[i]);
+        fseek(fdres, writes[i], SEEK_SET);
+        if (fwrite(g_flashmem + writes[i], 1, len, fdres) != len) {
+            std::cerr << "error: failed to write image file" << std::endl;
+            result = 1;
+            break;
+        }
+    }
     fclose(fdres);
 
+    if (!s_deltaName.empty()) {
+        FILE* fddelta = fopen(s_deltaName.c_str(), "wb");
+        if (!fddelta) {
+            std::cerr << "error: failed to open delta file" << std::endl;
+            imageClose();
+            return 1;
+        }
+        fwrite("SPFD", 1, 4, fddelta);
+        writeLE32(fddelta, s_blockSize);
+        writeLE32(fddelta, changed.size());
+        for (size_t i = 0; i < changed.size(); i++) {
+            size_t len = std::min((size_t)s_blockSize, g_flashmemSize - changed[i]);
+            writeLE32(fddelta, changed[i]);
+            fwrite(g_flashmem + changed[i], 1, len, fddelta);
+        }
+        if (fclose(fddelta) != 0) {
+            std::cerr << "error: failed to write delta file" << std::endl;
+            result = 1;
+        }
+    }
+
+    imageClose();
     return result;
 }
 
@@ -498,21 +1046,13 @@ int actionPack() {
  */
 int actionUnpack(void) {
     int ret = 0;
-    s_flashmem.resize(s_imageSize, 0xff);
 
     // open spiffs image
-    FILE* fdsrc = fopen(s_imageName.c_str(), "rb");
-    if (!fdsrc) {
+    if (!imageOpen(s_imageName.c_str(), s_imageSize)) {
         std::cerr << "error: failed to open image file" << std::endl;
         return 1;
     }
 
-    // read content into s_flashmem
-    ret = fread(&s_flashmem[0], 4, s_flashmem.size()/4, fdsrc);
-
-    // close fiel handle
-    fclose(fdsrc);
-
     // mount file system
     spiffsMount();
 
@@ -523,6 +1063,7 @@ int actionUnpack(void) {
 
     // unmount file system
     spiffsUnmount();
+    imageClose();
 
     return ret;
 }
@@ -530,65 +1071,435 @@ int actionUnpack(void) {
 
 int actionList() {
     int ret = 0;
-    s_flashmem.resize(s_imageSize, 0xff);
-
-    FILE* fdsrc = fopen(s_imageName.c_str(), "rb");
-    if (!fdsrc) {
+    if (!imageOpen(s_imageName.c_str(), s_imageSize)) {
         std::cerr << "error: failed to open image file" << std::endl;
         return 1;
     }
 
-    ret = fread(&s_flashmem[0], 4, s_flashmem.size()/4, fdsrc);
-    fclose(fdsrc);
     spiffsMount();
     listFiles();
     spiffsUnmount();
+    imageClose();
     
     ret = 0;
     return ret;
 }
 
+static std::string jsonString(const char* str) {
+    std::string out = "\"";
+    for (; *str; str++) {
+        char c = *str;
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+/**
+ * @brief Print a JSON analysis of the mounted image.
+ *
+ * The object lookup pages of every block are read straight from the image
+ * to count free, deleted, data and index pages and fetch the erase count.
+ * Per object, the index pages and data page headers are the metadata
+ * overhead, and the unused end of the last data page is slack. The free
+ * space reachable after garbage collection follows SPIFFS_info(): all
+ * pages except those in use, the two spare blocks and the emergency page.
+ */
+void analyzeImage() {
+    spiffs* fs = &s_fs;
+    const u32_t pageSize = SPIFFS_CFG_LOG_PAGE_SZ(fs);
+    const u32_t pagesPerBlock = SPIFFS_PAGES_PER_BLOCK(fs);
+    const u32_t lookupPages = SPIFFS_OBJ_LOOKUP_PAGES(fs);
+    const u32_t entries = SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+    const u32_t dataPageSize = SPIFFS_DATA_PAGE_SIZE(fs);
+    const u32_t blocks = fs->block_count;
+
+    struct ObjectInfo {
+        ObjectInfo() : size(0), dataPages(0), indexPages(0), name("") {}
+        u32_t size;
+        u32_t dataPages;
+        u32_t indexPages;
+        std::string name;
+    };
+    std::map<spiffs_obj_id, ObjectInfo> objects;
+
+    u32_t totalFree = 0, totalDeleted = 0, totalData = 0, totalIndex = 0;
+
+    std::cout << "{" << std::endl;
+    std::cout << "  \"geometry\": {\"image_size\": " << g_flashmemSize
+              << ", \"block_size\": " << SPIFFS_CFG_LOG_BLOCK_SZ(fs)
+              << ", \"page_size\": " << pageSize
+              << ", \"blocks\": " << blocks
+              << ", \"pages_per_block\": " << pagesPerBlock
+              << ", \"lookup_pages_per_block\": " << lookupPages << "}," << std::endl;
+
+    std::cout << "  \"blocks\": [" << std::endl;
+    for (u32_t bix = 0; bix < blocks; bix++) {
+        const uint8_t* block = g_flashmem + SPIFFS_BLOCK_TO_PADDR(fs, bix);
+        u32_t nFree = 0, nDeleted = 0, nData = 0, nIndex = 0;
+        for (u32_t entry = 0; entry < entries; entry++) {
+            spiffs_obj_id id;
+            memcpy(&id, block + entry * sizeof(spiffs_obj_id), sizeof(id));
+            if (id == SPIFFS_OBJ_ID_FREE) {
+                nFree++;
+            } else if (id == SPIFFS_OBJ_ID_DELETED) {
+                nDeleted++;
+            } else if (id & SPIFFS_OBJ_ID_IX_FLAG) {
+                nIndex++;
+                ObjectInfo& obj = objects[id & ~SPIFFS_OBJ_ID_IX_FLAG];
+                obj.indexPages++;
+                const uint8_t* page = g_flashmem + SPIFFS_OBJ_LOOKUP_ENTRY_TO_PADDR(fs, bix, entry);
+                spiffs_page_object_ix_header hdr;
+                memcpy(&hdr, page, sizeof(hdr));
+                if (hdr.p_hdr.span_ix == 0) {
+                    hdr.name[SPIFFS_OBJ_NAME_LEN - 1] = 0;
+                    obj.name = (const char*)hdr.name;
+                    obj.size = (hdr.size == SPIFFS_UNDEFINED_LEN) ? 0 : hdr.size;
+                }
+            } else {
+                nData++;
+                objects[id].dataPages++;
+            }
+        }
+        spiffs_obj_id eraseCount;
+        memcpy(&eraseCount, g_flashmem + SPIFFS_ERASE_COUNT_PADDR(fs, bix), sizeof(eraseCount));
+        std::cout << "    {\"block\": " << bix
+                  << ", \"used\": " << nData + nIndex
+                  << ", \"data\": " << nData
+                  << ", \"index\": " << nIndex
+                  << ", \"deleted\": " << nDeleted
+                  << ", \"free\": " << nFree
+                  << ", \"erase_count\": " << eraseCount << "}"
+                  << ((bix + 1 < blocks) ? "," : "") << std::endl;
+        totalFree += nFree;
+        totalDeleted += nDeleted;
+        totalData += nData;
+        totalIndex += nIndex;
+    }
+    std::cout << "  ]," << std::endl;
+
+    u32_t fileBytes = 0;
+    u32_t metadataBytes = lookupPages * pageSize * blocks;
+    u32_t slackBytes = 0;
+    std::cout << "  \"objects\": [" << std::endl;
+    for (std::map<spiffs_obj_id, ObjectInfo>::iterator it = objects.begin(); it != objects.end(); ) {
+        const ObjectInfo& obj = it->second;
+        u32_t overhead = obj.indexPages * pageSize + obj.dataPages * sizeof(spiffs_page_header);
+        u32_t capacity = obj.dataPages * dataPageSize;
+        u32_t slack = (capacity > obj.size) ? capacity - obj.size : 0;
+        std::cout << "    {\"id\": " << it->first
+                  << ", \"name\": " << jsonString(obj.name.c_str())
+                  << ", \"size\": " << obj.size
+                  << ", \"data_pages\": " << obj.dataPages
+                  << ", \"index_pages\": " << obj.indexPages
+                  << ", \"overhead_bytes\": " << overhead
+                  << ", \"slack_bytes\": " << slack << "}";
+        fileBytes += obj.size;
+        metadataBytes += overhead;
+        slackBytes += slack;
+        ++it;
+        std::cout << ((it != objects.end()) ? "," : "") << std::endl;
+    }
+    std::cout << "  ]," << std::endl;
+
+    u32_t usable = (blocks - 2) * (pagesPerBlock - lookupPages) + 1;
+    u32_t used = totalData + totalIndex;
+    u32_t afterGc = (usable > used) ? usable - used : 0;
+    std::cout << "  \"summary\": {\"data_pages\": " << totalData
+              << ", \"index_pages\": " << totalIndex
+              << ", \"deleted_pages\": " << totalDeleted
+              << ", \"free_pages\": " << totalFree
+              << ", \"lookup_pages\": " << lookupPages * blocks
+              << ", \"file_bytes\": " << fileBytes
+              << ", \"metadata_bytes\": " << metadataBytes
+              << ", \"slack_bytes\": " << slackBytes
+              << ", \"metadata_fraction\": " << (double)metadataBytes / g_flashmemSize
+              << ", \"free_bytes\": " << (uint64_t)totalFree * dataPageSize
+              << ", \"reclaimable_bytes\": " << (uint64_t)totalDeleted * dataPageSize
+              << ", \"free_after_gc_bytes\": " << (uint64_t)afterGc * dataPageSize << "}" << std::endl;
+    std::cout << "}" << std::endl;
+}
+
 int actionVisualize() {
     int ret = 0;
-    s_flashmem.resize(s_imageSize, 0xff);
-
-    FILE* fdsrc = fopen(s_imageName.c_str(), "rb");
-    if (!fdsrc) {
+    if (!imageOpen(s_imageName.c_str(), s_imageSize)) {
         std::cerr << "error: failed to open image file" << std::endl;
         return 1;
     }
 
-    ret = fread(&s_flashmem[0], 4, s_flashmem.size()/4, fdsrc);
-    fclose(fdsrc);
 
-    spiffsMount();
-    //SPIFFS_vis(&s_fs);
-    uint32_t total, used;
-    SPIFFS_info(&s_fs, &total, &used);
-    std::cout << "total: " << total <<  std::endl << "used: " << used << std::endl;
+    if (!spiffsMount()) {
+        std::cerr << "error: failed to mount image" << std::endl;
+        imageClose();
+        return 1;
+    }
+    if (s_json) {
+        analyzeImage();
+    } else {
+        //SPIFFS_vis(&s_fs);
+        uint32_t total, used;
+        SPIFFS_info(&s_fs, &total, &used);
+        std::cout << "total: " << total <<  std::endl << "used: " << used << std::endl;
+    }
     spiffsUnmount();
+    imageClose();
 
     ret = 0;
     return ret;
 }
 
+// Workload simulator
+
+static uint32_t s_simSeed = 1;
+
+// xorshift32, so runs are repeatable on every host
+static uint32_t simRandom() {
+    s_simSeed ^= s_simSeed << 13;
+    s_simSeed ^= s_simSeed >> 17;
+    s_simSeed ^= s_simSeed << 5;
+    return s_simSeed;
+}
+
+/**
+ * @brief Write size bytes of generated data to a file opened with flags.
+ * @return True or false, false when the file system is full.
+ */
+static bool simWrite(const std::string& name, spiffs_flags flags, size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)simRandom();
+    }
+    spiffs_file fd = SPIFFS_open(&s_fs, name.c_str(), flags | SPIFFS_CREAT | SPIFFS_WRONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool result = (size == 0) || SPIFFS_write(&s_fs, fd, &data[0], size) == (s32_t)size;
+    return (SPIFFS_close(&s_fs, fd) == SPIFFS_OK) && result;
+}
+
+static void simRemove(const std::string& name) {
+    // SPIFFS_remove() does not give back its file descriptor
+    spiffs_file fd = SPIFFS_open(&s_fs, name.c_str(), SPIFFS_RDWR, 0);
+    if (fd >= 0) {
+        SPIFFS_fremove(&s_fs, fd);
+        SPIFFS_close(&s_fs, fd);
+    }
+}
+
+static std::string simFileName(const char* prefix, int index) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%s%04d", prefix, index);
+    return name;
+}
+
+// Nearest rank percentile of sorted values
+static double simPercentile(const std::vector<double>& sorted, double percent) {
+    size_t rank = (size_t)(percent / 100 * sorted.size() + 0.5);
+    return sorted[rank ? std::min(rank, sorted.size()) - 1 : 0];
+}
+
+// Workload parameters
+static const int SIM_LOG_FILES = 4;
+static const size_t SIM_LOG_RECORD = 64;
+static const int SIM_REWRITE_FILES = 64;
+static const size_t SIM_REWRITE_MAX = 1024;
+static const size_t SIM_FULL_FILE = 4096;
+
+/**
+ * @brief Simulate action: replay a workload on a fresh image.
+ *
+ * - log: appends SIM_LOG_RECORD byte records to SIM_LOG_FILES files, each
+ *   removed and started again once it holds an eighth of the image.
+ * - rewrite: rewrites one of SIM_REWRITE_FILES small files with a new
+ *   size of up to SIM_REWRITE_MAX bytes.
+ * - full: fills the image to s_simFill percent with SIM_FULL_FILE byte
+ *   files, then rewrites one of them.
+ *
+ * Flash accesses, garbage collection, cache and wear statistics and the
+ * flash time given by the timing model are counted from the first
+ * operation on, so the fill of the full workload is left out. The aged
+ * image is written to the image file for --visualize.
+ *
+ * With s_simGcReserve set, one SPIFFS_gc_step() runs between operations as
+ * a background task would in idle time. Its flash time is reported apart
+ * and does not count in the operation latencies.
+ * @return 0 success, 1 error
+ */
+int actionSimulate() {
+    if (s_simWorkload != "log" && s_simWorkload != "rewrite" && s_simWorkload != "full") {
+        std::cerr << "error: unknown workload \"" << s_simWorkload << "\", use log, rewrite or full" << std::endl;
+        return 1;
+    }
+    if (!imageCreate(s_imageName.c_str(), s_imageSize, s_useMmap)) {
+        std::cerr << "error: failed to open image file" << std::endl;
+        imageClose();
+        return 1;
+    }
+    if (!spiffsFormat()) {
+        std::cerr << "error: failed to format image" << std::endl;
+        imageClose();
+        return 1;
+    }
+
+    std::vector<size_t> sizes;
+    if (s_simWorkload == "log") {
+        sizes.resize(SIM_LOG_FILES, 0);
+    } else if (s_simWorkload == "rewrite") {
+        sizes.resize(SIM_REWRITE_FILES, 0);
+        for (size_t i = 0; i < sizes.size(); i++) {
+            sizes[i] = simRandom() % SIM_REWRITE_MAX + 1;
+            simWrite(simFileName("cfg", i), SPIFFS_TRUNC, sizes[i]);
+        }
+    } else {
+        u32_t total, used;
+        SPIFFS_info(&s_fs, &total, &used);
+        while ((uint64_t)used * 100 < (uint64_t)total * s_simFill &&
+               simWrite(simFileName("f", sizes.size()), SPIFFS_TRUNC, SIM_FULL_FILE)) {
+            sizes.push_back(SIM_FULL_FILE);
+            SPIFFS_info(&s_fs, &total, &used);
+        }
+        if (sizes.empty()) {
+            std::cerr << "error: image too small for the workload" << std::endl;
+            spiffsUnmount();
+            imageClose();
+            return 1;
+        }
+    }
+
+    s_flashStats = FlashStats();
+    s_flashStats.blockErases.resize(s_fs.block_count, 0);
+    s_fs.stats_gc_runs = 0;
+    s_fs.cache_hits = 0;
+    s_fs.cache_misses = 0;
+
+    uint64_t written = 0;   // user data that made it into the image
+    int failed = 0;
+    int gcSteps = 0;
+    double gcUs = 0;
+    std::vector<double> opUs;
+    opUs.reserve(s_simOps);
+    for (int op = 0; op < s_simOps; op++) {
+        double startUs = s_flashStats.busyUs;
+        bool ok;
+        if (s_simWorkload == "log") {
+            int i = simRandom() % sizes.size();
+            if (sizes[i] + SIM_LOG_RECORD > (size_t)s_imageSize / 8) {
+                simRemove(simFileName("log", i));
+                sizes[i] = 0;
+            }
+            ok = simWrite(simFileName("log", i), SPIFFS_APPEND, SIM_LOG_RECORD);
+            if (ok) {
+                sizes[i] += SIM_LOG_RECORD;
+                written += SIM_LOG_RECORD;
+            }
+        } else {
+            int i = simRandom() % sizes.size();
+            size_t size = (s_simWorkload == "rewrite") ? simRandom() % SIM_REWRITE_MAX + 1 : sizes[i];
+            ok = simWrite(simFileName((s_simWorkload == "rewrite") ? "cfg" : "f", i), SPIFFS_TRUNC, size);
+            if (ok) {
+                written += size;
+            }
+        }
+        if (!ok) {
+            failed++;
+        }
+        opUs.push_back(s_flashStats.busyUs - startUs);
+
+        if (s_simGcReserve > 0) {
+            startUs = s_flashStats.busyUs;
+            if (SPIFFS_gc_step(&s_fs, s_simGcReserve) > 0) {
+                gcSteps++;
+            }
+            gcUs += s_flashStats.busyUs - startUs;
+        }
+    }
+    std::sort(opUs.begin(), opUs.end());
+
+    u32_t total, used;
+    SPIFFS_info(&s_fs, &total, &used);
+    uint32_t minErases = *std::min_element(s_flashStats.blockErases.begin(), s_flashStats.blockErases.end());
+    uint32_t maxErases = *std::max_element(s_flashStats.blockErases.begin(), s_flashStats.blockErases.end());
+    u32_t cacheLookups = s_fs.cache_hits + s_fs.cache_misses;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "workload: " << s_simWorkload << std::endl;
+    std::cout << "ops: " << s_simOps << " (failed: " << failed << ")" << std::endl;
+    std::cout << "bytes written: " << written << std::endl;
+    std::cout << "used: " << used << " of " << total << std::endl;
+    std::cout << "flash reads: " << s_flashStats.reads << " (" << s_flashStats.readBytes << " bytes)" << std::endl;
+    std::cout << "flash writes: " << s_flashStats.writes << " (" << s_flashStats.writeBytes << " bytes)" << std::endl;
+    std::cout << "flash erases: " << s_flashStats.erases << " (" << s_flashStats.eraseBytes << " bytes)" << std::endl;
+    std::cout << "write amplification: " << (written ? (double)s_flashStats.writeBytes / written : 0) << std::endl;
+    std::cout << "gc runs: " << s_fs.stats_gc_runs << std::endl;
+    std::cout << "cache hits: " << s_fs.cache_hits << ", misses: " << s_fs.cache_misses
+              << " (hit rate: " << (cacheLookups ? 100.0 * s_fs.cache_hits / cacheLookups : 0) << "%)" << std::endl;
+    std::cout << "block erases: min " << minErases << ", max " << maxErases
+              << ", mean " << (double)s_flashStats.erases / s_flashStats.blockErases.size() << std::endl;
+    std::cout << "simulated flash time: " << s_flashStats.busyUs / 1000 << " ms (per op: mean "
+              << (s_simOps ? (s_flashStats.busyUs - gcUs) / s_simOps : 0) << " us)" << std::endl;
+    if (!opUs.empty()) {
+        std::cout << "op latency: p50 " << simPercentile(opUs, 50) << " us, p90 " << simPercentile(opUs, 90)
+                  << " us, p99 " << simPercentile(opUs, 99) << " us, p99.9 " << simPercentile(opUs, 99.9)
+                  << " us, max " << opUs.back() << " us" << std::endl;
+    }
+    if (s_simGcReserve > 0) {
+        std::cout << "background gc: reserve " << s_simGcReserve << " blocks, " << gcSteps << " blocks erased, "
+                  << gcUs / 1000 << " ms, free blocks at end " << s_fs.free_blocks << std::endl;
+    }
+
+    spiffsUnmount();
+    if (!imageClose()) {
+        std::cerr << "error: failed to write image file" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 void processArgs(int argc, const char** argv) {
     TCLAP::CmdLine cmd("", ' ', MKSPIFFS_VERSION);
     TCLAP::ValueArg<std::string> packArg( "c", "create", "create spiffs image from a directory", true, "", "pack_dir");
     TCLAP::ValueArg<std::string> unpackArg( "u", "unpack", "unpack spiffs image to a directory", true, "", "dest_dir");
+    TCLAP::ValueArg<std::string> updateArg( "U", "update", "update an existing spiffs image to match a directory, rewriting only changed blocks", true, "", "pack_dir");
+    TCLAP::ValueArg<std::string> deltaArg( "D", "delta", "with --update, also save the changed blocks to a delta file", false, "", "delta_file");
     TCLAP::SwitchArg listArg( "l", "list", "list files in spiffs image", false);
+    TCLAP::ValueArg<std::string> simulateArg( "S", "simulate", "replay a workload (log, rewrite or full) on a fresh image and report flash, gc and cache statistics", true, "", "workload");
+    TCLAP::ValueArg<int> opsArg( "n", "ops", "with --simulate, number of operations", false, 10000, "number" );
+    TCLAP::ValueArg<int> fillArg( "f", "fill", "with --simulate full, percentage of the image filled before the operations", false, 90, "percent" );
+    TCLAP::ValueArg<int> gcReserveArg( "g", "gc-reserve", "with --simulate, run a background gc step between operations keeping this many free blocks", false, 0, "blocks" );
     TCLAP::SwitchArg visualizeArg( "i", "visualize", "visualize spiffs image", false);
+    TCLAP::SwitchArg jsonArg( "J", "json", "with --visualize, print a JSON space and wear analysis", false);
     TCLAP::UnlabeledValueArg<std::string> outNameArg( "image_file", "spiffs image file", true, "", "image_file"  );
     TCLAP::ValueArg<int> imageSizeArg( "s", "size", "fs image size, in bytes", false, 0x10000, "number" );
     TCLAP::ValueArg<int> pageSizeArg( "p", "page", "fs page size, in bytes", false, 256, "number" );
     TCLAP::ValueArg<int> blockSizeArg( "b", "block", "fs block size, in bytes", false, 4096, "number" );
     TCLAP::ValueArg<int> debugArg( "d", "debug", "Debug level. 0 means no debug output.", false, 0, "0-5" );
+    TCLAP::SwitchArg mmapArg( "m", "mmap", "pack directly into the memory mapped image file instead of a copy in memory", false);
+    TCLAP::ValueArg<std::string> manifestArg( "M", "manifest", "with --create, write a manifest with the SHA-256 of each file and of the image, and skip packing if it shows the image is up to date", false, "", "manifest_file");
+    TCLAP::ValueArg<long> timestampArg( "T", "timestamp", "timestamp given to the files, in seconds since the epoch (default: SOURCE_DATE_EPOCH or the current time)", false, -1, "seconds");
+    TCLAP::ValueArg<int> jobsArg( "j", "jobs", "number of threads reading host files when packing, 0 reads them inline", false, 4, "number" );
 
     cmd.add( imageSizeArg );
     cmd.add( pageSizeArg );
     cmd.add( blockSizeArg );
     cmd.add(debugArg);
-    std::vector<TCLAP::Arg*> args = {&packArg, &unpackArg, &listArg, &visualizeArg};
+    cmd.add(jobsArg);
+    cmd.add(mmapArg);
+    cmd.add(deltaArg);
+    cmd.add(jsonArg);
+    cmd.add(manifestArg);
+    cmd.add(timestampArg);
+    cmd.add(opsArg);
+    cmd.add(fillArg);
+    cmd.add(gcReserveArg);
+    std::vector<TCLAP::Arg*> args = {&packArg, &unpackArg, &updateArg, &listArg, &visualizeArg, &simulateArg};
     cmd.xorAdd( args );
     cmd.add( outNameArg );
     cmd.parse( argc, argv );
@@ -604,16 +1515,33 @@ void processArgs(int argc, const char** argv) {
     } else if (unpackArg.isSet()) {
         s_dirName = unpackArg.getValue();
         s_action = ACTION_UNPACK;
+    } else if (updateArg.isSet()) {
+        s_dirName = updateArg.getValue();
+        s_deltaName = deltaArg.getValue();
+        s_action = ACTION_UPDATE;
     } else if (listArg.isSet()) {
         s_action = ACTION_LIST;
     } else if (visualizeArg.isSet()) {
         s_action = ACTION_VISUALIZE;
+    } else if (simulateArg.isSet()) {
+        s_simWorkload = simulateArg.getValue();
+        s_action = ACTION_SIMULATE;
     }
 
     s_imageName = outNameArg.getValue();
     s_imageSize = imageSizeArg.getValue();
     s_pageSize  = pageSizeArg.getValue();
     s_blockSize = blockSizeArg.getValue();
+    s_jobs      = jobsArg.getValue();
+    s_useMmap   = mmapArg.getValue();
+    s_json      = jsonArg.getValue();
+    s_simOps    = opsArg.getValue();
+    s_simFill   = fillArg.getValue();
+    s_simGcReserve = gcReserveArg.getValue();
+    s_manifestName = manifestArg.getValue();
+
+    // One timestamp for every file, fixed for reproducible images
+    s_timestamp = imageTimestamp(timestampArg.getValue());
 }
 
 int main(int argc, const char * argv[]) {
@@ -632,12 +1560,18 @@ int main(int argc, const char * argv[]) {
     case ACTION_UNPACK:
     	return actionUnpack();
         break;
+    case ACTION_UPDATE:
+        return actionUpdate();
+        break;
     case ACTION_LIST:
         return actionList();
         break;
     case ACTION_VISUALIZE:
         return actionVisualize();
         break;
+    case ACTION_SIMULATE:
+        return actionSimulate();
+        break;
     default:
         break;
     }
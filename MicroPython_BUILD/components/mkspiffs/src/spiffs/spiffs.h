@@ -652,6 +652,21 @@ u8_t SPIFFS_mounted(spiffs *fs);
  */
 s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
 
+/**
+ * Does one bounded step of garbage collection, for background tidying
+ * while the system is idle. If less than reserve_blocks blocks are free and
+ * enough pages are deleted to gain a block, erases one block, moving the
+ * remaining data of the block first if needed. One step costs at most the
+ * moves of one block's pages and one block erase.
+ *
+ * Returns 1 if a block was erased, SPIFFS_OK if there was nothing to do,
+ * or an error.
+ *
+ * @param fs             the file system struct
+ * @param reserve_blocks number of free blocks to keep
+ */
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t reserve_blocks);
+
 /**
  * Will try to make room for given amount of bytes in the filesystem by moving
  * pages and erasing blocks.
@@ -100,8 +100,9 @@ typedef unsigned char u8_t;
 #endif
 
 // Enable/disable statistics on caching. Debug/test purpose only.
+// Reported by mkspiffs --simulate.
 #ifndef  SPIFFS_CACHE_STATS
-#define SPIFFS_CACHE_STATS              0
+#define SPIFFS_CACHE_STATS              1
 #endif
 #endif
 
@@ -117,8 +118,9 @@ typedef unsigned char u8_t;
 #endif
 
 // Enable/disable statistics on gc. Debug/test purpose only.
+// Reported by mkspiffs --simulate.
 #ifndef SPIFFS_GC_STATS
-#define SPIFFS_GC_STATS                 0
+#define SPIFFS_GC_STATS                 1
 #endif
 
 // Garbage collecting examines all pages in a block which and sums up
@@ -1126,6 +1126,24 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages) {
 }
 
 
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t reserve_blocks) {
+#if SPIFFS_READ_ONLY
+  (void)fs; (void)reserve_blocks;
+  return SPIFFS_ERR_RO_NOT_IMPL;
+#else
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_gc_step(fs, reserve_blocks);
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return res;
+#endif // SPIFFS_READ_ONLY
+}
+
 s32_t SPIFFS_gc(spiffs *fs, u32_t size) {
 #if SPIFFS_READ_ONLY
   (void)fs; (void)size;
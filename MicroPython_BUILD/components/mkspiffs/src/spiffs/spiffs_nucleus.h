@@ -738,6 +738,10 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs, u16_t max_free_pages);
 
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t reserve_blocks);
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -275,6 +275,7 @@ typedef struct spiffs_t {
 #if SPIFFS_CACHE_STATS
   u32_t cache_hits;
   u32_t cache_misses;
+  u32_t cache_prefetched;
 #endif
 #endif
 
@@ -447,6 +448,21 @@ spiffs_file SPIFFS_open_by_dirent(spiffs *fs, struct spiffs_dirent *e, spiffs_fl
  */
 spiffs_file SPIFFS_open_by_page(spiffs *fs, spiffs_page_ix page_ix, spiffs_flags flags, spiffs_mode mode);
 
+/**
+ * Opens a file by its object id. The index header is found through the
+ * object lookup pages and opened under the same lock, so garbage collection
+ * can't move the file in between.
+ * If there is no file with the id SPIFFS_ERR_NOT_FOUND is returned.
+ * @param fs            the file system struct
+ * @param obj_id        the object id, without SPIFFS_OBJ_ID_IX_FLAG
+ * @param flags         the flags for the open command, can be combinations of
+ *                      SPIFFS_APPEND, SPIFFS_TRUNC, SPIFFS_CREAT, SPIFFS_RD_ONLY,
+ *                      SPIFFS_WR_ONLY, SPIFFS_RDWR, SPIFFS_DIRECT.
+ *                      SPIFFS_CREAT will have no effect in this case.
+ * @param mode          ignored, for posix compliance
+ */
+spiffs_file SPIFFS_open_by_id(spiffs *fs, spiffs_obj_id obj_id, spiffs_flags flags, spiffs_mode mode);
+
 /**
  * Reads from given filehandle.
  * @param fs            the file system struct
@@ -652,6 +668,21 @@ u8_t SPIFFS_mounted(spiffs *fs);
  */
 s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
 
+/**
+ * Does one bounded step of garbage collection, for background tidying
+ * while the system is idle. If less than reserve_blocks blocks are free and
+ * enough pages are deleted to gain a block, erases one block, moving the
+ * remaining data of the block first if needed. One step costs at most the
+ * moves of one block's pages and one block erase.
+ *
+ * Returns 1 if a block was erased, SPIFFS_OK if there was nothing to do,
+ * or an error.
+ *
+ * @param fs             the file system struct
+ * @param reserve_blocks number of free blocks to keep
+ */
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t reserve_blocks);
+
 /**
  * Will try to make room for given amount of bytes in the filesystem by moving
  * pages and erasing blocks.
@@ -10,8 +10,9 @@
 
 #if SPIFFS_CACHE
 
-// returns cached page for give page index, or null if no such cached page
-static spiffs_cache_page *spiffs_cache_page_get(spiffs *fs, spiffs_page_ix pix) {
+// returns cached page for give page index, or null if no such cached page,
+// does not count as an access
+static spiffs_cache_page *spiffs_cache_page_find(spiffs *fs, spiffs_page_ix pix) {
   spiffs_cache *cache = spiffs_get_cache(fs);
   if ((cache->cpage_use_map & cache->cpage_use_mask) == 0) return 0;
   int i;
@@ -20,15 +21,24 @@ static spiffs_cache_page *spiffs_cache_page_get(spiffs *fs, spiffs_page_ix pix)
     if ((cache->cpage_use_map & (1<<i)) &&
         (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) == 0 &&
         cp->pix == pix ) {
-      SPIFFS_CACHE_DBG("CACHE_GET: have cache page "_SPIPRIi" for "_SPIPRIpg"\n", i, pix);
-      cp->last_access = cache->last_access;
       return cp;
     }
   }
-  //SPIFFS_CACHE_DBG("CACHE_GET: no cache for "_SPIPRIpg"\n", pix);
   return 0;
 }
 
+// returns cached page for give page index, or null if no such cached page
+static spiffs_cache_page *spiffs_cache_page_get(spiffs *fs, spiffs_page_ix pix) {
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  spiffs_cache_page *cp = spiffs_cache_page_find(fs, pix);
+  if (cp) {
+    SPIFFS_CACHE_DBG("CACHE_GET: have cache page "_SPIPRIi" for "_SPIPRIpg"\n", cp->ix, pix);
+    cp->last_access = cache->last_access;
+  }
+  //SPIFFS_CACHE_DBG("CACHE_GET: no cache for "_SPIPRIpg"\n", pix);
+  return cp;
+}
+
 // frees cached page
 static s32_t spiffs_cache_page_free(spiffs *fs, int ix, u8_t write_back) {
   s32_t res = SPIFFS_OK;
@@ -65,15 +75,22 @@ static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t fl
     return SPIFFS_OK;
   }
 
-  // all busy, scan thru all to find the cpage which has oldest access
+  // all busy, scan thru all to find the cpage which has oldest access,
+  // pages still on probation go before pages which were hit again, so that
+  // one pass over the lookup pages or a big file does not flush the cache
   int i;
   int cand_ix = -1;
   u32_t oldest_val = 0;
+  u8_t cand_probation = 0;
   for (i = 0; i < cache->cpage_count; i++) {
     spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->last_access - cp->last_access) > oldest_val &&
-        (cp->flags & flag_mask) == flags) {
-      oldest_val = cache->last_access - cp->last_access;
+    if ((cp->flags & flag_mask) != flags) continue;
+    u8_t probation = (cp->flags & SPIFFS_CACHE_FLAG_PROBATION) ? 1 : 0;
+    u32_t age = cache->last_access - cp->last_access;
+    if (probation > cand_probation ||
+        (probation == cand_probation && age > oldest_val)) {
+      oldest_val = age;
+      cand_probation = probation;
       cand_ix = i;
     }
   }
@@ -114,6 +131,102 @@ void spiffs_cache_drop_page(spiffs *fs, spiffs_page_ix pix) {
   }
 }
 
+// keeps at most half of the cache pages out of probation, by putting the
+// least recently used referenced page back on probation, so that the lookup
+// pages hit by every open and write can't pin the whole cache
+static void spiffs_cache_limit_referenced(spiffs *fs) {
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  int i;
+  int count = 0;
+  int cand_ix = -1;
+  u32_t oldest_val = 0;
+  for (i = 0; i < cache->cpage_count; i++) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
+    if ((cache->cpage_use_map & (1<<i)) == 0 ||
+        (cp->flags & (SPIFFS_CACHE_FLAG_TYPE_WR | SPIFFS_CACHE_FLAG_PROBATION))) continue;
+    count++;
+    u32_t age = cache->last_access - cp->last_access;
+    if (cand_ix < 0 || age > oldest_val) {
+      oldest_val = age;
+      cand_ix = i;
+    }
+  }
+  if (count > cache->cpage_count / 2) {
+    spiffs_get_cache_page_hdr(fs, cache, cand_ix)->flags |= SPIFFS_CACHE_FLAG_PROBATION;
+  }
+}
+
+#if SPIFFS_CACHE_PREFETCH
+// reads data page pix and the pages following it in the same block into a
+// run of adjacent cache pages, with one flash read. Returns the cache page
+// holding pix, or null if there is nothing to read ahead
+static spiffs_cache_page *spiffs_cache_prefetch(spiffs *fs, spiffs_page_ix pix, s32_t *res) {
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  u32_t n = SPIFFS_CACHE_PREFETCH + 1;
+  u32_t left = SPIFFS_PAGES_PER_BLOCK(fs) - (pix % SPIFFS_PAGES_PER_BLOCK(fs));
+  u32_t i, j;
+
+  if (n > (u32_t)cache->cpage_count / 2) n = cache->cpage_count / 2;
+  if (n > left) n = left;
+  // stop at the first page which is cached already
+  for (i = 1; i < n; i++) {
+    if (spiffs_cache_page_find(fs, pix + i)) break;
+  }
+  n = i;
+  if (n < 2) return 0;
+
+  // find the run of cache pages which is cheapest to evict, free pages cost
+  // nothing, any referenced page costs more than all pages on probation and
+  // recently used referenced pages cost more than older ones
+  int run_ix = -1;
+  u32_t run_cost = 0xffffffff;
+  for (i = 0; i + n <= cache->cpage_count; i++) {
+    u32_t cost = 0;
+    for (j = i; j < i + n; j++) {
+      spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, j);
+      if ((cache->cpage_use_map & (1<<j)) == 0) continue;
+      if (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) {
+        cost = 0xffffffff;
+        break;
+      }
+      if (cp->flags & SPIFFS_CACHE_FLAG_PROBATION) {
+        cost += 1;
+      } else {
+        u32_t age = cache->last_access - cp->last_access;
+        cost += n + 1 + (age < cache->cpage_count ? cache->cpage_count - age : 0);
+      }
+    }
+    if (cost < run_cost) {
+      run_cost = cost;
+      run_ix = i;
+    }
+  }
+  if (run_ix < 0) return 0;
+
+  for (j = run_ix; j < run_ix + n; j++) {
+    s32_t res2 = spiffs_cache_page_free(fs, j, 1);
+    if (res2 != SPIFFS_OK) *res = res2;
+  }
+  if (SPIFFS_HAL_READ(fs, SPIFFS_PAGE_TO_PADDR(fs, pix), n * SPIFFS_CFG_LOG_PAGE_SZ(fs),
+      spiffs_get_cache_page(fs, cache, run_ix)) != SPIFFS_OK) {
+    // let the caller read the single page and report the error
+    return 0;
+  }
+  for (j = 0; j < n; j++) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, run_ix + j);
+    cache->cpage_use_map |= (1 << (run_ix + j));
+    cp->flags = SPIFFS_CACHE_FLAG_WRTHRU | SPIFFS_CACHE_FLAG_PROBATION;
+    cp->pix = pix + j;
+    cp->last_access = cache->last_access;
+  }
+  SPIFFS_CACHE_DBG("CACHE_PREF: read "_SPIPRIi" pages from "_SPIPRIpg"\n", n, pix);
+#if SPIFFS_CACHE_STATS
+  fs->cache_prefetched += n - 1;
+#endif
+  return spiffs_get_cache_page_hdr(fs, cache, run_ix);
+}
+#endif
+
 // ------------------------------
 
 // reads from spi flash or the cache
@@ -127,14 +240,40 @@ s32_t spiffs_phys_rd(
   (void)fh;
   s32_t res = SPIFFS_OK;
   spiffs_cache *cache = spiffs_get_cache(fs);
-  spiffs_cache_page *cp =  spiffs_cache_page_get(fs, SPIFFS_PADDR_TO_PAGE(fs, addr));
+  spiffs_page_ix pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+  // set when a file descriptor reads its data pages in physical order
+  u8_t seq = 0;
+#if SPIFFS_CACHE_PREFETCH
+  if ((op & SPIFFS_OP_TYPE_MASK) == SPIFFS_OP_T_OBJ_DA &&
+      (op & SPIFFS_OP_COM_MASK) == SPIFFS_OP_C_READ &&
+      fh > 0 && (u32_t)fh <= fs->fd_count) {
+    spiffs_fd *fd = &((spiffs_fd *)fs->fd_space)[fh-1];
+    if (pix == fd->ra_pix || pix + 1 == fd->ra_pix ||
+        ((fd->ra_pix % SPIFFS_PAGES_PER_BLOCK(fs)) == 0 &&
+         pix == fd->ra_pix + SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
+      // next page, same page again or first data page of the next block
+      seq = 1;
+    }
+    fd->ra_pix = pix + 1;
+  }
+#endif
+  spiffs_cache_page *cp =  spiffs_cache_page_find(fs, pix);
   cache->last_access++;
   if (cp) {
     // we've already got one, you see
 #if SPIFFS_CACHE_STATS
     fs->cache_hits++;
 #endif
-    cp->last_access = cache->last_access;
+    if (!seq) {
+      // referenced again, keep it over pages which were used only once
+      cp->last_access = cache->last_access;
+      if (cp->flags & SPIFFS_CACHE_FLAG_PROBATION) {
+        cp->flags &= ~SPIFFS_CACHE_FLAG_PROBATION;
+        spiffs_cache_limit_referenced(fs);
+      }
+    }
+    // pages passed by a sequential reader keep their age, so the ones
+    // already consumed are evicted before the ones read ahead
     u8_t *mem =  spiffs_get_cache_page(fs, cache, cp->ix);
     memcpy(dst, &mem[SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr)], len);
   } else {
@@ -144,6 +283,16 @@ s32_t spiffs_phys_rd(
     }
 #if SPIFFS_CACHE_STATS
     fs->cache_misses++;
+#endif
+#if SPIFFS_CACHE_PREFETCH
+    if (seq) {
+      cp = spiffs_cache_prefetch(fs, pix, &res);
+      if (cp) {
+        u8_t *mem =  spiffs_get_cache_page(fs, cache, cp->ix);
+        memcpy(dst, &mem[SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr)], len);
+        return res;
+      }
+    }
 #endif
     // this operation will always free one cache page (unless all already free),
     // the result code stems from the write operation of the possibly freed cache page
@@ -151,8 +300,8 @@ s32_t spiffs_phys_rd(
 
     cp = spiffs_cache_page_allocate(fs);
     if (cp) {
-      cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
-      cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+      cp->flags = SPIFFS_CACHE_FLAG_WRTHRU | SPIFFS_CACHE_FLAG_PROBATION;
+      cp->pix = pix;
 
       s32_t res2 = SPIFFS_HAL_READ(fs,
           addr - SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr),
@@ -286,6 +435,8 @@ void spiffs_cache_init(spiffs *fs) {
   int cache_entries =
       (sz - sizeof(spiffs_cache)) / (SPIFFS_CACHE_PAGE_SIZE(fs));
   if (cache_entries <= 0) return;
+  // the cache page use map is 32 bits wide
+  if (cache_entries > 32) cache_entries = 32;
 
   for (i = 0; i < cache_entries; i++) {
     cache_mask <<= 1;
@@ -107,7 +107,14 @@ QueueHandle_t spiffs_mutex;
 
 // Enable/disable statistics on caching. Debug/test purpose only.
 #ifndef  SPIFFS_CACHE_STATS
-#define SPIFFS_CACHE_STATS              0
+#define SPIFFS_CACHE_STATS              1
+#endif
+
+// Number of data pages read ahead into the cache, in one flash read, when a
+// file descriptor reads physically consecutive data pages. Read ahead pages
+// never take more than half of the cache. 0 disables read ahead.
+#ifndef  SPIFFS_CACHE_PREFETCH
+#define SPIFFS_CACHE_PREFETCH           4
 #endif
 #endif
 
@@ -0,0 +1,194 @@
+/*
+ * spiffs_dirindex.c
+ *
+ * In-RAM directory index for the spiffs VFS
+ *
+ * Names are spiffs object names: "/a/b" for a file, "/a/b/." for the
+ * directory marker of "/a/b" and "/." for the root. Paths are the VFS
+ * paths, "/a/b". Nodes with neither a file nor a marker only hold the
+ * path to deeper entries and are not listed.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "spiffs_dirindex.h"
+
+// Compare a node name with the component name[0..len)
+//--------------------------------------------------------------------------
+static int name_cmp(const char *node_name, const char *name, size_t len) {
+    int res = strncmp(node_name, name, len);
+    if (res != 0) return res;
+    return (unsigned char)node_name[len];
+}
+
+// Find the node of path, creating the missing nodes if create is set
+//--------------------------------------------------------------------------------------------------------------------------
+static struct spiffs_dirindex_node * find_node(struct spiffs_dirindex *index, const char *path, size_t path_len, int create) {
+    struct spiffs_dirindex_node *node = index->root;
+    const char *end = path + path_len;
+
+    while (node && path < end) {
+        // Next path component
+        while ((path < end) && (*path == '/')) path++;
+        const char *comp = path;
+        while ((path < end) && (*path != '/')) path++;
+        size_t len = path - comp;
+        if (len == 0) break;
+
+        // Children are sorted, stop at the first one not below comp
+        struct spiffs_dirindex_node **link = &node->child;
+        int cmp = 1;
+        while (*link && ((cmp = name_cmp((*link)->name, comp, len)) < 0)) {
+            link = &(*link)->next;
+        }
+        if (*link && (cmp == 0)) {
+            node = *link;
+            continue;
+        }
+        if (!create) return NULL;
+
+        struct spiffs_dirindex_node *child = calloc(1, sizeof(struct spiffs_dirindex_node) + len + 1);
+        if (!child) return NULL;
+        memcpy(child->name, comp, len);
+        child->parent = node;
+        child->next = *link;
+        *link = child;
+        node = child;
+    }
+    return node;
+}
+
+// Split an object name into its path and whether it is a directory marker
+//-------------------------------------------------------------------------
+static size_t name_to_path(const char *name, int *is_marker) {
+    size_t len = strlen(name);
+    *is_marker = 0;
+    if ((len >= 2) && (name[len - 2] == '/') && (name[len - 1] == '.')) {
+        *is_marker = 1;
+        len -= 2;
+    }
+    return len;
+}
+
+static void free_nodes(struct spiffs_dirindex_node *node) {
+    while (node) {
+        struct spiffs_dirindex_node *next = node->next;
+        free_nodes(node->child);
+        free(node);
+        node = next;
+    }
+}
+
+int spiffs_dirindex_init(struct spiffs_dirindex *index) {
+    index->root = calloc(1, sizeof(struct spiffs_dirindex_node) + 1);
+    if (!index->root) return ENOMEM;
+    index->generation = 0;
+    mtx_init(&index->mutex, NULL, NULL, 0);
+    return 0;
+}
+
+void spiffs_dirindex_destroy(struct spiffs_dirindex *index) {
+    if (!index->root) return;
+    mtx_lock(&index->mutex);
+    free_nodes(index->root);
+    index->root = NULL;
+    mtx_unlock(&index->mutex);
+    mtx_destroy(&index->mutex);
+}
+
+// Add the file or directory marker with the object name name
+//-------------------------------------------------------------------------------------------------------
+int spiffs_dirindex_add(struct spiffs_dirindex *index, const char *name, spiffs_obj_id obj_id) {
+    int is_marker;
+    size_t len = name_to_path(name, &is_marker);
+
+    mtx_lock(&index->mutex);
+    struct spiffs_dirindex_node *node = find_node(index, name, len, 1);
+    if (!node) {
+        mtx_unlock(&index->mutex);
+        return ENOMEM;
+    }
+    if (is_marker) node->dir_id = obj_id;
+    else node->file_id = obj_id;
+    index->generation++;
+    mtx_unlock(&index->mutex);
+
+    return 0;
+}
+
+// Remove the file or directory marker with the object name name
+//------------------------------------------------------------------------------------------
+void spiffs_dirindex_remove(struct spiffs_dirindex *index, const char *name) {
+    int is_marker;
+    size_t len = name_to_path(name, &is_marker);
+
+    mtx_lock(&index->mutex);
+    struct spiffs_dirindex_node *node = find_node(index, name, len, 0);
+    if (node) {
+        if (is_marker) node->dir_id = 0;
+        else node->file_id = 0;
+
+        // Drop the nodes left without entries
+        while ((node != index->root) && !node->file_id && !node->dir_id && !node->child) {
+            struct spiffs_dirindex_node *parent = node->parent;
+            struct spiffs_dirindex_node **link = &parent->child;
+            while (*link != node) link = &(*link)->next;
+            *link = node->next;
+            free(node);
+            node = parent;
+        }
+        index->generation++;
+    }
+    mtx_unlock(&index->mutex);
+}
+
+// Get the object ids of the file and directory marker at path
+// Returns 1 if there is either of them, 0 if not
+//-----------------------------------------------------------------------------------------------------------------------------------------
+int spiffs_dirindex_lookup(struct spiffs_dirindex *index, const char *path, spiffs_obj_id *file_id, spiffs_obj_id *dir_id) {
+    mtx_lock(&index->mutex);
+    struct spiffs_dirindex_node *node = find_node(index, path, strlen(path), 0);
+    *file_id = node ? node->file_id : 0;
+    *dir_id = node ? node->dir_id : 0;
+    mtx_unlock(&index->mutex);
+
+    return (*file_id || *dir_id) ? 1 : 0;
+}
+
+// Get the next entry of the directory path, in name order
+// Returns 1 and the entry's name and type, or 0 at the end of the directory
+//---------------------------------------------------------------------------------------------------------------------------------------------------------------
+int spiffs_dirindex_next(struct spiffs_dirindex *index, const char *path, struct spiffs_dirindex_pos *pos, char *name, size_t len, int *is_dir) {
+    struct spiffs_dirindex_node *node;
+
+    mtx_lock(&index->mutex);
+    if (pos->started && (pos->generation == index->generation)) {
+        node = pos->next;
+    } else {
+        // First call, or the index changed: find the entry after the last one
+        node = find_node(index, path, strlen(path), 0);
+        node = node ? node->child : NULL;
+        while (pos->started && node && (strcmp(node->name, pos->last) <= 0)) {
+            node = node->next;
+        }
+    }
+    while (node && !node->file_id && !node->dir_id) {
+        node = node->next;
+    }
+
+    pos->started = 1;
+    pos->generation = index->generation;
+    pos->next = node ? node->next : NULL;
+    if (node) {
+        strlcpy(pos->last, node->name, sizeof(pos->last));
+        strlcpy(name, node->name, len);
+        *is_dir = node->dir_id ? 1 : 0;
+    }
+    mtx_unlock(&index->mutex);
+
+    return node ? 1 : 0;
+}
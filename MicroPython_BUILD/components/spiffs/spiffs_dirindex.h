@@ -0,0 +1,52 @@
+/*
+ * spiffs_dirindex.h
+ *
+ * In-RAM directory index for the spiffs VFS
+ *
+ * spiffs has a flat name space, directories are marked with "<dir>/." files.
+ * The index holds one node per path component, children sorted by name,
+ * with the object ids of the file and of the directory marker at that path.
+ * It is built once at mount and kept up to date by the VFS operations, so
+ * lookups and directory listings don't scan the whole file system.
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef _SPIFFS_DIRINDEX_H
+#define _SPIFFS_DIRINDEX_H
+
+#include <stdint.h>
+#include "spiffs.h"
+#include "mutex.h"
+
+struct spiffs_dirindex_node {
+    struct spiffs_dirindex_node *parent;
+    struct spiffs_dirindex_node *child;     // first child, children are sorted by name
+    struct spiffs_dirindex_node *next;      // next sibling
+    spiffs_obj_id file_id;                  // file with this path, 0 if none
+    spiffs_obj_id dir_id;                   // "<path>/." directory marker, 0 if none
+    char name[];
+};
+
+struct spiffs_dirindex {
+    struct mtx mutex;
+    struct spiffs_dirindex_node *root;
+    uint32_t generation;                    // changed by every update
+};
+
+// Position of a directory listing
+struct spiffs_dirindex_pos {
+    uint32_t generation;
+    struct spiffs_dirindex_node *next;      // valid while generation is unchanged
+    char last[SPIFFS_OBJ_NAME_LEN];
+    uint8_t started;
+};
+
+int spiffs_dirindex_init(struct spiffs_dirindex *index);
+void spiffs_dirindex_destroy(struct spiffs_dirindex *index);
+int spiffs_dirindex_add(struct spiffs_dirindex *index, const char *name, spiffs_obj_id obj_id);
+void spiffs_dirindex_remove(struct spiffs_dirindex *index, const char *name);
+int spiffs_dirindex_lookup(struct spiffs_dirindex *index, const char *path, spiffs_obj_id *file_id, spiffs_obj_id *dir_id);
+int spiffs_dirindex_next(struct spiffs_dirindex *index, const char *path, struct spiffs_dirindex_pos *pos, char *name, size_t len, int *is_dir);
+
+#endif /* _SPIFFS_DIRINDEX_H */
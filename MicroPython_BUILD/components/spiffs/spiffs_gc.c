@@ -195,6 +195,97 @@ s32_t spiffs_gc_check(
   return res;
 }
 
+// Counts the deleted pages of a block
+static s32_t spiffs_gc_count_deleted(
+    spiffs *fs,
+    spiffs_block_ix bix,
+    u32_t *dele) {
+  s32_t res = SPIFFS_OK;
+  int obj_lookup_page = 0;
+  int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
+  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
+  int cur_entry = 0;
+
+  *dele = 0;
+  while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+    int entry_offset = obj_lookup_page * entries_per_page;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+        0, bix * SPIFFS_CFG_LOG_BLOCK_SZ(fs) + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    while (res == SPIFFS_OK &&
+        cur_entry - entry_offset < entries_per_page && cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
+      if (obj_lu_buf[cur_entry-entry_offset] == SPIFFS_OBJ_ID_DELETED) {
+        (*dele)++;
+      }
+      cur_entry++;
+    } // per entry
+    obj_lookup_page++;
+  } // per object lookup page
+  return res;
+}
+
+// Does one step of incremental garbage collection, meant to be called when
+// the file system is idle so that writes rarely have to wait for gc_check.
+// If less than reserve_blocks blocks are free and the deleted pages add up
+// to at least one block, the best gc candidate having deleted pages is
+// cleaned and erased. Candidates are ranked by spiffs_gc_find_candidate, so
+// erase age is honored the same way as in gc_check. Returns 1 if a block
+// was erased, SPIFFS_OK if there was nothing to do, or an error.
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t reserve_blocks) {
+  s32_t res;
+  u32_t pages_per_block = SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs);
+  s32_t free_pages =
+      pages_per_block * (fs->block_count - 2)
+      - fs->stats_p_allocated - fs->stats_p_deleted;
+
+  if (fs->free_blocks >= reserve_blocks || fs->stats_p_deleted < pages_per_block) {
+    return SPIFFS_OK;
+  }
+
+  if (free_pages <= 0) {
+    // crammed, leave it to gc_check
+    return SPIFFS_OK;
+  }
+
+  spiffs_block_ix *cands;
+  int count;
+  res = spiffs_gc_find_candidate(fs, &cands, &count, 0);
+  SPIFFS_CHECK_RES(res);
+
+  // the candidate table lives in the work buffer, which is used for cleaning
+  spiffs_block_ix cand_list[8];
+  int cand_count = MIN(count, (int)(sizeof(cand_list) / sizeof(cand_list[0])));
+  memcpy(cand_list, cands, cand_count * sizeof(spiffs_block_ix));
+
+  int i;
+  for (i = 0; i < cand_count; i++) {
+    u32_t dele;
+    res = spiffs_gc_count_deleted(fs, cand_list[i], &dele);
+    SPIFFS_CHECK_RES(res);
+    if (dele == 0) {
+      // moving data around gains nothing here
+      continue;
+    }
+    SPIFFS_GC_DBG("gc_step: cleaning block "_SPIPRIbl", "_SPIPRIi" deleted\n", cand_list[i], dele);
+#if SPIFFS_GC_STATS
+    fs->stats_gc_runs++;
+#endif
+    fs->cleaning = 1;
+    res = spiffs_gc_clean(fs, cand_list[i]);
+    fs->cleaning = 0;
+    SPIFFS_CHECK_RES(res);
+
+    res = spiffs_gc_erase_page_stats(fs, cand_list[i]);
+    SPIFFS_CHECK_RES(res);
+
+    res = spiffs_gc_erase_block(fs, cand_list[i]);
+    SPIFFS_CHECK_RES(res);
+    return 1;
+  }
+  return SPIFFS_OK;
+}
+
 // Updates page statistics for a block that is about to be erased
 s32_t spiffs_gc_erase_page_stats(
     spiffs *fs,
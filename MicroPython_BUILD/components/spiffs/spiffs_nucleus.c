@@ -2259,6 +2259,9 @@ s32_t spiffs_fd_find_new(spiffs *fs, spiffs_fd **fd, const char *name) {
       }
     }
     cur_fd->file_nbr = cand_ix+1;
+#if SPIFFS_CACHE && SPIFFS_CACHE_PREFETCH
+    cur_fd->ra_pix = 0;
+#endif
     *fd = cur_fd;
     return SPIFFS_OK;
   } else {
@@ -2272,6 +2275,9 @@ s32_t spiffs_fd_find_new(spiffs *fs, spiffs_fd **fd, const char *name) {
     spiffs_fd *cur_fd = &fds[i];
     if (cur_fd->file_nbr == 0) {
       cur_fd->file_nbr = i+1;
+#if SPIFFS_CACHE && SPIFFS_CACHE_PREFETCH
+      cur_fd->ra_pix = 0;
+#endif
       *fd = cur_fd;
       return SPIFFS_OK;
     }
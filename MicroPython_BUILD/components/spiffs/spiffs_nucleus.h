@@ -358,6 +358,8 @@
 #define SPIFFS_CACHE_FLAG_OBJLU       (1<<2)
 #define SPIFFS_CACHE_FLAG_OBJIX       (1<<3)
 #define SPIFFS_CACHE_FLAG_DATA        (1<<4)
+// page was read once and not referenced since, first choice for eviction
+#define SPIFFS_CACHE_FLAG_PROBATION   (1<<5)
 #define SPIFFS_CACHE_FLAG_TYPE_WR     (1<<7)
 
 #define SPIFFS_CACHE_PAGE_SIZE(fs) \
@@ -366,11 +368,13 @@
 #define spiffs_get_cache(fs) \
   ((spiffs_cache *)((fs)->cache))
 
+// cache page headers are kept in front of the page data, so that the data of
+// adjacent cache pages is contiguous and can be filled by one flash read
 #define spiffs_get_cache_page_hdr(fs, c, ix) \
-  ((spiffs_cache_page *)(&((c)->cpages[(ix) * SPIFFS_CACHE_PAGE_SIZE(fs)])))
+  ((spiffs_cache_page *)(&((c)->cpages[(ix) * sizeof(spiffs_cache_page)])))
 
 #define spiffs_get_cache_page(fs, c, ix) \
-  ((u8_t *)(&((c)->cpages[(ix) * SPIFFS_CACHE_PAGE_SIZE(fs)])) + sizeof(spiffs_cache_page))
+  ((u8_t *)(&((c)->cpages[(c)->cpage_count * sizeof(spiffs_cache_page) + (ix) * SPIFFS_CFG_LOG_PAGE_SZ(fs)])))
 
 // cache page struct
 typedef struct {
@@ -437,6 +441,10 @@ typedef struct {
 #if SPIFFS_CACHE_WR
   spiffs_cache_page *cache_page;
 #endif
+#if SPIFFS_CACHE && SPIFFS_CACHE_PREFETCH
+  // data page expected next if this descriptor reads sequentially
+  spiffs_page_ix ra_pix;
+#endif
 #if SPIFFS_TEMPORAL_FD_CACHE
   // djb2 hash of filename
   u32_t name_hash;
@@ -738,6 +746,10 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs, u16_t max_free_pages);
 
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t reserve_blocks);
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -62,6 +62,7 @@
 #include <esp_spiffs.h>
 #include <spiffs_nucleus.h>
 #include "spiffs_list.h"
+#include "spiffs_dirindex.h"
 #include <sys/fcntl.h>
 #include <sys/dirent.h>
 #include "sdkconfig.h"
@@ -87,6 +88,7 @@ typedef struct {
 	char path[MAXNAMLEN + 1];
 	struct dirent ent;
 	uint8_t read_mount;
+	struct spiffs_dirindex_pos pos;
 } vfs_spiffs_dir_t;
 
 typedef struct {
@@ -105,6 +107,31 @@ typedef struct {
 static spiffs fs;
 static struct spiffs_list files;
 
+// Directory index, used while dirindex_ok is set. If it can't be built or
+// updated for lack of memory, the file system is scanned as before.
+static struct spiffs_dirindex dirindex;
+static int dirindex_ok = 0;
+
+// Number of spiffs read cache pages, up to 32
+#ifdef CONFIG_MICROPY_SPIFFS_CACHE_PAGES
+#define SPIFFS_VFS_CACHE_PAGES CONFIG_MICROPY_SPIFFS_CACHE_PAGES
+#else
+#define SPIFFS_VFS_CACHE_PAGES 8
+#endif
+
+// Number of free blocks kept by uos.fsgc() and the background gc task
+#ifdef CONFIG_MICROPY_SPIFFS_GC_RESERVE
+#define SPIFFS_VFS_GC_RESERVE CONFIG_MICROPY_SPIFFS_GC_RESERVE
+#else
+#define SPIFFS_VFS_GC_RESERVE 4
+#endif
+// Background gc task idle check period
+#define SPIFFS_VFS_GC_PERIOD_MS 1000
+
+#if CONFIG_MICROPY_SPIFFS_GC_TASK
+static TaskHandle_t gc_task_handle = NULL;
+#endif
+
 static uint8_t *my_spiffs_work_buf;
 static uint8_t *my_spiffs_fds;
 static uint8_t *my_spiffs_cache;
@@ -125,6 +152,71 @@ void IRAM_ATTR spiffs_fs_stat(uint32_t *total, uint32_t *used) {
 	}
 }
 
+// Get the read cache statistics, optionally clearing the counters
+//--------------------------------------------------------------------------------------------------------------------
+void IRAM_ATTR spiffs_cache_stat(uint32_t *pages, uint32_t *hits, uint32_t *misses, uint32_t *prefetched, int reset) {
+	*pages = 0;
+	*hits = 0;
+	*misses = 0;
+	*prefetched = 0;
+	if (!spiffs_is_mounted) return;
+
+	SPIFFS_LOCK(&fs);
+	*pages = spiffs_get_cache(&fs)->cpage_count;
+	#if SPIFFS_CACHE_STATS
+	*hits = fs.cache_hits;
+	*misses = fs.cache_misses;
+	*prefetched = fs.cache_prefetched;
+	if (reset) {
+		fs.cache_hits = 0;
+		fs.cache_misses = 0;
+		fs.cache_prefetched = 0;
+	}
+	#endif
+	SPIFFS_UNLOCK(&fs);
+}
+
+/*
+ * Incremental garbage collection: run gc steps until SPIFFS_VFS_GC_RESERVE
+ * blocks are free, there is nothing left to reclaim or budget_ms is used up.
+ * At least one step is done and a started step is always finished, a step
+ * moves the data of one block and erases it.
+ * Returns the number of erased blocks, -1 on error.
+ */
+//---------------------------------------------------------------------
+int IRAM_ATTR spiffs_fs_gc(uint32_t budget_ms, uint32_t *free_blocks) {
+	int erased = 0;
+	*free_blocks = 0;
+	if (!spiffs_is_mounted) return -1;
+
+	TickType_t start = xTaskGetTickCount();
+	while (1) {
+		int res = SPIFFS_gc_step(&fs, SPIFFS_VFS_GC_RESERVE);
+		if (res < 0) {
+			ESP_LOGE(TAG, "gc step error %d", res);
+			return -1;
+		}
+		if (res == 0) break;
+		erased++;
+		if ((xTaskGetTickCount() - start) * portTICK_PERIOD_MS >= budget_ms) break;
+	}
+	*free_blocks = fs.free_blocks;
+	return erased;
+}
+
+#if CONFIG_MICROPY_SPIFFS_GC_TASK
+// Low priority task keeping SPIFFS_VFS_GC_RESERVE blocks free, so that
+// writes rarely have to wait for the garbage collector themselves
+//----------------------------------------------
+static void spiffs_gc_task(void *pvParameters) {
+	while (1) {
+		int res = SPIFFS_gc_step(&fs, SPIFFS_VFS_GC_RESERVE);
+		// give the cpu and the file system lock away between steps
+		vTaskDelay(((res > 0) ? 10 : SPIFFS_VFS_GC_PERIOD_MS) / portTICK_PERIOD_MS);
+	}
+}
+#endif
+
 /*
  * Test if path corresponds to a directory. Return 0 if is not a directory,
  * 1 if it's a directory.
@@ -139,6 +231,12 @@ static int IRAM_ATTR is_dir(const char *path) {
 	ESP_LOGD(TAG, "is_dir() path '%s'", path);
 	struct spiffs_dirent e;
 
+	if (dirindex_ok) {
+		spiffs_obj_id file_id, dir_id;
+		spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id);
+		return dir_id ? 1 : 0;
+	}
+
     // Add /. to path
     strlcpy(npath, path, PATH_MAX);
     if (strcmp(path,"/") != 0) {
@@ -160,6 +258,47 @@ static int IRAM_ATTR is_dir(const char *path) {
     return res;
 }
 
+/*
+ * Index maintenance, the index is dropped if it can't be updated
+ */
+//------------------------------------------------------------------------
+static void IRAM_ATTR dirindex_add(const char *name, spiffs_obj_id obj_id) {
+	if (dirindex_ok && spiffs_dirindex_add(&dirindex, name, obj_id)) {
+		ESP_LOGW(TAG, "out of memory, directory index disabled");
+		dirindex_ok = 0;
+		spiffs_dirindex_destroy(&dirindex);
+	}
+}
+
+//-----------------------------------------------------
+static void IRAM_ATTR dirindex_remove(const char *name) {
+	if (dirindex_ok) spiffs_dirindex_remove(&dirindex, name);
+}
+
+//--------------------------
+static void dirindex_build() {
+	spiffs_DIR d;
+	struct spiffs_dirent e;
+
+	if (spiffs_dirindex_init(&dirindex)) return;
+	dirindex_ok = 1;
+	SPIFFS_opendir(&fs, "/", &d);
+	while (dirindex_ok && SPIFFS_readdir(&d, &e)) {
+		dirindex_add((const char *)e.name, e.obj_id);
+	}
+	SPIFFS_closedir(&d);
+}
+
+/*
+ * Open the object with the given id. The index header is found through
+ * the object lookup pages, without reading every object's name as
+ * SPIFFS_open() does.
+ */
+//--------------------------------------------------------------------------------------
+static spiffs_file IRAM_ATTR open_by_id(spiffs_obj_id obj_id, spiffs_flags spiffs_mode) {
+	return SPIFFS_open_by_id(&fs, obj_id, spiffs_mode, 0);
+}
+
 /*
  * This function translate error codes from SPIFFS to errno error codes
  *
@@ -203,6 +342,7 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
 	int fd, result = 0, exists = 0;
 	spiffs_stat stat;
 	spiffs_metadata_t meta;
+	spiffs_obj_id file_id = 0, dir_id = 0;
 
 	ESP_LOGD(TAG, "open() path '%s'", path);
 	// Allocate new file
@@ -221,7 +361,8 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
     }
 
     // Check if file exists
-    if (SPIFFS_stat(&fs, path, &stat) == SPIFFS_OK) exists = 1;
+    if (dirindex_ok) exists = spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id);
+    else if (SPIFFS_stat(&fs, path, &stat) == SPIFFS_OK) exists = 1;
 
     // Make a copy of path
 	strlcpy(file->path, path, MAXNAMLEN);
@@ -248,7 +389,7 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
     if (flags & O_TRUNC)
     	spiffs_mode |= SPIFFS_TRUNC;
 
-    if (is_dir(path)) {
+    if (dirindex_ok ? (dir_id != 0) : is_dir(path)) {
         char npath[PATH_MAX + 1];
 
         // Add /. to path
@@ -260,15 +401,24 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
         }
 
         // Open SPIFFS file
-        file->spiffs_file = SPIFFS_open(&fs, npath, spiffs_mode, 0);
+        if (dir_id) file->spiffs_file = open_by_id(dir_id, spiffs_mode);
+        else file->spiffs_file = SPIFFS_open(&fs, npath, spiffs_mode, 0);
         if (file->spiffs_file < 0) {
             result = spiffs_result(fs.err_code);
         }
 
     	file->is_dir = 1;
+    } else if (file_id && ((flags & (O_CREAT | O_EXCL)) == (O_CREAT | O_EXCL))) {
+    	result = EEXIST;
     } else {
         // Open SPIFFS file
-        file->spiffs_file = SPIFFS_open(&fs, path, spiffs_mode, 0);
+        file->spiffs_file = SPIFFS_ERR_NOT_FOUND;
+        fs.err_code = SPIFFS_ERR_NOT_FOUND;
+        if (file_id) file->spiffs_file = open_by_id(file_id, spiffs_mode);
+        // A file missing from the index can only be created
+        if ((file->spiffs_file < 0) && (!dirindex_ok || (flags & O_CREAT))) {
+            file->spiffs_file = SPIFFS_open(&fs, path, spiffs_mode, 0);
+        }
         if (file->spiffs_file < 0) {
             result = spiffs_result(fs.err_code);
         }
@@ -282,6 +432,8 @@ static int IRAM_ATTR vfs_spiffs_open(const char *path, int flags, int mode) {
 
     res = vfs_spiffs_getstat(file->spiffs_file, &stat, &meta);
 	if (res == SPIFFS_OK) {
+		if (!exists && !file->is_dir) dirindex_add(path, stat.obj_id);
+
 		// update file's time information
 		meta.atime = time(NULL); // Get the system time to access time
 		if (!exists) meta.ctime = meta.atime;
@@ -357,6 +509,15 @@ static ssize_t IRAM_ATTR vfs_spiffs_read(int fd, void * dst, size_t size) {
 	return -1;
 }
 
+//-------------------------------------------------------------------------------------------------
+static void IRAM_ATTR set_stat_times(struct stat *st, spiffs_stat *stat, spiffs_metadata_t *meta) {
+    st->st_mtime = meta->mtime;
+    st->st_ctime = meta->ctime;
+    st->st_atime = meta->atime;
+
+	st->st_size = stat->size;
+}
+
 //---------------------------------------------------------------
 static int IRAM_ATTR vfs_spiffs_fstat(int fd, struct stat * st) {
 	vfs_spiffs_file_t *file;
@@ -377,12 +538,7 @@ static int IRAM_ATTR vfs_spiffs_fstat(int fd, struct stat * st) {
     res = vfs_spiffs_getstat(file->spiffs_file, &stat, &meta);
     if (res == SPIFFS_OK) {
         // Set file's time information from metadata
-        st->st_mtime = meta.mtime;
-        st->st_ctime = meta.ctime;
-        st->st_atime = meta.atime;
-
-    	st->st_size = stat.size;
-
+        set_stat_times(st, &stat, &meta);
 	} else {
         st->st_mtime = 0;
         st->st_ctime = 0;
@@ -465,6 +621,32 @@ static int IRAM_ATTR vfs_spiffs_stat(const char * path, struct stat * st) {
 	int fd;
 	int res;
 	ESP_LOGD(TAG, "stat() path '%s'", path);
+	if (dirindex_ok) {
+		// Read only, without the access time update of open()
+		spiffs_obj_id file_id, dir_id;
+		spiffs_stat stat;
+		spiffs_metadata_t meta;
+
+		if (!spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id)) {
+			errno = ENOENT;
+			return -1;
+		}
+		spiffs_file sfd = open_by_id(dir_id ? dir_id : file_id, SPIFFS_RDONLY);
+		if (sfd < 0) {
+			errno = spiffs_result(fs.err_code);
+			return -1;
+		}
+		res = vfs_spiffs_getstat(sfd, &stat, &meta);
+		SPIFFS_close(&fs, sfd);
+		if (res != SPIFFS_OK) {
+			errno = spiffs_result(fs.err_code);
+			return -1;
+		}
+		st->st_blksize = SPIFFS_LOG_PAGE_SIZE;
+		set_stat_times(st, &stat, &meta);
+		st->st_mode = dir_id ? S_IFDIR : S_IFREG;
+		return 0;
+	}
 	fd = vfs_spiffs_open(path, 0, 0);
 	res = vfs_spiffs_fstat(fd, st);
 	vfs_spiffs_close(fd);
@@ -513,7 +695,18 @@ static int IRAM_ATTR vfs_spiffs_unlink(const char *path) {
 	}
 
     // Open SPIFFS file
-	spiffs_file FP = SPIFFS_open(&fs, npath, SPIFFS_RDWR, 0);
+	spiffs_file FP;
+	if (dirindex_ok) {
+		spiffs_obj_id file_id, dir_id;
+		spiffs_dirindex_lookup(&dirindex, path, &file_id, &dir_id);
+		if (is_dir(path)) file_id = dir_id;
+		if (file_id) FP = open_by_id(file_id, SPIFFS_RDWR);
+		else {
+			FP = SPIFFS_ERR_NOT_FOUND;
+			fs.err_code = SPIFFS_ERR_NOT_FOUND;
+		}
+	}
+	else FP = SPIFFS_open(&fs, npath, SPIFFS_RDWR, 0);
     if (FP < 0) {
     	errno = spiffs_result(fs.err_code);
     	return -1;
@@ -527,17 +720,29 @@ static int IRAM_ATTR vfs_spiffs_unlink(const char *path) {
     }
 
 	SPIFFS_close(&fs, FP);
+	dirindex_remove(npath);
 
 	return 0;
 }
 
 //------------------------------------------------------------------------
 static int IRAM_ATTR vfs_spiffs_rename(const char *src, const char *dst) {
+	spiffs_obj_id file_id = 0, dir_id;
+	spiffs_stat stat;
+
+	if (dirindex_ok) spiffs_dirindex_lookup(&dirindex, src, &file_id, &dir_id);
+
     if (SPIFFS_rename(&fs, src, dst) < 0) {
     	errno = spiffs_result(fs.err_code);
     	return -1;
     }
 
+    if (dirindex_ok) {
+    	dirindex_remove(src);
+    	if (!file_id && (SPIFFS_stat(&fs, dst, &stat) == SPIFFS_OK)) file_id = stat.obj_id;
+    	if (file_id) dirindex_add(dst, file_id);
+    }
+
     return 0;
 }
 
@@ -595,6 +800,15 @@ static struct dirent* IRAM_ATTR vfs_spiffs_readdir(DIR* pdir) {
     // Clear current dirent
     memset(ent,0,sizeof(struct dirent));
 
+    if (dirindex_ok) {
+        int entry_is_dir;
+        if (!spiffs_dirindex_next(&dirindex, dir->path, &dir->pos, ent->d_name, sizeof(ent->d_name), &entry_is_dir)) {
+            return NULL;
+        }
+        ent->d_type = entry_is_dir ? DT_DIR : DT_REG;
+        return ent;
+    }
+
     if (!dir->read_mount) {
     	/*
 		// If this is the first call to readdir for pdir, and
@@ -734,11 +948,15 @@ static int IRAM_ATTR vfs_spiffs_mkdir(const char *path, mode_t mode) {
         return -1;
     }
 
+    spiffs_stat stat;
+    int indexed = (SPIFFS_fstat(&fs, fd, &stat) == SPIFFS_OK);
+
     if (SPIFFS_close(&fs, fd) < 0) {
         res = spiffs_result(fs.err_code);
         errno = res;
         return -1;
     }
+    if (indexed) dirindex_add(npath, stat.obj_id);
 
 	spiffs_metadata_t meta;
 	meta.atime = time(NULL); // Get the system time to access time
@@ -802,8 +1020,12 @@ int spiffs_mount() {
     	goto err_exit;
     }
 
-    int cache_len = cfg.log_page_size * SPIFFS_TEMPORAL_CACHE_HIT_SCORE;
-    my_spiffs_cache = heap_caps_malloc(cache_len, MALLOC_CAP_DMA);
+    int cache_len = sizeof(spiffs_cache) + SPIFFS_VFS_CACHE_PAGES * (sizeof(spiffs_cache_page) + cfg.log_page_size);
+    my_spiffs_cache = NULL;
+	#if CONFIG_SPIRAM_SUPPORT && defined(CONFIG_MICROPY_SPIFFS_CACHE_PSRAM)
+    my_spiffs_cache = heap_caps_malloc(cache_len, MALLOC_CAP_SPIRAM);
+	#endif
+    if (!my_spiffs_cache) my_spiffs_cache = heap_caps_malloc(cache_len, MALLOC_CAP_DMA);
     if (!my_spiffs_cache) {
         free(my_spiffs_work_buf);
         free(my_spiffs_fds);
@@ -816,7 +1038,7 @@ int spiffs_mount() {
 	printf("  Start address: 0x%x; Size %d KB\n", cfg.phys_addr, cfg.phys_size / 1024);
 	printf("    Work buffer: %4d B @ %p\n", cfg.log_page_size * 8, my_spiffs_work_buf);
 	printf("     FDS buffer: %4d B @ %p\n", sizeof(spiffs_fd) * SPIFFS_TEMPORAL_CACHE_HIT_SCORE, my_spiffs_fds);
-	printf("     Cache size: %4d B @ %p\n", cfg.log_page_size * SPIFFS_TEMPORAL_CACHE_HIT_SCORE, my_spiffs_cache);
+	printf("     Cache size: %4d B @ %p (%d pages)\n", cache_len, my_spiffs_cache, SPIFFS_VFS_CACHE_PAGES);
 	printf("----------------\n");
 	#endif
 
@@ -868,6 +1090,7 @@ int spiffs_mount() {
     }
 
     spiffslist_init(&files, 0);
+    dirindex_build();
 
 	#if MICROPY_SDMMC_SHOW_INFO
     printf("Mounted.\n");
@@ -881,6 +1104,13 @@ int spiffs_mount() {
 	#endif
 
     spiffs_is_mounted = 1;
+
+	#if CONFIG_MICROPY_SPIFFS_GC_TASK
+    if (xTaskCreate(&spiffs_gc_task, "spiffs_gc", 2560, NULL, tskIDLE_PRIORITY+1, &gc_task_handle) != pdPASS) {
+    	gc_task_handle = NULL;
+		ESP_LOGW(TAG, "gc task not started");
+    }
+	#endif
     return 1;
 
 err_exit:
@@ -947,8 +1177,21 @@ int spiffs_unmount(int unreg) {
 
 	if (!spiffs_is_mounted) return 0;
 
+	#if CONFIG_MICROPY_SPIFFS_GC_TASK
+	if (gc_task_handle) {
+		// never delete the task while it holds the file system lock
+		SPIFFS_LOCK(&fs);
+		vTaskDelete(gc_task_handle);
+		gc_task_handle = NULL;
+		SPIFFS_UNLOCK(&fs);
+	}
+	#endif
 	SPIFFS_unmount(&fs);
     spiffs_is_mounted = 0;
+    if (dirindex_ok) {
+    	dirindex_ok = 0;
+    	spiffs_dirindex_destroy(&dirindex);
+    }
 
     if (unreg) {
     	esp_vfs_unregister(VFS_NATIVE_MOUNT_POINT);
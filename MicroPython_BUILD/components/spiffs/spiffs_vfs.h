@@ -53,3 +53,5 @@ void vfs_spiffs_register();
 int spiffs_mount();
 int spiffs_unmount(int unreg);
 void spiffs_fs_stat(uint32_t *total, uint32_t *used);
+void spiffs_cache_stat(uint32_t *pages, uint32_t *hits, uint32_t *misses, uint32_t *prefetched, int reset);
+int spiffs_fs_gc(uint32_t budget_ms, uint32_t *free_blocks);